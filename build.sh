@@ -2,26 +2,50 @@
 
 error_message() {
 	echo 'build: invalid build specification'
-	echo 'flags can be "--release" or "--debug" or "--test"'
+	echo 'flags can be "--release" or "--debug" or "--test" or "--headless" or "--bench" or "--micro"'
 	exit 1
 }
 
 build_release() {
 	echo 'building release'
 	# experimentation showed significant slowdown when using o2 or o3 so i stuck with o1
-	clang `pkg-config --libs --cflags sdl3` -DRELEASE ./src/*.c -o ./target/ray-trace -lm -O1
+	clang `pkg-config --libs --cflags sdl3` -DRELEASE ./src/*.c -o ./target/ray-trace -lm -lpthread -O1
 	exit 0
 }
 
 build_debug() {
 	echo 'building debug'
-	clang `pkg-config --libs --cflags sdl3` -DDEBUG ./src/*.c -o ./target/ray-trace -lm -O0 -Wall -Wextra
+	clang `pkg-config --libs --cflags sdl3` -DDEBUG ./src/*.c -o ./target/ray-trace -lm -lpthread -O0 -Wall -Wextra
 	exit 0
 }
 
+build_headless() {
+	echo 'building headless'
+	# release settings without sdl, for machines with no display
+	clang -DRELEASE -DHEADLESS ./src/*.c -o ./target/ray-trace-headless -lm -lpthread -O1
+	exit 0
+}
+
+build_bench() {
+	echo 'building and running benchmarks'
+	# headless release build, results in target/bench.csv (compare runs with --compare)
+	clang -DRELEASE -DHEADLESS ./src/*.c -o ./target/ray-trace-headless -lm -lpthread -O1
+	./target/ray-trace-headless --bench ./target/bench.csv
+	exit $?
+}
+
+build_micro() {
+	echo 'building and running microbenchmarks'
+	# kernels timed in isolation, results in target/microbench.csv (rows carry the flags)
+	flags='-O1'
+	clang -DRELEASE -DHEADLESS -DMICROBENCH -DMICROBENCH_FLAGS="\"$flags\"" ./src/*.c -o ./target/microbench -lm -lpthread $flags
+	./target/microbench --output ./target/microbench.csv
+	exit $?
+}
+
 build_test() {
 	echo 'building test'
-	clang `pkg-config --libs --cflags sdl3` -DUNIT_TEST ./src/*.c -o ./target/ray-trace -lm -O0 -Wall -Wextra
+	clang `pkg-config --libs --cflags sdl3` -DUNIT_TEST ./src/*.c -o ./target/ray-trace -lm -lpthread -O0 -Wall -Wextra
 	exit 0
 }
 
@@ -50,6 +74,24 @@ else
 		-t)
 			build_test
 			;;
+		--headless)
+			build_headless
+			;;
+		-H)
+			build_headless
+			;;
+		--bench)
+			build_bench
+			;;
+		-b)
+			build_bench
+			;;
+		--micro)
+			build_micro
+			;;
+		-m)
+			build_micro
+			;;
 		*)
 			error_message
 			;;
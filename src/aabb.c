@@ -23,10 +23,10 @@ static Interval _axis_interval(AABB aabb, size_t axis_idx)
  * Returns the index of the largest axis (interval with the largest range) for 
  * the given AABB. Axis index mapping can be seen above in _axis_interval method.
  */
-static size_t _largest_axis(AABB aabb)
+size_t AABB_largest_axis(AABB aabb)
 {
 	double max = -1000.0;
-	size_t idx;
+	size_t idx = 0;
 	for (size_t i = 0; i < 3; i++)
 	{
 		Interval tmp = _axis_interval(aabb, i); 
@@ -52,6 +52,47 @@ AABB AABB_from_AABB(AABB aabb_1, AABB aabb_2)
 	return out;
 }
 
+/*
+ * Returns an AABB that contains nothing. Each axis has its minimum set to a very 
+ * large value and its maximum set to a very small one, so that combining it with 
+ * any other AABB through AABB_from_AABB results in that other AABB. This is 
+ * useful as a starting point when accumulating the bounds of many boxes.
+ */
+AABB AABB_empty(void)
+{
+	Interval empty = {INFINITY, -INFINITY};
+	AABB out = {empty, empty, empty};
+	return out;
+}
+
+/*
+ * Returns the point at the centre of the given AABB.
+ */
+Vector AABB_centroid(AABB aabb)
+{
+	Vector out = {0.5 * (aabb.x.min + aabb.x.max),
+				  0.5 * (aabb.y.min + aabb.y.max),
+				  0.5 * (aabb.z.min + aabb.z.max)};
+	return out;
+}
+
+/*
+ * Returns the surface area of the given AABB. Empty AABBs (see AABB_empty) 
+ * have a surface area of 0.0. The surface area of a box is proportional to the 
+ * probability of a random ray hitting it, which is what the surface area 
+ * heuristic in the BVH builder relies on.
+ */
+double AABB_surface_area(AABB aabb)
+{
+	double dx = aabb.x.max - aabb.x.min;
+	double dy = aabb.y.max - aabb.y.min;
+	double dz = aabb.z.max - aabb.z.min;
+	if ((dx < 0.0) || (dy < 0.0) || (dz < 0.0))
+		return 0.0;
+
+	return 2.0 * (dx * dy + dy * dz + dz * dx);
+}
+
 /*
  * Returns a new AABB between 2 opposing corners passed in. If any axis of the 
  * resulting AABB is too small, then it is automatically increased to a minimum
@@ -97,6 +138,7 @@ AABB AABB_from_corners(Vector u, Vector v)
  */
 bool AABB_hit(AABB aabb, Ray r, Interval* itvl)
 {
+	STATS_ADD(box_tests, 1);
 	for (size_t i = 0; i < 3; i++)
 	{
 		Interval ax_itvl = _axis_interval(aabb, i);
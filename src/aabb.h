@@ -3,6 +3,7 @@
 
 #include "render_utils.h"
 #include "math_utils.h"
+#include "stats.h"
 
 /*
  * AABB is axis-aligned so each axis component is represented as two scalar 
@@ -24,6 +25,26 @@ extern AABB AABB_from_AABB(AABB aabb_1, AABB aabb_2);
  */
 extern AABB AABB_from_corners(Vector u, Vector v);
 
+/*
+ * Returns an AABB that contains nothing, used as a starting point for merging.
+ */
+extern AABB AABB_empty(void);
+
+/*
+ * Returns the point at the centre of the given AABB.
+ */
+extern Vector AABB_centroid(AABB aabb);
+
+/*
+ * Returns the surface area of the given AABB.
+ */
+extern double AABB_surface_area(AABB aabb);
+
+/*
+ * Returns the index of the axis with the largest range: 0 = x, 1 = y, 2 = z.
+ */
+extern size_t AABB_largest_axis(AABB aabb);
+
 /*
  * Checks if the ray given intersects with the aabb and updates the bounds 
  * of the interval if it does.
@@ -0,0 +1,297 @@
+#include "benchmark.h"
+
+/*
+ * PRIVATE:
+ */
+
+#define _SPHERE_COUNT 100000 // spheres in the generated scene
+
+/*
+ * Builds the generated sphere field with _SPHERE_COUNT spheres.
+ */
+static Hittable_List* _build_spheres(Camera* cam)
+{
+	return build_spheres_scene(cam, _SPHERE_COUNT);
+}
+
+/*
+ * Struct for a benchmark scene and the function that builds it.
+ */
+typedef struct _Bench_Scene {
+	const char* 	name;
+	Hittable_List* 	(*build)(Camera* cam);
+} _Bench_Scene;
+
+// smallest first, as the peak memory of the process only ever grows
+static const _Bench_Scene _SCENES[] = {
+	{"demo", build_demo_scene},
+	{"model", build_model_scene},
+	{"spheres_100k", _build_spheres}
+};
+
+/*
+ * Returns the seconds between two readings of CLOCK_MONOTONIC.
+ */
+static double _secs_between(struct timespec start, struct timespec end)
+{
+	return (double) (end.tv_sec - start.tv_sec)
+		 + (double) (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+}
+
+/*
+ * Returns true if (path) ends in (ext).
+ */
+static bool _has_ext(const char* path, const char* ext)
+{
+	const char* dot = strrchr(path, '.');
+	return (dot != NULL) && (strcmp(dot, ext) == 0);
+}
+
+/*
+ * Returns the relative change from (base) to (val) in percent.
+ */
+static double _change_pct(double base, double val)
+{
+	return (base != 0.0) ? 100.0 * (val - base) / base : 0.0;
+}
+
+/*
+ * Renders one scene with the fixed benchmark settings and fills (result). The
+ * settings are those of the release build without adaptive sampling, so the
+ * amount of work only depends on the scene and the seed.
+ */
+static void _run_scene(const _Bench_Scene* bench_scene, Render_Pool* pool, size_t width,
+					   size_t height, size_t samples_per_pixel, Bench_Result* result)
+{
+	Camera cam;
+	uint64_t hist[CAM_DEPTH_BINS] = {0};
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cam_init(&cam, width, height);
+	Hittable_List* scene = bench_scene->build(&cam);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	cam.samples_per_pixel = (uint16_t) samples_per_pixel;
+	cam.adaptive_threshold = 0.0;
+	cam.max_ray_bounces = 50;
+	cam.roulette_depth = 3;
+	cam.sampler = SAMPLER_SOBOL;
+	cam.seed = 1;
+	cam.depth_hist = hist;
+	cam_calculate_matrices(&cam, width, height);
+
+	Framebuffer* fb = framebuffer_new(width, height);
+	struct timespec render_start, render_end;
+	clock_gettime(CLOCK_MONOTONIC, &render_start);
+	render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+	clock_gettime(CLOCK_MONOTONIC, &render_end);
+
+	uint64_t samples = 0;
+	uint64_t secondary = 0;
+	for (size_t i = 0; i < CAM_DEPTH_BINS; i++)
+	{
+		samples += hist[i];
+		secondary += hist[i] * i;
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	double secs = _secs_between(render_start, render_end);
+	snprintf(result->scene, sizeof(result->scene), "%s", bench_scene->name);
+	result->width = width;
+	result->height = height;
+	result->samples_per_pixel = samples_per_pixel;
+	result->thread_count = pool->thread_count;
+	result->build_secs = _secs_between(start, end);
+	result->render_secs = secs;
+	result->samples_per_sec = (double) samples / secs;
+	result->secondary_per_sec = (double) secondary / secs;
+	result->mrays_per_sec = (double) (samples + secondary) / secs * 1.0E-6;
+	result->peak_rss_kb = usage.ru_maxrss; // kilobytes on linux
+
+	framebuffer_free(fb);
+	free(cam.transform);
+	free(scene);
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Renders every benchmark scene in turn with seed 1, 50 bounces, roulette after
+ * 3 and no adaptive sampling, and stores one result per scene in (results),
+ * which must hold BENCH_MAX_RESULTS. A line is printed for each scene as it
+ * finishes. Returns the amount of results.
+ *
+ * The scenes and the camera are built again for every scene, and their
+ * build time is reported apart from the render, which is what the rays per
+ * second are measured over.
+ */
+size_t bench_run(size_t width, size_t height, size_t samples_per_pixel,
+				 size_t thread_count, Bench_Result* results)
+{
+	Render_Pool* pool = render_pool_new(thread_count, 16);
+	size_t count = sizeof(_SCENES) / sizeof(_SCENES[0]);
+	printf("%-14s %9s %9s %10s %10s %9s %10s\n", "scene", "build s", "render s",
+		   "Msamples/s", "Msec. /s", "Mrays/s", "peak KB");
+	for (size_t i = 0; i < count; i++)
+	{
+		Bench_Result* res = &results[i];
+		_run_scene(&_SCENES[i], pool, width, height, samples_per_pixel, res);
+		printf("%-14s %9.3f %9.3f %10.3f %10.3f %9.3f %10ld\n", res->scene,
+			   res->build_secs, res->render_secs, res->samples_per_sec * 1.0E-6,
+			   res->secondary_per_sec * 1.0E-6, res->mrays_per_sec, res->peak_rss_kb);
+		fflush(stdout);
+	}
+	render_pool_free(pool);
+	return count;
+}
+
+/*
+ * Writes the results to (path), one row per scene. A .csv file starts with a
+ * header row, a .json file holds an array of objects under "results", one object
+ * per line so that bench_read can read it back without a JSON parser. Primary
+ * rays per second are written next to samples per second for tools that look
+ * for either. Returns false and prints a message if the extension is not known
+ * or the file cannot be written.
+ */
+bool bench_write(const char* path, const Bench_Result* results, size_t count)
+{
+	bool csv = _has_ext(path, ".csv");
+	if (!csv && !_has_ext(path, ".json"))
+	{
+		fprintf(stderr, "unknown benchmark format for %s (use .csv or .json)\n", path);
+		return false;
+	}
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "failed to open %s for writing\n", path);
+		return false;
+	}
+
+	bool ok = (fprintf(file, csv
+		? "scene,width,height,spp,threads,build_s,render_s,samples_per_s,"
+		  "primary_rays_per_s,secondary_rays_per_s,mrays_per_s,peak_rss_kb\n"
+		: "{\"results\": [\n") > 0);
+	for (size_t i = 0; ok && (i < count); i++)
+	{
+		const Bench_Result* res = &results[i];
+		ok = (fprintf(file, csv
+			? "%s,%zu,%zu,%zu,%zu,%.6f,%.6f,%.1f,%.1f,%.1f,%.4f,%ld\n"
+			: "  {\"scene\": \"%s\", \"width\": %zu, \"height\": %zu, \"spp\": %zu, "
+			  "\"threads\": %zu, \"build_s\": %.6f, \"render_s\": %.6f, "
+			  "\"samples_per_s\": %.1f, \"primary_rays_per_s\": %.1f, "
+			  "\"secondary_rays_per_s\": %.1f, \"mrays_per_s\": %.4f, "
+			  "\"peak_rss_kb\": %ld}",
+			res->scene, res->width, res->height, res->samples_per_pixel,
+			res->thread_count, res->build_secs, res->render_secs,
+			res->samples_per_sec, res->samples_per_sec, res->secondary_per_sec,
+			res->mrays_per_sec, res->peak_rss_kb) > 0)
+		   && (csv || (fprintf(file, (i + 1 < count) ? ",\n" : "\n") > 0));
+	}
+	if (!csv)
+		ok = ok && (fprintf(file, "]}\n") > 0);
+
+	if ((fclose(file) != 0) || !ok)
+	{
+		fprintf(stderr, "failed to write %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Reads the results in a file written by bench_write (CSV or JSON by its
+ * extension) into (results), which must hold BENCH_MAX_RESULTS. Lines that are
+ * not results are skipped. Returns the amount read, or 0 and prints a message if
+ * the file cannot be opened or holds no results.
+ */
+size_t bench_read(const char* path, Bench_Result* results)
+{
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "failed to open %s\n", path);
+		return 0;
+	}
+
+	bool csv = _has_ext(path, ".csv");
+	char line[1024];
+	size_t count = 0;
+	while ((count < BENCH_MAX_RESULTS) && (fgets(line, sizeof(line), file) != NULL))
+	{
+		Bench_Result* res = &results[count];
+		int fields = csv
+			? sscanf(line, "%31[^,],%zu,%zu,%zu,%zu,%lf,%lf,%lf,%*f,%lf,%lf,%ld",
+					 res->scene, &res->width, &res->height, &res->samples_per_pixel,
+					 &res->thread_count, &res->build_secs, &res->render_secs,
+					 &res->samples_per_sec, &res->secondary_per_sec,
+					 &res->mrays_per_sec, &res->peak_rss_kb)
+			: sscanf(line, " {\"scene\": \"%31[^\"]\", \"width\": %zu, \"height\": %zu, "
+					 "\"spp\": %zu, \"threads\": %zu, \"build_s\": %lf, "
+					 "\"render_s\": %lf, \"samples_per_s\": %lf, "
+					 "\"primary_rays_per_s\": %*f, \"secondary_rays_per_s\": %lf, "
+					 "\"mrays_per_s\": %lf, \"peak_rss_kb\": %ld",
+					 res->scene, &res->width, &res->height, &res->samples_per_pixel,
+					 &res->thread_count, &res->build_secs, &res->render_secs,
+					 &res->samples_per_sec, &res->secondary_per_sec,
+					 &res->mrays_per_sec, &res->peak_rss_kb);
+		if (fields == 11)
+			count++;
+	}
+	fclose(file);
+	if (count == 0)
+		fprintf(stderr, "no benchmark results in %s\n", path);
+	return count;
+}
+
+/*
+ * Prints a table with the change of the rays per second, render time and peak
+ * memory of every result against the result of the same scene in (base). A scene
+ * is a regression if its rays per second dropped, or its peak memory grew, by
+ * more than (threshold_pct) percent. Scenes rendered with a different size,
+ * sample count or thread count are not compared, and neither are scenes that
+ * are missing from (base). Returns the amount of regressions.
+ */
+size_t bench_compare(const Bench_Result* base, size_t base_count,
+					 const Bench_Result* results, size_t count, double threshold_pct)
+{
+	size_t regressions = 0;
+	printf("%-14s %9s %9s %8s %9s %9s %8s %10s %8s\n", "scene", "old Mr/s",
+		   "new Mr/s", "change", "old s", "new s", "change", "peak KB", "change");
+	for (size_t i = 0; i < count; i++)
+	{
+		const Bench_Result* res = &results[i];
+		const Bench_Result* old = NULL;
+		for (size_t j = 0; (j < base_count) && (old == NULL); j++)
+			if (strcmp(base[j].scene, res->scene) == 0)
+				old = &base[j];
+		if (old == NULL)
+		{
+			printf("%-14s not in the base results\n", res->scene);
+			continue;
+		}
+		if ((old->width != res->width) || (old->height != res->height)
+			|| (old->samples_per_pixel != res->samples_per_pixel)
+			|| (old->thread_count != res->thread_count))
+		{
+			printf("%-14s rendered with different settings, not compared\n", res->scene);
+			continue;
+		}
+
+		double rays_pct = _change_pct(old->mrays_per_sec, res->mrays_per_sec);
+		double secs_pct = _change_pct(old->render_secs, res->render_secs);
+		double rss_pct = _change_pct((double) old->peak_rss_kb, (double) res->peak_rss_kb);
+		bool slower = rays_pct < -threshold_pct;
+		bool bigger = rss_pct > threshold_pct;
+		regressions += slower || bigger;
+		printf("%-14s %9.3f %9.3f %+7.1f%% %9.3f %9.3f %+7.1f%% %10ld %+7.1f%%%s%s\n",
+			   res->scene, old->mrays_per_sec, res->mrays_per_sec, rays_pct,
+			   old->render_secs, res->render_secs, secs_pct, res->peak_rss_kb,
+			   rss_pct, slower ? "  SLOWER" : "", bigger ? "  MORE MEMORY" : "");
+	}
+	printf("%zu regression%s above %.1f%%\n", regressions, (regressions == 1) ? "" : "s",
+		   threshold_pct);
+	return regressions;
+}
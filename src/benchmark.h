@@ -0,0 +1,67 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "camera.h"
+#include "scene.h"
+#include "scene_builder.h"
+#include "framebuffer.h"
+#include "render_pool.h"
+
+#define BENCH_MAX_RESULTS 16 // most scenes in one result file
+
+/*
+ * Struct for the measurements of one benchmark scene. Every sample starts with
+ * one primary ray, so primary rays per second are samples per second, and each
+ * bounce of a path casts one secondary ray.
+ */
+typedef struct Bench_Result {
+	char 	scene[32];
+	size_t 	width, height;
+	size_t 	samples_per_pixel;
+	size_t 	thread_count;
+	double 	build_secs;		   // building the scene and its BVH
+	double 	render_secs;	   // wall time of the render
+	double 	samples_per_sec;
+	double 	secondary_per_sec;
+	double 	mrays_per_sec;	   // primary and secondary rays, in millions
+	long 	peak_rss_kb;	   // peak resident memory of the process so far
+} Bench_Result;
+
+/*
+ * Renders every benchmark scene (demo, model and 100k spheres) with a fixed
+ * seed, at (width, height) pixels and (samples_per_pixel) samples, on a pool of
+ * (thread_count) threads (0 for one per core), and stores one result per scene
+ * in (results). Returns the amount of results.
+ */
+extern size_t bench_run(size_t width, size_t height, size_t samples_per_pixel,
+						size_t thread_count, Bench_Result* results);
+
+/*
+ * Writes (count) results to (path) as CSV or JSON, chosen by its extension.
+ * Returns false if the extension is neither .csv nor .json, or writing fails.
+ */
+extern bool bench_write(const char* path, const Bench_Result* results, size_t count);
+
+/*
+ * Reads up to BENCH_MAX_RESULTS results from a file written by bench_write.
+ * Returns the amount read, 0 if the file cannot be read.
+ */
+extern size_t bench_read(const char* path, Bench_Result* results);
+
+/*
+ * Prints the change of every result in (results) against the result of the same
+ * scene in (base), and returns how many got slower or bigger by more than
+ * (threshold_pct) percent.
+ */
+extern size_t bench_compare(const Bench_Result* base, size_t base_count,
+							const Bench_Result* results, size_t count,
+							double threshold_pct);
+
+#endif
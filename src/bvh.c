@@ -0,0 +1,878 @@
+#include "bvh.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BVH_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * PRIVATE:
+ */
+
+#define _BIN_COUNT 12	 // amount of buckets that centroids are sorted into per axis
+#define _MAX_LEAF_SIZE 4 // leaves larger than this are always split if possible
+
+#define _STACK_SIZE BVH_MAX_DEPTH // one entry per interior node on the path to a leaf
+#define _WIDE_STACK_SIZE (3 * BVH_MAX_DEPTH + 1) // up to 3 more entries per wide node
+
+static const double _traversal_cost = 0.125; // cost of a node visit relative to a primitive test
+
+// counters are per thread so render threads do not share their cache lines
+static _Thread_local uint64_t _node_visits = 0; // nodes visited by every traversal since the last reset
+static _Thread_local uint64_t _prim_tests = 0;  // primitives tested by every traversal since the last reset
+static _Thread_local uint64_t _ray_count = 0;	// traversals since the last reset
+
+/*
+ * Entry of the wide traversal stack: a child lane that passed its slab test, 
+ * along with the distance at which the ray entered its bounds.
+ */
+typedef struct _Wide_Entry {
+	uint32_t child;
+	uint16_t count;
+	double 	 t_near;
+} _Wide_Entry;
+
+/*
+ * Function that tests the primitives of a leaf (slots offset - offset + count 
+ * of the BVH) against a ray, updating the interval and closest hit. (prims) is 
+ * whatever the function needs to find and test the primitives.
+ */
+typedef void (*_Leaf_Func)(void* prims, size_t offset, size_t count, Ray r, 
+						   Interval* itvl, size_t* hit_idx);
+
+/*
+ * The primitives of bvh_hit_idx: the hittables the BVH was built over, and the 
+ * hit record to fill in for the closest of them.
+ */
+typedef struct _Hittable_Prims {
+	BVH* 		bvh;
+	Hittable** 	hittables;
+	Hit_Record* hit_rec;
+} _Hittable_Prims;
+
+/*
+ * Bucket used while evaluating candidate split planes. Stores the bounds of all
+ * primitives whose centroid falls into the bucket and how many there are.
+ */
+typedef struct _Bin {
+	AABB   aabb;
+	size_t count;
+} _Bin;
+
+/*
+ * Returns the index of the bin that the given centroid component (c) falls into
+ * when the range (lo - hi) is split into _BIN_COUNT equally sized bins.
+ */
+static size_t _bin_idx(double c, double lo, double hi)
+{
+	size_t idx = (size_t) (((c - lo) / (hi - lo)) * (double) _BIN_COUNT);
+	return (idx >= _BIN_COUNT) ? _BIN_COUNT - 1 : idx;
+}
+
+/*
+ * Reorders prim_idxs[start - end) so that every primitive whose centroid falls 
+ * into a bin at or below (split_bin) along (axis) comes first. Returns the index 
+ * of the first primitive on the right hand side of the partition.
+ */
+static size_t _partition(size_t* prim_idxs, size_t start, size_t end, Vector* centroids,
+						 size_t axis, double lo, double hi, size_t split_bin)
+{
+	size_t i = start;
+	size_t j = end;
+	while (i < j)
+	{
+		double c = vec_axis(centroids[prim_idxs[i]], axis);
+		if (_bin_idx(c, lo, hi) <= split_bin)
+		{
+			i++;
+		}
+		else
+		{
+			size_t tmp = prim_idxs[i];
+			prim_idxs[i] = prim_idxs[--j];
+			prim_idxs[j] = tmp;
+		}
+	}
+	return i;
+}
+
+/*
+ * Reorders prim_idxs[start - end) so that the primitive with the median centroid 
+ * along (axis) sits at the middle of the range, with no centroid after it lower 
+ * and none before it higher, and returns the index of the middle. Used to keep 
+ * the tree within BVH_MAX_DEPTH, as it always splits the range in half.
+ */
+static size_t _median_split(size_t* prim_idxs, size_t start, size_t end, Vector* centroids,
+							size_t axis)
+{
+	int64_t mid = (int64_t) (start + (end - start) / 2);
+	int64_t lo = (int64_t) start;
+	int64_t hi = (int64_t) end - 1;
+	while (lo < hi)
+	{
+		double pivot = vec_axis(centroids[prim_idxs[lo + (hi - lo) / 2]], axis);
+		int64_t i = lo;
+		int64_t j = hi;
+		while (i <= j)
+		{
+			while (vec_axis(centroids[prim_idxs[i]], axis) < pivot)
+				i++;
+			while (vec_axis(centroids[prim_idxs[j]], axis) > pivot)
+				j--;
+			if (i <= j)
+			{
+				size_t tmp = prim_idxs[i];
+				prim_idxs[i++] = prim_idxs[j];
+				prim_idxs[j--] = tmp;
+			}
+		}
+
+		if (mid <= j)
+			hi = j;
+		else if (mid >= i)
+			lo = i;
+		else
+			break;
+	}
+	return (size_t) mid;
+}
+
+/*
+ * Finds the cheapest split plane for the primitives in prim_idxs[start - end)
+ * according to the surface area heuristic. The centroid bounds of the range are
+ * split into _BIN_COUNT buckets on every axis and each boundary between buckets
+ * is considered as a candidate. The cost of a candidate is the surface area of
+ * each side multiplied by the amount of primitives on that side (relative to the
+ * area of the parent), which estimates how many primitive tests a random ray
+ * passing through the parent would need.
+ *
+ * The best axis and bucket boundary are written to (best_axis) and (best_bin),
+ * and the estimated cost is returned. If no split is possible (all centroids
+ * are coincident), INFINITY is returned.
+ */
+static double _find_split(AABB* boxes, Vector* centroids, size_t* prim_idxs,
+						  size_t start, size_t end, AABB bounds, AABB centroid_bounds,
+						  size_t* best_axis, size_t* best_bin)
+{
+	double best_cost = INFINITY;
+	double parent_area = AABB_surface_area(bounds);
+	Interval axes[3] = {centroid_bounds.x, centroid_bounds.y, centroid_bounds.z};
+
+	for (size_t axis = 0; axis < 3; axis++)
+	{
+		double lo = axes[axis].min;
+		double hi = axes[axis].max;
+		if (hi - lo < 1.0E-12)
+			continue;
+
+		_Bin bins[_BIN_COUNT];
+		for (size_t b = 0; b < _BIN_COUNT; b++)
+		{
+			bins[b].aabb = AABB_empty();
+			bins[b].count = 0;
+		}
+
+		for (size_t i = start; i < end; i++)
+		{
+			size_t prim = prim_idxs[i];
+			size_t b = _bin_idx(vec_axis(centroids[prim], axis), lo, hi);
+			bins[b].aabb = AABB_from_AABB(bins[b].aabb, boxes[prim]);
+			bins[b].count++;
+		}
+
+		// sweep from the right to get the area and count of every right side
+		double right_area[_BIN_COUNT];
+		size_t right_count[_BIN_COUNT];
+		AABB acc = AABB_empty();
+		size_t acc_count = 0;
+		for (size_t b = _BIN_COUNT - 1; b > 0; b--)
+		{
+			acc = AABB_from_AABB(acc, bins[b].aabb);
+			acc_count += bins[b].count;
+			right_area[b - 1] = AABB_surface_area(acc);
+			right_count[b - 1] = acc_count;
+		}
+
+		// sweep from the left and evaluate each boundary
+		acc = AABB_empty();
+		acc_count = 0;
+		for (size_t b = 0; b < _BIN_COUNT - 1; b++)
+		{
+			acc = AABB_from_AABB(acc, bins[b].aabb);
+			acc_count += bins[b].count;
+			if ((acc_count == 0) || (right_count[b] == 0))
+				continue;
+
+			double cost = _traversal_cost
+						+ (AABB_surface_area(acc) * acc_count
+						+  right_area[b] * right_count[b]) / parent_area;
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				*best_axis = axis;
+				*best_bin = b;
+			}
+		}
+	}
+
+	return best_cost;
+}
+
+/*
+ * Recursively builds the subtree rooted at nodes[node_idx], which is (depth) 
+ * levels below the root, over prim_idxs[start - end).
+ *
+ * The range becomes a leaf when it is small enough and splitting it is not
+ * estimated to be cheaper than testing every primitive directly. Otherwise it
+ * is partitioned at the best SAH split and both halves are built recursively.
+ * If the SAH partition is degenerate (can happen when many centroids share the
+ * same bucket), the range is split at the midpoint of the largest axis of its
+ * centroid bounds, and failing that, simply in half.
+ *
+ * SAH splits of very skewed centroids (such as a geometric series of positions) 
+ * can peel off only a few primitives per level, so the tree has no depth limit 
+ * of its own. Once bvh_must_halve says so, ranges are split at their median 
+ * instead, which keeps every leaf within BVH_MAX_DEPTH.
+ *
+ * Nodes are taken from the array in the order they are visited, so the left 
+ * subtree always directly follows its parent and the index of the right child 
+ * is only known once the left subtree has been built.
+ */
+static void _build_recursive(BVH* bvh, size_t node_idx, AABB* boxes, Vector* centroids,
+							 size_t start, size_t end, size_t depth)
+{
+	AABB bounds = AABB_empty();
+	AABB centroid_bounds = AABB_empty();
+	for (size_t i = start; i < end; i++)
+	{
+		size_t prim = bvh->prim_idxs[i];
+		Vector c = centroids[prim];
+		AABB point = {{c.x, c.x}, {c.y, c.y}, {c.z, c.z}};
+		bounds = AABB_from_AABB(bounds, boxes[prim]);
+		centroid_bounds = AABB_from_AABB(centroid_bounds, point);
+	}
+
+	BVH_Node* node = &bvh->nodes[node_idx];
+	node->aabb = bounds;
+	node->offset = (uint32_t) start;
+	node->count = (uint16_t) (end - start);
+	node->axis = 0;
+
+	size_t count = end - start;
+	if (count <= 1)
+		return;
+
+	size_t axis = 0;
+	size_t mid = start;
+	if (bvh_must_halve(depth, count))
+	{
+		if (count <= _MAX_LEAF_SIZE)
+			return;
+
+		axis = AABB_largest_axis(centroid_bounds);
+		mid = _median_split(bvh->prim_idxs, start, end, centroids, axis);
+	}
+	else
+	{
+		size_t split_bin = 0;
+		double split_cost = _find_split(boxes, centroids, bvh->prim_idxs, start, end,
+										bounds, centroid_bounds, &axis, &split_bin);
+
+		if ((count <= _MAX_LEAF_SIZE) && (split_cost >= (double) count))
+			return;
+
+		if (split_cost < INFINITY)
+		{
+			Interval axes[3] = {centroid_bounds.x, centroid_bounds.y, centroid_bounds.z};
+			mid = _partition(bvh->prim_idxs, start, end, centroids, axis,
+							 axes[axis].min, axes[axis].max, split_bin);
+		}
+
+		if ((mid == start) || (mid == end))
+		{
+			axis = AABB_largest_axis(centroid_bounds);
+			Interval axes[3] = {centroid_bounds.x, centroid_bounds.y, centroid_bounds.z};
+			double lo = axes[axis].min;
+			double hi = axes[axis].max;
+			mid = (hi - lo < 1.0E-12)
+				? start
+				: _partition(bvh->prim_idxs, start, end, centroids, axis, lo, hi,
+							 (_BIN_COUNT / 2) - 1);
+			if ((mid == start) || (mid == end))
+				mid = start + count / 2;
+		}
+	}
+
+	node->count = 0;
+	node->axis = (uint8_t) axis;
+
+	_build_recursive(bvh, bvh->node_count++, boxes, centroids, start, mid, depth + 1);
+	size_t right_idx = bvh->node_count++;
+	bvh->nodes[node_idx].offset = (uint32_t) right_idx;
+	_build_recursive(bvh, right_idx, boxes, centroids, mid, end, depth + 1);
+}
+
+/*
+ * Writes the bounds (aabb) into lane (lane) of the wide node (node).
+ */
+static void _set_lane(BVH4_Node* node, size_t lane, AABB aabb, uint32_t child, uint16_t count)
+{
+	node->min_x[lane] = aabb.x.min;
+	node->max_x[lane] = aabb.x.max;
+	node->min_y[lane] = aabb.y.min;
+	node->max_y[lane] = aabb.y.max;
+	node->min_z[lane] = aabb.z.min;
+	node->max_z[lane] = aabb.z.max;
+	node->child[lane] = child;
+	node->count[lane] = count;
+}
+
+/*
+ * Recursively collapses the binary subtree rooted at the interior node 
+ * nodes[node_idx] into wide nodes and returns the index of the wide node that 
+ * represents it. (depth) is the depth of the wide node.
+ *
+ * The two children of the binary node are taken as the initial lanes. While 
+ * there are free lanes, the interior lane with the largest surface area is 
+ * replaced by its own two children, as it is the lane most likely to be hit and 
+ * so gains the most from being flattened. Any remaining lanes are filled with 
+ * empty bounds which fail every slab test.
+ *
+ * Every lane is at least one binary level below its wide node, so the builders 
+ * keeping the binary tree within BVH_MAX_DEPTH keeps the wide tree, and with it 
+ * the wide traversal stack, within it too. A deeper tree is a bug in a builder, 
+ * so it prints a message and exits with code 1 rather than overflow the stack.
+ */
+static uint32_t _widen_recursive(BVH* bvh, size_t node_idx, size_t depth)
+{
+	if (depth >= BVH_MAX_DEPTH)
+	{
+		fprintf(stderr, "bvh deeper than %d levels\n", BVH_MAX_DEPTH);
+		exit(1);
+	}
+
+	size_t wide_idx = bvh->wide_node_count++;
+	size_t lanes[4] = {node_idx + 1, bvh->nodes[node_idx].offset, 0, 0};
+	size_t lane_count = 2;
+
+	while (lane_count < 4)
+	{
+		size_t best = SIZE_MAX;
+		double best_area = -1.0;
+		for (size_t i = 0; i < lane_count; i++)
+		{
+			BVH_Node* child = &bvh->nodes[lanes[i]];
+			double area = AABB_surface_area(child->aabb);
+			if ((child->count == 0) && (area > best_area))
+			{
+				best = i;
+				best_area = area;
+			}
+		}
+		if (best == SIZE_MAX)
+			break;
+
+		size_t expand = lanes[best];
+		lanes[best] = expand + 1;
+		lanes[lane_count++] = bvh->nodes[expand].offset;
+	}
+
+	for (size_t i = 0; i < 4; i++)
+	{
+		if (i >= lane_count)
+		{
+			_set_lane(&bvh->wide_nodes[wide_idx], i, AABB_empty(), 0, 0);
+			continue;
+		}
+
+		BVH_Node* child = &bvh->nodes[lanes[i]];
+		if (child->count > 0)
+		{
+			_set_lane(&bvh->wide_nodes[wide_idx], i, child->aabb, child->offset, child->count);
+		}
+		else
+		{
+			uint32_t wide_child = _widen_recursive(bvh, lanes[i], depth + 1);
+			_set_lane(&bvh->wide_nodes[wide_idx], i, child->aabb, wide_child, 0);
+		}
+	}
+
+	return (uint32_t) wide_idx;
+}
+
+/*
+ * Builds the wide nodes of the given BVH from its binary nodes (see 
+ * _widen_recursive). A binary tree with n interior nodes never needs more than 
+ * n wide nodes, so the array is allocated once. If the binary root is itself a 
+ * leaf, the wide root holds that leaf in its first lane. If the allocation 
+ * fails, the application exits with code 1.
+ */
+static void _widen(BVH* bvh)
+{
+	size_t max_nodes = bvh->node_count + 1;
+	if ((bvh->wide_nodes = aligned_alloc(64, sizeof(BVH4_Node) * max_nodes)) == NULL)
+	{
+		fprintf(stderr, "malloc failed in bvh\n");
+		exit(1);
+	}
+	bvh->wide_node_count = 0;
+
+	if (bvh->node_count == 0)
+		return;
+
+	BVH_Node* root = &bvh->nodes[0];
+	if (root->count > 0)
+	{
+		BVH4_Node* wide_root = &bvh->wide_nodes[bvh->wide_node_count++];
+		_set_lane(wide_root, 0, root->aabb, root->offset, root->count);
+		for (size_t i = 1; i < 4; i++)
+			_set_lane(wide_root, i, AABB_empty(), 0, 0);
+		return;
+	}
+
+	_widen_recursive(bvh, 0, 0);
+}
+
+/*
+ * Slab tests the ray against all 4 children of a wide node one lane at a time. 
+ * The near and far planes of each axis have already been chosen by the sign of 
+ * the ray direction (near_* / far_*), and (org_inv) is the ray origin multiplied 
+ * by the inverse direction so that each plane distance is a single multiply and 
+ * subtract. Writes the entry distance of each child into (t_near) and returns a 
+ * bit mask of the lanes that were hit within the interval (itvl).
+ */
+static int _slab_test_scalar(const double* near[3], const double* far[3], 
+							 Vector inv_dir, Vector org_inv, Interval itvl, 
+							 double t_near[4])
+{
+	int mask = 0;
+	for (size_t i = 0; i < 4; i++)
+	{
+		double tx0 = near[0][i] * inv_dir.x - org_inv.x;
+		double ty0 = near[1][i] * inv_dir.y - org_inv.y;
+		double tz0 = near[2][i] * inv_dir.z - org_inv.z;
+		double tx1 = far[0][i] * inv_dir.x - org_inv.x;
+		double ty1 = far[1][i] * inv_dir.y - org_inv.y;
+		double tz1 = far[2][i] * inv_dir.z - org_inv.z;
+
+		double t0 = max(max(tx0, ty0), max(tz0, itvl.min));
+		double t1 = min(min(tx1, ty1), min(tz1, itvl.max));
+		t_near[i] = t0;
+		if (t0 < t1)
+			mask |= 1 << i;
+	}
+	return mask;
+}
+
+#ifdef BVH_X86
+/*
+ * AVX version of _slab_test_scalar that tests all 4 lanes with one instruction 
+ * per operation. Only called when the host supports AVX2 and FMA.
+ */
+__attribute__((target("avx2,fma")))
+static int _slab_test_avx2(const double* near[3], const double* far[3], 
+						   Vector inv_dir, Vector org_inv, Interval itvl, 
+						   double t_near[4])
+{
+	__m256d inv_x = _mm256_set1_pd(inv_dir.x);
+	__m256d inv_y = _mm256_set1_pd(inv_dir.y);
+	__m256d inv_z = _mm256_set1_pd(inv_dir.z);
+	__m256d oi_x = _mm256_set1_pd(org_inv.x);
+	__m256d oi_y = _mm256_set1_pd(org_inv.y);
+	__m256d oi_z = _mm256_set1_pd(org_inv.z);
+
+	__m256d tx0 = _mm256_fmsub_pd(_mm256_load_pd(near[0]), inv_x, oi_x);
+	__m256d ty0 = _mm256_fmsub_pd(_mm256_load_pd(near[1]), inv_y, oi_y);
+	__m256d tz0 = _mm256_fmsub_pd(_mm256_load_pd(near[2]), inv_z, oi_z);
+	__m256d tx1 = _mm256_fmsub_pd(_mm256_load_pd(far[0]), inv_x, oi_x);
+	__m256d ty1 = _mm256_fmsub_pd(_mm256_load_pd(far[1]), inv_y, oi_y);
+	__m256d tz1 = _mm256_fmsub_pd(_mm256_load_pd(far[2]), inv_z, oi_z);
+
+	__m256d t0 = _mm256_max_pd(_mm256_max_pd(tx0, ty0), 
+							   _mm256_max_pd(tz0, _mm256_set1_pd(itvl.min)));
+	__m256d t1 = _mm256_min_pd(_mm256_min_pd(tx1, ty1), 
+							   _mm256_min_pd(tz1, _mm256_set1_pd(itvl.max)));
+	_mm256_storeu_pd(t_near, t0);
+	int mask = _mm256_movemask_pd(_mm256_cmp_pd(t0, t1, _CMP_LT_OQ));
+	_mm256_zeroupper(); // gcc at -O1 leaves this out, stalling the SSE caller
+	return mask;
+}
+#endif
+
+/*
+ * Returns true if the host supports the AVX2 slab test. The answer is looked up 
+ * once and cached.
+ */
+static bool _has_avx2(void)
+{
+#ifdef BVH_X86
+	static int supported = -1;
+	if (supported < 0)
+		supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return supported;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Tests the hittables hittables[prim_idxs[offset - offset + count)] of (prims), 
+ * a _Hittable_Prims, against the ray (r) and updates (itvl), its hit record and 
+ * (hit_idx) with the closest hit so far. The index stored in (hit_idx) is the 
+ * index into hittables.
+ */
+static void _hit_hittable_leaf(void* prims, size_t offset, size_t count, Ray r, 
+							   Interval* itvl, size_t* hit_idx)
+{
+	_Hittable_Prims* hp = prims;
+	for (size_t i = offset; i < offset + count; i++)
+	{
+		size_t prim = hp->bvh->prim_idxs[i];
+		Hit_Record temp_rec;
+		if (hittable_hit(hp->hittables[prim], r, *itvl, &temp_rec)
+			&& interval_surrounds(*itvl, temp_rec.t))
+		{
+			*hit_idx = prim;
+			itvl->max = temp_rec.t;
+			*hp->hit_rec = temp_rec;
+		}
+	}
+}
+
+/*
+ * Tests triangles [offset - offset + count) of a triangle store laid out in the 
+ * BVH's leaf order against the ray (r), see tri_store_hit. Only (itvl) and 
+ * (hit_idx) are updated, the index stored is the index into the store.
+ */
+static void _hit_tri_leaf(void* prims, size_t offset, size_t count, Ray r, 
+						  Interval* itvl, size_t* hit_idx)
+{
+	tri_store_hit(prims, offset, count, r, itvl, hit_idx);
+}
+
+/*
+ * Closest hit traversal of the binary nodes, see bvh_hit_idx. Leaves are tested 
+ * with (leaf) on the primitives (prims). On return, itvl->max is the distance 
+ * of the closest hit.
+ */
+static size_t _hit_binary(BVH* bvh, _Leaf_Func leaf, void* prims, Ray r, 
+						  Interval* itvl)
+{
+	size_t hit_idx = SIZE_MAX;
+	bool dir_neg[3] = {r.direction.x < 0.0, r.direction.y < 0.0, r.direction.z < 0.0};
+	uint32_t stack[_STACK_SIZE];
+	size_t stack_head = 0;
+	uint32_t node_idx = 0;
+	uint64_t visits = 0;
+
+	while (true)
+	{
+		BVH_Node* node = &bvh->nodes[node_idx];
+		Interval box_itvl = *itvl;
+		visits++;
+
+		if (AABB_hit(node->aabb, r, &box_itvl))
+		{
+			if (node->count > 0)
+			{
+				leaf(prims, node->offset, node->count, r, itvl, &hit_idx);
+				_prim_tests += node->count;
+			}
+			else
+			{
+				uint32_t first = node_idx + 1;
+				uint32_t second = node->offset;
+				if (dir_neg[node->axis])
+				{
+					stack[stack_head++] = first;
+					node_idx = second;
+				}
+				else
+				{
+					stack[stack_head++] = second;
+					node_idx = first;
+				}
+				continue;
+			}
+		}
+
+		if (stack_head == 0)
+			break;
+		node_idx = stack[--stack_head];
+	}
+
+	_node_visits += visits;
+	_ray_count++;
+	return hit_idx;
+}
+
+/*
+ * Closest hit traversal of the wide nodes, see bvh_hit_idx and _hit_binary.
+ *
+ * Every wide node that is popped has all 4 of its children slab tested at once. 
+ * The children that were hit are pushed onto the stack furthest first so that 
+ * the nearest is popped next. Each stack entry remembers the distance at which 
+ * the ray entered the child, so entries that are further away than the closest 
+ * hit found since they were pushed are discarded without being visited.
+ */
+static size_t _hit_wide(BVH* bvh, _Leaf_Func leaf, void* prims, Ray r, 
+						Interval* itvl)
+{
+	size_t hit_idx = SIZE_MAX;
+	Vector inv_dir = {1.0 / r.direction.x, 1.0 / r.direction.y, 1.0 / r.direction.z};
+	Vector org_inv = vec_mul_vec(r.origin, inv_dir);
+	bool dir_neg[3] = {inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0};
+	bool use_avx2 = _has_avx2();
+
+	_Wide_Entry stack[_WIDE_STACK_SIZE];
+	size_t stack_head = 0;
+	_Wide_Entry root = {0, 0, itvl->min};
+	stack[stack_head++] = root;
+	uint64_t visits = 0;
+
+	while (stack_head > 0)
+	{
+		_Wide_Entry entry = stack[--stack_head];
+		if (entry.t_near > itvl->max)
+			continue;
+
+		if (entry.count > 0)
+		{
+			leaf(prims, entry.child, entry.count, r, itvl, &hit_idx);
+			_prim_tests += entry.count;
+			continue;
+		}
+
+		BVH4_Node* node = &bvh->wide_nodes[entry.child];
+		const double* near[3] = {dir_neg[0] ? node->max_x : node->min_x,
+								 dir_neg[1] ? node->max_y : node->min_y,
+								 dir_neg[2] ? node->max_z : node->min_z};
+		const double* far[3] = {dir_neg[0] ? node->min_x : node->max_x,
+								dir_neg[1] ? node->min_y : node->max_y,
+								dir_neg[2] ? node->min_z : node->max_z};
+		double t_near[4];
+		int mask;
+#ifdef BVH_X86
+		if (use_avx2)
+			mask = _slab_test_avx2(near, far, inv_dir, org_inv, *itvl, t_near);
+		else
+#endif
+			mask = _slab_test_scalar(near, far, inv_dir, org_inv, *itvl, t_near);
+		visits++;
+		STATS_ADD(box_tests, 4);
+
+		// sort the hit lanes by entry distance, furthest first. Unused lanes are 
+		// skipped by their interior child of 0 (the root, which is no one's 
+		// child), as a ray with a 0 component whose origin lies on 0 in that axis 
+		// makes the slab distances NaN and can let their empty bounds through
+		size_t order[4];
+		size_t hit_count = 0;
+		for (size_t i = 0; i < 4; i++)
+		{
+			if (!(mask & (1 << i)) || ((node->count[i] == 0) && (node->child[i] == 0)))
+				continue;
+
+			size_t j = hit_count++;
+			while ((j > 0) && (t_near[order[j - 1]] < t_near[i]))
+			{
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = i;
+		}
+
+		for (size_t i = 0; i < hit_count; i++)
+		{
+			_Wide_Entry child = {node->child[order[i]], node->count[order[i]], 
+								 t_near[order[i]]};
+			stack[stack_head++] = child;
+		}
+	}
+
+	_node_visits += visits;
+	_ray_count++;
+	return hit_idx;
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Builds a bounding volume hierarchy over (count) primitives whose bounding
+ * boxes are given in (boxes). The index of each primitive is its index in the
+ * boxes array, and these are the indices that the hierarchy stores.
+ *
+ * Splits are chosen using a binned surface area heuristic (see _find_split). A
+ * binary tree over n primitives never has more than 2n - 1 nodes, so the node
+ * array is allocated once up front, aligned so that every node sits in its own 
+ * cache line. This method allocates heap memory for the BVH, its node array, 
+ * its index array and temporary centroids. If any of these allocations fail, 
+ * the application exits with code 1. The BVH starts in the binary layout.
+ */
+BVH* bvh_build(AABB* boxes, size_t count)
+{
+	BVH* bvh;
+	if ((bvh = malloc(sizeof(BVH))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in bvh\n");
+		exit(1);
+	}
+
+	bvh->node_count = 0;
+	bvh->wide_nodes = NULL;
+	bvh->wide_node_count = 0;
+	bvh->prim_count = count;
+	bvh->layout = BVH_BINARY;
+	size_t max_nodes = (count == 0) ? 1 : 2 * count - 1;
+
+	Vector* centroids;
+	if (((bvh->nodes = aligned_alloc(64, sizeof(BVH_Node) * max_nodes)) == NULL)
+		|| ((bvh->prim_idxs = malloc(sizeof(size_t) * (count + 1))) == NULL)
+		|| ((centroids = malloc(sizeof(Vector) * (count + 1))) == NULL))
+	{
+		fprintf(stderr, "malloc failed in bvh\n");
+		exit(1);
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		bvh->prim_idxs[i] = i;
+		centroids[i] = AABB_centroid(boxes[i]);
+	}
+
+	if (count > 0)
+		_build_recursive(bvh, bvh->node_count++, boxes, centroids, 0, count, 0);
+
+	free(centroids);
+	return bvh;
+}
+
+/*
+ * Returns true if a node at (depth) levels below the root over (count) 
+ * primitives has to be split exactly in half to keep every leaf below it within 
+ * BVH_MAX_DEPTH. Halving takes ceil(log2(count)) more levels to reach single 
+ * primitives, so the builders may split however they like until the depth plus 
+ * that reaches the limit. Both children of a halved node have to be halved 
+ * again, so the answer stays true below it.
+ */
+bool bvh_must_halve(size_t depth, size_t count)
+{
+	size_t levels = 0;
+	while (((size_t) 1 << levels) < count)
+		levels++;
+	return depth + levels >= BVH_MAX_DEPTH;
+}
+
+/*
+ * Selects the node layout that bvh_hit_idx traverses. The binary layout tests 
+ * one AABB per node visit, the wide layout tests 4 at once and so visits far 
+ * fewer nodes per ray. The wide nodes are built from the binary nodes the first 
+ * time the wide layout is selected.
+ */
+void bvh_set_layout(BVH* bvh, E_BVH_Layout layout)
+{
+	if ((layout == BVH_WIDE) && (bvh->wide_nodes == NULL))
+		_widen(bvh);
+
+	bvh->layout = layout;
+}
+
+/*
+ * Frees the given BVH along with its node arrays and index array.
+ */
+void bvh_free(BVH* bvh)
+{
+	if (bvh == NULL)
+		return;
+
+	free(bvh->nodes);
+	free(bvh->wide_nodes);
+	free(bvh->prim_idxs);
+	free(bvh);
+}
+
+/*
+ * Returns the index (into hittables) of the closest hittable that the given ray
+ * (r) intersects within the interval (itvl), using the BVH to skip every subtree
+ * whose bounds the ray misses. Information about the intersection is stored in
+ * (hit_rec). If nothing is hit, SIZE_MAX is returned as a sentinel value,
+ * matching scene_hit_idx.
+ *
+ * Traversal is iterative using a small fixed size stack so that no allocation 
+ * happens, and walks either the binary or the wide nodes depending on the 
+ * layout of the BVH (see bvh_set_layout). In the binary layout, at every 
+ * interior node, the child on the side of the split plane that the ray starts 
+ * from (based on the sign of the ray direction along the node's split axis) is 
+ * visited first and the other is pushed onto the stack. In the wide layout, 
+ * children are visited in order of the distance to their bounds. Both find 
+ * close hits early, which shrinks the interval and culls more of the far 
+ * subtrees.
+ */
+size_t bvh_hit_idx(BVH* bvh, Hittable** hittables, Ray r, Interval itvl, Hit_Record* hit_rec)
+{
+	if (bvh->node_count == 0)
+		return SIZE_MAX;
+
+	_Hittable_Prims prims = {bvh, hittables, hit_rec};
+	if (bvh->layout == BVH_WIDE)
+		return _hit_wide(bvh, _hit_hittable_leaf, &prims, r, &itvl);
+
+	return _hit_binary(bvh, _hit_hittable_leaf, &prims, r, &itvl);
+}
+
+/*
+ * Returns the index (into store) of the closest triangle that the given ray (r) 
+ * intersects within the interval (itvl), or SIZE_MAX if there is none, and 
+ * stores its distance in (t). The store must have been built in the leaf order 
+ * of this BVH (see tri_store_build). Traversal is the same as bvh_hit_idx, but 
+ * no hit record is filled in, see tri_store_hit_record to get one for the 
+ * returned triangle.
+ */
+size_t bvh_hit_tri_idx(BVH* bvh, Tri_Store* store, Ray r, Interval itvl, double* t)
+{
+	if (bvh->node_count == 0)
+		return SIZE_MAX;
+
+	size_t hit_idx = (bvh->layout == BVH_WIDE)
+				   ? _hit_wide(bvh, _hit_tri_leaf, store, r, &itvl)
+				   : _hit_binary(bvh, _hit_tri_leaf, store, r, &itvl);
+	*t = itvl.max;
+	return hit_idx;
+}
+
+/*
+ * Returns the average amount of nodes that were visited (had their AABB tested) 
+ * per call to bvh_hit_idx since the counters were last reset. Returns 0.0 if no 
+ * rays have been cast.
+ */
+double bvh_visits_per_ray(void)
+{
+	if (_ray_count == 0)
+		return 0.0;
+
+	return (double) _node_visits / (double) _ray_count;
+}
+
+/*
+ * Returns the average amount of primitives that were tested per traversal since 
+ * the counters were last reset. Returns 0.0 if no rays have been cast.
+ */
+double bvh_prim_tests_per_ray(void)
+{
+	if (_ray_count == 0)
+		return 0.0;
+
+	return (double) _prim_tests / (double) _ray_count;
+}
+
+/*
+ * Resets the counters used to calculate the average node visits and primitive 
+ * tests per ray.
+ */
+void bvh_reset_stats(void)
+{
+	_node_visits = 0;
+	_prim_tests = 0;
+	_ray_count = 0;
+}
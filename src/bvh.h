@@ -0,0 +1,124 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "math_utils.h"
+#include "hittable.h"
+#include "aabb.h"
+#include "tri_store.h"
+
+#define BVH_MAX_DEPTH 64 // deepest node any builder makes, which bounds the traversal stacks
+
+/*
+ * Node of a linearized bounding volume hierarchy. Nodes are stored depth first 
+ * in one contiguous array, so the first child of an interior node is always the 
+ * node directly after it and only the index of the second child is stored. Leaf 
+ * nodes instead reference a range of (count) primitives starting at (offset) in 
+ * the owning BVH's prim_idxs array. Each node is padded to exactly one 64 byte 
+ * cache line.
+ */
+typedef struct BVH_Node {
+	AABB 	 aabb;   // bounds of everything below this node
+	uint32_t offset; // leaf: first index into prim_idxs, interior: second child
+	uint16_t count;  // amount of primitives, 0 for interior nodes
+	uint8_t  axis;   // axis the children were split along (interior only)
+} __attribute__((aligned(64))) BVH_Node;
+
+/*
+ * Node of a 4 wide bounding volume hierarchy. The bounds of all 4 children are 
+ * stored as structure of arrays so that one vectorized slab test covers every 
+ * child at once. Each lane is either an interior child (count of 0, child is 
+ * the index of another BVH4_Node), a leaf (count of primitives starting at 
+ * child in prim_idxs), or unused (empty bounds that no ray can hit).
+ */
+typedef struct BVH4_Node {
+	double 	 min_x[4], max_x[4]; // x bounds of each child
+	double 	 min_y[4], max_y[4]; // y bounds of each child
+	double 	 min_z[4], max_z[4]; // z bounds of each child
+	uint32_t child[4];			 // wide node index or first index into prim_idxs
+	uint16_t count[4];			 // amount of primitives, 0 for interior children
+} __attribute__((aligned(64))) BVH4_Node;
+
+/*
+ * Specifies the node layout that is traversed when casting rays through a BVH.
+ */
+typedef enum E_BVH_Layout {
+	BVH_BINARY,
+	BVH_WIDE
+} E_BVH_Layout;
+
+/*
+ * Struct for a bounding volume hierarchy built over an array of primitives. The 
+ * primitives themselves are not stored, only their indices (prim_idxs) which 
+ * are ordered so that each leaf references a contiguous range. The binary nodes 
+ * are always present, the wide nodes are collapsed from them when the wide 
+ * layout is first selected.
+ */
+typedef struct BVH {
+	BVH_Node*    nodes;			  // node array, nodes[0] is the root
+	size_t 	     node_count;	  // amount of nodes used in the array
+	BVH4_Node*   wide_nodes;	  // wide node array, wide_nodes[0] is the root
+	size_t 	     wide_node_count; // amount of wide nodes used in the array
+	size_t*      prim_idxs;		  // primitive indices in leaf order
+	size_t 	     prim_count;	  // amount of primitives in the hierarchy
+	E_BVH_Layout layout;		  // node layout used for traversal
+} BVH;
+
+/*
+ * Builds a BVH over (count) primitives with the bounding boxes (boxes) using 
+ * the surface area heuristic.
+ */
+extern BVH* bvh_build(AABB* boxes, size_t count);
+
+/*
+ * Returns true if a node at (depth) over (count) primitives has to be split in 
+ * half for every leaf below it to stay within BVH_MAX_DEPTH.
+ */
+extern bool bvh_must_halve(size_t depth, size_t count);
+
+/*
+ * Selects which node layout is traversed when casting rays through the BVH.
+ */
+extern void bvh_set_layout(BVH* bvh, E_BVH_Layout layout);
+
+/*
+ * Frees a BVH and all of its nodes.
+ */
+extern void bvh_free(BVH* bvh);
+
+/*
+ * Casts the given ray through a BVH built over the given hittables and returns 
+ * the index of the closest hittable hit within the interval, or SIZE_MAX.
+ */
+extern size_t bvh_hit_idx(BVH* bvh, Hittable** hittables, Ray r, 
+						  Interval itvl, Hit_Record* hit_rec);
+
+/*
+ * Casts the given ray through a BVH built over the given triangle store and 
+ * returns the index of the closest triangle hit within the interval, or 
+ * SIZE_MAX. The distance of the hit is stored in t.
+ */
+extern size_t bvh_hit_tri_idx(BVH* bvh, Tri_Store* store, Ray r, Interval itvl, double* t);
+
+/*
+ * Returns the average amount of nodes visited per ray cast through any BVH by 
+ * the calling thread since the last call to bvh_reset_stats.
+ */
+extern double bvh_visits_per_ray(void);
+
+/*
+ * Returns the average amount of primitives tested per ray cast through any BVH 
+ * by the calling thread since the last call to bvh_reset_stats.
+ */
+extern double bvh_prim_tests_per_ray(void);
+
+/*
+ * Resets the calling thread's counters used by bvh_visits_per_ray and 
+ * bvh_prim_tests_per_ray.
+ */
+extern void bvh_reset_stats(void);
+
+#endif
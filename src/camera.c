@@ -33,7 +33,12 @@ static void _set_defaults(Camera* cam, double screen_width, double screen_height
 
 	cam->aspect_ratio = screen_width / screen_height;
 	cam->samples_per_pixel = 10;
+	cam->min_samples_per_pixel = 4;
+	cam->adaptive_threshold = 0.0;
 	cam->max_ray_bounces = 10;
+	cam->roulette_depth = 3;
+	cam->depth_hist = NULL;
+	cam->sampler = SAMPLER_SOBOL;
 	cam->fov_radians = PI / 2.0;
 	cam->focus_distance = 1.5;
 	cam->defocus_angle = 0.0;
@@ -43,6 +48,8 @@ static void _set_defaults(Camera* cam, double screen_width, double screen_height
 	cam->max_ray_bounces = 15;
 #elif RELEASE
 	cam->samples_per_pixel = 200;
+	cam->min_samples_per_pixel = 16;
+	cam->adaptive_threshold = 0.01;
 	cam->max_ray_bounces = 75;
 #endif
 }
@@ -51,15 +58,16 @@ static void _set_defaults(Camera* cam, double screen_width, double screen_height
  * Returns a ray struct representing the ray cast into a specific pixel 
  * coordinate of the image (as indicated by col (x) and row (y)). These values 
  * should be given in pixels. This method handles sub-pixel sampling for 
- * antialiasing and focus distance for depth of field effects.
+ * antialiasing and focus distance for depth of field effects, taking the first 
+ * dimensions of the sample from the sampler.
  */
-static Ray _get_ray(Camera* cam, size_t col, size_t row)
+static Ray _get_ray(Camera* cam, Sampler* sampler, size_t col, size_t row)
 {
 	Vector ray_orig;
 	Vector ray_dir;
-	Vector square_sample = {rng_01() - 0.5, 
-							rng_01() - 0.5, 
-							0.0};
+	Vector square_sample = sampler_2d(sampler);
+	square_sample.x -= 0.5;
+	square_sample.y -= 0.5;
 	Vector x_offset = vec_mul(cam->pixel_delta_u, 
 							  (double) (col + square_sample.x));
 	Vector y_offset = vec_mul(cam->pixel_delta_v, 
@@ -70,7 +78,7 @@ static Ray _get_ray(Camera* cam, size_t col, size_t row)
 		ray_orig = cam->transform->position;
 	else 
 	{
-		Vector disk_sample = vec_rndm_in_unit_disk();
+		Vector disk_sample = vec_map_to_unit_disk(sampler_2d(sampler));
 		Vector x_d_offset = vec_mul(cam->defocus_disk_u, disk_sample.x);
 		Vector y_d_offset = vec_mul(cam->defocus_disk_v, disk_sample.y);
 		ray_orig = vec_add(vec_add(x_d_offset, y_d_offset), 
@@ -98,56 +106,136 @@ static Vector _bg_ray_col(Ray r)
 
 /**
  * Performs path tracing on a single ray (r) through the world (scene) until the 
- * depth limit is reached (max bounces). This method returns a vector representing 
- * the accumulated colour that the traced ray collects as it interacts with the 
- * scene.
+ * path is terminated. This method returns a vector representing the accumulated 
+ * colour that the traced ray collects as it interacts with the scene, and stores 
+ * the amount of surfaces the path scattered off in (depth).
  *
- * This method allocates heap memory for a ray intersection tracker. This memory 
- * is all freed within the method. If the allocation fails, the application will
- * exit with code 1.
+ * The path is followed iteratively: the product of the attenuations of every 
+ * surface hit so far (throughput) is carried along and applied to the colour of 
+ * the background once the ray escapes. No heap memory is allocated, the 
+ * intersection tracker lives on the stack and is reused for every bounce. 
+ * Scattering and roulette draw the next dimensions of the sample (sampler).
+ *
+ * After (roulette_depth) bounces, a path whose largest throughput channel is 
+ * below 0.95 survives each bounce with that channel as its probability, and 
+ * survivors divide their throughput by it. Paths at 0.95 or above always 
+ * survive and keep their throughput, but still draw the roulette dimension, so 
+ * that the dimensions used by later bounces do not depend on the throughput. 
+ * Dim paths, which could only add a little light, are usually ended early while
+ * the expected colour of the pixel stays the same. Paths that reach 
+ * (max_bounces) return black, this is only a safety limit for paths that keep 
+ * bouncing between bright surfaces.
  */
-static Vector _ray_col(Ray r, Hittable_List* scene, uint16_t max_bounces)
+static Vector _ray_col(Ray r, Hittable_List* scene, uint16_t max_bounces, 
+					   uint16_t roulette_depth, Sampler* sampler, uint16_t* depth)
 {
-	if (max_bounces <= 0) 
-	{
-		Vector black = {0.0, 0.0, 0.0};
-		return black;
-	}
+	Vector throughput = {1.0, 1.0, 1.0};
+	Vector black = {0.0, 0.0, 0.0};
 	Interval itvl = {0.001, 1000.0};
-	Hit_Record* hit_rec;
-	if ((hit_rec = malloc(sizeof(Hit_Record))) == NULL)
+	Hit_Record hit_rec;
+	uint16_t bounce;
+	for (bounce = 0; bounce < max_bounces; bounce++)
 	{
-		fprintf(stderr, "malloc failed in camera\n");
-		exit(1);
-	}
-	size_t hit_idx;
-	if ((hit_idx = scene_hit_idx(scene, r, itvl, hit_rec)) != SIZE_MAX) 
-	{
-		Ray bounce;
-		bounce.origin = hit_rec->p;
+		*depth = bounce;
+		size_t hit_idx;
+		if ((hit_idx = scene_hit_idx(scene, r, itvl, &hit_rec)) == SIZE_MAX)
+		{
+			STATS_ADD(escaped, 1);
+			return vec_mul_vec(throughput, _bg_ray_col(r));
+		}
+
+		Vector dir;
 		Material mat = scene->hittables[hit_idx]->mat;
 		switch (mat.type) {
 		case DIFFUSE: 
-			bounce.direction = scatter_diffuse(hit_rec->norm);
+			dir = scatter_diffuse(sampler, hit_rec.norm);
 			break;
 		case METALLIC: 
-			bounce.direction = scatter_metallic(r.direction, hit_rec->norm);
+			dir = scatter_metallic(r.direction, hit_rec.norm);
 			break;
 		case GLASS: 
-			bounce.direction = scatter_glass(r.direction, hit_rec->norm, 
-					hit_rec->front, mat.constant);
+			dir = scatter_glass(sampler, r.direction, hit_rec.norm, 
+					hit_rec.front, mat.constant);
 			break;
 		default:
-			free(hit_rec);
-			return _bg_ray_col(r);
+			STATS_ADD(escaped, 1);
+			return vec_mul_vec(throughput, _bg_ray_col(r));
+		}
+		STATS_ADD(bounces, 1);
+		throughput = vec_mul_vec(throughput, hit_rec.atten);
+		r.origin = hit_rec.p;
+		r.direction = dir;
+
+		if (bounce + 1 >= roulette_depth)
+		{
+			double survive = fmax(throughput.x, fmax(throughput.y, throughput.z));
+			double roll = sampler_1d(sampler); // drawn even when unused, see scatter_glass
+			if (survive < 0.95)
+			{
+				if (roll >= survive)
+				{
+					STATS_ADD(roulette, 1);
+					*depth = bounce + 1;
+					return black;
+				}
+				throughput = vec_div(throughput, survive);
+			}
 		}
-		Vector col =  vec_mul_vec(hit_rec->atten, 
-						   		  _ray_col(bounce, scene, --max_bounces));
-		free(hit_rec);
-		return col;
 	}
-	free(hit_rec);
-	return _bg_ray_col(r);
+
+	STATS_ADD(max_depth, 1);
+	*depth = bounce;
+	return black;
+}
+
+/*
+ * Adds the counts of a histogram of path depths (hist) to the camera's 
+ * histogram, if it has one, and the calling thread's hot path counters to the 
+ * totals (see stats_flush). Workers each count into their own histogram and 
+ * merge it once per section so they do not contend on the shared counters.
+ */
+static void _merge_depth_hist(Camera* cam, uint64_t* hist)
+{
+	stats_flush();
+	if (cam->depth_hist == NULL)
+		return;
+	for (size_t i = 0; i < CAM_DEPTH_BINS; i++)
+		if (hist[i] > 0)
+			__atomic_fetch_add(&cam->depth_hist[i], hist[i], __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the colour of sample (samp_idx) of the pixel at (col, row). The sampler 
+ * is started from the camera's sampler type and seed and the pixel and sample 
+ * indices before the sample is traced. The depth of the path is counted in 
+ * (hist), the last bin holding every path of CAM_DEPTH_BINS - 1 bounces or more.
+ */
+static Vector _trace_sample(Camera* cam, Hittable_List* scene, Sampler* sampler, 
+							uint64_t* hist, size_t col, size_t row, size_t samp_idx)
+{
+	STATS_ADD(samples, 1);
+	sampler_start(sampler, cam->sampler, cam->seed, col, row, samp_idx);
+	Ray r = _get_ray(cam, sampler, col, row);
+	uint16_t depth;
+	Vector col_out = _ray_col(r, scene, cam->max_ray_bounces, cam->roulette_depth, 
+							  sampler, &depth);
+	hist[(depth < CAM_DEPTH_BINS) ? depth : CAM_DEPTH_BINS - 1]++;
+	return col_out;
+}
+
+/*
+ * Returns the sum of the colours of samples [first_sample - first_sample + count) 
+ * of the pixel at (col, row), see _trace_sample.
+ */
+static Vector _pixel_sum(Camera* cam, Hittable_List* scene, Sampler* sampler, 
+						 uint64_t* hist, size_t col, size_t row, size_t first_sample, 
+						 size_t count)
+{
+	Vector pix_col = {0.0, 0.0, 0.0};
+	for (size_t samp_idx = first_sample; samp_idx < first_sample + count; samp_idx++)
+		pix_col = vec_add(pix_col, _trace_sample(cam, scene, sampler, hist, col, row, 
+												   samp_idx));
+	return pix_col;
 }
 
 /*
@@ -197,42 +285,210 @@ void cam_calculate_matrices(Camera* cam, size_t screen_width, size_t screen_heig
 
 /*
  * Initializes the camera struct passed in so that it is ready to be used to 
- * render the scene. Seeds the RNG, defaults camera values, and calculates 
- * view matrices.
+ * render the scene. Seeds the RNG and the camera's sample streams, defaults 
+ * camera values, and calculates view matrices.
  */
 void cam_init(Camera* cam, size_t screen_width, size_t screen_height)
 {
 	rng_set_seed(time(NULL));
+	cam->seed = (uint64_t) time(NULL);
 	_set_defaults(cam, (double) screen_height, (double) screen_width);
 	cam_calculate_matrices(cam, screen_width, screen_height);
 }
 
+/*
+ * Moves the camera by (right, up, forward) along its own axes: right and 
+ * forward are taken from the direction it faces, and up is the camera's up 
+ * vector, so moving forward while looking down lowers the camera. The view 
+ * matrices must be recalculated (see cam_calculate_matrices) afterwards.
+ */
+void cam_move(Camera* cam, double right, double up, double forward)
+{
+	Camera_Transform* trans = cam->transform;
+	Vector facing = vec_unit(trans->facing);
+	Vector side = vec_unit(vec_cross(facing, trans->v_up));
+	Vector delta = vec_add_3(vec_mul(side, right), vec_mul(vec_unit(trans->v_up), up), 
+							 vec_mul(facing, forward));
+	trans->position = vec_add(trans->position, delta);
+}
+
+/*
+ * Turns the camera by (yaw) radians to the right around its up vector, then by 
+ * (pitch) radians upwards. The pitch is limited so that the camera never faces 
+ * within about 3 degrees of straight up or down, where the right vector (facing x 
+ * up) would flip. Both rotations use Rodrigues' formula. The view matrices 
+ * must be recalculated (see cam_calculate_matrices) afterwards.
+ */
+void cam_turn(Camera* cam, double yaw, double pitch)
+{
+	Camera_Transform* trans = cam->transform;
+	Vector up = vec_unit(trans->v_up);
+	Vector facing = vec_unit(trans->facing);
+
+	// around the up vector, which is perpendicular to the part of facing that turns
+	Vector axis = vec_mul(up, -1.0);
+	facing = vec_add_3(vec_mul(facing, cos(yaw)), vec_mul(vec_cross(axis, facing), sin(yaw)),
+					   vec_mul(axis, vec_dot(axis, facing) * (1.0 - cos(yaw))));
+
+	double limit = PI / 2.0 - 0.05;
+	double elevation = asin(max(-1.0, min(1.0, vec_dot(facing, up))));
+	pitch = max(-limit - elevation, min(limit - elevation, pitch));
+	axis = vec_unit(vec_cross(facing, up)); // right, facing is perpendicular to it
+	facing = vec_add(vec_mul(facing, cos(pitch)), vec_mul(vec_cross(axis, facing), sin(pitch)));
+	trans->facing = vec_unit(facing);
+}
+
+/*
+ * Traces the first sample of every pixel in a rectangular section of the image 
+ * (between points defined by start / end, x / y) whose coordinates are both 
+ * multiples of (block) and which has no samples yet, and adds it to the 
+ * framebuffer (fb). Returns the amount of samples traced.
+ *
+ * Running this for blocks of 8, 4 and 2 pixels in turn renders a coarse preview 
+ * at 1/8 of the resolution for 1/64 of the cost of a full pass, then refines it 
+ * (see tonemap_fill_holes to show it). Each sample is a proper first sample of 
+ * its pixel, so nothing is thrown away when the full passes follow.
+ */
+size_t cam_render_preview(Camera* cam, Hittable_List* scene, Framebuffer* fb, 
+						  size_t block, size_t start_x, size_t start_y, size_t end_x, 
+						  size_t end_y)
+{
+	Sampler sampler;
+	uint64_t hist[CAM_DEPTH_BINS] = {0};
+	size_t traced = 0;
+	size_t first_col = (start_x + block - 1) / block * block;
+	for (size_t row = (start_y + block - 1) / block * block; row < end_y; row += block)
+	{
+		for (size_t col = first_col; col < end_x; col += block)
+		{
+			if (fb->samples[row * fb->width + col] > 0)
+				continue;
+			uint64_t cost = STATS_COST();
+			Vector samp_col = _trace_sample(cam, scene, &sampler, hist, col, row, 0);
+			framebuffer_add_sample(fb, col, row, samp_col);
+			framebuffer_add_cost(fb, col, row, STATS_COST() - cost);
+			traced++;
+		}
+	}
+	_merge_depth_hist(cam, hist);
+	return traced;
+}
+
 /*
  * Renders a rectangular section of the image between points defined by start / 
- * end, x / y. This method accepts a function pointer to the method that allows 
- * it to send pixels the the window's pixel buffer. 
+ * end, x / y, tracing every sample of each pixel at once and adding their sum to 
+ * the framebuffer (fb). Nothing is converted for display here, that is left to 
+ * tonemap_rect once the window is refreshed.
  *
- * For a detailed explanation of the rendering loop, see cam_render below.
+ * Every sample starts its own sampler from the camera's seed and the pixel and 
+ * sample indices, so the image only depends on the seed and not on which thread 
+ * renders a section or in which order. For a detailed explanation of the 
+ * rendering loop, see cam_render below.
  */
-void cam_render_section(void (*set_pixel)(size_t, size_t, Vector), Camera* cam, 
-						Hittable_List* scene, size_t start_x, size_t start_y,
-					    size_t end_x, size_t end_y)
+void cam_render_section(Camera* cam, Hittable_List* scene, Framebuffer* fb, 
+						size_t start_x, size_t start_y, size_t end_x, size_t end_y)
 {
 	size_t samp_per_pix = cam->samples_per_pixel;
+	Sampler sampler;
+	uint64_t hist[CAM_DEPTH_BINS] = {0};
 	for (size_t row = start_y; row < end_y; row++)
 	{
 		for (size_t col = start_x; col < end_x; col++)
 		{
-			Vector pix_col = {0.0, 0.0, 0.0};
-			for (size_t samp_idx = 0; samp_idx < samp_per_pix; samp_idx++)
+			uint64_t cost = STATS_COST();
+			Vector pix_col = _pixel_sum(cam, scene, &sampler, hist, col, row, 0, 
+									   samp_per_pix);
+			framebuffer_add_sum(fb, col, row, pix_col, samp_per_pix);
+			framebuffer_add_cost(fb, col, row, STATS_COST() - cost);
+		}
+	}
+	_merge_depth_hist(cam, hist);
+}
+
+/*
+ * Runs one pass of a progressive render over the section of the image between 
+ * points defined by start / end, x / y. Each pixel traces up to (sample_count) 
+ * more samples and adds them to the framebuffer (fb). Returns the amount of 
+ * samples traced, which is 0 once every pixel of the section is done.
+ *
+ * A pixel is done once it has samples_per_pixel samples, or, with adaptive 
+ * sampling (adaptive_threshold > 0), once it has at least min_samples_per_pixel 
+ * samples and the error estimate of its shown brightness (see 
+ * framebuffer_error) is below the threshold. Flat pixels such as the sky stop 
+ * early while noisy ones keep sampling up to the maximum.
+ *
+ * A pixel's next sample index is the amount of samples it already has, so passes 
+ * that take every pixel to samples_per_pixel give the same image as 
+ * cam_render_section (up to the rounding of the float sums).
+ */
+size_t cam_render_pass(Camera* cam, Hittable_List* scene, Framebuffer* fb, 
+					   size_t sample_count, size_t start_x, size_t start_y, 
+					   size_t end_x, size_t end_y)
+{
+	Sampler sampler;
+	uint64_t hist[CAM_DEPTH_BINS] = {0};
+	size_t traced = 0;
+	for (size_t row = start_y; row < end_y; row++)
+	{
+		for (size_t col = start_x; col < end_x; col++)
+		{
+			size_t done = fb->samples[row * fb->width + col];
+			if (done >= cam->samples_per_pixel)
+				continue;
+			if ((cam->adaptive_threshold > 0.0) 
+				&& (done >= cam->min_samples_per_pixel)
+				&& (framebuffer_error(fb, col, row) < cam->adaptive_threshold))
+				continue;
+
+			size_t count = cam->samples_per_pixel - done;
+			if (count > sample_count)
+				count = sample_count;
+			uint64_t cost = STATS_COST();
+			for (size_t samp_idx = done; samp_idx < done + count; samp_idx++)
 			{
-				Ray r = _get_ray(cam, col, row);
-				Vector samp_col = _ray_col(r, scene, cam->max_ray_bounces);
-				pix_col = vec_add(pix_col, samp_col);
+				Vector samp_col = _trace_sample(cam, scene, &sampler, hist, col, row, 
+												samp_idx);
+				framebuffer_add_sample(fb, col, row, samp_col);
 			}
-			set_pixel(col, row, vec_div(pix_col, (double) samp_per_pix));
+			framebuffer_add_cost(fb, col, row, STATS_COST() - cost);
+			traced += count;
 		}
 	}
+	_merge_depth_hist(cam, hist);
+	return traced;
+}
+
+/*
+ * Writes the path depth histogram of the camera (see depth_hist) to (path) as 
+ * CSV, one row per bin with the amount of bounces and the amount of paths that 
+ * ended after that many. The last row also counts every deeper path. Returns 
+ * false and prints a message if the camera has no histogram or the file cannot 
+ * be written.
+ */
+bool cam_write_depth_hist(const Camera* cam, const char* path)
+{
+	if (cam->depth_hist == NULL)
+	{
+		fprintf(stderr, "no path depth histogram to write to %s\n", path);
+		return false;
+	}
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "failed to open %s for writing\n", path);
+		return false;
+	}
+
+	bool ok = fprintf(file, "bounces,paths\n") > 0;
+	for (size_t i = 0; ok && (i < CAM_DEPTH_BINS); i++)
+		ok = fprintf(file, "%zu,%llu\n", i, (unsigned long long) cam->depth_hist[i]) > 0;
+
+	if ((fclose(file) != 0) || !ok)
+	{
+		fprintf(stderr, "failed to write %s\n", path);
+		return false;
+	}
+	return true;
 }
 
 /*
@@ -240,27 +496,26 @@ void cam_render_section(void (*set_pixel)(size_t, size_t, Vector), Camera* cam,
  * Loops over every pixel in the image, starting with the top left and finishing 
  * in the bottom right. For each pixel, it performs multiple path traces (as 
  * defined by samples_per_pixel in the Camera struct) through the scene that is 
- * passed in. The results of these path traces are averaged and outputted to the image.
+ * passed in. The results of these path traces are added to the framebuffer (fb).
  */
-void cam_render(void (*set_pixel)(size_t, size_t, Vector), Camera* cam, 
-				Hittable_List* scene, size_t screen_width, size_t screen_height)
+void cam_render(Camera* cam, Hittable_List* scene, Framebuffer* fb)
 {
-	uint8_t samp_per_pix = cam->samples_per_pixel;
-	for (size_t row = 0; row < screen_height; row++)
+	uint16_t samp_per_pix = cam->samples_per_pixel;
+	Sampler sampler;
+	uint64_t hist[CAM_DEPTH_BINS] = {0};
+	for (size_t row = 0; row < fb->height; row++)
 	{
-		printf("\rscanlines remaining: %u  ", (uint) (screen_height - row - 1));
+		printf("\rscanlines remaining: %u  ", (uint) (fb->height - row - 1));
 		fflush(stdout);
-		for (size_t col = 0; col < screen_width; col++)
+		for (size_t col = 0; col < fb->width; col++)
 		{
-			Vector pix_col = {0.0, 0.0, 0.0};
-			for (size_t i = 0; i < samp_per_pix; i++)
-			{
-				Ray r = _get_ray(cam, col, row);
-				Vector samp_col = _ray_col(r, scene, cam->max_ray_bounces);
-				pix_col = vec_add(pix_col, samp_col);
-			}
-			set_pixel(col, row, vec_div(pix_col, (double) samp_per_pix));
+			uint64_t cost = STATS_COST();
+			Vector pix_col = _pixel_sum(cam, scene, &sampler, hist, col, row, 0, 
+									   samp_per_pix);
+			framebuffer_add_sum(fb, col, row, pix_col, samp_per_pix);
+			framebuffer_add_cost(fb, col, row, STATS_COST() - cost);
 		}
 	}
+	_merge_depth_hist(cam, hist);
 	printf("\rrender complete         \n");
 }
@@ -4,7 +4,11 @@
 #include "math_utils.h"
 #include "scene.h"
 #include "scatter.h"
+#include "sampler.h"
 #include "hittable.h"
+#include "framebuffer.h"
+
+#define CAM_DEPTH_BINS 64 // bins of the path depth histogram, the last one collects the rest
 
 /*
  * Struct for storing the position and basis vectors of the camera.
@@ -22,8 +26,11 @@ typedef struct Camera_Transform {
 typedef struct Camera {
 	Camera_Transform* transform;		   // transform pointer
 	double 			  aspect_ratio;		   // width / height
-	uint16_t 		  samples_per_pixel;   // rays per pixel
-	uint16_t 		  max_ray_bounces;	   // max bounces to track
+	uint16_t 		  samples_per_pixel;   // rays per pixel (the most with adaptive sampling)
+	uint16_t 		  min_samples_per_pixel; // fewest rays per pixel with adaptive sampling
+	double 			  adaptive_threshold;  // error at which a pixel stops sampling, 0 to disable
+	uint16_t 		  max_ray_bounces;	   // safety limit on bounces to track
+	uint16_t 		  roulette_depth;	   // bounces before paths may be ended at random
 	double 			  fov_radians;		   // field of view radians
 	double 			  focus_distance;	   // focal length
 	double 			  defocus_angle;	   // size of defocus disk
@@ -34,6 +41,9 @@ typedef struct Camera {
 	Vector 			  pixel_delta_v;	   // y offset between pixels 
 	double 			  vp_height, vp_width; // dimensions of the viewport
 	Vector 			  vp_u, vp_v;		   // vectors along viewport edges
+	Sampler_Type 	  sampler;			   // sequence the samples of each pixel are drawn from
+	uint64_t 		  seed;				   // seed of the per sample sequences
+	uint64_t* 		  depth_hist;		   // paths per bounce count (CAM_DEPTH_BINS), or NULL
 } Camera;
 
 /*
@@ -50,17 +60,50 @@ extern void cam_calculate_matrices(Camera* cam, size_t screen_width,
 								   size_t screen_height);
 
 /*
- * Renders a portion of the given scene to the screen (between start / end, x / y).
+ * Moves the camera by the given distances along its right, up and forward axes.
+ */
+extern void cam_move(Camera* cam, double right, double up, double forward);
+
+/*
+ * Turns the camera by (yaw) radians to the right and (pitch) radians up.
+ */
+extern void cam_turn(Camera* cam, double yaw, double pitch);
+
+/*
+ * Adds the first sample of every pixel of a portion of the image (between start 
+ * / end, x / y) on the grid of (block) pixels that has none yet to the 
+ * framebuffer. Returns the amount of samples traced.
+ */
+extern size_t cam_render_preview(Camera* cam, Hittable_List* scene, Framebuffer* fb, 
+								 size_t block, size_t start_x, size_t start_y, 
+								 size_t end_x, size_t end_y);
+
+/*
+ * Renders a portion of the given scene (between start / end, x / y) into the 
+ * framebuffer.
+ */
+extern void cam_render_section(Camera* cam, Hittable_List* scene, Framebuffer* fb, 
+							   size_t start_x, size_t start_y, size_t end_x, 
+							   size_t end_y);
+
+/*
+ * Adds up to (sample_count) samples to every unfinished pixel of a portion of the 
+ * image (between start / end, x / y) in the framebuffer. Returns the amount of 
+ * samples traced.
+ */
+extern size_t cam_render_pass(Camera* cam, Hittable_List* scene, Framebuffer* fb, 
+							  size_t sample_count, size_t start_x, size_t start_y, 
+							  size_t end_x, size_t end_y);
+
+/*
+ * Renders a the given scene into the framebuffer.
  */
-extern void cam_render_section(void (*set_pixel)(size_t, size_t, Vector), 
-				   			   Camera* cam, Hittable_List* scene, size_t start_x, 
-							   size_t start_y, size_t end_x, size_t end_y);
+extern void cam_render(Camera* cam, Hittable_List* scene, Framebuffer* fb);
 
 /*
- * Renders a the given scene to the screen.
+ * Writes the path depth histogram of the camera to a CSV file. Returns false if 
+ * there is none or it could not be written.
  */
-extern void cam_render(void (*set_pixel_func)(size_t, size_t, Vector), 
-				   	   Camera* cam, Hittable_List* scene, 
-				   	   size_t screen_width, size_t screen_height);
+extern bool cam_write_depth_hist(const Camera* cam, const char* path);
 
 #endif
@@ -0,0 +1,228 @@
+#include "framebuffer.h"
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Creates a framebuffer of the given dimensions with no samples in it.
+ *
+ * This method allocates heap memory for the framebuffer and its pixels. If any of 
+ * these allocations fail, the application exits with code 1.
+ */
+Framebuffer* framebuffer_new(size_t width, size_t height)
+{
+	Framebuffer* fb;
+	if (((fb = malloc(sizeof(Framebuffer))) == NULL)
+		|| ((fb->accum = malloc(sizeof(float) * 3 * width * height)) == NULL)
+		|| ((fb->samples = malloc(sizeof(uint32_t) * width * height)) == NULL)
+		|| ((fb->lum_mean = malloc(sizeof(float) * width * height)) == NULL)
+		|| ((fb->lum_m2 = malloc(sizeof(float) * width * height)) == NULL))
+	{
+		fprintf(stderr, "malloc failed in framebuffer\n");
+		exit(1);
+	}
+
+	fb->cost = NULL;
+#ifdef STATS_ENABLED
+	if ((fb->cost = malloc(sizeof(uint64_t) * width * height)) == NULL)
+	{
+		fprintf(stderr, "malloc failed in framebuffer\n");
+		exit(1);
+	}
+#endif
+
+	fb->width = width;
+	fb->height = height;
+	framebuffer_clear(fb);
+	return fb;
+}
+
+/*
+ * Zeroes the sums and sample counts of every pixel, ready to start a new image.
+ */
+void framebuffer_clear(Framebuffer* fb)
+{
+	memset(fb->accum, 0, sizeof(float) * 3 * fb->width * fb->height);
+	memset(fb->samples, 0, sizeof(uint32_t) * fb->width * fb->height);
+	memset(fb->lum_mean, 0, sizeof(float) * fb->width * fb->height);
+	memset(fb->lum_m2, 0, sizeof(float) * fb->width * fb->height);
+	if (fb->cost != NULL)
+		memset(fb->cost, 0, sizeof(uint64_t) * fb->width * fb->height);
+}
+
+/*
+ * Adds the sample (col) to the pixel at the coordinates (x, y), and updates the 
+ * running mean and variance of the pixel's luminance with Welford's method, 
+ * which stays accurate in single precision over many samples. Each pixel must 
+ * only be added to by one thread at a time.
+ */
+void framebuffer_add_sample(Framebuffer* fb, size_t x, size_t y, Vector col)
+{
+	size_t idx = y * fb->width + x;
+	fb->accum[3 * idx] += (float) col.x;
+	fb->accum[3 * idx + 1] += (float) col.y;
+	fb->accum[3 * idx + 2] += (float) col.z;
+	uint32_t n = ++fb->samples[idx];
+
+	float lum = (float) (0.2126 * col.x + 0.7152 * col.y + 0.0722 * col.z);
+	float delta = lum - fb->lum_mean[idx];
+	fb->lum_mean[idx] += delta / (float) n;
+	fb->lum_m2[idx] += delta * (lum - fb->lum_mean[idx]);
+}
+
+/*
+ * Adds (count) samples whose colours add up to (sum) to the pixel at the 
+ * coordinates (x, y), for renders that trace all of a pixel's samples at once. 
+ * The luminance statistics are left alone, so framebuffer_error only covers 
+ * samples added one at a time. Each pixel must only be added to by one thread at 
+ * a time.
+ */
+void framebuffer_add_sum(Framebuffer* fb, size_t x, size_t y, Vector sum, 
+						 uint32_t count)
+{
+	size_t idx = y * fb->width + x;
+	fb->accum[3 * idx] += (float) sum.x;
+	fb->accum[3 * idx + 1] += (float) sum.y;
+	fb->accum[3 * idx + 2] += (float) sum.z;
+	fb->samples[idx] += count;
+}
+
+/*
+ * Adds (cost), the box and primitive tests (see STATS_COST) of samples just 
+ * added to the pixel at the coordinates (x, y), to the pixel's traversal cost. 
+ * Does nothing if the counters are compiled out, in which case (cost) is 
+ * always 0 anyway. Each pixel must only be added to by one thread at a time.
+ */
+void framebuffer_add_cost(Framebuffer* fb, size_t x, size_t y, uint64_t cost)
+{
+	if (fb->cost != NULL)
+		fb->cost[y * fb->width + x] += cost;
+}
+
+/*
+ * Returns the mean of the samples accumulated in the pixel at the coordinates 
+ * (x, y), or black if it has none yet.
+ */
+Vector framebuffer_mean(Framebuffer* fb, size_t x, size_t y)
+{
+	size_t idx = y * fb->width + x;
+	if (fb->samples[idx] == 0)
+	{
+		Vector black = {0.0, 0.0, 0.0};
+		return black;
+	}
+
+	double inv_count = 1.0 / (double) fb->samples[idx];
+	Vector mean = {fb->accum[3 * idx] * inv_count,
+				   fb->accum[3 * idx + 1] * inv_count,
+				   fb->accum[3 * idx + 2] * inv_count};
+	return mean;
+}
+
+/*
+ * Returns the standard error of the mean luminance of the pixel at the 
+ * coordinates (x, y), carried through the gamma correction of the display (a 
+ * square root, so the error is divided by twice the root of the mean). This is 
+ * roughly how much the shown brightness of the pixel, in the range 0-1, is still 
+ * expected to change. Returns INFINITY for pixels with fewer than 2 samples.
+ */
+double framebuffer_error(Framebuffer* fb, size_t x, size_t y)
+{
+	size_t idx = y * fb->width + x;
+	uint32_t n = fb->samples[idx];
+	if (n < 2)
+		return INFINITY;
+
+	double variance = fb->lum_m2[idx] / (double) (n - 1);
+	double std_err = sqrt(max(variance, 0.0) / (double) n);
+	return std_err / (2.0 * sqrt(max(fb->lum_mean[idx], 1.0E-2)));
+}
+
+/*
+ * Writes a colour for every pixel to (pixels) (ARGB8888, with (pitch) bytes 
+ * between rows) that shows how many samples it has taken, blending from blue 
+ * (no samples) to red (max_samples or more).
+ */
+void framebuffer_heatmap(const Framebuffer* fb, uint32_t* pixels, size_t pitch, 
+						 uint32_t max_samples)
+{
+	for (size_t y = 0; y < fb->height; y++)
+	{
+		uint32_t* row = (uint32_t*) ((uint8_t*) pixels + y * pitch);
+		for (size_t x = 0; x < fb->width; x++)
+		{
+			double t = min((double) fb->samples[y * fb->width + x] 
+						   / (double) max_samples, 1.0);
+			uint32_t red = (uint32_t) round(t * 255.0);
+			row[x] = 0xFF000000 | (red << 16) | (255 - red);
+		}
+	}
+}
+
+/*
+ * Writes a false colour for every pixel to (pixels) (ARGB8888, with (pitch) 
+ * bytes between rows) that shows its traversal cost per sample, so that the 
+ * geometry that slows a frame down stands out. Costs are shown on a log scale 
+ * from the cheapest to the most expensive pixel of the image, blending from 
+ * black through blue, green and yellow to red. Pixels without samples, and 
+ * every pixel if the counters are compiled out, are black.
+ */
+void framebuffer_cost_heatmap(const Framebuffer* fb, uint32_t* pixels, size_t pitch)
+{
+	static const double stops[5][3] = {{0.0, 0.0, 0.0}, {0.0, 0.0, 255.0}, 
+									   {0.0, 255.0, 0.0}, {255.0, 255.0, 0.0}, 
+									   {255.0, 0.0, 0.0}};
+	double lo = INFINITY;
+	double hi = 0.0;
+	size_t count = fb->width * fb->height;
+	for (size_t i = 0; (fb->cost != NULL) && (i < count); i++)
+	{
+		if (fb->samples[i] == 0)
+			continue;
+		double cost = log1p((double) fb->cost[i] / (double) fb->samples[i]);
+		lo = min(lo, cost);
+		hi = max(hi, cost);
+	}
+
+	for (size_t y = 0; y < fb->height; y++)
+	{
+		uint32_t* row = (uint32_t*) ((uint8_t*) pixels + y * pitch);
+		for (size_t x = 0; x < fb->width; x++)
+		{
+			size_t idx = y * fb->width + x;
+			if ((fb->cost == NULL) || (fb->samples[idx] == 0))
+			{
+				row[x] = 0xFF000000;
+				continue;
+			}
+			double cost = log1p((double) fb->cost[idx] / (double) fb->samples[idx]);
+			double t = (hi > lo) ? 4.0 * (cost - lo) / (hi - lo) : 0.0;
+			size_t stop = (t >= 3.0) ? 3 : (size_t) t;
+			double f = t - (double) stop;
+			uint32_t col = 0xFF000000;
+			for (size_t c = 0; c < 3; c++)
+			{
+				double val = stops[stop][c] + f * (stops[stop + 1][c] - stops[stop][c]);
+				col |= (uint32_t) round(val) << (16 - 8 * c);
+			}
+			row[x] = col;
+		}
+	}
+}
+
+/*
+ * Frees the given framebuffer and its pixels.
+ */
+void framebuffer_free(Framebuffer* fb)
+{
+	if (fb == NULL)
+		return;
+
+	free(fb->accum);
+	free(fb->samples);
+	free(fb->lum_mean);
+	free(fb->lum_m2);
+	free(fb->cost);
+	free(fb);
+}
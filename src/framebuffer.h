@@ -0,0 +1,87 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "math_utils.h"
+#include "stats.h"
+
+/*
+ * Struct for a persistent image that samples are accumulated into over several 
+ * render passes. Each pixel keeps the running sum of its samples as 3 floats 
+ * (red, green, blue) and the amount of samples in that sum, so that the mean can 
+ * be shown at any time. The running mean and variance of the luminance of each 
+ * pixel's samples are tracked as well, to tell when a pixel has converged.
+ */
+typedef struct Framebuffer {
+	float* 	  accum;	// sum of the samples of each pixel, row by row
+	uint32_t* samples;	// amount of samples summed for each pixel
+	float* 	  lum_mean; // mean luminance of each pixel's samples
+	float* 	  lum_m2;	// sum of squared luminance deviations of each pixel (Welford)
+	uint64_t* cost;		// box and primitive tests of each pixel, NULL without stats
+	size_t 	  width;
+	size_t 	  height;
+} Framebuffer;
+
+/*
+ * Creates an empty framebuffer of the given dimensions.
+ */
+extern Framebuffer* framebuffer_new(size_t width, size_t height);
+
+/*
+ * Removes every sample from the framebuffer.
+ */
+extern void framebuffer_clear(Framebuffer* fb);
+
+/*
+ * Adds one sample (col) to the pixel at the coordinates (x, y).
+ */
+extern void framebuffer_add_sample(Framebuffer* fb, size_t x, size_t y, Vector col);
+
+/*
+ * Adds (count) samples that add up to (sum) to the pixel at the coordinates 
+ * (x, y), without tracking their variance.
+ */
+extern void framebuffer_add_sum(Framebuffer* fb, size_t x, size_t y, Vector sum, 
+								uint32_t count);
+
+/*
+ * Adds the traversal cost (cost) of samples of the pixel at the coordinates 
+ * (x, y), if the counters are compiled in (see stats.h).
+ */
+extern void framebuffer_add_cost(Framebuffer* fb, size_t x, size_t y, uint64_t cost);
+
+/*
+ * Returns the mean of the samples of the pixel at the coordinates (x, y).
+ */
+extern Vector framebuffer_mean(Framebuffer* fb, size_t x, size_t y);
+
+/*
+ * Returns the estimated error of the displayed brightness of the pixel at the 
+ * coordinates (x, y).
+ */
+extern double framebuffer_error(Framebuffer* fb, size_t x, size_t y);
+
+/*
+ * Writes the amount of samples taken by every pixel to (pixels) (ARGB8888, with 
+ * (pitch) bytes per row) as colours from blue (none) to red (max_samples).
+ */
+extern void framebuffer_heatmap(const Framebuffer* fb, uint32_t* pixels, size_t pitch, 
+								uint32_t max_samples);
+
+/*
+ * Writes the traversal cost per sample of every pixel to (pixels) (ARGB8888, 
+ * with (pitch) bytes per row) as false colours, from black (cheapest) through 
+ * blue, green and yellow to red (most expensive).
+ */
+extern void framebuffer_cost_heatmap(const Framebuffer* fb, uint32_t* pixels, 
+									 size_t pitch);
+
+/*
+ * Frees a framebuffer.
+ */
+extern void framebuffer_free(Framebuffer* fb);
+
+#endif
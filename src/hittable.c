@@ -1,4 +1,5 @@
 #include "hittable.h"
+#include "bvh.h"
 
 /*
  * PRIVATE:
@@ -59,7 +60,7 @@ static bool _hit_sphere(Hittable* hittable, Ray r, Interval itvl, Hit_Record* hi
  * Checks if a given ray (r) intersects with the triangle pointed to by (hittable)
  * within the interval (itvl) and stores data about the collision in (hit_rec).
  * 
- * To see the structure of a triangle Hittable, see hittable_new_tri.
+ * To see the structure of a triangle Hittable, see hittable_init_tri.
  *
  * Intersection is calculated based on the basis vectors and normals of the triangle 
  * (using barycentric coordinates to see if the ray is within the tri) and the 
@@ -111,6 +112,80 @@ static bool _hit_tri(Hittable* hittable, Ray r, Interval itvl, Hit_Record* hit_r
 	return true;
 }
 
+/*
+ * Returns the result of multiplying the vector (u) by the 3x3 matrix with the 
+ * rows (row_0, row_1, row_2).
+ */
+static Vector _mat_mul(Vector row_0, Vector row_1, Vector row_2, Vector u)
+{
+	Vector out = {vec_dot(row_0, u), vec_dot(row_1, u), vec_dot(row_2, u)};
+	return out;
+}
+
+/*
+ * Checks if a given ray (r) intersects with the mesh instance pointed to by 
+ * (hittable) within the interval (itvl) and stores data about the collision in 
+ * (hit_rec).
+ *
+ * To see the structure of an instance Hittable, see hittable_new_instance.
+ *
+ * The ray is moved into the mesh's object space with the inverse transform and 
+ * cast through the mesh's own BVH and triangle store. The direction is not 
+ * renormalized, so the distance (t) along the ray is the same in both spaces and 
+ * the interval can be used as is. On a collision, the position is recalculated 
+ * along the world space ray, the normal is moved back to world space with the 
+ * inverse transpose of the transform, and the colour is taken from the 
+ * instance's material.
+ */
+static bool _hit_instance(Hittable* hittable, Ray r, Interval itvl, Hit_Record* hit_rec)
+{
+	Vector* m = hittable->vectors;
+	Ray local = {vec_add(_mat_mul(m[4], m[5], m[6], r.origin), m[7]), 
+				 _mat_mul(m[4], m[5], m[6], r.direction)};
+
+	Obj_Object* mesh = hittable->mesh;
+	double t;
+	size_t tri_idx = bvh_hit_tri_idx(mesh->bvh, mesh->store, local, itvl, &t);
+	if (tri_idx == SIZE_MAX)
+		return false;
+
+	tri_store_hit_record(mesh->store, tri_idx, local, t, hit_rec);
+	Vector n = hit_rec->norm;
+	hit_rec->p = ray_at(r, hit_rec->t);
+	hit_rec->norm = vec_unit(vec_add_3(vec_mul(m[4], n.x), 
+									   vec_mul(m[5], n.y), 
+									   vec_mul(m[6], n.z)));
+	hit_rec->atten = hittable->mat.albedo;
+
+	return true;
+}
+
+/*
+ * Builds the BVH over the triangles of the given mesh, and the triangle store 
+ * in the leaf order of that BVH, if it does not have them yet. If the 
+ * allocation of the temporary bounding box array fails, the application exits 
+ * with code 1.
+ */
+static void _build_mesh_bvh(Obj_Object* mesh)
+{
+	if (mesh->bvh != NULL)
+		return;
+
+	AABB* boxes;
+	if ((boxes = malloc(sizeof(AABB) * (mesh->length + 1))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in hittable\n");
+		exit(1);
+	}
+	for (size_t i = 0; i < mesh->length; i++)
+		boxes[i] = mesh->tris[i]->aabb;
+
+	mesh->bvh = bvh_build(boxes, mesh->length);
+	bvh_set_layout(mesh->bvh, BVH_WIDE);
+	mesh->store = tri_store_build(mesh, mesh->bvh->prim_idxs);
+	free(boxes);
+}
+
 /*
  * PUBLIC:
  */
@@ -151,6 +226,7 @@ Hittable* hittable_new_sphere(double x, double y, double z, double s, Material m
 	out->vectors[0] = pos;
 	out->mat = material;
 	out->scale = s;
+	out->mesh = NULL;
 
 	Interval x_i = {pos.x - s, pos.x + s};
 	Interval y_i = {pos.y - s, pos.y + s};
@@ -162,8 +238,9 @@ Hittable* hittable_new_sphere(double x, double y, double z, double s, Material m
 }
 
 /*
- * Returns a pointer to a hittable representing a triangle with vertex coordinates 
- * (a, b, c) and vertex normals (na, nb, nc), with the material (material).
+ * Makes (out) a triangle with vertex coordinates (a, b, c) and vertex normals 
+ * (na, nb, nc), with the material (material), storing its 6 basis vectors in 
+ * (vectors), which the caller provides and which must outlive the hittable.
  *
  * A triangle hittable stores 6 basis vectors in its vectors, respectively:
  * coord of vertex a, coord of vertex b, coord of vertex c, normal of vertex a,
@@ -173,12 +250,78 @@ Hittable* hittable_new_sphere(double x, double y, double z, double s, Material m
  * automatically created for the triangle based on its vertex coordinates and is 
  * expanded slightly to account for floating point inaccuracies.
  *
+ * Nothing is allocated, so a mesh can keep all of its triangles in one block 
+ * (see parse_obj_file).
+ */
+void hittable_init_tri(Hittable* out, Vector* vectors, Vector a, Vector b, Vector c, 
+					   Vector na, Vector nb, Vector nc, Material material)
+{
+	out->type = TRI;
+	out->v_len = sizeof(Vector) * out->type;
+	out->vectors = vectors;
+	out->vectors[0] = a;
+	out->vectors[1] = b;
+	out->vectors[2] = c;
+	out->vectors[3] = na;
+	out->vectors[4] = nb;
+	out->vectors[5] = nc;
+	out->mat = material;
+	out->mesh = NULL;
+
+	double epsilon = 1.0E-8;
+	Interval x_i = {min(min(a.x, b.x), c.x) - epsilon, max(max(a.x, b.x), c.x) + epsilon};
+	Interval y_i = {min(min(a.y, b.y), c.y) - epsilon, max(max(a.y, b.y), c.y) + epsilon};
+	Interval z_i = {min(min(a.z, b.z), c.z) - epsilon, max(max(a.z, b.z), c.z) + epsilon};
+	AABB aabb = {x_i, y_i, z_i};
+	out->aabb = aabb;
+}
+
+/*
+ * Returns a pointer to a hittable representing a triangle with vertex coordinates 
+ * (a, b, c) and vertex normals (na, nb, nc), with the material (material). See 
+ * hittable_init_tri for the structure of a triangle hittable.
+ *
  * This method allocates the hittable and its position vector on the heap, 
  * if the allocation fails then the application exits with code 1.
  */
 Hittable* hittable_new_tri(Vector a, Vector b, Vector c, 
 						   Vector na, Vector nb, Vector nc, Material material)
 {
+	Hittable* out;
+	Vector* vectors;
+	if (((out = malloc(sizeof(Hittable))) == NULL) 
+		|| ((vectors = malloc(sizeof(Vector) * TRI)) == NULL))
+	{
+		fprintf(stderr, "malloc failed in hittable\n");
+		exit(1);
+	} 
+
+	hittable_init_tri(out, vectors, a, b, c, na, nb, nc, material);
+	return out;
+}
+
+/*
+ * Returns a pointer to a hittable representing an instance of the mesh (mesh) 
+ * placed in the scene with a position (pos), a rotation in radians about the x, 
+ * y, then z axes (rot), a uniform scale (scale), and a material (material) that 
+ * is used instead of the mesh's own.
+ *
+ * The mesh itself is not copied, every instance of it shares the same triangles 
+ * and the same BVH, which is built the first time the mesh is instanced. An 
+ * instance hittable stores 8 basis vectors in its vectors, respectively: the 3 
+ * rows of the object to world rotation and scale, the translation, the 3 rows 
+ * of the world to object rotation and scale, and the world to object 
+ * translation. An AABB is automatically calculated for the instance by moving 
+ * the corners of the mesh's bounds into world space.
+ *
+ * This method allocates the hittable and its vectors on the heap, if the 
+ * allocation fails then the application exits with code 1.
+ */
+Hittable* hittable_new_instance(Obj_Object* mesh, Vector pos, Vector rot, 
+								double scale, Material material)
+{
+	_build_mesh_bvh(mesh);
+
 	Hittable* out;
 	if ((out = malloc(sizeof(Hittable))) == NULL)
 	{
@@ -186,7 +329,7 @@ Hittable* hittable_new_tri(Vector a, Vector b, Vector c,
 		exit(1);
 	} 
 
-	out->type = TRI;
+	out->type = INSTANCE;
 	out->v_len = sizeof(Vector) * out->type;
 
 	if ((out->vectors = malloc(out->v_len)) == NULL)
@@ -195,20 +338,47 @@ Hittable* hittable_new_tri(Vector a, Vector b, Vector c,
 		exit(1);
 	}
 
-	out->vectors[0] = a;
-	out->vectors[1] = b;
-	out->vectors[2] = c;
-	out->vectors[3] = na;
-	out->vectors[4] = nb;
-	out->vectors[5] = nc;
+	double cx = cos(rot.x), sx = sin(rot.x);
+	double cy = cos(rot.y), sy = sin(rot.y);
+	double cz = cos(rot.z), sz = sin(rot.z);
+
+	// rows of rz * ry * rx
+	Vector r0 = {cz * cy, cz * sy * sx - sz * cx, cz * sy * cx + sz * sx};
+	Vector r1 = {sz * cy, sz * sy * sx + cz * cx, sz * sy * cx - cz * sx};
+	Vector r2 = {-sy, cy * sx, cy * cx};
+
+	// the inverse of a rotation is its transpose
+	Vector i0 = {r0.x, r1.x, r2.x};
+	Vector i1 = {r0.y, r1.y, r2.y};
+	Vector i2 = {r0.z, r1.z, r2.z};
+
+	out->vectors[0] = vec_mul(r0, scale);
+	out->vectors[1] = vec_mul(r1, scale);
+	out->vectors[2] = vec_mul(r2, scale);
+	out->vectors[3] = pos;
+	out->vectors[4] = vec_div(i0, scale);
+	out->vectors[5] = vec_div(i1, scale);
+	out->vectors[6] = vec_div(i2, scale);
+	out->vectors[7] = vec_mul(_mat_mul(out->vectors[4], out->vectors[5], 
+									   out->vectors[6], pos), -1.0);
 	out->mat = material;
+	out->scale = scale;
+	out->mesh = mesh;
 
-	double epsilon = 1.0E-8;
-	Interval x_i = {min(min(a.x, b.x), c.x) - epsilon, max(max(a.x, b.x), c.x) + epsilon};
-	Interval y_i = {min(min(a.y, b.y), c.y) - epsilon, max(max(a.y, b.y), c.y) + epsilon};
-	Interval z_i = {min(min(a.z, b.z), c.z) - epsilon, max(max(a.z, b.z), c.z) + epsilon};
-	AABB aabb = {x_i, y_i, z_i};
-	out->aabb = aabb;
+	out->aabb = AABB_empty();
+	if (mesh->bvh->node_count > 0)
+	{
+		AABB local = mesh->bvh->nodes[0].aabb;
+		for (size_t i = 0; i < 8; i++)
+		{
+			Vector corner = {(i & 1) ? local.x.max : local.x.min,
+							 (i & 2) ? local.y.max : local.y.min,
+							 (i & 4) ? local.z.max : local.z.min};
+			Vector world = vec_add(_mat_mul(out->vectors[0], out->vectors[1], 
+											out->vectors[2], corner), pos);
+			out->aabb = AABB_from_AABB(out->aabb, AABB_from_corners(world, world));
+		}
+	}
 
 	return out;
 }
@@ -220,18 +390,33 @@ Hittable* hittable_new_tri(Vector a, Vector b, Vector c,
  * cheaper than full collision tests. If successful, the method calls the 
  * appropriate hit function for the hittable type of (hittable).
  *
- * For detailed collision logic see _hit_sphere and _hit_tri.
+ * For detailed collision logic see _hit_sphere, _hit_tri and _hit_instance.
  */
 bool hittable_hit(Hittable* hittable, Ray r, Interval itvl, Hit_Record* hit_rec)
 {
 	if (!AABB_hit(hittable->aabb, r, &itvl))
 		return false;
 
+	return hittable_hit_primitive(hittable, r, itvl, hit_rec);
+}
+
+/*
+ * Calls the hit function for the hittable type of (hittable) without checking 
+ * its AABB first, which is what hittable_hit does once the box is hit. This lets 
+ * the microbenchmarks time _hit_sphere and _hit_tri on their own.
+ */
+bool hittable_hit_primitive(Hittable* hittable, Ray r, Interval itvl, Hit_Record* hit_rec)
+{
 	switch (hittable->type) {
 	case SPHERE: // sphere stores position in bv
+		STATS_ADD(sphere_tests, 1);
 		return _hit_sphere(hittable, r, itvl, hit_rec);
 	case TRI: // tri stores position + 2 basis vectors in bv
+		STATS_ADD(tri_tests, 1);
 		return _hit_tri(hittable, r, itvl, hit_rec);
+	case INSTANCE: // instance stores its transform and inverse in bv
+		STATS_ADD(instance_tests, 1);
+		return _hit_instance(hittable, r, itvl, hit_rec);
 	default: 
 		return false;
 	}
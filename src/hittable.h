@@ -18,10 +18,15 @@ typedef enum E_Material {
  * the amount of basis vectors that this hittable type stores.
  */
 typedef enum E_Hittable {
-	SPHERE = 1,
-	TRI	   = 6
+	SPHERE 	 = 1,
+	TRI	   	 = 6,
+	INSTANCE = 8
 } E_Hittable;
 
+struct Obj_Object;
+struct BVH;
+struct Tri_Store;
+
 /*
  * Overarching type for materials consisting of a type, colour, and refractive 
  * index (when applicable).
@@ -37,22 +42,27 @@ typedef struct Material {
  * different types of object.
  */
 typedef struct Hittable {
-	E_Hittable type;
-	size_t 	   v_len;
-	Vector*    vectors;
-	Material   mat;
-	double     scale;
-	AABB 	   aabb;
+	E_Hittable 		   type;
+	size_t 	   		   v_len;
+	Vector*    		   vectors;
+	Material   		   mat;
+	double     		   scale;
+	AABB 	   		   aabb;
+	struct Obj_Object* mesh; // instanced mesh (instance only)
 } Hittable;
 
 /*
- * Struct for an imported OBJ file that consists of many triangles.
+ * Struct for an imported OBJ file that consists of many triangles. The BVH over 
+ * its triangles, and the triangle store laid out in that BVH's leaf order, are 
+ * only built once the object is instanced.
  */
 typedef struct Obj_Object {
-	Hittable* tris[1000];
-	size_t 	  length;
-	Material  mat;
-	Vector 	  pos;
+	Hittable**  	  tris; // (length) triangles, held in one block
+	size_t 	    	  length;
+	Material    	  mat;
+	Vector 	    	  pos;
+	struct BVH* 	  bvh;
+	struct Tri_Store* store;
 } Obj_Object;
 
 /*
@@ -61,11 +71,23 @@ typedef struct Obj_Object {
  */
 extern bool hittable_hit(Hittable* h, Ray r, Interval itvl, Hit_Record* hit_rec);
 
+/*
+ * Same as hittable_hit, without the test against the hittable's bounding box.
+ */
+extern bool hittable_hit_primitive(Hittable* h, Ray r, Interval itvl, Hit_Record* hit_rec);
+
 /*
  * Returns a pointer to a new sphere hittable with a given position, radius, and material
  */
 extern Hittable* hittable_new_sphere(double x, double y, double z, double s, Material material);
 
+/*
+ * Makes (out) a triangle hittable with given vertex coordinates, normals, and 
+ * material, storing its 6 vectors in (vectors) instead of allocating them.
+ */
+extern void hittable_init_tri(Hittable* out, Vector* vectors, Vector a, Vector b, Vector c, 
+							  Vector na, Vector nb, Vector nc, Material material);
+
 /*
  * Returns a pointer to a new triangle hittable with given vertex coordinates, normals, 
  * and material.
@@ -73,4 +95,12 @@ extern Hittable* hittable_new_sphere(double x, double y, double z, double s, Mat
 extern Hittable* hittable_new_tri(Vector a, Vector b, Vector c, 
 								  Vector na, Vector nb, Vector nc, Material material);
 
+/*
+ * Returns a pointer to a new instance hittable that places the given mesh in the 
+ * scene with a position, rotation (radians about x, y, z), uniform scale, and 
+ * material that overrides the mesh's own.
+ */
+extern Hittable* hittable_new_instance(Obj_Object* mesh, Vector pos, Vector rot, 
+									   double scale, Material material);
+
 #endif
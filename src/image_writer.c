@@ -0,0 +1,416 @@
+#include "image_writer.h"
+
+/*
+ * PRIVATE:
+ */
+
+#define _PNG_MAX_BLOCK 65535 // most bytes in one stored deflate block
+
+/*
+ * Returns a buffer for (height) 8 bit RGB rows of (width) pixels and stores its 
+ * size in (size). If (filter_bytes) is true, every row has room for a leading 
+ * filter byte (see _pack_row). The caller frees the buffer.
+ *
+ * If the allocation fails, the application exits with code 1.
+ */
+static uint8_t* _alloc_rows(size_t width, size_t height, bool filter_bytes, 
+							size_t* size)
+{
+	*size = (3 * width + (filter_bytes ? 1 : 0)) * height;
+	uint8_t* rows;
+	if ((rows = malloc(*size)) == NULL)
+	{
+		fprintf(stderr, "malloc failed in image writer\n");
+		exit(1);
+	}
+	return rows;
+}
+
+/*
+ * Stores (width) ARGB8888 pixels (argb) as 8 bit RGB at (row). If 
+ * (filter_bytes) is true, the row starts with a 0 byte, which is the PNG filter 
+ * type for an unfiltered row.
+ */
+static void _pack_row(uint8_t* row, const uint32_t* argb, size_t width, 
+					  bool filter_bytes)
+{
+	if (filter_bytes)
+		*row++ = 0;
+	for (size_t x = 0; x < width; x++)
+	{
+		row[3 * x] = (uint8_t) (argb[x] >> 16);
+		row[3 * x + 1] = (uint8_t) (argb[x] >> 8);
+		row[3 * x + 2] = (uint8_t) argb[x];
+	}
+}
+
+/*
+ * Returns the 8 bit RGB rows of the framebuffer, top row first, mapped to the 
+ * display with (op) (see tonemap_rect), see _pack_row. The caller frees the 
+ * buffer.
+ *
+ * If an allocation fails, the application exits with code 1.
+ */
+static uint8_t* _rgb8_rows(Framebuffer* fb, Tonemap_Op op, bool filter_bytes, 
+						   size_t* size)
+{
+	uint8_t* rows = _alloc_rows(fb->width, fb->height, filter_bytes, size);
+	uint32_t* argb;
+	if ((argb = malloc(sizeof(uint32_t) * fb->width)) == NULL)
+	{
+		fprintf(stderr, "malloc failed in image writer\n");
+		exit(1);
+	}
+
+	size_t row_size = *size / fb->height;
+	for (size_t y = 0; y < fb->height; y++)
+	{
+		tonemap_rect(fb, op, argb, 0, 0, y, fb->width, y + 1); // a pitch of 0 reuses one row
+		_pack_row(rows + y * row_size, argb, fb->width, filter_bytes);
+	}
+	free(argb);
+	return rows;
+}
+
+/*
+ * Returns the 8 bit RGB rows of (height) rows of (width) ARGB8888 (pixels), 
+ * packed without gaps, see _pack_row. The caller frees the buffer.
+ *
+ * If the allocation fails, the application exits with code 1.
+ */
+static uint8_t* _pixel_rows(const uint32_t* pixels, size_t width, size_t height, 
+							bool filter_bytes, size_t* size)
+{
+	uint8_t* rows = _alloc_rows(width, height, filter_bytes, size);
+	size_t row_size = *size / height;
+	for (size_t y = 0; y < height; y++)
+		_pack_row(rows + y * row_size, pixels + y * width, width, filter_bytes);
+	return rows;
+}
+
+/*
+ * Opens the file (path) for writing, printing a message if it cannot be opened.
+ */
+static FILE* _open(const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+		fprintf(stderr, "failed to open %s for writing\n", path);
+	return file;
+}
+
+/*
+ * Closes the file (path), returning false and printing a message if any write
+ * to it failed (ok is false) or it cannot be closed.
+ */
+static bool _close(FILE* file, const char* path, bool ok)
+{
+	if ((fclose(file) != 0) || !ok)
+	{
+		fprintf(stderr, "failed to write %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Stores (val) in the 4 bytes at (out), most significant byte first.
+ */
+static void _put_u32_be(uint8_t* out, uint32_t val)
+{
+	out[0] = (uint8_t) (val >> 24);
+	out[1] = (uint8_t) (val >> 16);
+	out[2] = (uint8_t) (val >> 8);
+	out[3] = (uint8_t) val;
+}
+
+/*
+ * Fills (table) with the CRC-32 of every byte value, for _crc32.
+ */
+static void _crc32_table(uint32_t* table)
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+		for (size_t bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? (0xEDB88320 ^ (crc >> 1)) : (crc >> 1);
+		table[i] = crc;
+	}
+}
+
+/*
+ * Continues the CRC-32 (crc) over (len) bytes of (data). Start with 0.
+ */
+static uint32_t _crc32(const uint32_t* table, uint32_t crc, const uint8_t* data,
+					   size_t len)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+/*
+ * Writes a PNG chunk of the given type (4 characters) holding (len) bytes of
+ * (data), framed by its length and followed by the CRC of its type and data.
+ * Returns false if a write fails.
+ */
+static bool _write_chunk(FILE* file, const uint32_t* crc_table, const char* type,
+						 const uint8_t* data, size_t len)
+{
+	uint8_t header[8];
+	uint8_t footer[4];
+	_put_u32_be(header, (uint32_t) len);
+	memcpy(header + 4, type, 4);
+	uint32_t crc = _crc32(crc_table, 0, header + 4, 4);
+	_put_u32_be(footer, _crc32(crc_table, crc, data, len));
+
+	return (fwrite(header, 1, 8, file) == 8)
+		&& (fwrite(data, 1, len, file) == len)
+		&& (fwrite(footer, 1, 4, file) == 4);
+}
+
+/*
+ * Wraps (len) bytes of (data) in a zlib stream made of stored (uncompressed)
+ * deflate blocks, and returns it with its length in (out_len). Rendered images
+ * are mostly noise and compress poorly, so skipping compression keeps writing
+ * cheap. The caller frees the stream.
+ *
+ * If the allocation fails, the application exits with code 1.
+ */
+static uint8_t* _zlib_stored(const uint8_t* data, size_t len, size_t* out_len)
+{
+	size_t block_count = (len + _PNG_MAX_BLOCK - 1) / _PNG_MAX_BLOCK;
+	if (block_count == 0)
+		block_count = 1;
+	*out_len = 2 + 5 * block_count + len + 4;
+	uint8_t* out;
+	if ((out = malloc(*out_len)) == NULL)
+	{
+		fprintf(stderr, "malloc failed in image writer\n");
+		exit(1);
+	}
+
+	uint8_t* pos = out;
+	*pos++ = 0x78; // deflate with a 32K window
+	*pos++ = 0x01; // no preset dictionary, header checksum
+	size_t done = 0;
+	for (size_t i = 0; i < block_count; i++)
+	{
+		size_t block_len = len - done;
+		if (block_len > _PNG_MAX_BLOCK)
+			block_len = _PNG_MAX_BLOCK;
+		*pos++ = (i == block_count - 1) ? 1 : 0; // final block flag, stored type
+		*pos++ = (uint8_t) block_len;
+		*pos++ = (uint8_t) (block_len >> 8);
+		*pos++ = (uint8_t) ~block_len;
+		*pos++ = (uint8_t) (~block_len >> 8);
+		memcpy(pos, data + done, block_len);
+		pos += block_len;
+		done += block_len;
+	}
+
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (size_t i = 0; i < len; i++)
+	{
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	_put_u32_be(pos, (b << 16) | a);
+	return out;
+}
+
+/*
+ * Writes 8 bit RGB (rows) (see _rgb8_rows) of a (width) x (height) image to 
+ * (path) as a binary PPM (P6) image and frees them. Returns false if the file 
+ * cannot be written.
+ */
+static bool _write_ppm(const char* path, uint8_t* rows, size_t size, size_t width, 
+					   size_t height)
+{
+	FILE* file = _open(path);
+	if (file == NULL)
+	{
+		free(rows);
+		return false;
+	}
+
+	bool ok = (fprintf(file, "P6\n%zu %zu\n255\n", width, height) > 0)
+		   && (fwrite(rows, 1, size, file) == size);
+	free(rows);
+	return _close(file, path, ok);
+}
+
+/*
+ * Writes 8 bit RGB (rows) with filter bytes (see _rgb8_rows) of a (width) x 
+ * (height) image to (path) as a PNG image and frees them. The rows are 
+ * unfiltered and stored without compression (see _zlib_stored). Returns false 
+ * if the file cannot be written.
+ */
+static bool _write_png(const char* path, uint8_t* rows, size_t size, size_t width, 
+					   size_t height)
+{
+	FILE* file = _open(path);
+	if (file == NULL)
+	{
+		free(rows);
+		return false;
+	}
+
+	uint32_t crc_table[256];
+	_crc32_table(crc_table);
+
+	uint8_t ihdr[13];
+	_put_u32_be(ihdr, (uint32_t) width);
+	_put_u32_be(ihdr + 4, (uint32_t) height);
+	ihdr[8] = 8;  // bits per channel
+	ihdr[9] = 2;  // RGB
+	ihdr[10] = 0; // deflate
+	ihdr[11] = 0; // adaptive filtering
+	ihdr[12] = 0; // not interlaced
+
+	size_t zlib_size;
+	uint8_t* zlib = _zlib_stored(rows, size, &zlib_size);
+	free(rows);
+
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	bool ok = (fwrite(signature, 1, 8, file) == 8)
+		   && _write_chunk(file, crc_table, "IHDR", ihdr, sizeof(ihdr))
+		   && _write_chunk(file, crc_table, "IDAT", zlib, zlib_size)
+		   && _write_chunk(file, crc_table, "IEND", NULL, 0);
+	free(zlib);
+	return _close(file, path, ok);
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Returns true if (path) ends in .ppm, .png, or .pfm (case sensitive), so that 
+ * callers can reject an output before spending time on a render.
+ */
+bool image_format_supported(const char* path)
+{
+	const char* ext = strrchr(path, '.');
+	return (ext != NULL) 
+		&& ((strcmp(ext, ".ppm") == 0) 
+			|| (strcmp(ext, ".png") == 0) 
+			|| (strcmp(ext, ".pfm") == 0));
+}
+
+/*
+ * Writes the framebuffer to (path) in the format chosen by the extension of the
+ * path (case sensitive), with the 8 bit formats mapped to the display with (op). 
+ * Returns false and prints a message if the extension is not one of .ppm, .png, 
+ * or .pfm, or if writing fails.
+ */
+bool image_write(Framebuffer* fb, const char* path, Tonemap_Op op)
+{
+	if (!image_format_supported(path))
+	{
+		fprintf(stderr, "unknown image format for %s (use .ppm, .png or .pfm)\n", path);
+		return false;
+	}
+
+	const char* ext = strrchr(path, '.');
+	if (strcmp(ext, ".ppm") == 0)
+		return image_write_ppm(fb, path, op);
+	if (strcmp(ext, ".png") == 0)
+		return image_write_png(fb, path, op);
+	return image_write_pfm(fb, path);
+}
+
+/*
+ * Writes the mean of every pixel of the framebuffer to (path) as a binary PPM
+ * (P6) image with 8 bits per channel, mapped with (op) like the render window.
+ * Returns false if the file cannot be written.
+ */
+bool image_write_ppm(Framebuffer* fb, const char* path, Tonemap_Op op)
+{
+	size_t size;
+	uint8_t* rows = _rgb8_rows(fb, op, false, &size);
+	return _write_ppm(path, rows, size, fb->width, fb->height);
+}
+
+/*
+ * Writes the mean of every pixel of the framebuffer to (path) as an 8 bit RGB
+ * PNG image, mapped with (op) like the render window. The rows are unfiltered
+ * and stored without compression (see _zlib_stored), so the file is a little
+ * larger than the raw pixels but takes almost no time to write. Returns false
+ * if the file cannot be written.
+ */
+bool image_write_png(Framebuffer* fb, const char* path, Tonemap_Op op)
+{
+	size_t size;
+	uint8_t* rows = _rgb8_rows(fb, op, true, &size);
+	return _write_png(path, rows, size, fb->width, fb->height);
+}
+
+/*
+ * Writes (height) rows of (width) ARGB8888 (pixels), packed without gaps, to 
+ * (path) as a PNG or PPM image chosen by the extension, for images that are not 
+ * a render such as the heatmaps of a framebuffer. Returns false and prints a 
+ * message if the extension is neither, or if writing fails.
+ */
+bool image_write_pixels(const uint32_t* pixels, size_t width, size_t height, 
+						const char* path)
+{
+	const char* ext = strrchr(path, '.');
+	bool png = (ext != NULL) && (strcmp(ext, ".png") == 0);
+	if (!png && ((ext == NULL) || (strcmp(ext, ".ppm") != 0)))
+	{
+		fprintf(stderr, "unknown image format for %s (use .ppm or .png)\n", path);
+		return false;
+	}
+
+	size_t size;
+	uint8_t* rows = _pixel_rows(pixels, width, height, png, &size);
+	return png ? _write_png(path, rows, size, width, height) 
+			   : _write_ppm(path, rows, size, width, height);
+}
+
+/*
+ * Writes the mean of every pixel of the framebuffer to (path) as a PFM image:
+ * linear (not gamma corrected) 32 bit floats, 3 per pixel, with no clamping, so
+ * the full range of the render is kept for later tone mapping or comparisons.
+ * The negative scale in the header marks the floats as little endian, and rows
+ * are stored bottom row first. Returns false if the file cannot be written.
+ */
+bool image_write_pfm(Framebuffer* fb, const char* path)
+{
+	FILE* file = _open(path);
+	if (file == NULL)
+		return false;
+
+	float* row;
+	if ((row = malloc(sizeof(float) * 3 * fb->width)) == NULL)
+	{
+		fprintf(stderr, "malloc failed in image writer\n");
+		exit(1);
+	}
+
+	bool ok = fprintf(file, "PF\n%zu %zu\n-1.0\n", fb->width, fb->height) > 0;
+	for (size_t y = fb->height; ok && (y-- > 0);)
+	{
+		for (size_t x = 0; x < fb->width; x++)
+		{
+			Vector col = framebuffer_mean(fb, x, y);
+			float rgb[3] = {(float) col.x, (float) col.y, (float) col.z};
+			uint32_t bits[3];
+			memcpy(bits, rgb, sizeof(bits));
+			for (size_t c = 0; c < 3; c++)
+			{
+				uint8_t* out = (uint8_t*) &row[3 * x + c];
+				out[0] = (uint8_t) bits[c];
+				out[1] = (uint8_t) (bits[c] >> 8);
+				out[2] = (uint8_t) (bits[c] >> 16);
+				out[3] = (uint8_t) (bits[c] >> 24);
+			}
+		}
+		ok = fwrite(row, sizeof(float), 3 * fb->width, file) == 3 * fb->width;
+	}
+	free(row);
+	return _close(file, path, ok);
+}
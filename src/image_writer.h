@@ -0,0 +1,48 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "math_utils.h"
+#include "framebuffer.h"
+#include "tonemap.h"
+
+/*
+ * Writes the mean of every pixel of the framebuffer to the file (path), in the
+ * format given by its extension: .ppm, .png or .pfm. The 8 bit formats are 
+ * mapped to the display with (op). Returns false if the extension is not known 
+ * or the file cannot be written.
+ */
+extern bool image_write(Framebuffer* fb, const char* path, Tonemap_Op op);
+
+/*
+ * Returns true if the extension of (path) is one of the formats image_write 
+ * supports.
+ */
+extern bool image_format_supported(const char* path);
+
+/*
+ * Writes the framebuffer as a binary 8 bit PPM image (P6).
+ */
+extern bool image_write_ppm(Framebuffer* fb, const char* path, Tonemap_Op op);
+
+/*
+ * Writes the framebuffer as an 8 bit RGB PNG image.
+ */
+extern bool image_write_png(Framebuffer* fb, const char* path, Tonemap_Op op);
+
+/*
+ * Writes ARGB8888 pixels as an 8 bit RGB PNG or PPM image.
+ */
+extern bool image_write_pixels(const uint32_t* pixels, size_t width, size_t height, 
+							   const char* path);
+
+/*
+ * Writes the framebuffer as a linear 32 bit float PFM image.
+ */
+extern bool image_write_pfm(Framebuffer* fb, const char* path);
+
+#endif
@@ -0,0 +1,427 @@
+#include "lbvh.h"
+
+/*
+ * PRIVATE:
+ */
+
+#define _MAX_LEAF_SIZE 4  // subtrees with this many primitives or fewer become one leaf
+#define _RADIX_BITS 8	  // bits sorted per radix pass
+#define _RADIX_PASSES 4   // passes needed to sort 30 bit morton codes
+#define _MAX_THREADS 64   // upper limit on worker threads per build phase
+#define _MIN_PER_THREAD 4096 // fewer primitives than this per thread is not worth a thread
+
+/*
+ * Internal node of the radix tree built from the sorted morton codes. Each
+ * internal node covers the sorted primitives [first - last] and splits them
+ * after index (split). A child is a leaf when its range holds one primitive.
+ */
+typedef struct _Radix_Node {
+	uint32_t first;
+	uint32_t last;
+	uint32_t split;
+	uint32_t prefix; // amount of leading bits shared by every code in the range
+} _Radix_Node;
+
+/*
+ * State shared by every worker thread during a build.
+ */
+typedef struct _Lbvh_Ctx {
+	AABB* 		 boxes;
+	size_t 		 count;
+	AABB 		 centroid_bounds;
+	uint32_t* 	 codes;		// morton codes, sorted in place
+	uint32_t* 	 idxs;		// primitive indices, sorted alongside the codes
+	uint32_t* 	 tmp_codes; // radix sort scatter target
+	uint32_t* 	 tmp_idxs;	// radix sort scatter target
+	size_t 		 shift;		// bit offset of the current radix pass
+	size_t 		 thread_count;
+	size_t 		 (*hists)[1 << _RADIX_BITS]; // per thread digit counts / offsets
+	_Radix_Node* radix_nodes;
+} _Lbvh_Ctx;
+
+/*
+ * Work handed to one thread by _parallel_for.
+ */
+typedef struct _Task {
+	void   (*fn)(_Lbvh_Ctx*, size_t, size_t, size_t);
+	_Lbvh_Ctx* ctx;
+	size_t thread_idx;
+	size_t start;
+	size_t end;
+} _Task;
+
+/*
+ * Thread entry point that runs a single task.
+ */
+static void* _run_task(void* arg)
+{
+	_Task* task = arg;
+	task->fn(task->ctx, task->thread_idx, task->start, task->end);
+	return NULL;
+}
+
+/*
+ * Splits the range [0 - count) into ctx->thread_count equal chunks and runs
+ * (fn) on each chunk in its own thread, waiting for all of them to finish. The
+ * chunk given to each thread index is always the same for the same count,
+ * which the radix sort relies on. The first chunk runs on the calling thread.
+ * If a thread cannot be created, its chunk is run on the calling thread instead.
+ */
+static void _parallel_for(_Lbvh_Ctx* ctx, size_t count,
+						  void (*fn)(_Lbvh_Ctx*, size_t, size_t, size_t))
+{
+	pthread_t threads[_MAX_THREADS];
+	bool started[_MAX_THREADS];
+	_Task tasks[_MAX_THREADS];
+	size_t thread_count = ctx->thread_count;
+
+	for (size_t t = 0; t < thread_count; t++)
+	{
+		_Task task = {fn, ctx, t, count * t / thread_count, count * (t + 1) / thread_count};
+		tasks[t] = task;
+		started[t] = (t > 0) && (pthread_create(&threads[t], NULL, _run_task, &tasks[t]) == 0);
+	}
+
+	for (size_t t = 0; t < thread_count; t++)
+	{
+		if (!started[t])
+			_run_task(&tasks[t]);
+	}
+
+	for (size_t t = 1; t < thread_count; t++)
+	{
+		if (started[t])
+			pthread_join(threads[t], NULL);
+	}
+}
+
+/*
+ * Spreads the lower 10 bits of (v) out so that there are two zero bits between
+ * each of them, ready to be interleaved with the other two axes.
+ */
+static uint32_t _expand_bits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+/*
+ * Returns the 30 bit morton code of a point that has been normalized to the
+ * range 0-1 on every axis. Bits are interleaved as x, y, z from the most
+ * significant bit down.
+ */
+static uint32_t _morton_code(Vector p)
+{
+	uint32_t x = (uint32_t) min(max(p.x * 1024.0, 0.0), 1023.0);
+	uint32_t y = (uint32_t) min(max(p.y * 1024.0, 0.0), 1023.0);
+	uint32_t z = (uint32_t) min(max(p.z * 1024.0, 0.0), 1023.0);
+	return (_expand_bits(x) << 2) | (_expand_bits(y) << 1) | _expand_bits(z);
+}
+
+/*
+ * Worker: computes the morton code of the centroid of each primitive in the
+ * chunk, relative to the bounds of every centroid.
+ */
+static void _compute_codes(_Lbvh_Ctx* ctx, size_t thread_idx, size_t start, size_t end)
+{
+	(void) thread_idx;
+	AABB cb = ctx->centroid_bounds;
+	Vector lo = {cb.x.min, cb.y.min, cb.z.min};
+	Vector extent = {cb.x.max - cb.x.min, cb.y.max - cb.y.min, cb.z.max - cb.z.min};
+	Vector inv_extent = {(extent.x > 0.0) ? 1.0 / extent.x : 0.0,
+						 (extent.y > 0.0) ? 1.0 / extent.y : 0.0,
+						 (extent.z > 0.0) ? 1.0 / extent.z : 0.0};
+
+	for (size_t i = start; i < end; i++)
+	{
+		Vector c = vec_mul_vec(vec_sub(AABB_centroid(ctx->boxes[i]), lo), inv_extent);
+		ctx->codes[i] = _morton_code(c);
+		ctx->idxs[i] = (uint32_t) i;
+	}
+}
+
+/*
+ * Worker: counts how many codes in the chunk have each value of the digit
+ * currently being sorted.
+ */
+static void _radix_histogram(_Lbvh_Ctx* ctx, size_t thread_idx, size_t start, size_t end)
+{
+	size_t* hist = ctx->hists[thread_idx];
+	memset(hist, 0, sizeof(ctx->hists[0]));
+	for (size_t i = start; i < end; i++)
+		hist[(ctx->codes[i] >> ctx->shift) & ((1 << _RADIX_BITS) - 1)]++;
+}
+
+/*
+ * Worker: moves every code in the chunk (and its primitive index) to its sorted
+ * position for the current digit. The histogram of this thread has already been
+ * turned into the first output position of each digit for this chunk, so each
+ * thread writes to its own disjoint slots and the sort stays stable.
+ */
+static void _radix_scatter(_Lbvh_Ctx* ctx, size_t thread_idx, size_t start, size_t end)
+{
+	size_t* offsets = ctx->hists[thread_idx];
+	for (size_t i = start; i < end; i++)
+	{
+		uint32_t code = ctx->codes[i];
+		size_t dst = offsets[(code >> ctx->shift) & ((1 << _RADIX_BITS) - 1)]++;
+		ctx->tmp_codes[dst] = code;
+		ctx->tmp_idxs[dst] = ctx->idxs[i];
+	}
+}
+
+/*
+ * Sorts the morton codes (and their primitive indices alongside them) using a
+ * parallel least significant digit radix sort. Each pass counts digits per
+ * chunk in parallel, turns the counts into output offsets with an exclusive
+ * prefix sum over (digit, thread), then scatters every chunk in parallel.
+ */
+static void _radix_sort(_Lbvh_Ctx* ctx)
+{
+	for (size_t pass = 0; pass < _RADIX_PASSES; pass++)
+	{
+		ctx->shift = pass * _RADIX_BITS;
+		_parallel_for(ctx, ctx->count, _radix_histogram);
+
+		size_t sum = 0;
+		for (size_t d = 0; d < (1 << _RADIX_BITS); d++)
+		{
+			for (size_t t = 0; t < ctx->thread_count; t++)
+			{
+				size_t digit_count = ctx->hists[t][d];
+				ctx->hists[t][d] = sum;
+				sum += digit_count;
+			}
+		}
+
+		_parallel_for(ctx, ctx->count, _radix_scatter);
+
+		uint32_t* tmp = ctx->codes;
+		ctx->codes = ctx->tmp_codes;
+		ctx->tmp_codes = tmp;
+		tmp = ctx->idxs;
+		ctx->idxs = ctx->tmp_idxs;
+		ctx->tmp_idxs = tmp;
+	}
+}
+
+/*
+ * Returns the amount of leading bits that the sorted keys (i) and (j) share, or
+ * -1 if (j) is out of range. Identical codes are told apart by their positions,
+ * so every key is unique.
+ */
+static int _common_prefix(_Lbvh_Ctx* ctx, int64_t i, int64_t j)
+{
+	if ((j < 0) || (j >= (int64_t) ctx->count))
+		return -1;
+
+	uint32_t a = ctx->codes[i];
+	uint32_t b = ctx->codes[j];
+	if (a == b)
+		return 32 + __builtin_clz((uint32_t) i ^ (uint32_t) j);
+
+	return __builtin_clz(a ^ b);
+}
+
+/*
+ * Worker: finds the range and split position of each internal node in the
+ * chunk, following Karras' "Maximizing Parallelism in the Construction of BVHs,
+ * Octrees, and k-d Trees". Internal node i always starts or ends at sorted key
+ * i, so every node can be found independently of the others. The direction of
+ * its range is towards the neighbour it shares the longer prefix with, the far
+ * end is found with an exponential then binary search, and the split is the
+ * last key that still shares more than the node's prefix with key i.
+ */
+static void _build_radix_nodes(_Lbvh_Ctx* ctx, size_t thread_idx, size_t start, size_t end)
+{
+	(void) thread_idx;
+	for (size_t n = start; n < end; n++)
+	{
+		int64_t i = (int64_t) n;
+		int d = (_common_prefix(ctx, i, i + 1) - _common_prefix(ctx, i, i - 1) > 0) ? 1 : -1;
+
+		int min_prefix = _common_prefix(ctx, i, i - d);
+		int64_t max_len = 2;
+		while (_common_prefix(ctx, i, i + max_len * d) > min_prefix)
+			max_len *= 2;
+
+		int64_t len = 0;
+		for (int64_t t = max_len / 2; t >= 1; t /= 2)
+		{
+			if (_common_prefix(ctx, i, i + (len + t) * d) > min_prefix)
+				len += t;
+		}
+		int64_t j = i + len * d;
+
+		int node_prefix = _common_prefix(ctx, i, j);
+		int64_t s = 0;
+		int64_t t = len;
+		do
+		{
+			t = (t + 1) >> 1;
+			if (_common_prefix(ctx, i, i + (s + t) * d) > node_prefix)
+				s += t;
+		} while (t > 1);
+
+		_Radix_Node node;
+		node.first = (uint32_t) ((d > 0) ? i : j);
+		node.last = (uint32_t) ((d > 0) ? j : i);
+		node.split = (uint32_t) (i + s * d + ((d < 0) ? -1 : 0));
+		node.prefix = (uint32_t) node_prefix;
+		ctx->radix_nodes[n] = node;
+	}
+}
+
+/*
+ * Returns the axis (0 = x, 1 = y, 2 = z) that the first bit after a shared
+ * prefix of (prefix) bits belongs to. Codes only use the low 30 bits, so the
+ * first 2 bits of every prefix are always shared.
+ */
+static uint8_t _prefix_axis(uint32_t prefix)
+{
+	if (prefix >= 32)
+		return 0;
+
+	return (uint8_t) ((prefix - 2) % 3);
+}
+
+/*
+ * Recursively writes the subtree covering the sorted primitives [first - last]
+ * into nodes[node_idx], which is (depth) levels below the root, in the same 
+ * depth first layout that the SAH builder produces, and returns its bounds. 
+ * (radix_idx) is the internal radix node for the range, or ignored when the 
+ * range holds few enough primitives to become a single leaf.
+ *
+ * Clustered or duplicate codes make long chains of radix nodes that split off 
+ * one primitive at a time, so once bvh_must_halve says so, the range is split 
+ * in half along the curve instead of at its radix node. Every node below is 
+ * then halved too, so (radix_idx) is no longer used and every leaf stays 
+ * within BVH_MAX_DEPTH.
+ */
+static AABB _emit(_Lbvh_Ctx* ctx, BVH* bvh, size_t node_idx, uint32_t radix_idx,
+				  uint32_t first, uint32_t last, size_t depth)
+{
+	size_t count = last - first + 1;
+	if (count <= _MAX_LEAF_SIZE)
+	{
+		AABB bounds = AABB_empty();
+		for (size_t i = first; i <= last; i++)
+			bounds = AABB_from_AABB(bounds, ctx->boxes[bvh->prim_idxs[i]]);
+
+		BVH_Node* leaf = &bvh->nodes[node_idx];
+		leaf->aabb = bounds;
+		leaf->offset = first;
+		leaf->count = (uint16_t) count;
+		leaf->axis = 0;
+		return bounds;
+	}
+
+	bool halve = bvh_must_halve(depth, count);
+	uint32_t split = halve ? first + (uint32_t) (count / 2) - 1 
+						   : ctx->radix_nodes[radix_idx].split;
+
+	size_t left_idx = bvh->node_count++;
+	AABB left = _emit(ctx, bvh, left_idx, split, first, split, depth + 1);
+	size_t right_idx = bvh->node_count++;
+	AABB right = _emit(ctx, bvh, right_idx, split + 1, split + 1, last, depth + 1);
+
+	BVH_Node* node = &bvh->nodes[node_idx];
+	node->aabb = AABB_from_AABB(left, right);
+	node->offset = (uint32_t) right_idx;
+	node->count = 0;
+	node->axis = halve ? (uint8_t) AABB_largest_axis(node->aabb) 
+					   : _prefix_axis(ctx->radix_nodes[radix_idx].prefix);
+	return node->aabb;
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Builds a linear BVH over (count) primitives whose bounding boxes are given in
+ * (boxes). The result is a normal BVH (see bvh.h) in the binary layout and is
+ * used in exactly the same way as one from bvh_build.
+ *
+ * The centroid of every primitive is given a 30 bit morton code, which orders
+ * the primitives along a space filling curve so that primitives close in the
+ * order are close in space. The codes are radix sorted and the hierarchy is
+ * read straight out of the sorted codes, where each internal node is the range
+ * of codes sharing a common prefix. Code generation, sorting and the internal
+ * node search all run in parallel over the available cores, and the final
+ * depth first write out and bounds calculation is a single O(n) pass.
+ *
+ * This method allocates heap memory for the BVH and temporary arrays for the
+ * build. If any of these allocations fail, the application exits with code 1.
+ */
+BVH* lbvh_build(AABB* boxes, size_t count)
+{
+	BVH* bvh;
+	if ((bvh = malloc(sizeof(BVH))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in lbvh\n");
+		exit(1);
+	}
+
+	bvh->node_count = 0;
+	bvh->wide_nodes = NULL;
+	bvh->wide_node_count = 0;
+	bvh->prim_count = count;
+	bvh->layout = BVH_BINARY;
+	size_t max_nodes = (count == 0) ? 1 : 2 * count - 1;
+
+	_Lbvh_Ctx ctx;
+	ctx.boxes = boxes;
+	ctx.count = count;
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	ctx.thread_count = count / _MIN_PER_THREAD;
+	if ((cores > 0) && (ctx.thread_count > (size_t) cores))
+		ctx.thread_count = (size_t) cores;
+	if (ctx.thread_count > _MAX_THREADS)
+		ctx.thread_count = _MAX_THREADS;
+	if (ctx.thread_count == 0)
+		ctx.thread_count = 1;
+
+	if (((bvh->nodes = aligned_alloc(64, sizeof(BVH_Node) * max_nodes)) == NULL)
+		|| ((bvh->prim_idxs = malloc(sizeof(size_t) * (count + 1))) == NULL)
+		|| ((ctx.codes = malloc(sizeof(uint32_t) * (count + 1))) == NULL)
+		|| ((ctx.idxs = malloc(sizeof(uint32_t) * (count + 1))) == NULL)
+		|| ((ctx.tmp_codes = malloc(sizeof(uint32_t) * (count + 1))) == NULL)
+		|| ((ctx.tmp_idxs = malloc(sizeof(uint32_t) * (count + 1))) == NULL)
+		|| ((ctx.hists = malloc(sizeof(ctx.hists[0]) * ctx.thread_count)) == NULL)
+		|| ((ctx.radix_nodes = malloc(sizeof(_Radix_Node) * (count + 1))) == NULL))
+	{
+		fprintf(stderr, "malloc failed in lbvh\n");
+		exit(1);
+	}
+
+	ctx.centroid_bounds = AABB_empty();
+	for (size_t i = 0; i < count; i++)
+	{
+		Vector c = AABB_centroid(boxes[i]);
+		AABB point = {{c.x, c.x}, {c.y, c.y}, {c.z, c.z}};
+		ctx.centroid_bounds = AABB_from_AABB(ctx.centroid_bounds, point);
+	}
+
+	_parallel_for(&ctx, count, _compute_codes);
+	_radix_sort(&ctx);
+	for (size_t i = 0; i < count; i++)
+		bvh->prim_idxs[i] = ctx.idxs[i];
+
+	if (count > 1)
+		_parallel_for(&ctx, count - 1, _build_radix_nodes);
+	if (count > 0)
+		_emit(&ctx, bvh, bvh->node_count++, 0, 0, (uint32_t) (count - 1), 0);
+
+	free(ctx.codes);
+	free(ctx.idxs);
+	free(ctx.tmp_codes);
+	free(ctx.tmp_idxs);
+	free(ctx.hists);
+	free(ctx.radix_nodes);
+	return bvh;
+}
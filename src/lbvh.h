@@ -0,0 +1,20 @@
+#ifndef LBVH_H
+#define LBVH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "math_utils.h"
+#include "aabb.h"
+#include "bvh.h"
+
+/*
+ * Builds a BVH over (count) primitives with the bounding boxes (boxes) by 
+ * sorting them along a Morton curve. Much faster to build than the SAH builder 
+ * but produces a slightly slower tree to traverse.
+ */
+extern BVH* lbvh_build(AABB* boxes, size_t count);
+
+#endif
@@ -1,115 +1,2593 @@
 #ifndef UNIT_TEST
 #include "scene_builder.h"
 #include "camera.h"
+#include "render_pool.h"
+#include "scene.h"
+#include "image_writer.h"
+#include "benchmark.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef HEADLESS
 #include "renderer.h"
+#include "render_worker.h"
+#include <SDL3/SDL_events.h>
+#endif
+
+#define _MAX_OUTPUTS 8 // most image files written by one render
+
+/*
+ * Settings taken from the command line. Sizes and counts of 0 keep the defaults
+ * of the build configuration.
+ */
+typedef struct _Options {
+	const char* outputs[_MAX_OUTPUTS]; // image files to write once the render is done
+	size_t 		output_count;
+	size_t 		width, height;
+	size_t 		samples_per_pixel;
+	size_t 		thread_count;		   // 0 uses every core
+	const char* scene;				   // model, demo, instanced, or spheres
+	bool 		has_seed;
+	uint64_t 	seed;
+	bool 		headless;			   // render without a window
+	bool 		interactive;		   // move the camera with the keyboard and mouse
+	const char* bench_path;			   // run the benchmarks and write the results here
+	const char* compare_paths[2];	   // benchmark results to compare, base first
+	double 		threshold;			   // change in percent that counts as a regression
+	const char* stats_path;			   // write the hot path counters here as JSON
+	const char* cost_path;			   // write the traversal cost heatmap here
+	const char* spp_path;			   // write the samples per pixel heatmap here
+	const char* depth_path;			   // write the path depth histogram here
+	const char* trace_path;			   // write a timeline of the run here
+	Tonemap_Op 	tonemap;			   // curve mapping the image to the display
+} _Options;
+
+/*
+ * Prints the command line usage.
+ */
+static void _print_usage(const char* name)
+{
+	printf("usage: %s [options]\n"
+		   "  -o, --output FILE   write the finished image to FILE (.png, .ppm or .pfm),\n"
+		   "                      can be given up to %d times, implies --headless\n"
+		   "  --headless          render without opening a window\n"
+		   "  --width N           image width in pixels\n"
+		   "  --height N          image height in pixels\n"
+		   "  --spp N             samples per pixel (the most with adaptive sampling)\n"
+		   "  --seed N            seed of the sample sequences, for repeatable images\n"
+		   "  --threads N         render threads, 0 for one per core\n"
+		   "  --scene NAME        model, demo, instanced or spheres\n"
+		   "  --tonemap NAME      gamma, srgb or aces (default gamma)\n"
+		   "  -i, --interactive   move the camera with the keyboard and mouse\n"
+		   "  --bench FILE        render the benchmark scenes and write the results\n"
+		   "                      to FILE (.csv or .json), --width, --height, --spp\n"
+		   "                      and --threads apply (default 320x180, 16 spp)\n"
+		   "  --compare OLD NEW   compare two benchmark results, exits with code 2\n"
+		   "                      if any scene regressed\n"
+		   "  --threshold PCT     slowdown or memory growth counted as a regression\n"
+		   "                      (default 5)\n"
+		   "  --stats FILE        write the hot path counters of the render as JSON\n"
+		   "  --cost-heatmap FILE write the traversal cost of every pixel as a false\n"
+		   "                      colour .png or .ppm (and show it in the window)\n"
+		   "                      both need a debug or -DRENDER_STATS build\n"
+		   "  --spp-heatmap FILE  write the samples taken by every pixel as colours\n"
+		   "                      from blue (none) to red (--spp) as a .png or .ppm\n"
+		   "                      (and show it in the window)\n"
+		   "  --depth-hist FILE   write how many paths ended after each amount of\n"
+		   "                      bounces as CSV, the last row counts deeper paths too\n"
+		   "  --trace FILE        write a timeline of the scene build, tiles and\n"
+		   "                      window updates as Chrome trace JSON (open it in\n"
+		   "                      chrome://tracing or ui.perfetto.dev)\n"
+		   "  -h, --help          show this message\n", name, _MAX_OUTPUTS);
+}
+
+/*
+ * Returns the number in the argument after (idx), moving (idx) past it. If it is 
+ * missing or not a whole number, prints a message and exits with code 1.
+ */
+static uint64_t _parse_number(int argc, char** argv, int* idx)
+{
+	const char* flag = argv[*idx];
+	char* end = NULL;
+	uint64_t val = 0;
+	if (++(*idx) < argc)
+		val = strtoull(argv[*idx], &end, 10);
+	if ((end == NULL) || (end == argv[*idx]) || (*end != '\0') || (argv[*idx][0] == '-'))
+	{
+		fprintf(stderr, "%s needs a whole number\n", flag);
+		exit(1);
+	}
+	return val;
+}
+
+/*
+ * Reads the command line arguments into (opts). Unknown arguments print the 
+ * usage and exit with code 1, --help prints it and exits with code 0.
+ */
+static void _parse_options(int argc, char** argv, _Options* opts)
+{
+	memset(opts, 0, sizeof(_Options));
+	opts->scene = "model";
+	opts->tonemap = TONEMAP_GAMMA;
+	opts->threshold = 5.0;
+#ifdef HEADLESS
+	opts->headless = true;
+#endif
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if ((strcmp(arg, "-o") == 0) || (strcmp(arg, "--output") == 0))
+		{
+			if ((i + 1 >= argc) || (opts->output_count == _MAX_OUTPUTS))
+			{
+				fprintf(stderr, "%s needs a file name (at most %d)\n", arg, _MAX_OUTPUTS);
+				exit(1);
+			}
+			opts->outputs[opts->output_count++] = argv[++i];
+			opts->headless = true;
+			if (!image_format_supported(argv[i]))
+			{
+				fprintf(stderr, "unknown image format for %s (use .ppm, .png or .pfm)\n", 
+						argv[i]);
+				exit(1);
+			}
+		}
+		else if (strcmp(arg, "--headless") == 0)
+			opts->headless = true;
+		else if ((strcmp(arg, "-i") == 0) || (strcmp(arg, "--interactive") == 0))
+			opts->interactive = true;
+		else if ((strcmp(arg, "--bench") == 0) && (i + 1 < argc))
+		{
+			opts->bench_path = argv[++i];
+			const char* ext = strrchr(argv[i], '.');
+			if ((ext == NULL) || ((strcmp(ext, ".csv") != 0) && (strcmp(ext, ".json") != 0)))
+			{
+				fprintf(stderr, "unknown benchmark format for %s (use .csv or .json)\n", 
+						argv[i]);
+				exit(1);
+			}
+		}
+		else if ((strcmp(arg, "--compare") == 0) && (i + 2 < argc))
+		{
+			opts->compare_paths[0] = argv[++i];
+			opts->compare_paths[1] = argv[++i];
+		}
+		else if (((strcmp(arg, "--stats") == 0) || (strcmp(arg, "--cost-heatmap") == 0)) 
+				 && (i + 1 < argc))
+		{
+			if (!stats_enabled())
+			{
+				fprintf(stderr, "%s needs the counters, which are compiled out (build "
+						"with -DRENDER_STATS or a debug build)\n", arg);
+				exit(1);
+			}
+			if (strcmp(arg, "--stats") == 0)
+				opts->stats_path = argv[++i];
+			else
+				opts->cost_path = argv[++i];
+		}
+		else if ((strcmp(arg, "--spp-heatmap") == 0) && (i + 1 < argc))
+			opts->spp_path = argv[++i];
+		else if ((strcmp(arg, "--depth-hist") == 0) && (i + 1 < argc))
+			opts->depth_path = argv[++i];
+		else if ((strcmp(arg, "--trace") == 0) && (i + 1 < argc))
+			opts->trace_path = argv[++i];
+		else if ((strcmp(arg, "--threshold") == 0) && (i + 1 < argc))
+		{
+			char* end;
+			opts->threshold = strtod(argv[++i], &end);
+			if ((end == argv[i]) || (*end != '\0') || (opts->threshold < 0.0))
+			{
+				fprintf(stderr, "--threshold needs a percentage\n");
+				exit(1);
+			}
+		}
+		else if (strcmp(arg, "--width") == 0)
+			opts->width = _parse_number(argc, argv, &i);
+		else if (strcmp(arg, "--height") == 0)
+			opts->height = _parse_number(argc, argv, &i);
+		else if (strcmp(arg, "--spp") == 0)
+			opts->samples_per_pixel = _parse_number(argc, argv, &i);
+		else if (strcmp(arg, "--threads") == 0)
+			opts->thread_count = _parse_number(argc, argv, &i);
+		else if (strcmp(arg, "--seed") == 0)
+		{
+			opts->seed = _parse_number(argc, argv, &i);
+			opts->has_seed = true;
+		}
+		else if ((strcmp(arg, "--scene") == 0) && (i + 1 < argc))
+			opts->scene = argv[++i];
+		else if ((strcmp(arg, "--tonemap") == 0) && (i + 1 < argc))
+		{
+			if (!tonemap_parse(argv[++i], &opts->tonemap))
+			{
+				fprintf(stderr, "unknown tonemap %s (use gamma, srgb or aces)\n", argv[i]);
+				exit(1);
+			}
+		}
+		else if ((strcmp(arg, "-h") == 0) || (strcmp(arg, "--help") == 0))
+		{
+			_print_usage(argv[0]);
+			exit(0);
+		}
+		else
+		{
+			fprintf(stderr, "unknown argument %s\n", arg);
+			_print_usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (opts->samples_per_pixel > UINT16_MAX)
+	{
+		fprintf(stderr, "--spp can be at most %d\n", UINT16_MAX);
+		exit(1);
+	}
+	if (opts->headless && (opts->output_count == 0))
+		opts->outputs[opts->output_count++] = "render.png";
+}
+
+/*
+ * Creates the camera and builds the scene named in (opts) for an image of 
+ * (screen_width, screen_height) pixels, applying the sample count and seed from 
+ * the command line over the defaults. If the scene is not known, prints a 
+ * message and exits with code 1.
+ *
+ * This method allocates heap memory for the camera. If this allocation fails, 
+ * the application exits with code 1.
+ */
+static Hittable_List* _build_scene(_Options* opts, Camera** cam_out, 
+								   size_t screen_width, size_t screen_height)
+{
+	uint64_t start = trace_begin();
+	Camera* cam;
+	if ((cam = malloc(sizeof(Camera))) != NULL)
+		cam_init(cam, screen_width, screen_height);
+	else 
+	{
+		fprintf(stderr, "malloc failed in main\n");
+		exit(1);
+	}
+
+	Hittable_List* scene;
+	if (strcmp(opts->scene, "model") == 0)
+		scene = build_model_scene(cam);
+	else if (strcmp(opts->scene, "demo") == 0)
+		scene = build_demo_scene(cam);
+	else if (strcmp(opts->scene, "instanced") == 0)
+		scene = build_instanced_scene(cam);
+	else if (strcmp(opts->scene, "spheres") == 0)
+		scene = build_spheres_scene(cam, 100000);
+	else
+	{
+		fprintf(stderr, "unknown scene %s (use model, demo, instanced or spheres)\n", 
+				opts->scene);
+		exit(1);
+	}
+
+	if (opts->samples_per_pixel > 0)
+	{
+		cam->samples_per_pixel = (uint16_t) opts->samples_per_pixel;
+		if (cam->min_samples_per_pixel > cam->samples_per_pixel)
+			cam->min_samples_per_pixel = cam->samples_per_pixel;
+	}
+	if (opts->has_seed)
+		cam->seed = opts->seed;
+	cam_calculate_matrices(cam, screen_width, screen_height);
+	trace_end("build scene", start);
+
+	*cam_out = cam;
+	return scene;
+}
+
+/*
+ * Prints the hot path counters of the finished render if they are compiled in, 
+ * and writes them and the traversal cost heatmap (see framebuffer_cost_heatmap) 
+ * to the files asked for on the command line. Returns false if a file could not 
+ * be written.
+ *
+ * If the allocation of the heatmap pixels fails, the application exits with 
+ * code 1.
+ */
+static bool _write_stats(_Options* opts, Framebuffer* fb)
+{
+	if (!stats_enabled())
+		return true;
+
+	Render_Stats stats;
+	stats_total(&stats);
+	printf("Render stats:\n");
+	stats_print(&stats, stdout);
+	bool ok = true;
+	if (opts->stats_path != NULL)
+	{
+		ok = stats_write_json(&stats, opts->stats_path);
+		if (ok)
+			printf("Wrote %s\n", opts->stats_path);
+	}
+	if (opts->cost_path != NULL)
+	{
+		uint32_t* pixels;
+		if ((pixels = malloc(sizeof(uint32_t) * fb->width * fb->height)) == NULL)
+		{
+			fprintf(stderr, "malloc failed in main\n");
+			exit(1);
+		}
+		framebuffer_cost_heatmap(fb, pixels, sizeof(uint32_t) * fb->width);
+		if (image_write_pixels(pixels, fb->width, fb->height, opts->cost_path))
+			printf("Wrote %s\n", opts->cost_path);
+		else
+			ok = false;
+		free(pixels);
+	}
+	return ok;
+}
+
+/*
+ * Writes the samples taken by every pixel of (fb) (see framebuffer_heatmap), 
+ * with max_samples shown as red, to the --spp-heatmap file if one was asked for.
+ * Returns false if it could not be written.
+ *
+ * If the allocation of the heatmap pixels fails, the application exits with 
+ * code 1.
+ */
+static bool _write_spp_heatmap(_Options* opts, Framebuffer* fb, uint32_t max_samples)
+{
+	if (opts->spp_path == NULL)
+		return true;
+
+	uint32_t* pixels;
+	if ((pixels = malloc(sizeof(uint32_t) * fb->width * fb->height)) == NULL)
+	{
+		fprintf(stderr, "malloc failed in main\n");
+		exit(1);
+	}
+	framebuffer_heatmap(fb, pixels, sizeof(uint32_t) * fb->width, max_samples);
+	bool ok = image_write_pixels(pixels, fb->width, fb->height, opts->spp_path);
+	if (ok)
+		printf("Wrote %s\n", opts->spp_path);
+	free(pixels);
+	return ok;
+}
+
+/*
+ * Writes the path depth histogram of the camera (see cam_write_depth_hist) to the
+ * --depth-hist file if one was asked for. Returns false if it could not be 
+ * written.
+ */
+static bool _write_depth_hist(_Options* opts, Camera* cam)
+{
+	if (opts->depth_path == NULL)
+		return true;
+
+	bool ok = cam_write_depth_hist(cam, opts->depth_path);
+	if (ok)
+		printf("Wrote %s\n", opts->depth_path);
+	return ok;
+}
+
+/*
+ * Renders the image without a window and writes it to every output file. The 
+ * samples go straight into a float framebuffer in passes (see 
+ * render_pool_render_pass) and are only mapped to bytes when the files are 
+ * written, and nothing from SDL is used. Returns false if any file could not be 
+ * written.
+ */
+static bool _run_headless(_Options* opts, size_t screen_width, size_t screen_height)
+{
+	Camera* cam;
+	Hittable_List* scene = _build_scene(opts, &cam, screen_width, screen_height);
+	Render_Pool* pool = render_pool_new(opts->thread_count, 16);
+	Framebuffer* fb = framebuffer_new(screen_width, screen_height);
+	uint64_t depth_hist[CAM_DEPTH_BINS] = {0};
+	if (opts->depth_path != NULL)
+		cam->depth_hist = depth_hist;
+
+	stats_reset();
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t samples_done = 0;
+	size_t traced;
+	while ((traced = render_pool_render_pass(pool, cam, scene, fb, 4, 0, 0, 
+											 screen_width, screen_height)) > 0)
+	{
+		samples_done += traced;
+		printf("\r%.1f / %hu samples per pixel", 
+			   (double) samples_done / (double) (screen_width * screen_height), 
+			   cam->samples_per_pixel);
+		fflush(stdout);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+	printf("\rRendered %zux%zu, %.1f samples per pixel in %.2fs (%.2f M samples/s)\n", 
+		   screen_width, screen_height, 
+		   (double) samples_done / (double) (screen_width * screen_height), secs, 
+		   (double) samples_done / secs * 1.0E-6);
+
+	bool ok = true;
+	for (size_t i = 0; i < opts->output_count; i++)
+	{
+		if (image_write(fb, opts->outputs[i], opts->tonemap))
+			printf("Wrote %s\n", opts->outputs[i]);
+		else
+			ok = false;
+	}
+	ok = _write_stats(opts, fb) && ok;
+	ok = _write_spp_heatmap(opts, fb, cam->samples_per_pixel) && ok;
+	ok = _write_depth_hist(opts, cam) && ok;
+
+	render_pool_free(pool);
+	framebuffer_free(fb);
+	free(cam);
+	free(scene);
+	return ok;
+}
+
+/*
+ * Runs the benchmark scenes (see bench_run) with the size, sample count and 
+ * threads from the command line, or 320x180 pixels and 16 samples, and writes 
+ * the results to the --bench file. Returns false if it could not be written.
+ */
+static bool _run_bench(_Options* opts)
+{
+	Bench_Result results[BENCH_MAX_RESULTS];
+	size_t count = bench_run((opts->width > 0) ? opts->width : 320, 
+							 (opts->height > 0) ? opts->height : 180, 
+							 (opts->samples_per_pixel > 0) ? opts->samples_per_pixel : 16, 
+							 opts->thread_count, results);
+	if (!bench_write(opts->bench_path, results, count))
+		return false;
+	printf("Wrote %s\n", opts->bench_path);
+	return true;
+}
+
+/*
+ * Compares the two --compare result files (see bench_compare). Returns 0 if no 
+ * scene regressed by more than the threshold, 2 if any did, and 1 if a file 
+ * could not be read.
+ */
+static int _run_compare(_Options* opts)
+{
+	Bench_Result base[BENCH_MAX_RESULTS];
+	Bench_Result results[BENCH_MAX_RESULTS];
+	size_t base_count = bench_read(opts->compare_paths[0], base);
+	size_t count = bench_read(opts->compare_paths[1], results);
+	if ((base_count == 0) || (count == 0))
+		return 1;
+	return (bench_compare(base, base_count, results, count, opts->threshold) > 0) ? 2 : 0;
+}
+
+#ifndef HEADLESS
+/*
+ * Maps the framebuffer to the pixels of the render window with (op), on the 
+ * threads of the pool, and shows it. The pool must not be rendering.
+ */
+static void _present(Render_Pool* pool, Framebuffer* fb, Tonemap_Op op)
+{
+	uint64_t start = trace_begin();
+	size_t pitch;
+	uint32_t* pixels = render_window_pixels(&pitch);
+	render_pool_tonemap(pool, fb, op, pixels, pitch);
+	update_render_window();
+	trace_end("window update", start);
+}
+
+/*
+ * Returns the amount of rows of a band of a non-progressive render of an image 
+ * (screen_width) pixels wide, enough for at least 8 tiles per thread.
+ */
+static size_t _band_rows(Render_Pool* pool, size_t screen_width)
+{
+	size_t tiles_per_row = (screen_width + pool->tile_size - 1) / pool->tile_size;
+	return pool->tile_size * ((8 * pool->thread_count + tiles_per_row - 1) 
+							  / tiles_per_row);
+}
+
+/*
+ * Adds the camera movement asked for by a keyboard or mouse event to (move) 
+ * (right, up, forward, in units of the focus distance) and (turn) (yaw and pitch
+ * in radians, in x and y). Holding shift moves 5 times as fast. Returns true if 
+ * the event moves the camera.
+ */
+static bool _camera_input(SDL_Event* e, Vector* move, Vector* turn, bool* fast)
+{
+	double step = *fast ? 0.25 : 0.05;
+	switch (e->type){
+	case (SDL_EVENT_KEY_DOWN):
+	case (SDL_EVENT_KEY_UP):
+		if (e->key.key == SDLK_LSHIFT)
+			*fast = e->type == SDL_EVENT_KEY_DOWN;
+		if (e->type == SDL_EVENT_KEY_UP)
+			return false;
+		switch (e->key.key){
+		case (SDLK_W): move->z += step; return true;
+		case (SDLK_S): move->z -= step; return true;
+		case (SDLK_D): move->x += step; return true;
+		case (SDLK_A): move->x -= step; return true;
+		case (SDLK_E): move->y += step; return true;
+		case (SDLK_Q): move->y -= step; return true;
+		default: return false;
+		}
+	case (SDL_EVENT_MOUSE_MOTION):
+		if (!(e->motion.state & SDL_BUTTON_LMASK))
+			return false;
+		turn->x += 0.003 * e->motion.xrel;
+		turn->y -= 0.003 * e->motion.yrel;
+		return true;
+	case (SDL_EVENT_MOUSE_WHEEL):
+		move->z += step * e->wheel.y;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Returns the milliseconds since (start), a value of SDL_GetTicksNS.
+ */
+static double _ms_since(uint64_t start)
+{
+	return (double) (SDL_GetTicksNS() - start) * 1.0E-6;
+}
+
+/*
+ * Initializes all required components, constructs a scene, and opens a render 
+ * window to start rendering. The image is rendered by a render worker (see 
+ * render_worker_new) in the background, on every thread of a render pool, while 
+ * this thread only handles window events and shows the image.
+ *
+ * In progressive mode, each pass adds a few samples to every pixel of a float 
+ * framebuffer, so a noisy full image appears quickly and refines until every 
+ * pixel has all of its samples, or has converged with adaptive sampling (see 
+ * cam_render_pass). Otherwise, the image is rendered into the framebuffer in 
+ * bands of rows with every sample at once.
+ *
+ * While the worker renders, the framebuffer is mapped to the window's pixels 
+ * (see tonemap_rect) every frame_ms, and events are handled as they come in 
+ * between frames. Closing the window cancels the render, which stops within 
+ * about the time it takes to render one tile (see render_worker_stop), and 
+ * resizing it restarts the render at the new size. A frame may catch a pixel 
+ * between adding its sum and its sample count, which only shows for that frame.
+ *
+ * In interactive mode, the camera follows the keyboard and mouse (see 
+ * _camera_input). The events of a frame are added up into one move, which 
+ * cancels the render and restarts it from the new position, so no work is 
+ * spent on a stale view. Every restart begins with a preview that traces one 
+ * sample every 8, then 4, then 2 pixels (see cam_render_preview), and the frames 
+ * fill the pixels without samples from the preview (see tonemap_fill_holes), so 
+ * the new view shows after about a 64th of a pass.
+ */
+void _run(_Options* opts, size_t screen_width, size_t screen_height)
+{
+	size_t tile_size = 16;	   // width and height of a tile in pixels
+	bool progressive = true;
+	size_t samples_per_pass = 1;
+	uint64_t frame_ms = 16;	   // time between window refreshes while rendering
+	size_t preview_block = 8;  // grid of the first preview stage in interactive mode
+
+	init_renderer(screen_width, screen_height);
+
+	Camera* cam;
+	Hittable_List* scene = _build_scene(opts, &cam, screen_width, screen_height);
+	Render_Pool* pool = render_pool_new(opts->thread_count, tile_size);
+	Framebuffer* fb = framebuffer_new(screen_width, screen_height);
+	uint64_t depth_hist[CAM_DEPTH_BINS]; // cleared by render_worker_restart
+	if (opts->depth_path != NULL)
+		cam->depth_hist = depth_hist;
+
+	Render_Worker* worker = render_worker_new(pool, cam, scene, fb);
+	worker->samples_per_pass = samples_per_pass;
+	worker->band_rows = progressive ? 0 : _band_rows(pool, screen_width);
+	if (opts->interactive)
+	{
+		worker->preview_block = preview_block;
+		printf("WASD to move, Q / E down / up, drag to look, wheel to move forward, "
+			   "shift to move faster, Esc to quit\n");
+	}
+	render_worker_restart(worker);
+
+	SDL_Event e;
+	bool quit = false;
+	bool render = true;
+	bool fast = false;
+	uint64_t next_frame = SDL_GetTicks();
+	while (!quit)
+	{
+		uint64_t now = SDL_GetTicks();
+		int32_t wait_ms = (!render) ? 100 : (next_frame > now) ? (int32_t) (next_frame - now) : 0;
+		bool has_event = SDL_WaitEventTimeout(&e, wait_ms);
+		bool moved = false;
+		Vector move = {0.0, 0.0, 0.0};
+		Vector turn = {0.0, 0.0, 0.0};
+		while (has_event)
+		{
+			if (opts->interactive)
+			{
+				if ((e.type == SDL_EVENT_KEY_DOWN) && (e.key.key == SDLK_ESCAPE))
+					e.type = SDL_EVENT_WINDOW_CLOSE_REQUESTED;
+				moved |= _camera_input(&e, &move, &turn, &fast);
+			}
+			switch (e.type){
+			case (SDL_EVENT_WINDOW_CLOSE_REQUESTED):
+			{
+				uint64_t start = SDL_GetTicksNS();
+				render_worker_stop(worker);
+				if (render)
+					printf("\nStopped rendering in %.2fms", _ms_since(start));
+				quit = true;
+				break;
+			}
+			case (SDL_EVENT_WINDOW_RESIZED):
+			{
+				uint64_t start = SDL_GetTicksNS();
+				render_worker_stop(worker);
+				double stop_ms = _ms_since(start);
+				resize_render_window(&screen_width, &screen_height);
+				framebuffer_free(fb);
+				fb = framebuffer_new(screen_width, screen_height);
+				cam_calculate_matrices(cam, screen_width, screen_height);
+				worker->fb = fb;
+				worker->band_rows = progressive ? 0 : _band_rows(pool, screen_width);
+				render_worker_restart(worker);
+				render = true;
+				printf("\nResized to %zux%zu (stopped rendering in %.2fms)\n", 
+					   screen_width, screen_height, stop_ms);
+				break;
+			}
+			default:
+				break;
+			}
+			has_event = SDL_PollEvent(&e);
+		}
+		if (moved && !quit)
+		{
+			render_worker_stop(worker);
+			cam_move(cam, move.x * cam->focus_distance, move.y * cam->focus_distance,
+					 move.z * cam->focus_distance);
+			cam_turn(cam, turn.x, turn.y);
+			cam_calculate_matrices(cam, screen_width, screen_height);
+			render_worker_restart(worker);
+			render = true;
+			next_frame = SDL_GetTicks();
+		}
+		if (quit || !render || (SDL_GetTicks() < next_frame))
+			continue;
+
+		double avg_spp = (double) render_worker_samples(worker) 
+					   / (double) (screen_width * screen_height);
+		if (render_worker_done(worker))
+		{
+			// the worker is idle, so the pool can map the final image
+			render = false;
+			if ((opts->cost_path != NULL) || (opts->spp_path != NULL))
+			{
+				size_t pitch;
+				uint32_t* pixels = render_window_pixels(&pitch);
+				if (opts->cost_path != NULL)
+					framebuffer_cost_heatmap(fb, pixels, pitch);
+				else
+					framebuffer_heatmap(fb, pixels, pitch, cam->samples_per_pixel);
+				update_render_window();
+			}
+			else 
+				_present(pool, fb, opts->tonemap);
+			printf("\rRender complete, %.1f samples per pixel\n", avg_spp);
+			_write_stats(opts, fb);
+			_write_spp_heatmap(opts, fb, cam->samples_per_pixel);
+			_write_depth_hist(opts, cam);
+			continue;
+		}
+
+		uint64_t start = trace_begin();
+		size_t pitch;
+		uint32_t* pixels = render_window_pixels(&pitch);
+		tonemap_rect(fb, opts->tonemap, pixels, pitch, 0, 0, screen_width, screen_height);
+		if (worker->preview_block > 1) // until the first pass has reached every pixel
+			tonemap_fill_holes(fb, pixels, pitch, worker->preview_block);
+		update_render_window();
+		trace_end("window update", start);
+		next_frame = SDL_GetTicks() + frame_ms;
+		if (progressive)
+			printf("\r%.1f / %hu samples per pixel", avg_spp, cam->samples_per_pixel);
+		else
+			printf("\r%.0f%%", 100.0 * avg_spp / (double) cam->samples_per_pixel);
+		fflush(stdout);
+	}
+	render_worker_free(worker);
+	render_pool_free(pool);
+	framebuffer_free(fb);
+	free(cam);
+	free(scene);
+	close_render_window();
+	printf("\n");
+}
+#endif
+
+/*
+ * Runs the benchmarks or compares their results if asked to. Otherwise, chooses 
+ * the image size from the build configuration and the command line, then 
+ * renders either headless or in a window. Returns the exit code of the run.
+ */
+static int _run_options(_Options* opts)
+{
+	if ((opts->bench_path != NULL) || (opts->compare_paths[0] != NULL))
+	{
+		if ((opts->bench_path != NULL) && !_run_bench(opts))
+			return 1;
+		return (opts->compare_paths[0] != NULL) ? _run_compare(opts) : 0;
+	}
+
+	size_t screen_width = 100;
+	size_t screen_height = 100;
+#ifdef DEBUG
+	screen_width = 200;
+	screen_height = 113;
+#elif RELEASE
+	screen_width = 800;
+	screen_height = 450;
+#endif
+	if (opts->width > 0)
+		screen_width = opts->width;
+	if (opts->height > 0)
+		screen_height = opts->height;
+
+	if (opts->headless)
+		return _run_headless(opts, screen_width, screen_height) ? 0 : 1;
+#ifndef HEADLESS
+	_run(opts, screen_width, screen_height);
+#endif
+	return 0;
+}
+
+/*
+ * Reads the command line and runs it (see _run_options). With --trace, events 
+ * are recorded from the start (see trace_start) and the timeline is written 
+ * once the run is over and every render thread has been joined.
+ */
+int _main(int argc, char** argv)
+{
+	_Options opts;
+	_parse_options(argc, argv, &opts);
+	if (opts.trace_path != NULL)
+	{
+		trace_thread_name("main");
+		trace_start();
+	}
+
+	int code = _run_options(&opts);
+	if (opts.trace_path != NULL)
+	{
+		if (!trace_write(opts.trace_path))
+			return 1;
+		printf("Wrote %s\n", opts.trace_path);
+	}
+	return code;
+}
+#endif
+
+#ifdef UNIT_TEST
+#include "random.h"
+#include "image_writer.h"
+#include "obj_importer.h"
+#include "scene_builder.h"
+#include "render_pool.h"
+#include "render_worker.h"
+#include "benchmark.h"
+#include "stats.h"
+#include "trace.h"
+#include "camera.h"
 #include "scene.h"
 
-#include <stdlib.h>
-#include <SDL3/SDL_events.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+#ifdef __GLIBC__
+/*
+ * Counts every call to malloc made by the test build so that tests can check 
+ * the heap traffic of a piece of code. Calls are passed on to glibc's own 
+ * allocator.
+ */
+extern void* __libc_malloc(size_t size);
+static uint64_t _malloc_count = 0;
+void* malloc(size_t size)
+{
+	__atomic_fetch_add(&_malloc_count, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+#endif
+
+/*
+ * Returns true if the vectors (u) and (v) are exactly equal.
+ */
+static bool _vec_equal(Vector u, Vector v)
+{
+	return (u.x == v.x) && (u.y == v.y) && (u.z == v.z);
+}
+
+/*
+ * Imports (file_name), then a small file with the forms the importer has to 
+ * handle (comments, tabs, CRLF line endings, w components, texture indices, 
+ * negative indices, faces without normals, a quad and no final new line) and 
+ * checks the triangles it makes. Then writes a grid of 2 * (size * size) 
+ * triangles, imports it and checks every vertex against strtod, and counts the 
+ * allocations made while importing it.
+ */
+void _test_obj_import(char* file_name)
+{
+	printf("Testing OBJ file importing:\n");
+	printf("Importing: %s\n", file_name);
+	Vector white = {1.0, 1.0, 1.0};
+	Material diff_white = {DIFFUSE, white, 0.0};
+	Obj_Object* obj = parse_obj_file(file_name, 0.0, 0.0, 0.0, diff_white);
+	printf("Triangles: %zu (expected 608)\n", obj->length);
+
+	FILE* file = fopen("test_import.obj", "wb");
+	fprintf(file, "# comment\r\nmtllib none.mtl\r\no thing\r\n"
+			"v 0 0 0 1.0\r\nv\t1.5 0 0\r\nv 1.5 2.5e-1 0\r\nv 0 0.25 -1E+1\r\n"
+			"vt 0.5 0.5\r\nvn 0 0 1\r\nvn 0 0 -1\r\n\r\ns off\r\n"
+			"f 1/1/1 2/1/1 3/1/1\r\nf -4//-1 -2//-1 -1//-1\r\nf 1/1 2/1 3/1\r\n"
+			"f 1 2 3 4");
+	fclose(file);
+	Vector offset = {1.0, 0.0, 0.0};
+	Obj_Object* small = parse_obj_file("test_import.obj", offset.x, offset.y, offset.z,
+									   diff_white);
+	remove("test_import.obj");
+	Vector v3 = {1.0, 0.25, -10.0};
+	Vector up = {0.0, 0.0, 1.0};
+	Vector down = {0.0, 0.0, -1.0};
+	Vector flat = {0.0, 0.0, 1.0}; // winding of (0 0 0) (1.5 0 0) (1.5 0.25 0)
+	bool ok = (small->length == 5)
+		   && _vec_equal(small->tris[0]->vectors[3], up)
+		   && _vec_equal(small->tris[1]->vectors[2], v3)
+		   && _vec_equal(small->tris[1]->vectors[5], down)
+		   && _vec_equal(small->tris[2]->vectors[4], flat)
+		   && _vec_equal(small->tris[4]->vectors[0], offset)
+		   && _vec_equal(small->tris[4]->vectors[2], v3);
+	printf("Small file: %zu triangles (expected 5), corners and normals match: %s\n", 
+		   small->length, ok ? "yes" : "no");
+
+	size_t size = 400;
+	file = fopen("test_import.obj", "wb");
+	for (size_t y = 0; y <= size; y++)
+		for (size_t x = 0; x <= size; x++)
+			fprintf(file, "v %.6f %.6f %.6f\n", (double) x * 0.013 - 2.6, 
+					(double) y * -0.007, sin((double) (x + y)) * 1.0E-3);
+	fprintf(file, "vn 0.000000 1.000000 0.000000\n");
+	for (size_t y = 0; y < size; y++)
+	{
+		for (size_t x = 0; x < size; x++)
+		{
+			size_t i = y * (size + 1) + x + 1;
+			fprintf(file, "f %zu//1 %zu//1 %zu//1\nf %zu//1 %zu//1 %zu//1\n", i, i + 1, 
+					i + size + 2, i, i + size + 2, i + size + 1);
+		}
+	}
+	fclose(file);
+
+	uint64_t mallocs = _malloc_count;
+	Obj_Object* grid = parse_obj_file("test_import.obj", 0.0, 0.0, 0.0, diff_white);
+	mallocs = _malloc_count - mallocs;
+	remove("test_import.obj");
+	size_t mismatches = 0;
+	for (size_t i = 0; i < grid->length; i += 2)
+	{
+		size_t x = (i / 2) % size;
+		size_t y = (i / 2) / size;
+		char line[128];
+		snprintf(line, sizeof(line), "%.6f %.6f %.6f", (double) x * 0.013 - 2.6, 
+				 (double) y * -0.007, sin((double) (x + y)) * 1.0E-3);
+		char* s = line;
+		Vector expected;
+		expected.x = strtod(s, &s);
+		expected.y = strtod(s, &s);
+		expected.z = strtod(s, &s);
+		mismatches += !_vec_equal(grid->tris[i]->vectors[0], expected);
+	}
+	printf("Grid: %zu triangles (expected %zu), vertices unlike strtod: %zu, "
+		   "allocations: %llu\n", grid->length, 2 * size * size, mismatches, 
+		   (unsigned long long) mallocs);
+}
+
+/*
+ * Returns true if the meshes (a) and (b) have the same triangles in the same 
+ * order, down to every bit of their 3 corners and 3 normals, bounds and material.
+ */
+static bool _same_mesh(const Obj_Object* a, const Obj_Object* b)
+{
+	if (a->length != b->length)
+		return false;
+	for (size_t i = 0; i < a->length; i++)
+	{
+		const Hittable* ta = a->tris[i];
+		const Hittable* tb = b->tris[i];
+		if ((ta->type != tb->type) || (ta->v_len != tb->v_len)
+			|| (memcmp(ta->vectors, tb->vectors, sizeof(Vector) * TRI) != 0)
+			|| (memcmp(&ta->aabb, &tb->aabb, sizeof(AABB)) != 0)
+			|| (memcmp(&ta->mat, &tb->mat, sizeof(Material)) != 0))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Imports (file_name) on 1 and 3 threads, then writes a strip mesh of (rows) rows 
+ * whose faces mostly use negative indices (so that chunks refer back into earlier 
+ * chunks) mixed with positive ones, normals given between the rows, faces with 
+ * and without normals, quads, and no final new line. Imports it serially and on 
+ * several amounts of threads, checks that every mesh is identical to the serial 
+ * one, and reports the time each took.
+ */
+void _test_obj_threads(char* file_name)
+{
+	printf("Testing threaded OBJ file importing:\n");
+	Vector white = {1.0, 1.0, 1.0};
+	Material diff_white = {DIFFUSE, white, 0.0};
+	Obj_Object* serial = parse_obj_file_threads(file_name, 1.0, 0.0, 0.0, diff_white, 1, 
+												NULL);
+	Obj_Object* threaded = parse_obj_file_threads(file_name, 1.0, 0.0, 0.0, diff_white, 3, 
+												  NULL);
+	printf("%s on 3 threads matches serial: %s\n", file_name, 
+		   _same_mesh(serial, threaded) ? "yes" : "no");
+
+	size_t rows = 300;
+	size_t cols = 300;
+	size_t expected = 1;
+	FILE* file = fopen("test_import.obj", "wb");
+	for (size_t y = 0; y < rows; y++)
+	{
+		for (size_t x = 0; x < cols; x++)
+			fprintf(file, "v %.6f %.6f %.6f\n", (double) x * 0.01, (double) y * 0.02, 
+					cos((double) (x * y)) * 1.0E-2);
+		fprintf(file, "vn 0 %.4f 1\n", (double) y * 1.0E-3);
+		if (y == 0)
+			continue;
+		for (size_t x = 0; x + 1 < cols; x++, expected++)
+		{
+			expected += (x % 3 == 0); // quads make 2 triangles
+			long below = -(long) (2 * cols - x); // the vertex x of the row before
+			if (x % 3 == 0)
+				fprintf(file, "f %ld//-1 %ld//-1 %ld//-2 %ld//-2\n", below, below + 1, 
+						-(long) (cols - x - 1), -(long) (cols - x));
+			else if (x % 3 == 1)
+				fprintf(file, "f %zu %zu %ld\n", (y - 1) * cols + x + 1, 
+						(y - 1) * cols + x + 2, -(long) (cols - x - 1));
+			else
+				fprintf(file, "f %ld/1 %ld/1 %zu/1\n", below, -(long) (cols - x - 1), 
+						y * cols + x + 1);
+		}
+	}
+	fprintf(file, "f 1 2 3");
+	fclose(file);
+
+	size_t thread_counts[] = {1, 2, 3, 7, 0};
+	for (size_t i = 0; i < sizeof(thread_counts) / sizeof(size_t); i++)
+	{
+		struct timespec start, end;
+		size_t threads_used;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		threaded = parse_obj_file_threads("test_import.obj", 0.0, 0.0, 0.0, diff_white, 
+										  thread_counts[i], &threads_used);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (i == 0)
+			serial = threaded;
+		printf("Strips on %zu threads (asked for %zu): %zu triangles (expected %zu), "
+			   "%.1fms, matches serial: %s\n", threads_used, thread_counts[i], 
+			   threaded->length, expected, 
+			   (double) (end.tv_sec - start.tv_sec) * 1.0E3 
+			   + (double) (end.tv_nsec - start.tv_nsec) * 1.0E-6,
+			   _same_mesh(serial, threaded) ? "yes" : "no");
+	}
+	remove("test_import.obj");
+}
+
+/*
+ * Returns a new scene with the hittables of (scene), where every mesh instance 
+ * is replaced by copies of its triangles moved into world space, as the model 
+ * scene was built before meshes were instanced. Only the corners are moved, so 
+ * the copies are only meant for finding hits, not for shading.
+ */
+static Hittable_List* _flatten_scene(Hittable_List* scene)
+{
+	Hittable_List* flat = malloc(sizeof(Hittable_List));
+	scene_init(flat);
+	for (size_t i = 0; i < scene->length; i++)
+	{
+		Hittable* hittable = scene->hittables[i];
+		if (hittable->type != INSTANCE)
+		{
+			scene_add(flat, hittable);
+			continue;
+		}
+
+		Vector* m = hittable->vectors; // object to world rows, then translation
+		for (size_t t = 0; t < hittable->mesh->length; t++)
+		{
+			Vector* v = hittable->mesh->tris[t]->vectors;
+			Vector corners[3];
+			for (size_t c = 0; c < 3; c++)
+			{
+				Vector world = {vec_dot(m[0], v[c]), vec_dot(m[1], v[c]), vec_dot(m[2], v[c])};
+				corners[c] = vec_add(world, m[3]);
+			}
+			scene_add(flat, hittable_new_tri(corners[0], corners[1], corners[2], 
+											 v[3], v[4], v[5], hittable->mat));
+		}
+	}
+	return flat;
+}
+
+/*
+ * Casts (rays) through (scene) without a BVH, then with its BVH in both node 
+ * layouts, and reports the speedup and node visits per ray of each layout along 
+ * with how many rays found a different closest hittable. The scene's BVH must 
+ * already be built.
+ */
+static void _bvh_speedup(char* name, Hittable_List* scene, Ray* rays, size_t ray_count)
+{
+	size_t* linear_idxs = malloc(sizeof(size_t) * ray_count);
+	if (linear_idxs == NULL)
+	{
+		fprintf(stderr, "malloc failed in main\n");
+		exit(1);
+	}
+
+	Interval itvl = {0.001, 1000.0};
+	Hit_Record hit_rec;
+	BVH* bvh = scene->bvh;
+	scene->bvh = NULL;
+	clock_t start = clock();
+	for (size_t i = 0; i < ray_count; i++)
+		linear_idxs[i] = scene_hit_idx(scene, rays[i], itvl, &hit_rec);
+	double linear_secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("%s: %zu hittables, linear: %fs\n", name, scene->length, linear_secs);
+
+	scene->bvh = bvh;
+	E_BVH_Layout layouts[2] = {BVH_BINARY, BVH_WIDE};
+	char* layout_names[2] = {"binary", "wide"};
+	for (size_t l = 0; l < 2; l++)
+	{
+		bvh_set_layout(bvh, layouts[l]);
+		bvh_reset_stats();
+		size_t mismatches = 0;
+		start = clock();
+		for (size_t i = 0; i < ray_count; i++)
+			if (scene_hit_idx(scene, rays[i], itvl, &hit_rec) != linear_idxs[i])
+				mismatches++;
+		double bvh_secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+		printf("BVH (%s): %fs, speedup: %.1fx, node visits per ray: %.1f, "
+			   "mismatched hits: %zu / %zu\n", layout_names[l], bvh_secs, 
+			   linear_secs / bvh_secs, bvh_visits_per_ray(), mismatches, ray_count);
+	}
+	free(linear_idxs);
+}
+
+/*
+ * Casts the same set of random rays through the model scene with and without its 
+ * BVH (in both node layouts), checks that they all find the same closest 
+ * hittable, and reports the speedup and node visits per ray of each layout. The 
+ * model scene only holds a handful of hittables since its mesh is instanced, 
+ * with the triangles behind the mesh's own BVH, so the same is done for a copy 
+ * with the mesh flattened into the scene, where the scene's BVH does all of the 
+ * work.
+ */
+void _test_bvh(void)
+{
+	printf("Testing BVH against linear scene traversal:\n");
+	Camera cam;
+	cam_init(&cam, 100, 100);
+	Hittable_List* scene = build_model_scene(&cam);
+	Hittable_List* flat = _flatten_scene(scene);
+	scene_build_bvh(flat);
+
+	size_t ray_count = 200000;
+	Ray* rays = malloc(sizeof(Ray) * ray_count);
+	if (rays == NULL)
+	{
+		fprintf(stderr, "malloc failed in main\n");
+		exit(1);
+	}
+
+	rng_set_seed(1);
+	for (size_t i = 0; i < ray_count; i++)
+	{
+		Ray r = {vec_rndm(rng_default(), -1.0, 3.0), vec_rndm_unit(rng_default())};
+		rays[i] = r;
+	}
+
+	_bvh_speedup("Instanced model scene", scene, rays, ray_count);
+	_bvh_speedup("Flattened model scene", flat, rays, ray_count);
+	free(rays);
+}
+
+/*
+ * Builds a BVH over a scene of a million randomly placed spheres with both the 
+ * SAH and the LBVH builders, and reports the build time per million primitives 
+ * and the time to trace the same random rays through each.
+ */
+void _test_bvh_builders(void)
+{
+	printf("Testing BVH builders:\n");
+	size_t sphere_count = 1000000;
+	size_t ray_count = 200000;
+	Vector white = {1.0, 1.0, 1.0};
+	Material diff_white = {DIFFUSE, white, 0.0};
+
+	Hittable_List scene;
+	scene_init(&scene);
+	rng_set_seed(2);
+	for (size_t i = 0; i < sphere_count; i++)
+	{
+		Vector pos = vec_rndm(rng_default(), -50.0, 50.0);
+		double radius = 0.05 + 0.15 * rng_01();
+		scene_add(&scene, hittable_new_sphere(pos.x, pos.y, pos.z, radius, diff_white));
+	}
+
+	E_BVH_Builder builders[2] = {BVH_BUILD_SAH, BVH_BUILD_LBVH};
+	char* builder_names[2] = {"SAH", "LBVH"};
+	for (size_t b = 0; b < 2; b++)
+	{
+		scene.builder = builders[b];
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		scene_build_bvh(&scene);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double build_secs = (end.tv_sec - start.tv_sec) 
+						  + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+
+		rng_set_seed(3);
+		Interval itvl = {0.001, 1000.0};
+		Hit_Record hit_rec;
+		size_t hits = 0;
+		bvh_reset_stats();
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t i = 0; i < ray_count; i++)
+		{
+			Ray r = {vec_rndm(rng_default(), -50.0, 50.0), vec_rndm_unit(rng_default())};
+			if (scene_hit_idx(&scene, r, itvl, &hit_rec) != SIZE_MAX)
+				hits++;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double trace_secs = (end.tv_sec - start.tv_sec) 
+						  + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+
+		printf("%s: build %fs per million primitives, %zu nodes, trace %fs "
+			   "(%.1f node visits per ray, %zu hits)\n", builder_names[b], 
+			   build_secs * 1.0E6 / (double) sphere_count, scene.bvh->node_count, 
+			   trace_secs, bvh_visits_per_ray(), hits);
+	}
+}
+
+/*
+ * Returns the depth of the binary subtree rooted at nodes[node_idx] of (bvh).
+ */
+static size_t _bvh_depth(BVH* bvh, size_t node_idx)
+{
+	BVH_Node* node = &bvh->nodes[node_idx];
+	if (node->count > 0)
+		return 0;
+	size_t left = _bvh_depth(bvh, node_idx + 1);
+	size_t right = _bvh_depth(bvh, node->offset);
+	return 1 + ((left > right) ? left : right);
+}
+
+/*
+ * Builds both kinds of BVH over spheres spaced in a geometric series along x, 
+ * which the SAH builder can only split a few off at a time, checks that neither 
+ * is deeper than BVH_MAX_DEPTH, and that rays along the series (one starting on 
+ * the axis, so that its slab distances are NaN in y and z) find the same closest 
+ * hit in both layouts as testing every sphere.
+ */
+void _test_bvh_depth(void)
+{
+	printf("Testing BVH depth:\n");
+	size_t count = 400;
+	Vector white = {1.0, 1.0, 1.0};
+	Material diff_white = {DIFFUSE, white, 0.0};
+	Hittable** spheres = malloc(sizeof(Hittable*) * count);
+	AABB* boxes = malloc(sizeof(AABB) * count);
+	for (size_t i = 0; i < count; i++)
+	{
+		spheres[i] = hittable_new_sphere(pow(3.0, (double) i), 0.0, 0.0, 0.1, diff_white);
+		boxes[i] = spheres[i]->aabb;
+	}
+
+	Ray rays[4] = {{{-1.0, 0.0, 0.0}, {1.0, 0.0, 0.0}},
+				   {{-1.0, 1.0E-9, 1.0E-9}, {1.0, 0.0, 0.0}},
+				   {{10.0, 0.01, 0.0}, {1.0, 0.0, 0.0}},
+				   {{-1.0E30, 0.02, -0.01}, {1.0, 0.0, 0.0}}};
+	Interval itvl = {0.001, INFINITY};
+	char* builder_names[2] = {"SAH", "LBVH"};
+	for (size_t b = 0; b < 2; b++)
+	{
+		BVH* bvh = (b == 0) ? bvh_build(boxes, count) : lbvh_build(boxes, count);
+		size_t mismatches = 0;
+		for (size_t layout = 0; layout < 2; layout++)
+		{
+			bvh_set_layout(bvh, (layout == 0) ? BVH_BINARY : BVH_WIDE);
+			for (size_t i = 0; i < sizeof(rays) / sizeof(Ray); i++)
+			{
+				double closest = INFINITY;
+				Hit_Record hit_rec;
+				for (size_t j = 0; j < count; j++)
+				{
+					if (hittable_hit(spheres[j], rays[i], itvl, &hit_rec) 
+						&& (hit_rec.t < closest))
+						closest = hit_rec.t;
+				}
+				size_t idx = bvh_hit_idx(bvh, spheres, rays[i], itvl, &hit_rec);
+				mismatches += (idx == SIZE_MAX) ? (closest < INFINITY) 
+												: (hit_rec.t != closest);
+			}
+		}
+		printf("%s: depth %zu (at most %d), hits unlike testing every sphere in "
+			   "either layout: %zu\n", builder_names[b], _bvh_depth(bvh, 0), 
+			   BVH_MAX_DEPTH, mismatches);
+		bvh_free(bvh);
+	}
+
+	free(spheres);
+	free(boxes);
+}
+
+/*
+ * Casts random rays at the car both as a flattened copy (offset baked into its 
+ * vertices) and as an instance of a mesh parsed at the origin, checks that both 
+ * find the same hits, and reports the memory cost of each extra copy.
+ */
+void _test_instancing(void)
+{
+	printf("Testing mesh instancing:\n");
+	Vector white = {1.0, 1.0, 1.0};
+	Material diff_white = {DIFFUSE, white, 0.0};
+	Vector pos = {1.8, -0.5, 0.3};
+	Vector rot = {0.0, 0.0, 0.0};
+
+	Obj_Object* flat = parse_obj_file("res/porsche.obj", pos.x, pos.y, pos.z, diff_white);
+	Obj_Object* mesh = parse_obj_file("res/porsche.obj", 0.0, 0.0, 0.0, diff_white);
+
+	Hittable_List flat_scene;
+	scene_init(&flat_scene);
+	scene_add_obj(&flat_scene, flat);
+	scene_build_bvh(&flat_scene);
+
+	Hittable_List inst_scene;
+	scene_init(&inst_scene);
+	scene_add(&inst_scene, hittable_new_instance(mesh, pos, rot, 1.0, diff_white));
+	scene_build_bvh(&inst_scene);
+
+	size_t ray_count = 200000;
+	size_t hits = 0;
+	size_t mismatches = 0;
+	Interval itvl = {0.001, 1000.0};
+	rng_set_seed(4);
+	for (size_t i = 0; i < ray_count; i++)
+	{
+		Ray r = {vec_rndm(rng_default(), -1.0, 3.0), vec_rndm_unit(rng_default())};
+		Hit_Record flat_rec, inst_rec;
+		bool flat_hit = scene_hit_idx(&flat_scene, r, itvl, &flat_rec) != SIZE_MAX;
+		bool inst_hit = scene_hit_idx(&inst_scene, r, itvl, &inst_rec) != SIZE_MAX;
+		if (flat_hit) 
+			hits++;
+		if ((flat_hit != inst_hit) || (flat_hit && (fabs(flat_rec.t - inst_rec.t) > 1.0E-9)))
+			mismatches++;
+	}
+
+	size_t flat_bytes = flat->length * (sizeof(Hittable) + sizeof(Vector) * TRI);
+	size_t inst_bytes = sizeof(Hittable) + sizeof(Vector) * INSTANCE;
+	printf("Bytes per extra copy, flattened: %zu, instanced: %zu\n", flat_bytes, inst_bytes);
+	printf("Hits: %zu, mismatched hits: %zu / %zu\n", hits, mismatches, ray_count);
+}
+
+/*
+ * Casts random rays through the car's mesh BVH testing its leaves both as 
+ * triangle hittables and as the SoA triangle store, checks that both find the 
+ * same triangles, and reports the triangle tests per second of each.
+ */
+void _test_tri_store(void)
+{
+	printf("Testing SoA triangle store:\n");
+	Vector white = {1.0, 1.0, 1.0};
+	Material diff_white = {DIFFUSE, white, 0.0};
+	Vector pos = {0.0, 0.0, 0.0};
+	Obj_Object* mesh = parse_obj_file("res/porsche.obj", 0.0, 0.0, 0.0, diff_white);
+	hittable_new_instance(mesh, pos, pos, 1.0, diff_white); // builds the mesh BVH and store
+
+	size_t ray_count = 500000;
+	Ray* rays = malloc(sizeof(Ray) * ray_count);
+	rng_set_seed(5);
+	for (size_t i = 0; i < ray_count; i++)
+	{
+		Ray r = {vec_rndm(rng_default(), -1.5, 1.5), vec_rndm_unit(rng_default())};
+		rays[i] = r;
+	}
+
+	Interval itvl = {0.001, 1000.0};
+	size_t* hit_idxs = malloc(sizeof(size_t) * ray_count);
+	double* hit_ts = malloc(sizeof(double) * ray_count);
+	struct timespec start, end;
+
+	bvh_reset_stats();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < ray_count; i++)
+	{
+		Hit_Record hit_rec;
+		hit_idxs[i] = bvh_hit_idx(mesh->bvh, mesh->tris, rays[i], itvl, &hit_rec);
+		hit_ts[i] = hit_rec.t;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double hittable_secs = (end.tv_sec - start.tv_sec) 
+						 + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+	double tests = bvh_prim_tests_per_ray() * (double) ray_count;
+
+	size_t hits = 0;
+	size_t mismatches = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < ray_count; i++)
+	{
+		double t;
+		size_t idx = bvh_hit_tri_idx(mesh->bvh, mesh->store, rays[i], itvl, &t);
+		size_t tri = (idx == SIZE_MAX) ? SIZE_MAX : mesh->bvh->prim_idxs[idx];
+		if (tri != SIZE_MAX)
+			hits++;
+		if ((tri != hit_idxs[i]) || ((tri != SIZE_MAX) && (fabs(t - hit_ts[i]) > 1.0E-9)))
+			mismatches++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double store_secs = (end.tv_sec - start.tv_sec) 
+					  + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+
+	printf("Hittable leaves: %fs (%.1f M tris/s), store leaves: %fs (%.1f M tris/s)\n", 
+		   hittable_secs, tests * 1.0E-6 / hittable_secs, 
+		   store_secs, tests * 1.0E-6 / store_secs);
+	printf("Hits: %zu, mismatched hits: %zu / %zu\n", hits, mismatches, ray_count);
+	free(rays);
+	free(hit_idxs);
+	free(hit_ts);
+}
+
+/*
+ * Tests groups of up to 4 triangles of the car's triangle store at once with 
+ * tri_store_hit4 and one at a time with _hit_tri (through hittable_hit), 
+ * aiming the random rays near the group so that most of them hit, and checks 
+ * that both find the same closest triangle at exactly the same distance. On the 
+ * first ray where they differ, prints it and exits with code 1.
+ */
+void _test_tri_kernel(void)
+{
+	printf("Testing triangle leaf kernel against _hit_tri:\n");
+	Vector white = {1.0, 1.0, 1.0};
+	Material diff_white = {DIFFUSE, white, 0.0};
+	Vector pos = {0.0, 0.0, 0.0};
+	Obj_Object* mesh = parse_obj_file("res/porsche.obj", 0.0, 0.0, 0.0, diff_white);
+	hittable_new_instance(mesh, pos, pos, 1.0, diff_white); // builds the mesh BVH and store
+	Tri_Store* store = mesh->store;
+
+	size_t ray_count = 4000000;
+	size_t hits = 0;
+	Interval itvl = {0.001, 1000.0};
+	rng_set_seed(6);
+	for (size_t i = 0; i < ray_count; i++)
+	{
+		size_t first = (size_t) (rng_01() * (double) store->length) % store->length;
+		size_t count = 1 + (size_t) (rng_01() * 4.0) % 4;
+		if (first + count > store->length)
+			count = store->length - first;
+
+		Vector target = {store->v0_x[first], store->v0_y[first], store->v0_z[first]};
+		target = vec_add(target, vec_mul(vec_rndm_unit(rng_default()), 0.02));
+		Vector origin = vec_rndm(rng_default(), -1.5, 1.5);
+		Ray r = {origin, vec_unit(vec_sub(target, origin))};
+
+		double t = 0.0;
+		int lane = tri_store_hit4(store, first, count, r, itvl, &t);
+
+		int ref_lane = -1;
+		Interval ref_itvl = itvl;
+		for (size_t j = 0; j < count; j++)
+		{
+			Hit_Record hit_rec;
+			Hittable* tri = mesh->tris[mesh->bvh->prim_idxs[first + j]];
+			if (hittable_hit(tri, r, ref_itvl, &hit_rec) 
+				&& interval_surrounds(ref_itvl, hit_rec.t))
+			{
+				ref_itvl.max = hit_rec.t;
+				ref_lane = (int) j;
+			}
+		}
+
+		if (ref_lane >= 0)
+			hits++;
+		if ((lane != ref_lane) || ((lane >= 0) && (t != ref_itvl.max)))
+		{
+			fprintf(stderr, "kernel differs from _hit_tri on ray %zu: origin (%.17g, %.17g, "
+					"%.17g), direction (%.17g, %.17g, %.17g), triangles [%zu, %zu), lane %d, "
+					"t %.17g, expected lane %d t %.17g\n", i, r.origin.x, r.origin.y, 
+					r.origin.z, r.direction.x, r.direction.y, r.direction.z, first, 
+					first + count, lane, t, ref_lane, ref_itvl.max);
+			exit(1);
+		}
+	}
+
+	printf("Hits: %zu, hits identical to _hit_tri: %zu / %zu\n", hits, ray_count, ray_count);
+
+	size_t group_count = 1000000;
+	Ray* rays = malloc(sizeof(Ray) * group_count);
+	size_t* firsts = malloc(sizeof(size_t) * group_count);
+	for (size_t i = 0; i < group_count; i++)
+	{
+		firsts[i] = (size_t) (rng_01() * (double) (store->length - 4));
+		Ray r = {vec_rndm(rng_default(), -1.5, 1.5), vec_rndm_unit(rng_default())};
+		rays[i] = r;
+	}
+
+	struct timespec start, end;
+	size_t kernel_hits = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < group_count; i++)
+	{
+		double t;
+		if (tri_store_hit4(store, firsts[i], 4, rays[i], itvl, &t) >= 0)
+			kernel_hits++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+	printf("Kernel: %.1f M tris/s (%zu hits)\n", 4.0 * group_count * 1.0E-6 / secs, kernel_hits);
+	free(rays);
+	free(firsts);
+}
+
+/*
+ * Renders the model scene at a low resolution and reports the frame time and the 
+ * amount of heap allocations made while rendering, which should be zero.
+ */
+void _test_render_allocs(void)
+{
+	printf("Testing heap allocations while rendering:\n");
+	size_t width = 160;
+	size_t height = 90;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam.samples_per_pixel = 4;
+	cam.max_ray_bounces = 15;
+	Framebuffer* fb = framebuffer_new(width, height);
+
+	struct timespec start, end;
+	uint64_t mallocs = 0;
+#ifdef __GLIBC__
+	mallocs = _malloc_count;
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cam_render_section(&cam, scene, fb, 0, 0, width, height);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+#ifdef __GLIBC__
+	mallocs = _malloc_count - mallocs;
+#endif
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+	printf("Frame (%zux%zu, %hu spp): %fs, heap allocations: %lu\n", width, height, 
+		   cam.samples_per_pixel, secs, (unsigned long) mallocs);
+	framebuffer_free(fb);
+}
+
+/*
+ * Renders the model scene through render pools of 1 thread up to one per core 
+ * (doubling each time), checks that every pixel is rendered exactly once (has 
+ * exactly samples_per_pixel samples), and reports the time and speedup over one 
+ * thread of each.
+ */
+void _test_render_pool(void)
+{
+	printf("Testing render pool scaling:\n");
+	size_t width = 320;
+	size_t height = 180;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam.samples_per_pixel = 4;
+	cam.max_ray_bounces = 15;
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_threads = (cores > 0) ? (size_t) cores : 1;
+	double single_secs = 0.0;
+	Framebuffer* fb = framebuffer_new(width, height);
+	for (size_t threads = 1; ; threads *= 2)
+	{
+		if (threads > max_threads)
+			threads = max_threads;
+
+		Render_Pool* pool = render_pool_new(threads, 16);
+		framebuffer_clear(fb);
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		render_pool_free(pool);
+
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+		if (threads == 1)
+			single_secs = secs;
+		size_t bad_pixels = 0;
+		for (size_t i = 0; i < width * height; i++)
+		{
+			if (fb->samples[i] != cam.samples_per_pixel)
+				bad_pixels++;
+		}
+		printf("%zu threads: %fs, speedup: %.2fx (%.0f%% efficiency), "
+			   "pixels not set once: %zu\n", threads, secs, single_secs / secs, 
+			   100.0 * single_secs / secs / (double) threads, bad_pixels);
+
+		if (threads == max_threads)
+			break;
+	}
+	framebuffer_free(fb);
+}
+
+static Vector _frame[160 * 90];
+
+/*
+ * Copies the mean of every pixel of (fb), which is 160 pixels wide, to _frame.
+ */
+static void _store_frame(Framebuffer* fb)
+{
+	for (size_t i = 0; i < fb->width * fb->height; i++)
+		_frame[i] = framebuffer_mean(fb, i % 160, i / 160);
+}
+
+/*
+ * Renders the model scene with the same camera seed on one thread, and through 
+ * render pools with different thread counts and tile sizes, and checks that 
+ * every image is bit identical to the first.
+ */
+void _test_rng_streams(void)
+{
+	printf("Testing per sample rng streams:\n");
+	size_t width = 160;
+	size_t height = 90;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam.samples_per_pixel = 4;
+	cam.max_ray_bounces = 15;
+	cam.seed = 1234;
+
+	static Vector reference[160 * 90];
+	Framebuffer* fb = framebuffer_new(width, height);
+	cam_render_section(&cam, scene, fb, 0, 0, width, height);
+	_store_frame(fb);
+	memcpy(reference, _frame, sizeof(_frame));
+
+	size_t thread_counts[3] = {1, 3, 8};
+	size_t tile_sizes[3] = {16, 7, 1};
+	for (size_t i = 0; i < 3; i++)
+	{
+		Render_Pool* pool = render_pool_new(thread_counts[i], tile_sizes[i]);
+		framebuffer_clear(fb);
+		render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+		render_pool_free(pool);
+		_store_frame(fb);
+		printf("%zu threads, %zupx tiles: %s\n", thread_counts[i], tile_sizes[i], 
+			   (memcmp(reference, _frame, sizeof(_frame)) == 0) ? "identical" : "DIFFERENT");
+	}
+	framebuffer_free(fb);
+}
+
+/*
+ * Renders the model scene in one go and progressively (one sample per pixel per 
+ * pass) with the same seed, reports the time to the first full frame and in 
+ * total, and checks that the final progressive image matches the one-shot one.
+ */
+void _test_progressive(void)
+{
+	printf("Testing progressive rendering:\n");
+	size_t width = 160;
+	size_t height = 90;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam.samples_per_pixel = 8;
+	cam.max_ray_bounces = 15;
+	cam.seed = 99;
+
+	Render_Pool* pool = render_pool_new(0, 16);
+	Framebuffer* fb = framebuffer_new(width, height);
+	struct timespec start, first, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double one_shot_secs = (end.tv_sec - start.tv_sec) 
+						 + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+	_store_frame(fb);
+
+	framebuffer_clear(fb);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t pass = 0; pass < cam.samples_per_pixel; pass++)
+	{
+		render_pool_render_pass(pool, &cam, scene, fb, 1, 0, 0, width, height);
+		if (pass == 0)
+			clock_gettime(CLOCK_MONOTONIC, &first);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double first_secs = (first.tv_sec - start.tv_sec) 
+					  + (first.tv_nsec - start.tv_nsec) * 1.0E-9;
+	double progressive_secs = (end.tv_sec - start.tv_sec) 
+							+ (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+
+	double max_diff = 0.0;
+	for (size_t y = 0; y < height; y++)
+	{
+		for (size_t x = 0; x < width; x++)
+		{
+			Vector diff = vec_sub(framebuffer_mean(fb, x, y), _frame[y * width + x]);
+			max_diff = max(max_diff, max(fabs(diff.x), max(fabs(diff.y), fabs(diff.z))));
+		}
+	}
+
+	printf("One-shot: %fs, progressive: first frame %fs, total %fs\n", 
+		   one_shot_secs, first_secs, progressive_secs);
+	printf("Largest difference from the one-shot image: %g\n", max_diff);
+	render_pool_free(pool);
+	framebuffer_free(fb);
+}
+
+static int _compare_doubles(const void* a, const void* b)
+{
+	double diff = *(const double*) a - *(const double*) b;
+	return (diff > 0.0) - (diff < 0.0);
+}
 
 /*
- * Initializes all required components, constructs a scene, and opens a render 
- * window to start rendering. Periodically polls window events, however this can 
- * be a little laggy especially when rendering with high settings. It may be 
- * necessary to force quit the application if you want to  close prematurely 
- * if the render is very demanding.
+ * Compares the gamma corrected image in (fb) to the reference image (ref) and 
+ * stores the root mean square difference over every pixel in (rmse), and the 
+ * difference that 99% of the pixels are below in (p99). The noisiest pixels are 
+ * what stands out when looking at an image, so p99 tracks perceived noise better 
+ * than the mean.
  */
-void _run(void)
+static void _display_error(Framebuffer* fb, Vector* ref, double* rmse, double* p99)
 {
-	size_t screen_width = 100;
-	size_t screen_height = 100;
-#ifdef DEBUG
-	screen_width = 200;
-	screen_height = 113;
-#elif RELEASE
-	screen_width = 800;
-	screen_height = 450;
-#endif
+	size_t count = fb->width * fb->height;
+	double* errors = malloc(sizeof(double) * count);
+	double sum = 0.0;
+	for (size_t i = 0; i < count; i++)
+	{
+		Vector a = framebuffer_mean(fb, i % fb->width, i / fb->width);
+		Vector b = ref[i];
+		double dx = sqrt(max(a.x, 0.0)) - sqrt(max(b.x, 0.0));
+		double dy = sqrt(max(a.y, 0.0)) - sqrt(max(b.y, 0.0));
+		double dz = sqrt(max(a.z, 0.0)) - sqrt(max(b.z, 0.0));
+		double err2 = (dx * dx + dy * dy + dz * dz) / 3.0;
+		errors[i] = sqrt(err2);
+		sum += err2;
+	}
+	qsort(errors, count, sizeof(double), &_compare_doubles);
+	*rmse = sqrt(sum / (double) count);
+	*p99 = errors[count * 99 / 100];
+	free(errors);
+}
 
-	init_renderer(screen_width, screen_height);
+/*
+ * Renders a converged reference of the model scene, then renders it with a fixed 
+ * amount of samples per pixel and with adaptive sampling at a few thresholds, 
+ * and reports the error against the reference (see _display_error) and the 
+ * average samples per pixel of each.
+ */
+void _test_adaptive(void)
+{
+	printf("Testing adaptive sampling:\n");
+	size_t width = 160;
+	size_t height = 90;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam.max_ray_bounces = 15;
+	cam.seed = 7;
 
-	Camera* cam;
-	if ((cam = malloc(sizeof(Camera))) != NULL)
-		cam_init(cam, screen_width, screen_height);
-	else 
+	static Vector reference[160 * 90];
+	Render_Pool* pool = render_pool_new(0, 16);
+	Framebuffer* fb = framebuffer_new(width, height);
+	cam.samples_per_pixel = 256;
+	render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+	_store_frame(fb);
+	memcpy(reference, _frame, sizeof(_frame));
+	cam.seed = 8; // independent of the reference
+
+	size_t fixed_spp[3] = {16, 32, 64};
+	for (size_t i = 0; i < 3; i++)
 	{
-		fprintf(stderr, "malloc failed in main\n");
-		exit(1);
+		framebuffer_clear(fb);
+		cam.samples_per_pixel = fixed_spp[i];
+		cam.adaptive_threshold = 0.0;
+		render_pool_render_pass(pool, &cam, scene, fb, fixed_spp[i], 0, 0, width, height);
+		double rmse, p99;
+		_display_error(fb, reference, &rmse, &p99);
+		printf("Fixed %zu spp: rmse %f, p99 %f\n", fixed_spp[i], rmse, p99);
 	}
 
-	// Uncomment the one you want to render, or make your own!
-	// Hittable_List* scene = build_demo_scene(cam);
-	Hittable_List* scene = build_model_scene(cam);
+	double thresholds[3] = {0.02, 0.01, 0.005};
+	for (size_t i = 0; i < 3; i++)
+	{
+		framebuffer_clear(fb);
+		cam.samples_per_pixel = 256;
+		cam.min_samples_per_pixel = 8;
+		cam.adaptive_threshold = thresholds[i];
+		size_t traced = 0;
+		size_t pass_traced;
+		while ((pass_traced = render_pool_render_pass(pool, &cam, scene, fb, 4, 
+													  0, 0, width, height)) > 0)
+			traced += pass_traced;
+		double rmse, p99;
+		_display_error(fb, reference, &rmse, &p99);
+		printf("Adaptive (threshold %.3f, 8-256 spp): rmse %f, p99 %f, %.1f spp on average\n", 
+			   thresholds[i], rmse, p99, (double) traced / (double) (width * height));
+	}
 
-	cam_calculate_matrices(cam, screen_width, screen_height);
+	render_pool_free(pool);
+	framebuffer_free(fb);
+}
 
-	SDL_Event e;
-	uint16_t start_row = 0;
+/*
+ * Renders the model scene with a high bounce limit, first with every path 
+ * followed to the end and then with russian roulette, and reports the average 
+ * path depth and render time of each, the difference in average brightness, and 
+ * the depth histogram of both. Roulette should shorten the paths without making 
+ * the image darker or brighter.
+ */
+void _test_roulette(void)
+{
+	printf("Testing russian roulette:\n");
+	size_t width = 160;
+	size_t height = 90;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam.samples_per_pixel = 32;
+	cam.max_ray_bounces = 50;
+	cam.seed = 11;
 
-	bool quit = false;
-	bool render = true;
-	while (!quit)
+	Render_Pool* pool = render_pool_new(0, 16);
+	Framebuffer* fb = framebuffer_new(width, height);
+	uint16_t roulette_depths[2] = {UINT16_MAX, 3};
+	uint64_t hists[2][CAM_DEPTH_BINS] = {{0}};
+	double brightness[2];
+	for (size_t i = 0; i < 2; i++)
 	{
-		while (SDL_PollEvent(&e))
+		cam.roulette_depth = roulette_depths[i];
+		cam.depth_hist = hists[i];
+		struct timespec start, end;
+		framebuffer_clear(fb);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+		_store_frame(fb);
+
+		brightness[i] = 0.0;
+		for (size_t j = 0; j < width * height; j++)
+			brightness[i] += (_frame[j].x + _frame[j].y + _frame[j].z) / 3.0;
+		brightness[i] /= (double) (width * height);
+
+		uint64_t paths = 0;
+		uint64_t bounces = 0;
+		for (size_t j = 0; j < CAM_DEPTH_BINS; j++)
 		{
-			switch (e.type){
-			case (SDL_EVENT_WINDOW_CLOSE_REQUESTED):
-				quit = true;
-				break;
-			default:
-				break;
+			paths += hists[i][j];
+			bounces += hists[i][j] * j;
+		}
+		printf("%s: %fs, %.3f bounces per path on average, brightness %f\n", 
+			   (i == 0) ? "Without roulette" : "Roulette after 3 bounces", secs, 
+			   (double) bounces / (double) paths, brightness[i]);
+	}
+	printf("Brightness difference: %+.3f%%\n", 
+		   100.0 * (brightness[1] - brightness[0]) / brightness[0]);
+
+	printf("Depth    without       roulette\n");
+	for (size_t j = 0; j < CAM_DEPTH_BINS; j++)
+	{
+		if ((hists[0][j] == 0) && (hists[1][j] == 0))
+			continue;
+		printf("%s%-6zu %-13lu %lu\n", (j == CAM_DEPTH_BINS - 1) ? ">=" : "  ", j, 
+			   (unsigned long) hists[0][j], (unsigned long) hists[1][j]);
+	}
+
+	cam.depth_hist = NULL;
+	render_pool_free(pool);
+	framebuffer_free(fb);
+}
+
+/*
+ * Renders the demo and model scenes with each sampler at a few sample counts and 
+ * reports the error against a converged reference (see _display_error). The 
+ * reference uses a different seed so its own noise is not shared with any of 
+ * the renders.
+ */
+void _test_samplers(void)
+{
+	printf("Testing samplers:\n");
+	size_t width = 80;
+	size_t height = 45;
+	static Vector reference[80 * 45];
+	Hittable_List* (*builders[2])(Camera*) = {&build_demo_scene, &build_model_scene};
+	const char* scene_names[2] = {"demo", "model"};
+	Sampler_Type types[3] = {SAMPLER_RANDOM, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE};
+	const char* type_names[3] = {"random", "sobol", "blue noise"};
+	size_t spps[3] = {4, 16, 64};
+
+	Render_Pool* pool = render_pool_new(0, 16);
+	Framebuffer* fb = framebuffer_new(width, height);
+	for (size_t i = 0; i < 2; i++)
+	{
+		Camera cam;
+		cam_init(&cam, width, height);
+		Hittable_List* scene = builders[i](&cam);
+		cam_calculate_matrices(&cam, width, height);
+		cam.max_ray_bounces = 15;
+		cam.sampler = SAMPLER_SOBOL;
+		cam.seed = 21;
+		cam.samples_per_pixel = 1024;
+		framebuffer_clear(fb);
+		render_pool_render_pass(pool, &cam, scene, fb, 1024, 0, 0, width, height);
+		for (size_t j = 0; j < width * height; j++)
+			reference[j] = framebuffer_mean(fb, j % width, j / width);
+
+		printf("%s scene, rmse at", scene_names[i]);
+		for (size_t k = 0; k < 3; k++)
+			printf(" %zu spp%s", spps[k], (k < 2) ? "," : "\n");
+		cam.seed = 22;
+		for (size_t t = 0; t < 3; t++)
+		{
+			cam.sampler = types[t];
+			printf("  %-11s", type_names[t]);
+			for (size_t k = 0; k < 3; k++)
+			{
+				framebuffer_clear(fb);
+				cam.samples_per_pixel = spps[k];
+				render_pool_render_pass(pool, &cam, scene, fb, spps[k], 0, 0, 
+										width, height);
+				double rmse, p99;
+				_display_error(fb, reference, &rmse, &p99);
+				printf(" %f", rmse);
 			}
+			printf("\n");
+		}
+	}
+	render_pool_free(pool);
+	framebuffer_free(fb);
+}
+
+/*
+ * Returns the seconds between (start) and (end).
+ */
+static double _secs_between(struct timespec start, struct timespec end)
+{
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+}
+
+/*
+ * Times the random direction and disk kernels, and the diffuse scatter kernels 
+ * on pregenerated samples and normals, and checks their distributions: for a 
+ * cosine weighted hemisphere the mean cosine to the normal is 2/3, for an even 
+ * unit disk the mean squared radius is 1/2, and for an even sphere the mean of 
+ * each axis is 0.
+ */
+void _test_scatter_sampling(void)
+{
+	printf("Testing sampling kernels:\n");
+	size_t count = 10000000;
+	struct timespec start, end;
+	Rng_Ctx rng;
+	rng_ctx_seed(&rng, 9);
+
+	Vector sum = {0.0, 0.0, 0.0};
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < count; i++)
+		sum = vec_add(sum, vec_rndm_unit(&rng));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("vec_rndm_unit: %.1fns, mean (%.4f %.4f %.4f)\n", 
+		   _secs_between(start, end) * 1.0E9 / (double) count, 
+		   sum.x / (double) count, sum.y / (double) count, sum.z / (double) count);
+
+	double r2_sum = 0.0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < count; i++)
+		r2_sum += vec_length2(vec_rndm_in_unit_disk(&rng));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("vec_rndm_in_unit_disk: %.1fns, mean squared radius %.4f\n", 
+		   _secs_between(start, end) * 1.0E9 / (double) count, r2_sum / (double) count);
+
+	size_t batch = 4096;
+	size_t rounds = count / batch;
+	Vector* samples = malloc(sizeof(Vector) * batch);
+	Vector* norms = malloc(sizeof(Vector) * batch);
+	Vector* dirs = malloc(sizeof(Vector) * batch);
+	for (size_t i = 0; i < batch; i++)
+	{
+		samples[i] = vec_rndm(&rng, 0.0, 1.0);
+		norms[i] = vec_rndm_unit(&rng);
+	}
+
+	double cos_sum = 0.0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t j = 0; j < rounds; j++)
+	{
+		for (size_t i = 0; i < batch; i++)
+		{
+			Vector dir = vec_unit(vec_add(norms[i], vec_map_to_unit(samples[i])));
+			cos_sum += vec_dot(dir, norms[i]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Normal plus unit vector: %.1fns, mean cosine %.4f\n", 
+		   _secs_between(start, end) * 1.0E9 / (double) (rounds * batch), 
+		   cos_sum / (double) (rounds * batch));
+
+	cos_sum = 0.0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t j = 0; j < rounds; j++)
+	{
+		for (size_t i = 0; i < batch; i++)
+		{
+			Vector dir = vec_map_to_cos_hemi(samples[i], norms[i]);
+			cos_sum += vec_dot(dir, norms[i]);
 		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Cosine hemisphere: %.1fns, mean cosine %.4f\n", 
+		   _secs_between(start, end) * 1.0E9 / (double) (rounds * batch), 
+		   cos_sum / (double) (rounds * batch));
+
+	cos_sum = 0.0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t j = 0; j < rounds; j++)
+	{
+		vec_map_to_cos_hemi_batch(samples, norms, dirs, batch);
+		for (size_t i = 0; i < batch; i++)
+			cos_sum += vec_dot(dirs[i], norms[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Cosine hemisphere batch: %.1fns, mean cosine %.4f\n", 
+		   _secs_between(start, end) * 1.0E9 / (double) (rounds * batch), 
+		   cos_sum / (double) (rounds * batch));
+
+	free(samples);
+	free(norms);
+	free(dirs);
+}
+
+/*
+ * Returns the contents of the file (path) and its size in (size), or NULL if it 
+ * cannot be read. The caller frees the contents.
+ */
+static uint8_t* _read_file(const char* path, size_t* size)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	*size = (size_t) ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t* data = malloc(*size);
+	if (fread(data, 1, *size, file) != *size)
+	{
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	return data;
+}
+
+/*
+ * Returns the display byte of the linear value (lin) for (op), computed in 
+ * double precision straight from the curves, as a reference for tonemap_rect.
+ */
+static uint32_t _exact_byte(double lin, Tonemap_Op op)
+{
+	lin = (lin > 0.0) ? lin : 0.0;
+	if (op == TONEMAP_GAMMA)
+		return (uint32_t) round(fmin(sqrt(lin), 1.0) * 255.0);
+
+	if (op == TONEMAP_ACES)
+	{
+		lin *= 0.6;
+		lin = (lin * (2.51 * lin + 0.03)) / (lin * (2.43 * lin + 0.59) + 0.14);
+	}
+	lin = fmin(lin, 1.0);
+	double srgb = (lin <= 0.0031308) ? 12.92 * lin : 1.055 * pow(lin, 1.0 / 2.4) - 0.055;
+	return (uint32_t) round(srgb * 255.0);
+}
+
+static uint32_t* _old_pixels;
+
+/*
+ * The per pixel display write that render threads used to call for every pixel 
+ * of every pass, kept to compare against tonemap_rect.
+ */
+static void _old_set_pixel(size_t x, size_t y, Vector colour)
+{
+	colour.x = (colour.x < 0.0) ? 0.0 : sqrt(colour.x);
+	colour.y = (colour.y < 0.0) ? 0.0 : sqrt(colour.y);
+	colour.z = (colour.z < 0.0) ? 0.0 : sqrt(colour.z);
+	uint32_t r = round(colour.x * 255.0);
+	uint32_t g = round(colour.y * 255.0);
+	uint32_t b = round(colour.z * 255.0);
+	_old_pixels[y * 800 + x] = (r << 16) | (g << 8) | (b);
+}
+
+/*
+ * Fills a framebuffer whose width is not a multiple of 8 with random sums and 
+ * sample counts (including empty pixels and values far outside 0-1), maps it 
+ * with each curve, and checks that the whole rows (AVX2 where supported) match 
+ * pixels mapped one at a time (the scalar code) exactly, and are at most 1 from 
+ * the curves computed in double precision. Then times mapping an 800x450 image 
+ * with each curve against the old per pixel write through a function pointer, 
+ * and on every thread of a render pool.
+ */
+void _test_tonemap(void)
+{
+	printf("Testing tonemapping:\n");
+	size_t width = 203;
+	size_t height = 61;
+	Framebuffer* fb = framebuffer_new(width, height);
+	Rng_Ctx rng;
+	rng_ctx_seed(&rng, 5);
+	for (size_t i = 0; i < width * height; i++)
+	{
+		uint32_t count = (uint32_t) (rng_ctx_01(&rng) * 17.0);
+		double scale = (double) count * pow(10.0, rng_ctx_01(&rng) * 5.0 - 4.0);
+		Vector sum = {(rng_ctx_01(&rng) - 0.05) * scale, rng_ctx_01(&rng) * scale, 
+					  rng_ctx_01(&rng) * scale};
+		framebuffer_add_sum(fb, i % width, i / width, sum, count);
+	}
 
-		if (render)
+	Tonemap_Op ops[3] = {TONEMAP_GAMMA, TONEMAP_SRGB, TONEMAP_ACES};
+	const char* op_names[3] = {"gamma", "srgb", "aces"};
+	uint32_t* rows = malloc(sizeof(uint32_t) * width * height);
+	uint32_t* single = malloc(sizeof(uint32_t) * width * height);
+	for (size_t k = 0; k < 3; k++)
+	{
+		size_t pitch = sizeof(uint32_t) * width;
+		tonemap_rect(fb, ops[k], rows, pitch, 0, 0, width, height);
+		size_t mismatches = 0;
+		uint32_t max_error = 0;
+		for (size_t i = 0; i < width * height; i++)
 		{
-			size_t end_row = (size_t) (start_row + 1);
-			if (end_row >= screen_height) 
+			size_t x = i % width;
+			size_t y = i / width;
+			tonemap_rect(fb, ops[k], single, pitch, x, y, x + 1, y + 1);
+			mismatches += (rows[i] != single[i]);
+
+			Vector mean = framebuffer_mean(fb, x, y);
+			double chans[3] = {mean.x, mean.y, mean.z};
+			for (size_t c = 0; c < 3; c++)
 			{
-				end_row = screen_height;
-				render = false;
+				uint32_t byte = (rows[i] >> (16 - 8 * c)) & 0xFF;
+				uint32_t exact = _exact_byte(chans[c], ops[k]);
+				uint32_t error = (byte > exact) ? byte - exact : exact - byte;
+				max_error = (error > max_error) ? error : max_error;
 			}
+			mismatches += ((rows[i] >> 24) != 0xFF);
+		}
+		printf("%-5s: rows and single pixels differ at %zu pixels, most off from "
+			   "exact: %u\n", op_names[k], mismatches, max_error);
+	}
+	free(rows);
+	free(single);
+	framebuffer_free(fb);
+
+	width = 800;
+	height = 450;
+	size_t repeats = 20;
+	fb = framebuffer_new(width, height);
+	for (size_t i = 0; i < width * height; i++)
+	{
+		Vector sum = {rng_ctx_01(&rng) * 4.0, rng_ctx_01(&rng) * 4.0, rng_ctx_01(&rng) * 4.0};
+		framebuffer_add_sum(fb, i % width, i / width, sum, 4);
+	}
+	_old_pixels = malloc(sizeof(uint32_t) * width * height);
+	void (*set_pixel)(size_t, size_t, Vector) = &_old_set_pixel;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t r = 0; r < repeats; r++)
+		for (size_t y = 0; y < height; y++)
+			for (size_t x = 0; x < width; x++)
+				set_pixel(x, y, framebuffer_mean(fb, x, y));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double old_secs = _secs_between(start, end) / (double) repeats;
+	printf("800x450 per pixel set_pixel: %.3fms (%.2f ns/pixel)\n", old_secs * 1.0E3, 
+		   old_secs * 1.0E9 / (double) (width * height));
+
+	Render_Pool* pool = render_pool_new(0, 16);
+	for (size_t k = 0; k < 3; k++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t r = 0; r < repeats; r++)
+			tonemap_rect(fb, ops[k], _old_pixels, sizeof(uint32_t) * width, 0, 0, 
+						 width, height);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double secs = _secs_between(start, end) / (double) repeats;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t r = 0; r < repeats; r++)
+			render_pool_tonemap(pool, fb, ops[k], _old_pixels, sizeof(uint32_t) * width);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double pool_secs = _secs_between(start, end) / (double) repeats;
+		printf("800x450 %-5s: %.3fms (%.2f ns/pixel, %.1fx), %zu threads: %.3fms\n", 
+			   op_names[k], secs * 1.0E3, secs * 1.0E9 / (double) (width * height), 
+			   old_secs / secs, pool->thread_count, pool_secs * 1.0E3);
+	}
+	render_pool_free(pool);
+	free(_old_pixels);
+	framebuffer_free(fb);
+}
+
+/*
+ * Returns the total amount of samples in the framebuffer.
+ */
+static uint64_t _total_samples(Framebuffer* fb)
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < fb->width * fb->height; i++)
+		total += fb->samples[i];
+	return total;
+}
+
+/*
+ * Renders the model scene with the release settings (800x450, 200 spp, 75 
+ * bounces, adaptive sampling) with a render worker, stops it at a few points of 
+ * the render, and reports how long each stop takes, which is how long closing 
+ * or resizing the window takes to respond. Checks that nothing is added to the 
+ * framebuffer once the worker has stopped. Also reports the time of one full 
+ * pass, which is how long the window went without handling events back when it 
+ * rendered on its own thread.
+ */
+void _test_render_worker(void)
+{
+	printf("Testing render worker cancellation:\n");
+	size_t width = 800;
+	size_t height = 450;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam_calculate_matrices(&cam, width, height);
+	cam.samples_per_pixel = 200;
+	cam.min_samples_per_pixel = 16;
+	cam.adaptive_threshold = 0.01;
+	cam.max_ray_bounces = 75;
 
-			double tmp = ((double) end_row / (double) screen_height) * 100.0;
-			size_t percent_complete = round(tmp);
-			printf("\r%zu%%", percent_complete);
-			fflush(stdout);
+	Render_Pool* pool = render_pool_new(0, 16);
+	Framebuffer* fb = framebuffer_new(width, height);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	render_pool_render_pass(pool, &cam, scene, fb, 1, 0, 0, width, height);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double pass_ms = _secs_between(start, end) * 1.0E3;
+
+	Render_Worker* worker = render_worker_new(pool, &cam, scene, fb);
+	size_t delays_ms[6] = {0, 5, 20, 50, 120, 300};
+	double total_ms = 0.0;
+	double worst_ms = 0.0;
+	size_t changed = 0;
+	for (size_t i = 0; i < 6; i++)
+	{
+		render_worker_restart(worker);
+		usleep(delays_ms[i] * 1000);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		render_worker_stop(worker);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double stop_ms = _secs_between(start, end) * 1.0E3;
+		total_ms += stop_ms;
+		worst_ms = (stop_ms > worst_ms) ? stop_ms : worst_ms;
+
+		size_t samples = render_worker_samples(worker);
+		uint64_t fb_samples = _total_samples(fb);
+		usleep(20000);
+		changed += (render_worker_samples(worker) != samples) 
+				 || (_total_samples(fb) != fb_samples);
+		printf("Stopped after %3zums (%.2f spp done): %.3fms\n", delays_ms[i], 
+			   (double) samples / (double) (width * height), stop_ms);
+	}
+	printf("One full pass (event latency before): %.1fms, stop average: %.3fms, "
+		   "worst: %.3fms, renders that changed after stopping: %zu\n", 
+		   pass_ms, total_ms / 6.0, worst_ms, changed);
+
+	render_worker_free(worker);
+	render_pool_free(pool);
+	framebuffer_free(fb);
+}
+
+/*
+ * Renders the model scene with the release settings through a render worker 
+ * with an 8 pixel preview, and reports when each stage of the preview (1/8, 
+ * 1/4 and 1/2 resolution) and the first full pass become visible. Then turns 
+ * the camera in the middle of a pass, like dragging the mouse, and reports how 
+ * long the stale render takes to stop and the new 1/8 preview takes to appear. 
+ * Checks that the hole filling leaves no pixel unwritten once the preview is 
+ * done.
+ */
+void _test_preview_stages(void)
+{
+	printf("Testing interactive preview stages:\n");
+	size_t width = 800;
+	size_t height = 450;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam_calculate_matrices(&cam, width, height);
+	cam.samples_per_pixel = 200;
+	cam.min_samples_per_pixel = 16;
+	cam.adaptive_threshold = 0.01;
+	cam.max_ray_bounces = 75;
 
-			cam_render_section(&set_pixel, cam, scene, 0, 
-							   start_row, screen_width, end_row);
-			update_render_window();
+	Render_Pool* pool = render_pool_new(0, 16);
+	Framebuffer* fb = framebuffer_new(width, height);
+	Render_Worker* worker = render_worker_new(pool, &cam, scene, fb);
+	worker->preview_block = 8;
 
-			if (render == false) printf("\rRender complete\n");
-			start_row = end_row;
-		} 
-		else 
+	struct timespec start, now;
+	double stage_ms[4] = {0.0}; // 1/8, 1/4, 1/2 and the first full pass
+	size_t preview_samples = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	render_worker_restart(worker);
+	for (size_t stage = 0; stage < 4;)
+	{
+		size_t block = render_worker_stage(worker);
+		size_t samples = render_worker_samples(worker);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((stage < 3) && (block < (8u >> stage)))
 		{
-			SDL_Delay(10);
+			stage_ms[stage++] = _secs_between(start, now) * 1.0E3;
+			preview_samples = samples;
 		}
+		else if ((stage == 3) && (samples >= preview_samples + width * height))
+			stage_ms[stage++] = _secs_between(start, now) * 1.0E3;
+		else
+			usleep(100);
 	}
-	free(cam);
-	free(scene);
-	close_render_window();
-	printf("\n");
+	render_worker_stop(worker);
+
+	size_t pitch = sizeof(uint32_t) * width;
+	uint32_t* pixels = malloc(pitch * height);
+	for (size_t i = 0; i < width * height; i++)
+		pixels[i] = 0xDEADBEEF; // no colour tonemap_rect writes has an alpha of DE
+	tonemap_rect(fb, TONEMAP_GAMMA, pixels, pitch, 0, 0, width, height);
+	tonemap_fill_holes(fb, pixels, pitch, 8);
+	size_t unwritten = 0;
+	for (size_t i = 0; i < width * height; i++)
+		unwritten += pixels[i] == 0xDEADBEEF;
+	free(pixels);
+	printf("1/8: %.1fms, 1/4: %.1fms, 1/2: %.1fms, first full pass: %.1fms "
+		   "(%zu samples traced by the preview), unwritten pixels: %zu\n", 
+		   stage_ms[0], stage_ms[1], stage_ms[2], stage_ms[3], preview_samples, 
+		   unwritten);
+
+	render_worker_restart(worker);
+	usleep(200000);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	render_worker_stop(worker);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double stop_ms = _secs_between(start, now) * 1.0E3;
+	cam_turn(&cam, 0.05, 0.02);
+	cam_calculate_matrices(&cam, width, height);
+	render_worker_restart(worker);
+	while (render_worker_stage(worker) == 8)
+		usleep(100);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	render_worker_stop(worker);
+	printf("Camera moved mid pass: stopped in %.3fms, new 1/8 preview after %.1fms\n", 
+		   stop_ms, _secs_between(start, now) * 1.0E3);
+
+	render_worker_free(worker);
+	render_pool_free(pool);
+	framebuffer_free(fb);
 }
-#endif
 
-#ifdef UNIT_TEST
-#include "random.h"
-#include "obj_importer.h"
+/*
+ * Writes made up benchmark results as CSV and JSON, reads them back and checks 
+ * that every field survives (to the precision written), then checks that 
+ * bench_compare flags a 10% slowdown and a 10% memory growth at a 5% threshold 
+ * but not a 2% slowdown, and skips a scene rendered at another size.
+ */
+void _test_benchmark(void)
+{
+	printf("Testing benchmark results:\n");
+	Bench_Result base[3];
+	for (size_t i = 0; i < 3; i++)
+	{
+		Bench_Result res = {"", 320, 180, 16, 4, 0.25 * i, 1.5 + i, 2.0E6 / (i + 1), 
+							1.0E6 + i, 0.0, 5000 + 1000 * (long) i};
+		snprintf(res.scene, sizeof(res.scene), "scene_%zu", i);
+		res.mrays_per_sec = (res.samples_per_sec + res.secondary_per_sec) * 1.0E-6;
+		base[i] = res;
+	}
 
-#include <stdint.h>
-#include <stdio.h>
-#include <time.h>
-#include <math.h>
+	const char* paths[2] = {"test_bench.csv", "test_bench.json"};
+	for (size_t p = 0; p < 2; p++)
+	{
+		Bench_Result read[BENCH_MAX_RESULTS];
+		size_t count = bench_write(paths[p], base, 3) ? bench_read(paths[p], read) : 0;
+		remove(paths[p]);
+		size_t errors = (count != 3);
+		for (size_t i = 0; (i < count) && (i < 3); i++)
+		{
+			errors += (strcmp(read[i].scene, base[i].scene) != 0) 
+					+ (read[i].width != base[i].width) + (read[i].height != base[i].height)
+					+ (read[i].samples_per_pixel != base[i].samples_per_pixel)
+					+ (read[i].thread_count != base[i].thread_count)
+					+ (fabs(read[i].render_secs - base[i].render_secs) > 1.0E-6)
+					+ (fabs(read[i].samples_per_sec - base[i].samples_per_sec) > 0.1)
+					+ (fabs(read[i].mrays_per_sec - base[i].mrays_per_sec) > 1.0E-4)
+					+ (read[i].peak_rss_kb != base[i].peak_rss_kb);
+		}
+		printf("%s: %zu results read back, %zu mismatched fields\n", paths[p], count, 
+			   errors);
+	}
 
-void _test_obj_import(char* file_name)
+	Bench_Result results[3] = {base[0], base[1], base[2]};
+	results[0].mrays_per_sec *= 0.9;
+	results[1].mrays_per_sec *= 0.98;
+	results[1].peak_rss_kb = base[1].peak_rss_kb * 11 / 10;
+	results[2].width = 640;
+	size_t regressions = bench_compare(base, 3, results, 3, 5.0);
+	printf("Regressions found: %zu (expected 2)\n", regressions);
+}
+
+/*
+ * Renders the model scene with 1 thread and with every core, and checks that 
+ * the hot path counters add up: every path ends in exactly one way, every ray 
+ * is a camera ray or a bounce that was not ended before it was cast, the cost 
+ * of the pixels adds up to the box and primitive tests, and the totals do not 
+ * depend on the amount of threads. Then writes the cost heatmap.
+ */
+void _test_stats(void)
 {
-	printf("Testing OBJ file importing:\n");
-	printf("Importing: %s\n", file_name);
-	Vector white = {1.0, 1.0, 1.0};
-	Material diff_white = {DIFFUSE, white, 0.0};
-	Obj_Object* obj = parse_obj_file(file_name, 0.0, 0.0, 0.0, diff_white);
+	printf("Testing render stats:\n");
+	if (!stats_enabled())
+	{
+		printf("Counters are compiled out, build with -DRENDER_STATS to test them\n");
+		return;
+	}
+
+	size_t width = 160;
+	size_t height = 90;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_model_scene(&cam);
+	cam_calculate_matrices(&cam, width, height);
+	cam.samples_per_pixel = 8;
+	cam.adaptive_threshold = 0.0;
+	cam.max_ray_bounces = 10;
+	cam.seed = 5;
+
+	Framebuffer* fb = framebuffer_new(width, height);
+	Render_Stats stats[2];
+	size_t thread_counts[2] = {1, 0};
+	for (size_t i = 0; i < 2; i++)
+	{
+		Render_Pool* pool = render_pool_new(thread_counts[i], 16);
+		framebuffer_clear(fb);
+		stats_reset();
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		stats_total(&stats[i]);
+		size_t threads = pool->thread_count;
+		render_pool_free(pool);
+
+		Render_Stats* s = &stats[i];
+		uint64_t cost = 0;
+		for (size_t j = 0; j < width * height; j++)
+			cost += fb->cost[j];
+		bool ends = s->escaped + s->roulette + s->max_depth == s->samples;
+		bool rays = s->rays == s->samples + s->bounces - s->roulette - s->max_depth;
+		bool costs = cost == s->box_tests + s->sphere_tests + s->tri_tests 
+						   + s->instance_tests;
+		printf("%zu thread(s), %.3fs: %llu samples (expected %zu), path ends add up: %s, "
+			   "rays add up: %s, pixel costs add up: %s\n", 
+			   threads, _secs_between(start, end), 
+			   (unsigned long long) s->samples, width * height * 8, ends ? "yes" : "no", 
+			   rays ? "yes" : "no", costs ? "yes" : "no");
+	}
+	printf("Totals equal across thread counts: %s\n", 
+		   (memcmp(&stats[0], &stats[1], sizeof(Render_Stats)) == 0) ? "yes" : "no");
+	stats_print(&stats[1], stdout);
+
+	uint32_t* pixels = malloc(sizeof(uint32_t) * width * height);
+	framebuffer_cost_heatmap(fb, pixels, sizeof(uint32_t) * width);
+	size_t size = 0;
+	uint8_t* file = NULL;
+	if (image_write_pixels(pixels, width, height, "test_cost.ppm"))
+		file = _read_file("test_cost.ppm", &size);
+	remove("test_cost.ppm");
+	printf("Cost heatmap written: %s\n", (file != NULL) && (size > 3 * width * height) 
+		   ? "yes" : "no");
+	free(file);
+	free(pixels);
+	framebuffer_free(fb);
+}
+
+/*
+ * Returns the amount of times (needle) appears in (text).
+ */
+static size_t _count_str(const char* text, const char* needle)
+{
+	size_t count = 0;
+	for (const char* s = strstr(text, needle); s != NULL; s = strstr(s + 1, needle))
+		count++;
+	return count;
+}
+
+/*
+ * Renders the demo scene before and after tracing is started and writes the 
+ * trace each time. Before, the file must hold no events, after, one event per 
+ * tile with its coordinates and a name for every render thread. Tracing cannot 
+ * be stopped, so this runs after every other test.
+ */
+void _test_trace(void)
+{
+	printf("Testing trace:\n");
+	size_t width = 200;
+	size_t height = 120;
+	Camera cam;
+	cam_init(&cam, width, height);
+	Hittable_List* scene = build_demo_scene(&cam);
+	cam_calculate_matrices(&cam, width, height);
+	cam.samples_per_pixel = 4;
+	cam.adaptive_threshold = 0.0;
+	Framebuffer* fb = framebuffer_new(width, height);
+	Render_Pool* pool = render_pool_new(4, 16);
+	size_t tiles = ((width + 15) / 16) * ((height + 15) / 16);
+
+	for (size_t i = 0; i < 2; i++)
+	{
+		if (i == 1)
+		{
+			trace_thread_name("test");
+			trace_start();
+		}
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		render_pool_render(pool, &cam, scene, fb, 0, 0, width, height);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		size_t size = 0;
+		char* file = NULL;
+		if (trace_write("test_trace.json"))
+			file = (char*) _read_file("test_trace.json", &size);
+		remove("test_trace.json");
+		if (file == NULL)
+		{
+			printf("Trace written: no\n");
+			continue;
+		}
+		file = realloc(file, size + 1);
+		file[size] = '\0';
+		bool closed = (size > 4) && (strcmp(file + size - 4, "\n]}\n") == 0);
+		printf("Tracing %s, %.3fs: %zu tile events (expected %zu), %zu with "
+			   "coordinates, %zu thread names (expected %zu), JSON closed: %s\n", 
+			   (i == 0) ? "off" : "on", _secs_between(start, end), 
+			   _count_str(file, "\"cam_render_section\""), (i == 0) ? 0 : tiles, 
+			   _count_str(file, "\"args\": {\"x\""), 
+			   _count_str(file, "\"thread_name\""), (i == 0) ? 0 : pool->thread_count, 
+			   closed ? "yes" : "no");
+		free(file);
+	}
+
+	render_pool_free(pool);
+	framebuffer_free(fb);
+	free(scene);
+}
+
+/*
+ * Writes a gradient with out of range values to PPM, PNG and PFM files, reads 
+ * them back and checks that the PPM pixels are the bytes shown in the window 
+ * (see tonemap_rect), that the stored blocks of the PNG hold the same pixels, 
+ * and that the PFM holds the linear means bottom row first. Then times writing an 800x450 
+ * image in each format.
+ */
+void _test_image_writer(void)
+{
+	printf("Testing image writer:\n");
+	size_t width = 300; // rows of 901 bytes, so the PNG blocks split rows
+	size_t height = 80;
+	Framebuffer* fb = framebuffer_new(width, height);
+	for (size_t y = 0; y < height; y++)
+	{
+		for (size_t x = 0; x < width; x++)
+		{
+			Vector col = {(double) x / (double) width * 1.5 - 0.25, 
+						  (double) y / (double) height, 0.5};
+			framebuffer_add_sample(fb, x, y, col);
+		}
+	}
+
+	const char* paths[3] = {"test_image.ppm", "test_image.png", "test_image.pfm"};
+	size_t sizes[3];
+	uint8_t* files[3];
+	for (size_t i = 0; i < 3; i++)
+	{
+		if (!image_write(fb, paths[i], TONEMAP_SRGB) || ((files[i] = _read_file(paths[i], &sizes[i])) == NULL))
+		{
+			printf("Failed to write or read back %s\n", paths[i]);
+			return;
+		}
+		remove(paths[i]);
+	}
+
+	char header[32];
+	int header_len = snprintf(header, sizeof(header), "P6\n%zu %zu\n255\n", width, height);
+	size_t ppm_errors = (memcmp(files[0], header, header_len) != 0);
+	uint8_t* ppm = files[0] + header_len;
+	uint32_t* argb = malloc(sizeof(uint32_t) * width * height);
+	tonemap_rect(fb, TONEMAP_SRGB, argb, sizeof(uint32_t) * width, 0, 0, width, height);
+	for (size_t i = 0; i < width * height; i++)
+	{
+		ppm_errors += (ppm[3 * i] != (uint8_t) (argb[i] >> 16))
+					+ (ppm[3 * i + 1] != (uint8_t) (argb[i] >> 8))
+					+ (ppm[3 * i + 2] != (uint8_t) argb[i]);
+	}
+	free(argb);
+
+	// signature, IHDR chunk and zlib header, then stored blocks of 5 byte headers
+	size_t png_errors = (memcmp(files[1], "\x89PNG\r\n\x1A\n", 8) != 0);
+	size_t pos = 8 + 25 + 8 + 2;
+	size_t pixel = 0;
+	size_t row_byte = 0;
+	bool final = false;
+	while (!final && (pos + 5 <= sizes[1]))
+	{
+		final = files[1][pos] & 1;
+		size_t len = files[1][pos + 1] | (files[1][pos + 2] << 8);
+		pos += 5;
+		for (size_t i = 0; i < len; i++, row_byte = (row_byte + 1) % (3 * width + 1))
+		{
+			if (row_byte == 0)
+				png_errors += (files[1][pos + i] != 0);
+			else
+				png_errors += (files[1][pos + i] != ppm[pixel++]);
+		}
+		pos += len;
+	}
+	png_errors += (pixel != 3 * width * height) || (pos + 4 + 4 + 12 != sizes[1]);
+
+	header_len = snprintf(header, sizeof(header), "PF\n%zu %zu\n-1.0\n", width, height);
+	size_t pfm_errors = (memcmp(files[2], header, header_len) != 0);
+	const float* pfm = (const float*) (files[2] + header_len);
+	for (size_t i = 0; i < width * height; i++)
+	{
+		size_t x = i % width;
+		size_t y = height - 1 - i / width;
+		Vector mean = framebuffer_mean(fb, x, y);
+		pfm_errors += (pfm[3 * i] != (float) mean.x) || (pfm[3 * i + 1] != (float) mean.y) 
+					|| (pfm[3 * i + 2] != (float) mean.z);
+	}
+	printf("Mismatched bytes / values: ppm %zu, png %zu, pfm %zu\n", 
+		   ppm_errors, png_errors, pfm_errors);
+	for (size_t i = 0; i < 3; i++)
+		free(files[i]);
+	framebuffer_free(fb);
+
+	fb = framebuffer_new(800, 450);
+	for (size_t i = 0; i < 800 * 450; i++)
+	{
+		Vector col = {0.25, 0.5, 0.75};
+		framebuffer_add_sample(fb, i % 800, i / 800, col);
+	}
+	for (size_t i = 0; i < 3; i++)
+	{
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		image_write(fb, paths[i], TONEMAP_SRGB);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		remove(paths[i]);
+		printf("800x450 %s: %.2fms\n", paths[i] + 11, _secs_between(start, end) * 1.0E3);
+	}
+	framebuffer_free(fb);
 }
 
 void _test_rng(void)
@@ -151,14 +2629,40 @@ void _test_rng(void)
 }
 #endif
 
-int main(void) 
+#ifndef MICROBENCH // the microbenchmarks have their own entry point
+int main(int argc, char** argv) 
 {
 #ifdef UNIT_TEST 
+	(void) argc;
+	(void) argv;
 	_test_obj_import("res/porsche.obj");
+	_test_obj_threads("res/porsche.obj");
+	_test_bvh();
+	_test_bvh_builders();
+	_test_bvh_depth();
+	_test_instancing();
+	_test_tri_store();
+	_test_tri_kernel();
+	_test_render_allocs();
+	_test_render_pool();
+	_test_rng_streams();
+	_test_progressive();
+	_test_adaptive();
+	_test_roulette();
+	_test_samplers();
+	_test_scatter_sampling();
+	_test_image_writer();
+	_test_tonemap();
+	_test_render_worker();
+	_test_preview_stages();
+	_test_benchmark();
+	_test_stats();
+	_test_trace(); // starts tracing, so it must stay last
 	// _test_rng();
 #endif
 #ifndef UNIT_TEST
-	_run();
+	exit(_main(argc, argv));
 #endif
 	exit(0);
 }
+#endif
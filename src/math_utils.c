@@ -79,25 +79,40 @@ Vector vec_unit(Vector u)
 	return vec_div(u, vec_length(u));
 }
 
-Vector vec_rndm(double min, double max)
+Vector vec_rndm(Rng_Ctx* rng, double min, double max)
 {
-	Vector out = {(max - min) * rng_01() + min,
-				  (max - min) * rng_01() + min,
-				  (max - min) * rng_01() + min};
+	Vector out = {(max - min) * rng_ctx_01(rng) + min,
+				  (max - min) * rng_ctx_01(rng) + min,
+				  (max - min) * rng_ctx_01(rng) + min};
 	return out;
 }
 
-Vector vec_rndm_unit(void)
+/*
+ * The height (z) is spread evenly over -1 - 1 and the angle around the z axis 
+ * over a full turn, which covers the sphere evenly. Unlike rejection sampling, 
+ * every sample maps to exactly one direction, so evenly spread samples (see 
+ * sampler_2d) stay evenly spread on the sphere.
+ */
+Vector vec_map_to_unit(Vector sample)
 {
-	while (true)
-	{
-		Vector p = vec_rndm(-1.0, 1.0);
-		double len_squared = vec_length2(p);
-		if ((len_squared <= 1.0) && (len_squared > 1.0E-160))
-		{
-			return vec_div(p, sqrt(len_squared));
-		}
-	}
+	double z = 1.0 - 2.0 * sample.x;
+	double r = sqrt(fmax(0.0, 1.0 - z * z));
+	double phi = 2.0 * PI * sample.y;
+	Vector out = {r * cos(phi), r * sin(phi), z};
+	return out;
+}
+
+/*
+ * Maps two random numbers to the sphere (see vec_map_to_unit), which always 
+ * takes exactly two numbers where rejection sampling took almost six.
+ */
+Vector vec_rndm_unit(Rng_Ctx* rng)
+{
+	double z = 1.0 - 2.0 * rng_ctx_01(rng);
+	double r = sqrt(fmax(0.0, 1.0 - z * z));
+	double phi = 2.0 * PI * rng_ctx_01(rng);
+	Vector out = {r * cos(phi), r * sin(phi), z};
+	return out;
 }
 
 double vec_axis(Vector u, size_t axis_idx)
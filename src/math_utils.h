@@ -106,14 +106,21 @@ extern double vec_length(Vector u);
 extern Vector vec_unit(Vector u);
 
 /*
- * Returns a random vector with each component in the range min-max.
+ * Returns a random vector with each component in the range min-max, drawn from 
+ * the given rng stream.
  */
-extern Vector vec_rndm(double min, double max);
+extern Vector vec_rndm(Rng_Ctx* rng, double min, double max);
 
 /*
- * Returns a random unit vector (|u| = 1.0)
+ * Maps a point (sample) of the unit square (x and y in the range 0-1) to a unit
+ * vector, evenly covering the sphere.
  */
-extern Vector vec_rndm_unit(void);
+extern Vector vec_map_to_unit(Vector sample);
+
+/*
+ * Returns a random unit vector (|u| = 1.0), drawn from the given rng stream.
+ */
+extern Vector vec_rndm_unit(Rng_Ctx* rng);
 
 /*
  * Returns the axis corresponding to (axis_idx) of the vector: 0=x, 1=y, 2=z.
@@ -0,0 +1,469 @@
+#ifdef MICROBENCH // entry point of the kernel microbenchmarks, see build.sh --micro
+#ifdef __linux__
+#define _GNU_SOURCE // sched_setaffinity and sched_getcpu
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "math_utils.h"
+#include "random.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "sampler.h"
+#include "scatter.h"
+
+// compiler flags of the build, set by build.sh so results can be told apart
+#ifndef MICROBENCH_FLAGS
+#define MICROBENCH_FLAGS "unknown"
+#endif
+
+/*
+ * PRIVATE:
+ */
+
+#define _BATCH_SIZE 1024 	 // rays and primitives per batch, small enough for L2
+#define _BATCH_MASK (_BATCH_SIZE - 1)
+#define _REP_SECS 0.01 		 // time each repetition runs for
+#define _MAX_KERNELS 16
+
+/*
+ * Rays and primitives generated once, before anything is timed, so that the
+ * kernels only ever read memory that is already in cache.
+ */
+typedef struct _Batch {
+	Ray 	   rays[_BATCH_SIZE];  	// from a sphere of radius 4 towards the unit cube
+	AABB 	   boxes[_BATCH_SIZE]; 	// within the unit cube
+	Hittable*  spheres[_BATCH_SIZE];
+	Hittable*  tris[_BATCH_SIZE];
+	Vector 	   norms[_BATCH_SIZE];  // unit normals facing against the rays
+	Sampler    sampler;
+	Rng_Ctx    rng;
+} _Batch;
+
+/*
+ * Struct for a kernel and the loop that runs it (ops) times over the batch.
+ * Every loop adds up something from each result, which is stored in _sink so
+ * that the compiler cannot drop the calls.
+ */
+typedef struct _Kernel {
+	const char* name;
+	double 		(*run)(_Batch* batch, size_t ops);
+} _Kernel;
+
+/*
+ * Timings of one kernel over every repetition, in nanoseconds per call.
+ */
+typedef struct _Kernel_Result {
+	const char* name;
+	size_t 		reps;
+	size_t 		ops_per_rep;
+	double 		mean_ns, min_ns, stddev_ns;
+	double 		mops_per_sec; // million calls per second at the mean
+} _Kernel_Result;
+
+static volatile double _sink;
+
+/*
+ * Tests rays against boxes with AABB_hit, as every BVH node visit does.
+ */
+static double _run_aabb_hit(_Batch* batch, size_t ops)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < ops; i++)
+	{
+		Interval itvl = {0.001, INFINITY};
+		if (AABB_hit(batch->boxes[i & _BATCH_MASK], batch->rays[(i * 7) & _BATCH_MASK],
+					 &itvl))
+			sum += itvl.min;
+	}
+	return sum;
+}
+
+/*
+ * Tests rays against spheres, see _hit_sphere.
+ */
+static double _run_hit_sphere(_Batch* batch, size_t ops)
+{
+	double sum = 0.0;
+	Interval itvl = {0.001, INFINITY};
+	Hit_Record hit_rec;
+	for (size_t i = 0; i < ops; i++)
+		if (hittable_hit_primitive(batch->spheres[i & _BATCH_MASK],
+								   batch->rays[(i * 7) & _BATCH_MASK], itvl, &hit_rec))
+			sum += hit_rec.t;
+	return sum;
+}
+
+/*
+ * Tests rays against triangles, see _hit_tri.
+ */
+static double _run_hit_tri(_Batch* batch, size_t ops)
+{
+	double sum = 0.0;
+	Interval itvl = {0.001, INFINITY};
+	Hit_Record hit_rec;
+	for (size_t i = 0; i < ops; i++)
+		if (hittable_hit_primitive(batch->tris[i & _BATCH_MASK],
+								   batch->rays[(i * 7) & _BATCH_MASK], itvl, &hit_rec))
+			sum += hit_rec.t;
+	return sum;
+}
+
+/*
+ * Scatters rays off glass, hitting the front and back in turn.
+ */
+static double _run_scatter_glass(_Batch* batch, size_t ops)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < ops; i++)
+	{
+		Vector dir = scatter_glass(&batch->sampler, batch->rays[i & _BATCH_MASK].direction,
+								   batch->norms[i & _BATCH_MASK], i & 1, 1.5);
+		sum += dir.x;
+	}
+	return sum;
+}
+
+/*
+ * Draws random unit vectors from the batch's stream.
+ */
+static double _run_vec_rndm_unit(_Batch* batch, size_t ops)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < ops; i++)
+		sum += vec_rndm_unit(&batch->rng).x;
+	return sum;
+}
+
+/*
+ * Draws random numbers from the default stream of the thread.
+ */
+static double _run_rng_01(_Batch* batch, size_t ops)
+{
+	(void) batch;
+	double sum = 0.0;
+	for (size_t i = 0; i < ops; i++)
+		sum += rng_01();
+	return sum;
+}
+
+static const _Kernel _KERNELS[] = {
+	{"AABB_hit", _run_aabb_hit},
+	{"_hit_sphere", _run_hit_sphere},
+	{"_hit_tri", _run_hit_tri},
+	{"scatter_glass", _run_scatter_glass},
+	{"vec_rndm_unit", _run_vec_rndm_unit},
+	{"rng_01", _run_rng_01}
+};
+
+/*
+ * Fills the batch from a fixed seed, so every run times the same inputs. Rays
+ * aim at the cube the boxes and primitives lie in, so both the hit and the miss
+ * paths of each kernel are timed.
+ *
+ * This method allocates heap memory for the spheres and triangles. If the
+ * allocations fail, the application exits with code 1.
+ */
+static void _fill_batch(_Batch* batch)
+{
+	Rng_Ctx* rng = &batch->rng;
+	rng_ctx_seed(rng, 1);
+	rng_set_seed(1);
+	Material mat = {DIFFUSE, {0.5, 0.5, 0.5}, 0.0};
+	for (size_t i = 0; i < _BATCH_SIZE; i++)
+	{
+		Vector origin = vec_mul(vec_rndm_unit(rng), 4.0);
+		Vector target = vec_rndm(rng, -1.0, 1.0);
+		Ray r = {origin, vec_unit(vec_sub(target, origin))};
+		batch->rays[i] = r;
+
+		Vector centre = vec_rndm(rng, -0.8, 0.8);
+		Vector half = vec_rndm(rng, 0.1, 0.6);
+		batch->boxes[i] = AABB_from_corners(vec_sub(centre, half), vec_add(centre, half));
+		batch->spheres[i] = hittable_new_sphere(centre.x, centre.y, centre.z,
+												0.2 + 0.5 * rng_ctx_01(rng), mat);
+
+		Vector a = vec_rndm(rng, -1.0, 1.0);
+		Vector b = vec_add(a, vec_rndm(rng, -1.2, 1.2));
+		Vector c = vec_add(a, vec_rndm(rng, -1.2, 1.2));
+		Vector n = vec_unit(vec_cross(vec_sub(b, a), vec_sub(c, a)));
+		batch->tris[i] = hittable_new_tri(a, b, c, n, n, n, mat);
+
+		Vector norm = vec_rndm_unit(rng);
+		batch->norms[i] = (vec_dot(norm, r.direction) > 0.0) ? vec_mul(norm, -1.0) : norm;
+	}
+	sampler_start(&batch->sampler, SAMPLER_SOBOL, 1, 0, 0, 0);
+}
+
+/*
+ * Returns the seconds between two readings of CLOCK_MONOTONIC.
+ */
+static double _secs_between(struct timespec start, struct timespec end)
+{
+	return (double) (end.tv_sec - start.tv_sec)
+		 + (double) (end.tv_nsec - start.tv_nsec) * 1.0E-9;
+}
+
+/*
+ * Returns the seconds (kernel) takes for (ops) calls.
+ */
+static double _time_kernel(const _Kernel* kernel, _Batch* batch, size_t ops)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	_sink = _sink + kernel->run(batch, ops);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return _secs_between(start, end);
+}
+
+/*
+ * Times (reps) repetitions of (kernel) and stores the mean, fastest and spread
+ * of the time per call in (result). The calls per repetition are doubled until
+ * a repetition takes a tenth of _REP_SECS, which also warms up the caches and
+ * the branch predictor, then scaled up to about _REP_SECS.
+ */
+static void _run_kernel(const _Kernel* kernel, _Batch* batch, size_t reps,
+						_Kernel_Result* result)
+{
+	size_t ops = _BATCH_SIZE;
+	double secs;
+	while ((secs = _time_kernel(kernel, batch, ops)) < 0.1 * _REP_SECS)
+		ops *= 2;
+	ops = (size_t) ((double) ops * _REP_SECS / secs) + 1;
+
+	double sum = 0.0;
+	double sum2 = 0.0;
+	double min_ns = INFINITY;
+	for (size_t i = 0; i < reps; i++)
+	{
+		double ns = _time_kernel(kernel, batch, ops) * 1.0E9 / (double) ops;
+		sum += ns;
+		sum2 += ns * ns;
+		if (ns < min_ns)
+			min_ns = ns;
+	}
+	double mean = sum / (double) reps;
+	double var = (reps > 1) ? (sum2 - sum * mean) / (double) (reps - 1) : 0.0;
+
+	result->name = kernel->name;
+	result->reps = reps;
+	result->ops_per_rep = ops;
+	result->mean_ns = mean;
+	result->min_ns = min_ns;
+	result->stddev_ns = (var > 0.0) ? sqrt(var) : 0.0;
+	result->mops_per_sec = 1.0E3 / mean;
+}
+
+/*
+ * Pins the process to (cpu), or to the CPU it is running on if (cpu) is
+ * negative, so that the timings are not spread over cores with different clocks
+ * and caches. Returns the CPU pinned to, or -1 if pinning is not supported here
+ * or failed.
+ */
+static int _pin_cpu(int cpu)
+{
+#ifdef __linux__
+	if (cpu < 0)
+		cpu = sched_getcpu();
+	if ((cpu >= 0) && (cpu < CPU_SETSIZE)) // CPU_SET is undefined outside the set
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == 0)
+			return cpu;
+	}
+	fprintf(stderr, "could not pin to cpu %d, timings may be noisier\n", cpu);
+#else
+	(void) cpu;
+#endif
+	return -1;
+}
+
+/*
+ * Returns true if (path) ends in (ext).
+ */
+static bool _has_ext(const char* path, const char* ext)
+{
+	const char* dot = strrchr(path, '.');
+	return (dot != NULL) && (strcmp(dot, ext) == 0);
+}
+
+/*
+ * Writes the results to (path), one row per kernel. A .csv file starts with a
+ * header row, a .json file holds the settings of the run and an array of
+ * objects under "results", one object per line. Every row of either carries the
+ * label, compiler and flags, so the files of many runs can be concatenated and
+ * compared. Returns false and prints a message if the file cannot be written.
+ */
+static bool _write_results(const char* path, const char* label, int cpu,
+						   const _Kernel_Result* results, size_t count)
+{
+	bool csv = _has_ext(path, ".csv");
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "failed to open %s for writing\n", path);
+		return false;
+	}
+
+	bool ok = (csv
+		? fprintf(file, "label,compiler,flags,cpu,kernel,reps,ops_per_rep,mean_ns,min_ns,"
+				  "stddev_ns,cv_pct,mops_per_s\n")
+		: fprintf(file, "{\"label\": \"%s\", \"compiler\": \"%s\", \"flags\": \"%s\", "
+				  "\"cpu\": %d, \"batch_size\": %d, \"results\": [\n", label, __VERSION__,
+				  MICROBENCH_FLAGS, cpu, _BATCH_SIZE)) > 0;
+	for (size_t i = 0; ok && (i < count); i++)
+	{
+		const _Kernel_Result* res = &results[i];
+		double cv_pct = 100.0 * res->stddev_ns / res->mean_ns;
+		ok = (csv
+			? fprintf(file, "%s,%s,%s,%d,%s,%zu,%zu,%.4f,%.4f,%.4f,%.3f,%.3f\n", label,
+					  __VERSION__, MICROBENCH_FLAGS, cpu, res->name, res->reps,
+					  res->ops_per_rep, res->mean_ns, res->min_ns, res->stddev_ns, cv_pct,
+					  res->mops_per_sec)
+			: fprintf(file, "  {\"kernel\": \"%s\", \"reps\": %zu, \"ops_per_rep\": %zu, "
+					  "\"mean_ns\": %.4f, \"min_ns\": %.4f, \"stddev_ns\": %.4f, "
+					  "\"cv_pct\": %.3f, \"mops_per_s\": %.3f}%s\n", res->name, res->reps,
+					  res->ops_per_rep, res->mean_ns, res->min_ns, res->stddev_ns, cv_pct,
+					  res->mops_per_sec, (i + 1 < count) ? "," : "")) > 0;
+	}
+	if (!csv)
+		ok = ok && (fprintf(file, "]}\n") > 0);
+
+	if ((fclose(file) != 0) || !ok)
+	{
+		fprintf(stderr, "failed to write %s\n", path);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Prints the command line usage.
+ */
+static void _print_usage(const char* name)
+{
+	printf("usage: %s [options]\n"
+		   "  -o, --output FILE   write the results to FILE (.csv or .json)\n"
+		   "  --reps N            timed repetitions of each kernel (default 20)\n"
+		   "  --kernel NAME       only run the kernel NAME, can be given more than once\n"
+		   "  --cpu N             pin to cpu N (default: the cpu it starts on)\n"
+		   "  --label TEXT        label of the run in the output, e.g. a commit\n"
+		   "  -h, --help          show this message\n"
+		   "kernels:", name);
+	for (size_t i = 0; i < sizeof(_KERNELS) / sizeof(_KERNELS[0]); i++)
+		printf(" %s", _KERNELS[i].name);
+	printf("\n");
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Times each kernel of the hot path in isolation over a batch of generated rays
+ * and primitives (see _fill_batch), pinned to one CPU, and prints the time per
+ * call, its spread over the repetitions and the calls per second. With --output,
+ * the results are also written as CSV or JSON.
+ */
+int main(int argc, char** argv)
+{
+	const char* output = NULL;
+	const char* label = "";
+	const char* only[_MAX_KERNELS];
+	size_t only_count = 0;
+	size_t reps = 20;
+	int cpu = -1;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		bool has_val = i + 1 < argc;
+		if (((strcmp(arg, "-o") == 0) || (strcmp(arg, "--output") == 0)) && has_val)
+		{
+			output = argv[++i];
+			if (!_has_ext(output, ".csv") && !_has_ext(output, ".json"))
+			{
+				fprintf(stderr, "unknown format for %s (use .csv or .json)\n", output);
+				return 1;
+			}
+		}
+		else if ((strcmp(arg, "--reps") == 0) && has_val && (atoi(argv[i + 1]) > 0))
+			reps = (size_t) atoi(argv[++i]);
+		else if ((strcmp(arg, "--cpu") == 0) && has_val && (atoi(argv[i + 1]) >= 0))
+			cpu = atoi(argv[++i]);
+		else if ((strcmp(arg, "--label") == 0) && has_val)
+			label = argv[++i];
+		else if ((strcmp(arg, "--kernel") == 0) && has_val && (only_count < _MAX_KERNELS))
+			only[only_count++] = argv[++i];
+		else if ((strcmp(arg, "-h") == 0) || (strcmp(arg, "--help") == 0))
+		{
+			_print_usage(argv[0]);
+			return 0;
+		}
+		else
+		{
+			fprintf(stderr, "unknown argument %s\n", arg);
+			_print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	_Batch* batch;
+	if ((batch = malloc(sizeof(_Batch))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in microbench\n");
+		exit(1);
+	}
+	_fill_batch(batch);
+	cpu = _pin_cpu(cpu);
+	printf("%s, flags %s, cpu %d, %d rays and primitives, %zu reps\n", __VERSION__,
+		   MICROBENCH_FLAGS, cpu, _BATCH_SIZE, reps);
+	printf("%-14s %10s %10s %10s %7s %10s\n", "kernel", "mean ns", "min ns",
+		   "stddev ns", "cv %", "Mops/s");
+
+	_Kernel_Result results[_MAX_KERNELS];
+	size_t count = 0;
+	for (size_t i = 0; i < sizeof(_KERNELS) / sizeof(_KERNELS[0]); i++)
+	{
+		bool run = only_count == 0;
+		for (size_t j = 0; j < only_count; j++)
+			run |= strcmp(only[j], _KERNELS[i].name) == 0;
+		if (!run)
+			continue;
+
+		_Kernel_Result* res = &results[count++];
+		_run_kernel(&_KERNELS[i], batch, reps, res);
+		printf("%-14s %10.3f %10.3f %10.3f %7.2f %10.2f\n", res->name, res->mean_ns,
+			   res->min_ns, res->stddev_ns, 100.0 * res->stddev_ns / res->mean_ns,
+			   res->mops_per_sec);
+		fflush(stdout);
+	}
+	if (count == 0)
+	{
+		fprintf(stderr, "no kernel matches --kernel\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < _BATCH_SIZE; i++)
+	{
+		free(batch->spheres[i]);
+		free(batch->tris[i]);
+	}
+	free(batch);
+	if (output != NULL)
+	{
+		if (!_write_results(output, label, cpu, results, count))
+			return 1;
+		printf("Wrote %s\n", output);
+	}
+	return 0;
+}
+#endif
@@ -5,428 +5,779 @@
  * PRIVATE:
  */
 
+#define _READ_SIZE (1 << 20) 	  // bytes read from the file at a time
+#define _MAX_THREADS 64 		  // upper limit on parser threads
+#define _MIN_PER_THREAD (4 << 20) // fewer bytes than this per thread is not worth a thread
+#define _RELATIVE (1u << 31) 	  // marks an index counted within its chunk, see _fix_index
+
 /*
- * Used internally to differentiate between the 2 types of data to be read from 
- * the obj file: coordinates (vectors) or indices (uint triples)
+ * Everything read from an OBJ file, or from one chunk of it, so far. The arrays
+ * grow by doubling, so a mesh of any size is read with a handful of allocations
+ * in total rather than any per line.
+ *
+ * Faces are stored as triangles of 6 indices (see _add_tri), already resolved
+ * to 1-indexed positions in the arrays, with a normal index of 0 when the face
+ * has no normals. In every chunk but the first, negative indices point at
+ * elements whose position is only known once the chunks before it are read, so
+ * they are marked with _RELATIVE instead (see _resolve_index).
  */
-static enum _E_Parse_Type {
-	_UINT32_TRIPLE,
-	_VECTOR
-} _E_Parse_Type;
-
-static struct Token_Line {
-	char** tokens;
-	size_t length;
-} Token_Line;
+typedef struct _Obj_Data {
+	Vector* 	verts;
+	size_t 		vert_count, vert_capacity;
+	Vector* 	norms;
+	size_t 		norm_count, norm_capacity;
+	uint32_t* 	faces;
+	size_t 		tri_count, tri_capacity;
+	const char* file_name;
+	size_t 		line; 	  // line being parsed, for error messages
+	bool 		relative; // negative indices are resolved once the chunks are joined
+	const char* text; 	  // whole file, if it is parsed in chunks from memory
+	const char* line_ptr; // line being parsed within (text)
+} _Obj_Data;
 
-
-static const size_t _max_token_chars = 20; // maximum amount of characters per word
-static const size_t _max_line_tokens = 4; // maximum amount of words per line
+/*
+ * The vertices and normals of a whole file, and the blocks its triangles are
+ * built into (see _build_tris).
+ */
+typedef struct _Obj_Mesh {
+	const char*   file_name;
+	const Vector* verts;
+	size_t 		  vert_count;
+	const Vector* norms;
+	size_t 		  norm_count;
+	Vector 		  pos_offset;
+	Material 	  material;
+	Hittable* 	  hittables;
+	Vector* 	  vectors;
+	Hittable** 	  tris;
+} _Obj_Mesh;
 
 /*
- * Allocates a char** (array of strings) to be used to read words from the input 
- * file. Allocated heap memory is _max_line_tokens * (_max_token_chars * sizeof(char) + 1).
- * The allocated string array leaves an extra character in each 'token' for the 
- * null terminator character '\0'.
+ * Makes sure that the array (*arr) of (elem_size) byte elements can hold one more
+ * than (count), doubling (*capacity) if it cannot. If the reallocation fails, the
+ * application exits with code 1.
  */
-static char** _alloc_str_arr()
+static void _reserve(void** arr, size_t* capacity, size_t count, size_t elem_size)
 {
-	char** tokens;
-	if ((tokens = malloc(_max_line_tokens * sizeof(char*))) == NULL)
+	if (count < *capacity)
+		return;
+
+	size_t new_capacity = (*capacity == 0) ? 1024 : 2 * *capacity;
+	void* grown;
+	if ((grown = realloc(*arr, elem_size * new_capacity)) == NULL)
 	{
-		fprintf(stderr, "malloc failed in obj importer");
+		fprintf(stderr, "realloc failed in obj importer\n");
 		exit(1);
 	}
+	*arr = grown;
+	*capacity = new_capacity;
+}
 
-	for (size_t i = 0; i < _max_line_tokens; i++)
+/*
+ * Prints which line of the file could not be read and exits with code 1. A chunk 
+ * does not know how many lines come before it, so they are counted here.
+ */
+static void _malformed(const _Obj_Data* data)
+{
+	size_t line = data->line;
+	if (data->text != NULL)
 	{
-		tokens[i] = malloc(_max_token_chars * sizeof(char) + 1);
-		if (tokens[i] == NULL)
-		{
-			fprintf(stderr, "malloc failed in obj importer");
-			exit(1);
-		}
+		line = 1;
+		for (const char* c = data->text; c < data->line_ptr; c++)
+			line += (*c == '\n');
 	}
-
-	return tokens;
+	fprintf(stderr, "malformed line %zu in %s\n", line, data->file_name);
+	exit(1);
 }
 
 /*
- * Takes in the input string (taken from the file) and separates it into an 
- * array of 'tokens' which are returned as a pointer to token_line. This token_line 
- * is allocated using the _alloc_str_arr method above. The amount of delimiters 
- * must also be passed in. The input string is assumed to be null terminated as 
- * this is the default for lines read from a file input stream.
- *
- * This method works by allocating a small buffer which is large enough to 
- * store one word or 'token' and scanning it across the input. When a delimiter 
- * is reached (usually a space or a null terminator) the buffer is flushed into 
- * the output token_line struct. This buffer is then reused for the next word.
- * If the buffer cannot be allocated, the application exits with code 1. The buffer 
- * is null terminated so its length can be measured, if the length of the buffer 
- * exceeds its maximum length, then the application exits with code 1.
- *
- * This method outputs the array of strings as a pointer to a token_line 
- * struct which stores each string as well as the number of tokens in that line.
- * If this struct cannot be allocated, the application exits with code 1.
+ * Moves (s) past any spaces, tabs and carriage returns.
  */
-static struct Token_Line* _tokenize(char* str, char delims[], size_t delim_cnt)
+static const char* _skip_space(const char* s)
 {
-	struct Token_Line* line;
-	if ((line = malloc(sizeof(Token_Line))) == NULL)
-	{
-		fprintf(stderr, "malloc failed in obj importer");
-		exit(1);
-	}
+	while ((*s == ' ') || (*s == '\t') || (*s == '\r'))
+		s++;
+	return s;
+}
 
-	line->tokens = _alloc_str_arr();
-	line->length = 0;
+// powers of ten that a double holds exactly
+static const double _POW_10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-	char* buf;
-	if ((buf = malloc(_max_token_chars * sizeof(char) + 1)) == NULL)
+/*
+ * Reads the number at (*s) into (out) and moves (*s) past it. Returns false if
+ * there is no number there.
+ *
+ * Plain decimals such as those written by Blender are read by hand: the digits
+ * make an integer of up to 2^53, which a double holds exactly, and a single
+ * multiplication or division by an exact power of ten then rounds correctly, so
+ * the result is the same as that of strtod at several times the speed. Numbers
+ * with more digits or a larger exponent, and any other form strtod accepts, are
+ * passed on to strtod. Every line ends in a new line, so neither reads past it.
+ */
+static bool _parse_double(const char** s, double* out)
+{
+	const char* start = *s;
+	const char* c = start;
+	bool negative = (*c == '-');
+	if ((*c == '-') || (*c == '+'))
+		c++;
+
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	for (; (*c >= '0') && (*c <= '9'); c++, digits++)
+		mantissa = mantissa * 10 + (uint64_t) (*c - '0');
+	if (*c == '.')
 	{
-		fprintf(stderr, "malloc failed in obj importer");
-		exit(1);
+		for (c++; (*c >= '0') && (*c <= '9'); c++, digits++, exponent--)
+			mantissa = mantissa * 10 + (uint64_t) (*c - '0');
 	}
-	buf[0] = '\0'; // init with null terminator
-
-	for (size_t ctr = 0; ; ctr++)
+	if ((*c == 'e') || (*c == 'E'))
 	{
-		char c = str[ctr];
-		bool is_delim = false;
-		for (size_t i = 0; (i < delim_cnt) && !is_delim; i++)
-			is_delim = (c == delims[i]);
-
-		if (is_delim) 
-		{
-			// flush and clear buffer
-			memcpy(*(line->tokens + line->length++), buf, _max_token_chars);
-			memset(buf, 0, _max_token_chars * sizeof(char) + 1);
-			buf[0] = '\0';
-		} 
-		else 
+		const char* e = c + 1;
+		bool exp_negative = (*e == '-');
+		if ((*e == '-') || (*e == '+'))
+			e++;
+		int exp = 0;
+		for (; (*e >= '0') && (*e <= '9') && (exp < 10000); e++)
+			exp = exp * 10 + (*e - '0');
+		if (e > c + 1)
 		{
-			// add current character to buffer
-			size_t buf_head = 0;
-			while (buf[buf_head++] != '\0');
-			buf_head--;
-			if (buf_head >= _max_token_chars)
-			{
-				fprintf(stderr, "buffer overrun in tokenize\n");
-				exit(1);
-			}
-			buf[buf_head] = c;
-			buf[buf_head + 1] = '\0';
+			exponent += exp_negative ? -exp : exp;
+			c = e;
 		}
+	}
 
-		if (str[ctr] == '\0') // null terminated input string
-			break;
+	if ((digits > 0) && (digits <= 18) && (mantissa <= (1ull << 53))
+		&& (exponent >= -22) && (exponent <= 22))
+	{
+		double val = (double) mantissa;
+		val = (exponent < 0) ? val / _POW_10[-exponent] : val * _POW_10[exponent];
+		*out = negative ? -val : val;
+		*s = c;
+		return true;
 	}
 
-	free(buf);
-	return line;
+	if (isspace((unsigned char) *start)) // strtod would skip to the next line
+		return false;
+	char* end;
+	*out = strtod(start, &end);
+	*s = end;
+	return end != start;
 }
 
 /*
- * Reads in every line from the input file, tokenizes each one and saves the 
- * lines that start with (prefix) to the output array of token_line pointers.
- * The amount of lines added to the output is stored in (end_ptr) which should 
- * be initialized to 0 before passing it into the method.
+ * Reads the whole number at (*s), which may be negative, into (out) and moves
+ * (*s) past it. Returns false if there is no number there.
+ */
+static bool _parse_int(const char** s, int64_t* out)
+{
+	const char* c = *s;
+	bool negative = (*c == '-');
+	if (negative)
+		c++;
+	if ((*c < '0') || (*c > '9'))
+		return false;
+
+	int64_t val = 0;
+	for (; (*c >= '0') && (*c <= '9') && (val < INT32_MAX); c++)
+		val = val * 10 + (*c - '0');
+	*out = negative ? -val : val;
+	*s = c;
+	return true;
+}
+
+/*
+ * Turns an index of a face (idx) into a 1-indexed position in an array that
+ * currently holds (count) elements. Negative indices count back from the last
+ * element read. Exits with code 1 if it is 0 or before the first element.
+ * Indices past the end are checked once the whole file is read, as they may
+ * refer to elements further down.
  *
- * There is a hard-coded limit of 650 lines that this method can handle as this 
- * is how many I needed for my demo, in the future i could do this in chunks and 
- * remove this restriction but it is ok for now.
+ * In a chunk that does not start the file, a negative index is resolved within 
+ * the chunk, which may give a position of 0 or less, pointing into an earlier 
+ * chunk. It is stored in the lower 31 bits with _RELATIVE set, and moved past 
+ * the earlier chunks by _fix_index.
+ */
+static uint32_t _resolve_index(const _Obj_Data* data, int64_t idx, size_t count)
+{
+	bool negative = idx < 0;
+	if (negative)
+		idx += (int64_t) count + 1;
+	if (negative && data->relative && (idx > -(int64_t) (_RELATIVE / 2))
+		&& (idx < (int64_t) (_RELATIVE / 2)))
+		return _RELATIVE | ((uint32_t) idx & (_RELATIVE - 1));
+	if ((idx <= 0) || (idx >= _RELATIVE))
+		_malformed(data);
+	return (uint32_t) idx;
+}
+
+/*
+ * Returns the position of the index (idx) of a chunk whose elements start after
+ * (base) elements of the earlier chunks. Only indices marked by _resolve_index 
+ * move, by sign extending their lower 31 bits and adding (base), the rest 
+ * already count from the start of the file.
+ */
+static int64_t _fix_index(uint32_t idx, size_t base)
+{
+	if (!(idx & _RELATIVE))
+		return idx;
+	int32_t local = (int32_t) (idx << 1) >> 1;
+	return (int64_t) base + local;
+}
+
+/*
+ * Reads one corner of a face at (*s), in any of the forms v, v/vt, v//vn and
+ * v/vt/vn, into its vertex and normal index (0 if it has none), and moves (*s)
+ * past it. Texture coordinates are not supported, so their index is skipped.
+ * Returns false if there is no corner there.
+ */
+static bool _parse_corner(_Obj_Data* data, const char** s, uint32_t* vert, uint32_t* norm)
+{
+	int64_t idx;
+	if (!_parse_int(s, &idx))
+		return false;
+	*vert = _resolve_index(data, idx, data->vert_count);
+	*norm = 0;
+	if (**s != '/')
+		return true;
+
+	(*s)++;
+	if ((**s != '/') && !_parse_int(s, &idx)) // texture index
+		_malformed(data);
+	if (**s != '/')
+		return true;
+
+	(*s)++;
+	if (!_parse_int(s, &idx))
+		_malformed(data);
+	*norm = _resolve_index(data, idx, data->norm_count);
+	return true;
+}
+
+/*
+ * Adds the triangle with corners (a, b, c), given as the vertex and normal
+ * index of each, to the faces. If any corner has no normal, none of them keep
+ * theirs, and the triangle is shaded flat (see _build_tris).
+ */
+static void _add_tri(_Obj_Data* data, const uint32_t a[2], const uint32_t b[2],
+					 const uint32_t c[2])
+{
+	_reserve((void**) &data->faces, &data->tri_capacity, data->tri_count,
+			 sizeof(uint32_t) * 6);
+	bool normals = (a[1] != 0) && (b[1] != 0) && (c[1] != 0);
+	uint32_t* face = &data->faces[6 * data->tri_count++];
+	face[0] = a[0];
+	face[1] = b[0];
+	face[2] = c[0];
+	face[3] = normals ? a[1] : 0;
+	face[4] = normals ? b[1] : 0;
+	face[5] = normals ? c[1] : 0;
+}
+
+/*
+ * Reads the line starting at (s), which ends in a new line, into (data).
  *
- * The read head of the input stream (file) is reset inside this method so that 
- * it can be used multiple times to find different prefixes.
+ * Vertex lines are given in the format v <x> <y> <z> and normal lines in the
+ * format vn <x> <y> <z>, anything after the z component (such as a w component
+ * or a vertex colour) is ignored. Face lines are given in the format
+ * f <corner> <corner> <corner> ..., see _parse_corner, and faces of more than 3
+ * corners are split into a fan of triangles around their first corner. Every
+ * other line (comments, texture coordinates, groups, materials, ...) is skipped.
  *
- * When tokenizing each line in the file, it is split at new lines, carriage returns,
- * and spaces. The lines read from the file are all null-terminated and this is 
- * handled in the _tokenize method.
+ * A vertex, normal or face line that cannot be read exits with code 1.
  */
-static struct Token_Line** _get_lines_with_prefix(FILE* file, size_t* end_ptr, char* prefix)
+static void _parse_line(_Obj_Data* data, const char* s)
 {
-	struct Token_Line** toks;
-	size_t toks_head = 0;
-	if ((toks = malloc(650 * sizeof(struct Token_Line*))) == NULL)
+	s = _skip_space(s);
+	bool vertex = (s[0] == 'v') && ((s[1] == ' ') || (s[1] == '\t'));
+	bool normal = (s[0] == 'v') && (s[1] == 'n') && ((s[2] == ' ') || (s[2] == '\t'));
+	if (vertex || normal)
 	{
-		fprintf(stderr, "malloc failed in obj importer\n");
-		exit(1);
+		Vector v;
+		s += vertex ? 1 : 2;
+		s = _skip_space(s);
+		if (!_parse_double(&s, &v.x))
+			_malformed(data);
+		s = _skip_space(s);
+		if (!_parse_double(&s, &v.y))
+			_malformed(data);
+		s = _skip_space(s);
+		if (!_parse_double(&s, &v.z))
+			_malformed(data);
+
+		if (vertex)
+		{
+			_reserve((void**) &data->verts, &data->vert_capacity, data->vert_count,
+					 sizeof(Vector));
+			data->verts[data->vert_count++] = v;
+		}
+		else
+		{
+			_reserve((void**) &data->norms, &data->norm_capacity, data->norm_count,
+					 sizeof(Vector));
+			data->norms[data->norm_count++] = v;
+		}
 	}
-
-	char delims[] = {'\n', '\r', ' '};
-	char read_buf[45];
-	fseek(file, 0, SEEK_SET);
-	while (fgets(read_buf, sizeof(read_buf) / sizeof(read_buf[0]), file))
+	else if ((s[0] == 'f') && ((s[1] == ' ') || (s[1] == '\t')))
 	{
-		struct Token_Line* token_arr = _tokenize(read_buf, delims, 3);
-		if (token_arr->length == 0) // ignore empty lines
-			continue;
-
-		if (strcmp(token_arr->tokens[0], prefix) == 0) // matches
+		uint32_t first[2], prev[2], corner[2];
+		size_t corners = 0;
+		s = _skip_space(s + 1);
+		while (*s != '\n')
 		{
-			toks[toks_head++] = token_arr;
-			*end_ptr = *end_ptr + 1;
+			if (!_parse_corner(data, &s, &corner[0], &corner[1]))
+				_malformed(data);
+			if (corners == 0)
+				memcpy(first, corner, sizeof(corner));
+			else if (corners >= 2)
+				_add_tri(data, first, prev, corner);
+			memcpy(prev, corner, sizeof(corner));
+			corners++;
+			s = _skip_space(s);
 		}
+		if (corners < 3)
+			_malformed(data);
 	}
-	return toks;
 }
 
 /*
- * Accepts a tokenized line and converts it into a given type of data. OBJ files 
- * contain two main types of data (floating point coordinate components: vectors, 
- * and indices into these coordinates: uint triples). The method will output 
- * either a vector or an array of uint32_t depending on the parse type passed.
+ * Reads (file) in blocks of _READ_SIZE and parses each complete line of a block
+ * in place (see _parse_line), so the file is read only once, and no line is
+ * copied or allocated on its own. A line cut off at the end of a block is moved
+ * to the start of the buffer and completed by the next read. The buffer only
+ * grows if a single line is longer than it. Returns the amount of bytes read.
  *
- * Vector lines from the file are given in the format <prefix> <x> <y> <z> and 
- * can are already split into pieces when tokenizing the whole string so they 
- * can just be converted using the built in strtod function. When outputting a 
- * vector, it must be allocated on the heap. If this allocation fails, the 
+ * If the buffer cannot be allocated, or the file cannot be read, the
  * application exits with code 1.
- *
- * Index lines from the file are given in the format <prefix> <ca/ta/na> <cb/tb/nb> <cc/tc/nc>
- * where c means a vector index, t means a texture index, and n means a normal index.
- * These indices refer to the vector lines in the file and are all 1-indexed.
- * My path tracer does not yet support textures so I ignore the middle component of each 
- * index triple and only look at the first (vertex index) and last (normal index) of each.
- * To parse this, I further tokenize each token by splitting at the '/' character 
- * and then output the indices as they are (still 1-indexed) as an array of 6 uint32_t.
- * These are in the format: vert idx a, vert idx b, vert idx c, norm idx a, norm idx b, norm idx c.
  */
-static void* _parse_line(struct Token_Line* line, enum _E_Parse_Type type)
+static size_t _read_file(FILE* file, _Obj_Data* data)
 {
-	if (line->length != 4)
+	size_t capacity = _READ_SIZE;
+	char* buf;
+	if ((buf = malloc(capacity + 1)) == NULL) // one byte for a final new line
 	{
-		fprintf(stderr, "malformed line in obj file\n");
+		fprintf(stderr, "malloc failed in obj importer\n");
 		exit(1);
 	}
 
-	void* out = NULL;
-	switch (type) {
-	case _UINT32_TRIPLE:
-		if ((out = malloc(sizeof(uint32_t) * 6)) == NULL)
+	size_t total = 0;
+	size_t len = 0; // bytes in the buffer, starting with the rest of the last block
+	bool eof = false;
+	while (!eof)
+	{
+		if (len == capacity)
 		{
-			fprintf(stderr, "malloc failed in obj importer\n");
-			exit(1);
+			capacity *= 2;
+			if ((buf = realloc(buf, capacity + 1)) == NULL)
+			{
+				fprintf(stderr, "realloc failed in obj importer\n");
+				exit(1);
+			}
 		}
-		for (size_t i = 1; i < 4; i++)
-		{
-			char delims[] = {'/', '\n', '\r', '\0'};
-			struct Token_Line* sub_tokens = _tokenize(line->tokens[i], delims, 4);
 
-			uint32_t parsed_1 = (uint32_t) strtoul(sub_tokens->tokens[0], NULL, 10);
-			uint32_t parsed_2 = (uint32_t) strtoul(sub_tokens->tokens[2], NULL, 10);
-
-			uint32_t* write_to = (uint32_t*) (out + (sizeof(uint32_t) * (i - 1)));
-			*write_to = parsed_1; // face data
-
-			write_to = (uint32_t*) (out + (sizeof(uint32_t) * 3) + (sizeof(uint32_t) * (i - 1)));
-			*write_to = parsed_2; // face data
-		}
-		break;
-	case _VECTOR:
-		if ((out = malloc(sizeof(Vector))) == NULL)
+		size_t got = fread(buf + len, 1, capacity - len, file);
+		if (ferror(file))
 		{
-			fprintf(stderr, "malloc failed in obj importer\n");
+			fprintf(stderr, "failed to read %s\n", data->file_name);
 			exit(1);
 		}
-
+		total += got;
+		len += got;
+		eof = (got == 0);
+		if (eof && (len > 0) && (buf[len - 1] != '\n'))
+			buf[len++] = '\n'; // the last line of the file has no new line
+
+		size_t line_start = 0;
+		for (char* nl; (nl = memchr(buf + line_start, '\n', len - line_start)) != NULL; )
 		{
-			double parsed[3];
-			for (size_t i = 0; i < 3; i++)
-				parsed[i] = strtod(line->tokens[i + 1], NULL);
-
-			Vector tmp = {parsed[0], parsed[1], parsed[2]};
-			out = &tmp;
+			data->line++;
+			_parse_line(data, buf + line_start);
+			line_start = (size_t) (nl - buf) + 1;
 		}
-		break;
+		memmove(buf, buf + line_start, len - line_start);
+		len -= line_start;
 	}
 
-	return out;
+	free(buf);
+	return total;
 }
 
 /*
- * Iteratively parses each token_line in lines, treating them as if they are of 
- * data type (type) and outputs them as an array.
- *
- * If the type is _VECTOR then the output is an array of vectors of size (count).
- * This requires allocating an array of Vector structs. If this malloc fails, 
- * the application exits with code 1.
+ * Allocates the blocks that (count) triangles of (mesh) are built into: the
+ * hittables, their vectors and the array of pointers to them are each one
+ * allocation, rather than one per triangle (see hittable_init_tri). If an
+ * allocation fails, the application exits with code 1.
+ */
+static void _alloc_tris(_Obj_Mesh* mesh, size_t count)
+{
+	if (((mesh->tris = malloc(sizeof(Hittable*) * (count + 1))) == NULL)
+		|| ((mesh->hittables = malloc(sizeof(Hittable) * (count + 1))) == NULL)
+		|| ((mesh->vectors = malloc(sizeof(Vector) * TRI * (count + 1))) == NULL))
+	{
+		fprintf(stderr, "malloc failed in obj importer\n");
+		exit(1);
+	}
+}
+
+/*
+ * Makes a triangle hittable for each of the (count) faces in (faces), offset by
+ * the mesh's position, and stores them in the mesh's blocks from the triangle
+ * (first) on. Indices are moved past (vert_base) vertices and (norm_base)
+ * normals of earlier chunks where needed (see _fix_index). Triangles without
+ * vertex normals get the normal of their plane at every corner, following
+ * their winding.
  *
- * If the type is _UINT32_TRIPLE then the output is an array of components of 
- * size (count * 6). To see why, see _parse_line. This requires allocating an 
- * array of integers, if this allocation fails, then the application exits with code 1.
+ * If an index points outside the vertices or normals of the file, prints a
+ * message and exits with code 1.
  */
-static void* _parse_all(struct Token_Line** lines, size_t count, enum _E_Parse_Type type)
+static void _build_tris(const _Obj_Mesh* mesh, const uint32_t* faces, size_t count,
+						size_t first, size_t vert_base, size_t norm_base)
 {
-	switch (type) {
-	case _UINT32_TRIPLE:
+	for (size_t i = 0; i < count; i++)
+	{
+		const uint32_t* face = &faces[i * 6];
+		int64_t idxs[6];
+		for (size_t j = 0; j < 3; j++)
 		{
-			uint32_t* out;
-			if ((out = malloc(sizeof(uint32_t) * 6 * count)) == NULL)
+			idxs[j] = _fix_index(face[j], vert_base);
+			idxs[j + 3] = _fix_index(face[j + 3], norm_base);
+			if ((idxs[j] < 1) || (idxs[j] > (int64_t) mesh->vert_count) 
+				|| ((face[j + 3] != 0) && (idxs[j + 3] < 1))
+				|| (idxs[j + 3] > (int64_t) mesh->norm_count))
 			{
-				fprintf(stderr, "malloc failed in obj importer\n");
+				fprintf(stderr, "face %zu in %s refers to a missing vertex or normal\n",
+						first + i + 1, mesh->file_name);
 				exit(1);
 			}
-			for (size_t i = 0; i < count; i++)
-			{
-				uint32_t* tmp = _parse_line(lines[i], type);
-
-				out[i * 6] = tmp[0];
-				out[i * 6 + 1] = tmp[1];
-				out[i * 6 + 2] = tmp[2];
-				out[i * 6 + 3] = tmp[3];
-				out[i * 6 + 4] = tmp[4];
-				out[i * 6 + 5] = tmp[5];
+		}
 
-				free(tmp);
-			}
-			return out;
+		Vector a = vec_add(mesh->verts[idxs[0] - 1], mesh->pos_offset);
+		Vector b = vec_add(mesh->verts[idxs[1] - 1], mesh->pos_offset);
+		Vector c = vec_add(mesh->verts[idxs[2] - 1], mesh->pos_offset);
+		Vector na, nb, nc;
+		if (face[3] != 0)
+		{
+			na = mesh->norms[idxs[3] - 1];
+			nb = mesh->norms[idxs[4] - 1];
+			nc = mesh->norms[idxs[5] - 1];
 		}
-		break;
-	case _VECTOR:
+		else
 		{
-			Vector* out;
-			if ((out = malloc(sizeof(Vector) * count)) == NULL)
-			{
-				fprintf(stderr, "malloc failed in obj importer\n");
-				exit(1);
-			}
-			for (size_t i = 0; i < count; i++)
-			{
-				Vector* tmp = _parse_line(lines[i], type);
-				out[i] = *tmp;
-			}
-			return out;
+			Vector n = vec_cross(vec_sub(b, a), vec_sub(c, a));
+			na = nb = nc = (vec_length2(n) > 0.0) ? vec_unit(n) : n;
 		}
-		break;
-	default:
-		break;
+
+		size_t idx = first + i;
+		hittable_init_tri(&mesh->hittables[idx], &mesh->vectors[idx * TRI], a, b, c,
+						  na, nb, nc, mesh->material);
+		mesh->tris[idx] = &mesh->hittables[idx];
 	}
+}
 
-	return NULL;
+/*
+ * Reads the whole file (file_name) on the calling thread with _read_file and
+ * builds its triangles into (mesh). Returns the amount of triangles, and stores
+ * the amount of bytes read in (bytes).
+ *
+ * If the file cannot be opened, prints a message and exits with code 1.
+ */
+static size_t _parse_serial(const char* file_name, _Obj_Mesh* mesh, size_t* bytes)
+{
+	FILE* file = fopen(file_name, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "failed to open %s\n", file_name);
+		exit(1);
+	}
+	_Obj_Data data;
+	memset(&data, 0, sizeof(_Obj_Data));
+	data.file_name = file_name;
+	*bytes = _read_file(file, &data);
+	fclose(file);
+
+	mesh->verts = data.verts;
+	mesh->vert_count = data.vert_count;
+	mesh->norms = data.norms;
+	mesh->norm_count = data.norm_count;
+	_alloc_tris(mesh, data.tri_count);
+	_build_tris(mesh, data.faces, data.tri_count, 0, 0, 0);
+
+	free(data.verts);
+	free(data.norms);
+	free(data.faces);
+	return data.tri_count;
 }
 
-#ifdef UNIT_TEST 
-static void _debug_print(struct Token_Line** token_line_array)
+/*
+ * A chunk of a file parsed by one thread: the lines in [start - end), what was
+ * read from them, and where its vertices, normals and triangles start in the
+ * whole mesh once every chunk is read.
+ */
+typedef struct _Obj_Chunk {
+	_Obj_Data 	data;
+	const char* start;
+	const char* end;
+	_Obj_Mesh* 	mesh;
+	size_t 		vert_base, norm_base, tri_base;
+} _Obj_Chunk;
+
+/*
+ * Thread entry point that parses every line of a chunk (see _parse_line) in
+ * place. Only the last chunk can end in a line with no new line, which is
+ * copied so that one can be added.
+ *
+ * If the copy cannot be allocated, the application exits with code 1.
+ */
+static void* _parse_chunk(void* arg)
 {
-	struct Token_Line* tmp;
-	size_t ctr = 0;
-	while ((tmp = token_line_array[ctr++]) != NULL)
+	_Obj_Chunk* chunk = arg;
+	uint64_t start = trace_begin();
+	const char* s = chunk->start;
+	for (const char* nl; (nl = memchr(s, '\n', (size_t) (chunk->end - s))) != NULL; 
+		 s = nl + 1)
 	{
-		for (size_t j = 0; j < tmp->length; j++)
-			printf("<%s> ", tmp->tokens[j]);
-		printf("\n");
+		chunk->data.line_ptr = s;
+		_parse_line(&chunk->data, s);
+	}
 
-		if (ctr == 5)
+	if (s < chunk->end) // the last line of the file has no new line
+	{
+		size_t len = (size_t) (chunk->end - s);
+		char* line;
+		if ((line = malloc(len + 1)) == NULL)
 		{
-			printf("...\n");
-			break;
+			fprintf(stderr, "malloc failed in obj importer\n");
+			exit(1);
 		}
+		memcpy(line, s, len);
+		line[len] = '\n';
+		chunk->data.line_ptr = s;
+		_parse_line(&chunk->data, line);
+		free(line);
 	}
+	trace_end("parse obj chunk", start);
+	return NULL;
 }
 
-static void _test_parse(struct Token_Line** vertex_data, struct Token_Line** normal_data, 
-						struct Token_Line** face_data, size_t v_ctr, size_t n_ctr, size_t f_ctr)
+/*
+ * Thread entry point that builds the triangles of a chunk into the mesh, once
+ * every chunk is parsed and the vertices and normals are joined.
+ */
+static void* _build_chunk(void* arg)
 {
-	printf("\nRead:\n");
-	printf("\nVertex Data\n");
-	_debug_print(vertex_data);
+	_Obj_Chunk* chunk = arg;
+	uint64_t start = trace_begin();
+	_build_tris(chunk->mesh, chunk->data.faces, chunk->data.tri_count, chunk->tri_base,
+				chunk->vert_base, chunk->norm_base);
+	trace_end("build obj chunk", start);
+	return NULL;
+}
 
-	printf("\nNormal Data\n");
-	_debug_print(normal_data);
+/*
+ * Runs (fn) on each of the (count) chunks in its own thread, waiting for all of
+ * them to finish. The first chunk runs on the calling thread. If a thread
+ * cannot be created, its chunk is run on the calling thread instead.
+ */
+static void _run_chunks(_Obj_Chunk* chunks, size_t count, void* (*fn)(void*))
+{
+	pthread_t threads[_MAX_THREADS];
+	bool started[_MAX_THREADS];
+	for (size_t t = 0; t < count; t++)
+		started[t] = (t > 0) && (pthread_create(&threads[t], NULL, fn, &chunks[t]) == 0);
 
-	printf("\nFace Data\n");
-	_debug_print(face_data);
+	for (size_t t = 0; t < count; t++)
+	{
+		if (!started[t])
+			fn(&chunks[t]);
+	}
 
-	printf("\nParse:\n");
-	printf("\nVector (vertex data line 1)\n");
-	Vector* vec = _parse_line(vertex_data[0], _VECTOR);
-	printf("%f %f %f\n", vec->x, vec->y, vec->z);
+	for (size_t t = 1; t < count; t++)
+	{
+		if (started[t])
+			pthread_join(threads[t], NULL);
+	}
+}
 
-	printf("\nInts (face data line 1)\n");
-	uint32_t* nums = _parse_line(face_data[0], _UINT32_TRIPLE);
-	printf("%u %u %u %u %u %u\n", nums[0], nums[1], nums[2], nums[3], nums[4], nums[5]);
+/*
+ * Maps the file (file_name) into memory and parses it in chunks on up to
+ * (thread_count) threads, or one per online core with at least _MIN_PER_THREAD
+ * bytes each if it is 0, then builds its triangles into (mesh).
+ *
+ * The file is split into chunks of about the same size, each moved on to the
+ * start of the next line, and every chunk is parsed into arrays of its own.
+ * Prefix sums over the amount of vertices, normals and triangles of each chunk
+ * then give where each chunk starts in the whole mesh. The vertices and normals
+ * are copied into place, and the chunks build their triangles in parallel,
+ * moving any index counted within the chunk past the chunks before it (see
+ * _fix_index). The result is the same as that of _parse_serial.
+ *
+ * Returns false, having done nothing, if the file cannot be mapped (it is
+ * empty, missing or not a regular file) or is too small for more than one
+ * thread. Otherwise returns true, and stores the amount of triangles in
+ * (tri_count), the size of the file in (bytes) and the threads used in
+ * (thread_count). If an allocation fails, the application exits with code 1.
+ */
+static bool _parse_mapped(const char* file_name, _Obj_Mesh* mesh, size_t* thread_count,
+						  size_t* tri_count, size_t* bytes)
+{
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size <= 0))
+	{
+		close(fd);
+		return false;
+	}
 
-	printf("\nAll vertex data\n");
-	Vector* all_vectors = _parse_all(vertex_data, v_ctr, _VECTOR);
-	for (size_t i = 0; i < v_ctr; i++) 
+	size_t size = (size_t) st.st_size;
+	size_t count = *thread_count;
+	if (count == 0)
 	{
-		if (i == 5) 
-		{
-			printf("...\n");
-			break;
-		}
-		printf("%f %f %f\n", all_vectors[i].x, all_vectors[i].y, all_vectors[i].z);
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		count = size / _MIN_PER_THREAD;
+		if ((cores > 0) && (count > (size_t) cores))
+			count = (size_t) cores;
 	}
+	if (count > _MAX_THREADS)
+		count = _MAX_THREADS;
+	if (count > size)
+		count = size;
+	if (count <= 1)
+	{
+		close(fd);
+		return false;
+	}
+
+	const char* text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED)
+		return false;
 
-	printf("\nAll normal data\n");
-	Vector* all_normals = _parse_all(normal_data, n_ctr, _VECTOR);
-	for (size_t i = 0; i < n_ctr; i++) 
+	_Obj_Chunk chunks[_MAX_THREADS];
+	const char* end = text + size;
+	const char* chunk_start = text;
+	for (size_t t = 0; t < count; t++)
 	{
-		if (i == 5) 
+		const char* chunk_end = end;
+		if (t + 1 < count)
 		{
-			printf("...\n");
-			break;
+			const char* split = text + size * (t + 1) / count;
+			const char* nl = (split > chunk_start) 
+						   ? memchr(split - 1, '\n', (size_t) (end - split + 1)) : NULL;
+			chunk_end = (split <= chunk_start) ? chunk_start : (nl != NULL) ? nl + 1 : end;
 		}
-		printf("%f %f %f\n", all_normals[i].x, all_normals[i].y, all_normals[i].z);
+		_Obj_Chunk* chunk = &chunks[t];
+		memset(chunk, 0, sizeof(_Obj_Chunk));
+		chunk->data.file_name = file_name;
+		chunk->data.relative = (t > 0);
+		chunk->data.text = text;
+		chunk->start = chunk_start;
+		chunk->end = chunk_end;
+		chunk->mesh = mesh;
+		chunk_start = chunk_end;
+	}
+	_run_chunks(chunks, count, _parse_chunk);
+	munmap((void*) text, size);
+
+	// prefix sums give where each chunk starts in the whole mesh
+	size_t verts = 0;
+	size_t norms = 0;
+	size_t tris = 0;
+	for (size_t t = 0; t < count; t++)
+	{
+		chunks[t].vert_base = verts;
+		chunks[t].norm_base = norms;
+		chunks[t].tri_base = tris;
+		verts += chunks[t].data.vert_count;
+		norms += chunks[t].data.norm_count;
+		tris += chunks[t].data.tri_count;
 	}
 
-	printf("\nAll face data\n");
-	uint32_t* all_faces = _parse_all(face_data, f_ctr, _UINT32_TRIPLE);
-	for (size_t i = 0; i < f_ctr; i ++)
+	Vector* all_verts;
+	Vector* all_norms;
+	if (((all_verts = malloc(sizeof(Vector) * (verts + 1))) == NULL)
+		|| ((all_norms = malloc(sizeof(Vector) * (norms + 1))) == NULL))
 	{
-		if (i == 5) 
-		{
-			printf("...\n");
-			break;
-		}
-		printf("%u %u %u %u %u %u\n", all_faces[i * 6], all_faces[i * 6 + 1], 
-			   all_faces[i * 6 + 2], all_faces[i * 6 + 3], all_faces[i * 6 + 4],
-			   all_faces[i * 6 + 5]);
+		fprintf(stderr, "malloc failed in obj importer\n");
+		exit(1);
 	}
+	for (size_t t = 0; t < count; t++)
+	{
+		_Obj_Data* data = &chunks[t].data;
+		if (data->vert_count > 0)
+			memcpy(&all_verts[chunks[t].vert_base], data->verts, 
+				   sizeof(Vector) * data->vert_count);
+		if (data->norm_count > 0)
+			memcpy(&all_norms[chunks[t].norm_base], data->norms, 
+				   sizeof(Vector) * data->norm_count);
+	}
+	mesh->verts = all_verts;
+	mesh->vert_count = verts;
+	mesh->norms = all_norms;
+	mesh->norm_count = norms;
+	_alloc_tris(mesh, tris);
+	_run_chunks(chunks, count, _build_chunk);
+
+	for (size_t t = 0; t < count; t++)
+	{
+		free(chunks[t].data.verts);
+		free(chunks[t].data.norms);
+		free(chunks[t].data.faces);
+	}
+	free(all_verts);
+	free(all_norms);
+	*thread_count = count;
+	*tri_count = tris;
+	*bytes = size;
+	return true;
 }
-#endif
 
 /*
  * PUBLIC:
  */
 
 /*
- * Reads a wavefront OBJ file and extracts the relevant vertex coordinates, 
+ * Reads a wavefront OBJ file and extracts the relevant vertex coordinates,
  * normal coordinates, and face data to reconstruct the mesh it represents.
- * This new mesh is offsetted by a vector {x, y, z} and is assigned the given 
- * material. The mesh is returned as a pointer to an Obj_Object which stores 
- * a pointer to each triangle of the mesh and the amount that there are. 
- * This method must allocate an Obj_Object struct as well as a hittable 
- * struct for each triangle in the mesh, if these allocations fail then the 
- * application exits with code 1.
- *
- * It is required that the mesh is made of ONLY TRIANGLES.
+ * This new mesh is offsetted by a vector {x, y, z} and is assigned the given
+ * material. The mesh is returned as a pointer to an Obj_Object which stores
+ * a pointer to each triangle of the mesh and the amount that there are. Files 
+ * of at least a few MB are read on every core, see parse_obj_file_threads.
  */
 Obj_Object* parse_obj_file(char* file_name, double x, double y, double z, Material material)
 {
-	// reading in the file
-	FILE* file = fopen(file_name, "r");
-
-	size_t v_ctr = 0;
-	size_t n_ctr = 0;
-	size_t f_ctr = 0;
-
-	struct Token_Line** vertex_data = _get_lines_with_prefix(file, &v_ctr, "v");
-	struct Token_Line** normal_data = _get_lines_with_prefix(file, &n_ctr, "vn");
-	struct Token_Line** face_data = _get_lines_with_prefix(file, &f_ctr, "f");
-
-	fclose(file);
-
-#ifdef UNIT_TEST
-	_test_parse(vertex_data, normal_data, face_data, v_ctr, n_ctr, f_ctr);
-#endif
+	return parse_obj_file_threads(file_name, x, y, z, material, 0, NULL);
+}
 
-	// parsing out the values
-	Vector* vertex_idxs = _parse_all(vertex_data, v_ctr, _VECTOR);
-	Vector* normal_idxs  = _parse_all(normal_data, n_ctr, _VECTOR);
-	uint32_t* faces = _parse_all(face_data, f_ctr, _UINT32_TRIPLE);
+/*
+ * Same as parse_obj_file, reading the file on up to (thread_count) threads, or 
+ * one per online core with at least a few MB of the file each if it is 0.
+ *
+ * With one thread, or if the file cannot be mapped into memory, the file is 
+ * read in a single streaming pass (see _read_file) into arrays that grow as 
+ * needed. Otherwise it is mapped and split into a chunk per thread at line 
+ * boundaries, which are parsed at the same time (see _parse_mapped). Either way 
+ * the mesh is the same, there is no limit on its size, and faces of any amount 
+ * of corners are split into triangles. The time taken, the rate the file was 
+ * read at and the threads used are printed once it is loaded, and the threads 
+ * used are also stored in (threads_used) unless it is NULL.
+ *
+ * This method allocates the Obj_Object and its triangles on the heap. If the
+ * file cannot be opened or read, a line of it is malformed, or an allocation
+ * fails, the application prints a message and exits with code 1.
+ */
+Obj_Object* parse_obj_file_threads(char* file_name, double x, double y, double z, 
+								   Material material, size_t thread_count, 
+								   size_t* threads_used)
+{
+	uint64_t start = trace_begin();
+	struct timespec start_time, end_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
 
 	// constructing the obj object
 	Obj_Object* out;
@@ -437,30 +788,35 @@ Obj_Object* parse_obj_file(char* file_name, double x, double y, double z, Materi
 	}
 
 	Vector pos_offset = {x, y, z};
-	out->length = f_ctr;
-	for (size_t i = 0; i < out->length; i++)
+	out->mat = material;
+	out->pos = pos_offset;
+	out->bvh = NULL;
+	out->store = NULL;
+
+	_Obj_Mesh mesh;
+	memset(&mesh, 0, sizeof(_Obj_Mesh));
+	mesh.file_name = file_name;
+	mesh.pos_offset = pos_offset;
+	mesh.material = material;
+	size_t bytes;
+	if ((thread_count == 1) 
+		|| !_parse_mapped(file_name, &mesh, &thread_count, &out->length, &bytes))
 	{
-		Vector a = vertex_idxs[faces[i * 6] - 1];
-		Vector b = vertex_idxs[faces[i * 6 + 1] - 1];
-		Vector c = vertex_idxs[faces[i * 6 + 2] - 1];
-		Vector na = normal_idxs[faces[i * 6 + 3] - 1];
-		Vector nb = normal_idxs[faces[i * 6 + 4] - 1];
-		Vector nc = normal_idxs[faces[i * 6 + 5] - 1];
-
-		a = vec_add(a, pos_offset);
-		b = vec_add(b, pos_offset);
-		c = vec_add(c, pos_offset);
-
-		out->tris[i] = hittable_new_tri(a, b, c, na, nb, nc, material);
+		thread_count = 1;
+		out->length = _parse_serial(file_name, &mesh, &bytes);
 	}
-
-	// cleaning up
-	free(vertex_data);
-	free(normal_data);
-	free(face_data);
-	free(vertex_idxs);
-	free(normal_idxs);
-	free(faces);
-
+	out->tris = mesh.tris;
+
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	double secs = (double) (end_time.tv_sec - start_time.tv_sec)
+				+ (double) (end_time.tv_nsec - start_time.tv_nsec) * 1.0E-9;
+	printf("Loaded %s: %zu vertices, %zu normals, %zu triangles, %.2f MB in %.3fs "
+		   "(%.1f MB/s, %zu thread%s)\n", file_name, mesh.vert_count, mesh.norm_count, 
+		   out->length, (double) bytes * 1.0E-6, secs, (double) bytes * 1.0E-6 / secs, 
+		   thread_count, (thread_count == 1) ? "" : "s");
+
+	if (threads_used != NULL)
+		*threads_used = thread_count;
+	trace_end("parse_obj_file", start);
 	return out;
 }
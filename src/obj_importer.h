@@ -2,15 +2,36 @@
 #define OBJ_IMPORTER_H
 
 #include "hittable.h"
+#include "trace.h"
 
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /*
  * Imports a given obj file as an object that can be added to a scene. Puts the 
- * object at the given coordinates and gives it the given material.
+ * object at the given coordinates and gives it the given material. Prints how 
+ * long the file took to load and at how many MB/s.
  */
 extern Obj_Object* parse_obj_file(char* file_name, double x, double y, 
 								  double z, Material material);
 
+/*
+ * Same as parse_obj_file, reading the file on up to (thread_count) threads, or 
+ * one per core if it is 0, and storing the amount used in (threads_used) unless 
+ * it is NULL. The mesh is the same for any amount of threads.
+ */
+extern Obj_Object* parse_obj_file_threads(char* file_name, double x, double y, double z, 
+										  Material material, size_t thread_count, 
+										  size_t* threads_used);
+
 #endif
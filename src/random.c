@@ -1,12 +1,24 @@
 #include "random.h"
 
-#if PRNG_IDX == 0 // fast pcg
-
 /*
  * PRIVATE:
  */
 
-static uint64_t _state = 0xCAFE00DD15EA5E5l;
+/*
+ * Splitmix64 step, advances (state) by a constant and returns a well mixed hash 
+ * of the new value. Used to turn counters (pixel and sample indices) into seeds.
+ */
+static uint64_t _splitmix64(uint64_t* state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+	return z ^ (z >> 31);
+}
+
+#if PRNG_IDX == 0 // fast pcg
+
+static _Thread_local Rng_Ctx _default = {0xCAFE00DD15EA5E5l}; // per thread
 static uint64_t const _mult = 6364136223846793005;
 
 /*
@@ -25,36 +37,44 @@ static double _u32_to_double_01(uint32_t val)
  */
 
 /*
- * Seeds the RNG. Fast PCG requires an odd seed to work properly, this is ensured
- * by doubling the input and adding 1.
+ * Seeds the stream. Fast PCG requires an odd seed to work properly, this is 
+ * ensured by doubling the input and adding 1.
  */
-void rng_set_seed(uint64_t seed)
+void rng_ctx_seed(Rng_Ctx* ctx, uint64_t seed)
 {
-	_state = 2 * seed + 1; // seed must be odd
+	ctx->state = 2 * seed + 1; // seed must be odd
 }
 
 /*
  * Fast pcg implementation, performs the necessary operations on the state and 
  * outputs its "random" 64 bit floating point value in the range 0-1.
  */
-double rng_01(void)
+double rng_ctx_01(Rng_Ctx* ctx)
 {
-	uint64_t x = _state;
+	uint64_t x = ctx->state;
 	uint64_t count = x >> 61;
 
-	_state = x * _mult;
+	ctx->state = x * _mult;
 	x ^= x >> 22;
 
 	return _u32_to_double_01((uint32_t) (x >> (22 + count)));
 }
 
-#elif PRNG_IDX == 1 // xoshiro256+
-
 /*
- * PRIVATE:
+ * Seeds the stream from a hash of the image seed and the pixel / sample indices.
  */
+void rng_ctx_seed_sample(Rng_Ctx* ctx, uint64_t seed, uint32_t x, uint32_t y, 
+						 uint32_t sample)
+{
+	uint64_t key = seed ^ (((uint64_t) y << 32) | x);
+	key = _splitmix64(&key) ^ sample;
+	rng_ctx_seed(ctx, _splitmix64(&key));
+}
 
-static uint64_t _state[4];
+#elif PRNG_IDX == 1 // xoshiro256+
+
+static _Thread_local Rng_Ctx _default = {{0x9E3779B97F4A7C15, 0xBF58476D1CE4E5B9, 
+										  0x94D049BB133111EB, 0xAB7F0912A3B1C813}};
 
 /*
  * Converts a given unsigned 64 bit integer to 64 bit floating point by forcing 
@@ -72,46 +92,65 @@ static double _u64_to_double_01(uint64_t val)
  */
 
 /*
- * Seeds the rng. Xoshiro256+ requires 4 seeds. Normally these would be generated 
- * by another, simpler rng. In this case, I decided that it would be simpler to 
- * create my own static multipliers to mess with the bits of the seed. This has 
- * acceptable results as I do not need the rng to be "perfect" but just reasonable.
+ * Seeds the stream. Xoshiro256+ requires 4 seeds. Normally these would be 
+ * generated by another, simpler rng. In this case, I decided that it would be 
+ * simpler to create my own static multipliers to mess with the bits of the seed. 
+ * This has acceptable results as I do not need the rng to be "perfect" but just 
+ * reasonable.
  */
-void rng_set_seed(uint64_t seed)
+void rng_ctx_seed(Rng_Ctx* ctx, uint64_t seed)
 {
-	_state[0] = seed * 0xAB7F0912A3B1C813; 
-	_state[1] = seed * 0x9E3779B97F4A7C15;
-	_state[2] = seed * 0xBF58476D1CE4E5B9;
-	_state[3] = seed * 0x94D049BB133111EB;
+	ctx->state[0] = seed * 0xAB7F0912A3B1C813; 
+	ctx->state[1] = seed * 0x9E3779B97F4A7C15;
+	ctx->state[2] = seed * 0xBF58476D1CE4E5B9;
+	ctx->state[3] = seed * 0x94D049BB133111EB;
 }
 
 /*
  * Xoshiro256+ implementation, performs the necessary operations on the state and 
  * outputs its "random" 64 bit floating point value in the range 0-1.
  */
-double rng_01(void)
+double rng_ctx_01(Rng_Ctx* ctx)
 {
-	uint64_t res = _state[0] + _state[3];
-	uint64_t t = _state[1] << 17;
+	uint64_t* state = ctx->state;
+	uint64_t res = state[0] + state[3];
+	uint64_t t = state[1] << 17;
 
-	_state[2] ^= _state[0];
-	_state[3] ^= _state[1];
-	_state[1] ^= _state[2];
-	_state[0] ^= _state[3];
-	_state[2] ^= t;
-	_state[3] = (_state[3] << 45) | (_state[3] >> (64 - 45));
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+	state[2] ^= t;
+	state[3] = (state[3] << 45) | (state[3] >> (64 - 45));
 
 	return _u64_to_double_01(res);
 }
 
+/*
+ * Seeds the stream from a hash of the image seed and the pixel / sample indices. 
+ * Here the 4 words of state come from consecutive splitmix64 outputs, which is 
+ * the usual way of seeding xoshiro and never leaves the state all zero.
+ */
+void rng_ctx_seed_sample(Rng_Ctx* ctx, uint64_t seed, uint32_t x, uint32_t y, 
+						 uint32_t sample)
+{
+	uint64_t key = seed ^ (((uint64_t) y << 32) | x);
+	key = _splitmix64(&key) ^ sample;
+	ctx->state[0] = _splitmix64(&key);
+	ctx->state[1] = _splitmix64(&key);
+	ctx->state[2] = _splitmix64(&key);
+	ctx->state[3] = _splitmix64(&key);
+}
+
 #else // did not select a valid prng
 
+static _Thread_local Rng_Ctx _default;
 
 /*
  * If the macro for choosing the rng for the program was defined incorrectly, then 
  * any attempt to generate a random number exits the application with code 1.
  */
-double rng_01(void)
+double rng_ctx_01(Rng_Ctx* ctx)
 {
 	fprintf(stderr, "Invalid PRNG selected in random.h\n");
 	exit(1);
@@ -121,10 +160,45 @@ double rng_01(void)
  * If the macro for choosing the rng for the program was defined incorrectly, then 
  * any attempt to seed the rng exits the application with code 1.
  */
-void rng_set_seed(uint64_t seed)
+void rng_ctx_seed(Rng_Ctx* ctx, uint64_t seed)
 {
 	fprintf(stderr, "Invalid PRNG selected in random.h\n");
 	exit(1);
 }
 
+/*
+ * See rng_ctx_seed.
+ */
+void rng_ctx_seed_sample(Rng_Ctx* ctx, uint64_t seed, uint32_t x, uint32_t y, 
+						 uint32_t sample)
+{
+	rng_ctx_seed(ctx, seed);
+}
+
 #endif
+
+/*
+ * Returns the calling thread's default stream. Every thread starts with the same 
+ * fixed state until it is seeded with rng_set_seed.
+ */
+Rng_Ctx* rng_default(void)
+{
+	return &_default;
+}
+
+/*
+ * Returns a random number in the range 0-1 from the calling thread's default 
+ * stream, see rng_ctx_01.
+ */
+double rng_01(void)
+{
+	return rng_ctx_01(&_default);
+}
+
+/*
+ * Seeds the calling thread's default stream, see rng_ctx_seed.
+ */
+void rng_set_seed(uint64_t seed)
+{
+	rng_ctx_seed(&_default, seed);
+}
@@ -11,12 +11,47 @@
 #include <stdint.h>
 
 /*
- * Returns a random floating point number between 0 and 1.
+ * State of one random number stream. Each render thread owns its own, and the 
+ * render path seeds it for every pixel sample (see rng_ctx_seed_sample).
+ */
+typedef struct Rng_Ctx {
+#if PRNG_IDX == 0
+	uint64_t state;
+#else
+	uint64_t state[4];
+#endif
+} Rng_Ctx;
+
+/*
+ * Returns a random floating point number between 0 and 1 from the given stream.
+ */
+extern double rng_ctx_01(Rng_Ctx* ctx);
+
+/*
+ * Seeds the given stream with the given number.
+ */
+extern void rng_ctx_seed(Rng_Ctx* ctx, uint64_t seed);
+
+/*
+ * Seeds the given stream for one sample of one pixel of an image rendered with 
+ * the given seed. The same arguments always give the same stream.
+ */
+extern void rng_ctx_seed_sample(Rng_Ctx* ctx, uint64_t seed, uint32_t x, 
+								uint32_t y, uint32_t sample);
+
+/*
+ * Returns the calling thread's default stream, used by rng_01.
+ */
+extern Rng_Ctx* rng_default(void);
+
+/*
+ * Returns a random floating point number between 0 and 1 from the calling 
+ * thread's default stream.
  */
 extern double rng_01(void);
 
 /*
- * Seeds the rng with the given number.
+ * Seeds the calling thread's default stream with the given number.
  */
 extern void rng_set_seed(uint64_t seed);
 
@@ -0,0 +1,409 @@
+#include "render_pool.h"
+
+/*
+ * PRIVATE:
+ */
+
+#define _MAX_THREADS 256 // upper limit on render threads
+
+/*
+ * Argument handed to each worker thread.
+ */
+typedef struct _Worker {
+	Render_Pool* pool;
+	size_t 		 idx;
+} _Worker;
+
+/*
+ * Everything needed to render a tile, for cam_render_section, cam_render_pass or 
+ * cam_render_preview.
+ */
+typedef struct _Render_Job {
+	Camera* 	   cam;
+	Hittable_List* scene;
+	Framebuffer*   fb;
+	size_t 		   sample_count; // samples per pixel of a pass, or the block of a preview
+	size_t 		   traced; 		 // samples traced by every tile of a pass
+} _Render_Job;
+
+/*
+ * Renders a tile in one go, see cam_render_section.
+ */
+static void _render_tile(void* arg, Tile tile)
+{
+	_Render_Job* job = arg;
+	uint64_t start = trace_begin();
+	cam_render_section(job->cam, job->scene, job->fb, tile.start_x, tile.start_y, 
+					   tile.end_x, tile.end_y);
+	trace_end_tile("cam_render_section", start, tile.start_x, tile.start_y);
+}
+
+/*
+ * Renders one progressive pass over a tile, see cam_render_pass.
+ */
+static void _render_pass_tile(void* arg, Tile tile)
+{
+	_Render_Job* job = arg;
+	uint64_t start = trace_begin();
+	size_t traced = cam_render_pass(job->cam, job->scene, job->fb, job->sample_count, 
+									tile.start_x, tile.start_y, tile.end_x, tile.end_y);
+	trace_end_tile("cam_render_pass", start, tile.start_x, tile.start_y);
+	__atomic_fetch_add(&job->traced, traced, __ATOMIC_RELAXED);
+}
+
+/*
+ * Renders one stage of a preview over a tile, see cam_render_preview.
+ */
+static void _render_preview_tile(void* arg, Tile tile)
+{
+	_Render_Job* job = arg;
+	uint64_t start = trace_begin();
+	size_t traced = cam_render_preview(job->cam, job->scene, job->fb, job->sample_count, 
+									   tile.start_x, tile.start_y, tile.end_x, tile.end_y);
+	trace_end_tile("cam_render_preview", start, tile.start_x, tile.start_y);
+	__atomic_fetch_add(&job->traced, traced, __ATOMIC_RELAXED);
+}
+
+/*
+ * Everything needed to map a tile of a framebuffer to the display.
+ */
+typedef struct _Tonemap_Job {
+	const Framebuffer* fb;
+	Tonemap_Op 		   op;
+	uint32_t* 		   pixels;
+	size_t 			   pitch;
+} _Tonemap_Job;
+
+/*
+ * Maps a tile to the display, see tonemap_rect.
+ */
+static void _tonemap_tile(void* arg, Tile tile)
+{
+	_Tonemap_Job* job = arg;
+	uint64_t start = trace_begin();
+	tonemap_rect(job->fb, job->op, job->pixels, job->pitch, tile.start_x, 
+				 tile.start_y, tile.end_x, tile.end_y);
+	trace_end_tile("tonemap_rect", start, tile.start_x, tile.start_y);
+}
+
+/*
+ * Takes the next tile for the worker (idx) and stores it in (tile). The worker's
+ * own deque is popped from the bottom first. Once it is empty, the other deques
+ * are visited in turn and a tile is stolen from the top of the first one that
+ * still has work, which is the tile furthest from where its owner is working.
+ * Returns false once every deque is empty. No tiles are added during a render,
+ * so a worker that finds nothing is done.
+ */
+static bool _next_tile(Render_Pool* pool, size_t idx, Tile* tile)
+{
+	Tile_Deque* own = &pool->deques[idx];
+	pthread_mutex_lock(&own->lock);
+	if (own->bottom > own->top)
+	{
+		*tile = pool->tiles[--own->bottom];
+		pthread_mutex_unlock(&own->lock);
+		return true;
+	}
+	pthread_mutex_unlock(&own->lock);
+
+	for (size_t i = 1; i < pool->thread_count; i++)
+	{
+		Tile_Deque* victim = &pool->deques[(idx + i) % pool->thread_count];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->bottom > victim->top)
+		{
+			*tile = pool->tiles[victim->top++];
+			pthread_mutex_unlock(&victim->lock);
+			return true;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+
+	return false;
+}
+
+/*
+ * Thread entry point of a worker. Waits for a render to start, renders tiles
+ * until there are none left or the pool is cancelled, reports that it is done, 
+ * and waits again until the pool is freed.
+ */
+static void* _run_worker(void* arg)
+{
+	_Worker* worker = arg;
+	Render_Pool* pool = worker->pool;
+	char name[32];
+	snprintf(name, sizeof(name), "render pool %zu", worker->idx);
+	trace_thread_name(name);
+
+	uint64_t seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	while (true)
+	{
+		while (!pool->quit && (pool->generation == seen))
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->quit)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		Tile tile;
+		while (!__atomic_load_n(&pool->cancelled, __ATOMIC_RELAXED)
+			   && _next_tile(pool, worker->idx, &tile))
+			pool->tile_func(pool->tile_arg, tile);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	free(worker);
+	return NULL;
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Creates a render pool and starts its threads. If (thread_count) is 0, one
+ * thread is started per online core. A (tile_size) of 0 is treated as 1.
+ *
+ * This method allocates heap memory for the pool, its threads and its deques. If
+ * any allocation fails or a thread cannot be started, the application exits
+ * with code 1.
+ */
+Render_Pool* render_pool_new(size_t thread_count, size_t tile_size)
+{
+	if (thread_count == 0)
+	{
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = (cores > 0) ? (size_t) cores : 1;
+	}
+	if (thread_count > _MAX_THREADS)
+		thread_count = _MAX_THREADS;
+
+	Render_Pool* pool;
+	if (((pool = malloc(sizeof(Render_Pool))) == NULL)
+		|| ((pool->threads = malloc(sizeof(pthread_t) * thread_count)) == NULL)
+		|| ((pool->deques = aligned_alloc(64, sizeof(Tile_Deque) * thread_count)) == NULL))
+	{
+		fprintf(stderr, "malloc failed in render pool\n");
+		exit(1);
+	}
+
+	pool->thread_count = thread_count;
+	pool->tile_size = (tile_size > 0) ? tile_size : 1;
+	pool->tiles = NULL;
+	pool->tile_capacity = 0;
+	pool->generation = 0;
+	pool->busy = 0;
+	pool->quit = false;
+	pool->cancelled = false;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (size_t i = 0; i < thread_count; i++)
+	{
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+		pool->deques[i].top = 0;
+		pool->deques[i].bottom = 0;
+
+		_Worker* worker;
+		if ((worker = malloc(sizeof(_Worker))) == NULL)
+		{
+			fprintf(stderr, "malloc failed in render pool\n");
+			exit(1);
+		}
+		worker->pool = pool;
+		worker->idx = i;
+		if (pthread_create(&pool->threads[i], NULL, _run_worker, worker) != 0)
+		{
+			fprintf(stderr, "failed to start render thread\n");
+			exit(1);
+		}
+	}
+
+	return pool;
+}
+
+/*
+ * Runs (tile_func) with the argument (tile_arg) on every tile of the rectangular 
+ * section of the image between points defined by start / end, x / y, on every 
+ * thread of the pool and returns once every tile is done. The section is split 
+ * into square tiles that are dealt out in contiguous runs, one run per worker 
+ * deque, so each worker starts on its own part of the image and steals from the 
+ * others once it runs out. If the pool is cancelled (see render_pool_cancel), 
+ * the tiles that have not been started yet are skipped. Only one thread may run 
+ * work on the pool at a time.
+ *
+ * If the tile array needs to grow and the allocation fails, the application
+ * exits with code 1.
+ */
+void render_pool_run(Render_Pool* pool, Tile_Func tile_func, void* tile_arg, 
+					 size_t start_x, size_t start_y, size_t end_x, size_t end_y)
+{
+	size_t size = pool->tile_size;
+	size_t tiles_x = (end_x - start_x + size - 1) / size;
+	size_t tiles_y = (end_y - start_y + size - 1) / size;
+	size_t tile_count = tiles_x * tiles_y;
+	if (tile_count == 0)
+		return;
+
+	if (tile_count > pool->tile_capacity)
+	{
+		Tile* tiles;
+		if ((tiles = realloc(pool->tiles, sizeof(Tile) * tile_count)) == NULL)
+		{
+			fprintf(stderr, "realloc failed in render pool\n");
+			exit(1);
+		}
+		pool->tiles = tiles;
+		pool->tile_capacity = tile_count;
+	}
+
+	for (size_t ty = 0; ty < tiles_y; ty++)
+	{
+		for (size_t tx = 0; tx < tiles_x; tx++)
+		{
+			Tile tile = {start_x + tx * size, start_y + ty * size,
+						 start_x + (tx + 1) * size, start_y + (ty + 1) * size};
+			if (tile.end_x > end_x) 
+				tile.end_x = end_x;
+			if (tile.end_y > end_y) 
+				tile.end_y = end_y;
+			pool->tiles[ty * tiles_x + tx] = tile;
+		}
+	}
+
+	// owners pop from the bottom, so reverse each run to start at its top left
+	for (size_t i = 0; i < pool->thread_count; i++)
+	{
+		size_t top = tile_count * i / pool->thread_count;
+		size_t bottom = tile_count * (i + 1) / pool->thread_count;
+		for (size_t lo = top, hi = bottom; lo + 1 < hi; lo++, hi--)
+		{
+			Tile tmp = pool->tiles[lo];
+			pool->tiles[lo] = pool->tiles[hi - 1];
+			pool->tiles[hi - 1] = tmp;
+		}
+		pool->deques[i].top = top;
+		pool->deques[i].bottom = bottom;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->tile_func = tile_func;
+	pool->tile_arg = tile_arg;
+	pool->busy = pool->thread_count;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Renders a rectangular section of the image between points defined by start /
+ * end, x / y, on every thread of the pool and returns once every pixel has been
+ * added to (fb). Each pixel is only ever added to by one thread. For the 
+ * rendering of each tile, see cam_render_section.
+ */
+void render_pool_render(Render_Pool* pool, Camera* cam, Hittable_List* scene, 
+						Framebuffer* fb, size_t start_x, size_t start_y, size_t end_x, 
+						size_t end_y)
+{
+	_Render_Job job = {cam, scene, fb, 0, 0};
+	render_pool_run(pool, &_render_tile, &job, start_x, start_y, end_x, end_y);
+}
+
+/*
+ * Runs one pass of a progressive render over a rectangular section of the image 
+ * between points defined by start / end, x / y, on every thread of the pool and 
+ * returns the amount of samples traced once every pixel has had its samples 
+ * added to (fb). For the rendering of each tile, see cam_render_pass.
+ */
+size_t render_pool_render_pass(Render_Pool* pool, Camera* cam, Hittable_List* scene, 
+							   Framebuffer* fb, size_t sample_count, size_t start_x, 
+							   size_t start_y, size_t end_x, size_t end_y)
+{
+	_Render_Job job = {cam, scene, fb, sample_count, 0};
+	render_pool_run(pool, &_render_pass_tile, &job, start_x, start_y, end_x, end_y);
+	return job.traced;
+}
+
+/*
+ * Renders one stage of a preview (see cam_render_preview), the first sample of 
+ * the pixels on the grid of (block) pixels, over a rectangular section of the 
+ * image between points defined by start / end, x / y, on every thread of the 
+ * pool and returns the amount of samples traced once it is complete.
+ */
+size_t render_pool_render_preview(Render_Pool* pool, Camera* cam, Hittable_List* scene, 
+								  Framebuffer* fb, size_t block, size_t start_x, 
+								  size_t start_y, size_t end_x, size_t end_y)
+{
+	_Render_Job job = {cam, scene, fb, block, 0};
+	render_pool_run(pool, &_render_preview_tile, &job, start_x, start_y, end_x, end_y);
+	return job.traced;
+}
+
+/*
+ * Maps the whole framebuffer to the display with (op) on every thread of the 
+ * pool, writing ARGB8888 pixels to (pixels), which has (pitch) bytes per row. 
+ * See tonemap_rect.
+ */
+void render_pool_tonemap(Render_Pool* pool, const Framebuffer* fb, Tonemap_Op op, 
+						 uint32_t* pixels, size_t pitch)
+{
+	_Tonemap_Job job = {fb, op, pixels, pitch};
+	render_pool_run(pool, &_tonemap_tile, &job, 0, 0, fb->width, fb->height);
+}
+
+/*
+ * Sets whether the pool is cancelled. Each worker checks before starting a tile, 
+ * so once the pool is cancelled, the render that is running returns as soon as 
+ * the tiles already started are done, which is a few milliseconds at most. Any 
+ * later render returns straight away until the pool is no longer cancelled. Can 
+ * be called from any thread.
+ */
+void render_pool_cancel(Render_Pool* pool, bool cancelled)
+{
+	__atomic_store_n(&pool->cancelled, cancelled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns true if the pool is cancelled, in which case the last render may have 
+ * skipped tiles.
+ */
+bool render_pool_cancelled(Render_Pool* pool)
+{
+	return __atomic_load_n(&pool->cancelled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Wakes every thread of the pool so that they exit, waits for them, and frees
+ * the pool.
+ */
+void render_pool_free(Render_Pool* pool)
+{
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->thread_count; i++)
+	{
+		pthread_join(pool->threads[i], NULL);
+		pthread_mutex_destroy(&pool->deques[i].lock);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	free(pool->tiles);
+	free(pool->deques);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,130 @@
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "math_utils.h"
+#include "camera.h"
+#include "scene.h"
+#include "framebuffer.h"
+#include "tonemap.h"
+#include "trace.h"
+
+/*
+ * Rectangular section of the image between points defined by start / end, x / y.
+ */
+typedef struct Tile {
+	size_t start_x, start_y;
+	size_t end_x, end_y;
+} Tile;
+
+/*
+ * Function run on each tile of a render, with the argument given to 
+ * render_pool_run.
+ */
+typedef void (*Tile_Func)(void* arg, Tile tile);
+
+/*
+ * Double ended queue of tiles owned by one worker. The owner pops tiles from the
+ * bottom while other workers steal from the top. Tiles [top - bottom) of the
+ * pool's tile array are still queued.
+ */
+typedef struct Tile_Deque {
+	pthread_mutex_t lock;
+	size_t 			top;
+	size_t 			bottom;
+} __attribute__((aligned(64))) Tile_Deque;
+
+/*
+ * Struct for a pool of worker threads that render an image tile by tile. The
+ * threads are started once and wait between renders.
+ */
+typedef struct Render_Pool {
+	pthread_t* 	    threads;
+	Tile_Deque*     deques;		  // one per thread
+	size_t 		    thread_count;
+	size_t 		    tile_size;	  // width and height of a tile in pixels
+	Tile* 		    tiles;		  // tiles of the current render
+	size_t 		    tile_capacity;
+
+	Tile_Func 	    tile_func;	  // work done on each tile of the current render
+	void* 		    tile_arg;
+	bool 		    cancelled;	  // skip the remaining tiles, see render_pool_cancel
+
+	pthread_mutex_t lock;		  // guards everything below
+	pthread_cond_t  work_cond;	  // signalled when a render starts or on quit
+	pthread_cond_t  done_cond;	  // signalled when the last worker finishes
+	uint64_t 	    generation;	  // amount of renders started
+	size_t 		    busy;		  // workers still rendering the current job
+	bool 		    quit;
+} Render_Pool;
+
+/*
+ * Starts a pool of (thread_count) render threads, or one per core if 0, that
+ * split images into square tiles of (tile_size) pixels.
+ */
+extern Render_Pool* render_pool_new(size_t thread_count, size_t tile_size);
+
+/*
+ * Runs (tile_func) on every tile of a portion of the image (between start / end, 
+ * x / y) on the threads of the pool, returning once every tile is done.
+ */
+extern void render_pool_run(Render_Pool* pool, Tile_Func tile_func, void* tile_arg, 
+							size_t start_x, size_t start_y, size_t end_x, 
+							size_t end_y);
+
+/*
+ * Renders a portion of the given scene (between start / end, x / y) into the 
+ * framebuffer on every thread of the pool, returning once it is complete.
+ */
+extern void render_pool_render(Render_Pool* pool, Camera* cam, Hittable_List* scene, 
+							   Framebuffer* fb, size_t start_x, size_t start_y, 
+							   size_t end_x, size_t end_y);
+
+/*
+ * Runs one progressive pass (see cam_render_pass) over a portion of the given 
+ * scene on every thread of the pool, returning the amount of samples traced 
+ * once it is complete.
+ */
+extern size_t render_pool_render_pass(Render_Pool* pool, Camera* cam, 
+									  Hittable_List* scene, Framebuffer* fb, 
+									  size_t sample_count, size_t start_x, 
+									  size_t start_y, size_t end_x, size_t end_y);
+
+/*
+ * Runs one stage of a preview (see cam_render_preview) over a portion of the 
+ * given scene on every thread of the pool, returning the amount of samples 
+ * traced once it is complete.
+ */
+extern size_t render_pool_render_preview(Render_Pool* pool, Camera* cam, 
+										 Hittable_List* scene, Framebuffer* fb, 
+										 size_t block, size_t start_x, size_t start_y, 
+										 size_t end_x, size_t end_y);
+
+/*
+ * Maps the framebuffer to ARGB8888 display pixels (see tonemap_rect) on every 
+ * thread of the pool, returning once it is complete.
+ */
+extern void render_pool_tonemap(Render_Pool* pool, const Framebuffer* fb, 
+								Tonemap_Op op, uint32_t* pixels, size_t pitch);
+
+/*
+ * Sets whether the pool is cancelled. While it is, renders skip every tile that 
+ * has not been started yet.
+ */
+extern void render_pool_cancel(Render_Pool* pool, bool cancelled);
+
+/*
+ * Returns true if the pool is cancelled.
+ */
+extern bool render_pool_cancelled(Render_Pool* pool);
+
+/*
+ * Stops the threads of the pool and frees it.
+ */
+extern void render_pool_free(Render_Pool* pool);
+
+#endif
@@ -1,34 +1,143 @@
 #include "render_utils.h"
 
-Vector vec_rndm_in_hemi(Vector surf_norm) 
+/*
+ * Stores the sine and cosine of (t), which must be within -pi/4 - pi/4, in (s) 
+ * and (c). Over this range the taylor series are accurate to about 1e-9 after 
+ * five terms, which is cheaper than calling sin and cos.
+ */
+static inline __attribute__((always_inline)) 
+void _sin_cos_eighth(double t, double* s, double* c)
+{
+	double t2 = t * t;
+	*s = t * (1.0 + t2 * (-1.0 / 6.0 + t2 * (1.0 / 120.0 + t2 * (-1.0 / 5040.0 
+		 + t2 * (1.0 / 362880.0)))));
+	*c = 1.0 + t2 * (-1.0 / 2.0 + t2 * (1.0 / 24.0 + t2 * (-1.0 / 720.0 
+		 + t2 * (1.0 / 40320.0 + t2 * (-1.0 / 3628800.0)))));
+}
+
+/*
+ * Maps the point (u, v) of the unit square to the unit disk with the concentric 
+ * mapping, storing the result in (x, y): the square is stretched over -1 - 1 and 
+ * each square ring around the centre is mapped to the circle of the same 
+ * radius. The angle within each quarter of the square is at most pi/4 either 
+ * side of its axis, so the quarters above and below use the sine and cosine of 
+ * the angle from the y axis swapped. Which quarter a point falls in is random, 
+ * so it is chosen by weighting both cases with 0 or 1 (x_major) rather than 
+ * with branches that would mispredict half of the time.
+ *
+ * Takes and returns plain numbers rather than vectors, so callers that have 
+ * just written the point do not stall reloading it as a vector.
+ */
+static inline __attribute__((always_inline)) 
+void _concentric_disk(double u, double v, double* x, double* y)
+{
+	double a = 2.0 * u - 1.0;
+	double b = 2.0 * v - 1.0;
+	double x_major = (double) (fabs(a) > fabs(b));
+	double y_major = 1.0 - x_major;
+	double r = x_major * a + y_major * b;
+	double other = x_major * b + y_major * a;
+	double s, c;
+	_sin_cos_eighth((PI / 4.0) * (other / (r + (double) (r == 0.0))), &s, &c);
+	*x = r * (x_major * c + y_major * s);
+	*y = r * (x_major * s + y_major * c);
+}
+
+/*
+ * Returns a new vector within a disk with a radius of 1 unit, mapped from two 
+ * random numbers (see vec_map_to_unit_disk). Unlike rejection sampling, this 
+ * always takes exactly two numbers and has no loop to mispredict.
+ */
+Vector vec_rndm_in_unit_disk(Rng_Ctx* rng)
+{
+	double u = rng_ctx_01(rng);
+	double v = rng_ctx_01(rng);
+	Vector out = {0.0, 0.0, 0.0};
+	_concentric_disk(u, v, &out.x, &out.y);
+	return out;
+}
+
+/*
+ * Returns the point of the unit disk that the point (sample) of the unit square 
+ * maps to, using the concentric mapping (see _concentric_disk). Neighbouring 
+ * samples stay neighbours and strata keep their shape better than with a polar 
+ * mapping, which helps the sobol samplers.
+ */
+Vector vec_map_to_unit_disk(Vector sample)
 {
-	Vector rnd_unit_vec = vec_rndm_unit();
-	return (vec_dot(rnd_unit_vec, surf_norm) > 0.0) 
-	? rnd_unit_vec
-	: vec_mul(rnd_unit_vec, -1.0);
+	Vector out = {0.0, 0.0, 0.0};
+	_concentric_disk(sample.x, sample.y, &out.x, &out.y);
+	return out;
 }
 
 /*
- * Returns a new vector within a disk with a radius of 1 unit. This method uses 
- * a loop to repeatedly generate points within a 2x2 (-1 - 1) square and only 
- * proceeds if a point close enough to the centre (within the unit disk) is 
- * generated. On average, this is faster than performing the division to force
- * the generated vector to be within the disk.
+ * Stores in (out) the cosine weighted direction around the unit vector 
+ * (surf_norm) for the point (u, v) of the unit square, see vec_map_to_cos_hemi.
  */
-Vector vec_rndm_in_unit_disk(void)
+static inline __attribute__((always_inline)) 
+void _cos_hemi(double u, double v, const Vector* surf_norm, Vector* out)
 {
-	while (true)
+	double disk_x, disk_y;
+	_concentric_disk(u, v, &disk_x, &disk_y);
+	double z = sqrt(fmax(0.0, 1.0 - disk_x * disk_x - disk_y * disk_y));
+
+	double sign = copysign(1.0, surf_norm->z);
+	double a = -1.0 / (sign + surf_norm->z);
+	double b = surf_norm->x * surf_norm->y * a;
+	double tan_x = 1.0 + sign * surf_norm->x * surf_norm->x * a;
+	double tan_y = sign * b;
+	double tan_z = -sign * surf_norm->x;
+	double bitan_x = b;
+	double bitan_y = sign + surf_norm->y * surf_norm->y * a;
+	double bitan_z = -surf_norm->y;
+
+	out->x = tan_x * disk_x + bitan_x * disk_y + surf_norm->x * z;
+	out->y = tan_y * disk_x + bitan_y * disk_y + surf_norm->y * z;
+	out->z = tan_z * disk_x + bitan_z * disk_y + surf_norm->z * z;
+}
+
+/*
+ * Returns a cosine weighted direction in the hemisphere around (surf_norm), 
+ * which must be a unit vector, for the point (sample) of the unit square. A 
+ * point of the unit disk (see vec_map_to_unit_disk) is lifted onto the 
+ * hemisphere, which weights it by the cosine, and turned into world space with 
+ * a branchless orthonormal basis around the normal (Duff et al.). The result is 
+ * already a unit vector.
+ */
+Vector vec_map_to_cos_hemi(Vector sample, Vector surf_norm)
+{
+	Vector out;
+	_cos_hemi(sample.x, sample.y, &surf_norm, &out);
+	return out;
+}
+
+/*
+ * Maps (count) points of the unit square (samples) to the unit disk, see 
+ * vec_map_to_unit_disk, and stores them in (out). The mapping is inlined into 
+ * the loop, so there is no call or vector copy per point.
+ */
+void vec_map_to_unit_disk_batch(const Vector* samples, Vector* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
 	{
-		Vector rnd_xy_vec = {2 * rng_01() - 1.0,
-							 2 * rng_01() - 1.0,
-							 0.0};
-		if (vec_length2(rnd_xy_vec) < 1.0)
-		{
-			return rnd_xy_vec;
-		}
+		out[i].z = 0.0;
+		_concentric_disk(samples[i].x, samples[i].y, &out[i].x, &out[i].y);
 	}
 }
 
+/*
+ * Maps (count) points of the unit square (samples) to cosine weighted 
+ * directions around the matching normals (surf_norms), see vec_map_to_cos_hemi, 
+ * and stores them in (out). The mapping is inlined into the loop, so there is no 
+ * call or vector copy per direction.
+ */
+void vec_map_to_cos_hemi_batch(const Vector* samples, const Vector* surf_norms, 
+							   Vector* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		_cos_hemi(samples[i].x, samples[i].y, &surf_norms[i], &out[i]);
+}
+
 /*
  * Returns a new vector that is a reflection of the given vector (u) in the surface
  * that has the normal vector (surf_norm).
@@ -16,15 +16,36 @@ typedef struct Hit_Record {
 } Hit_Record;
 
 /*
- * Returns a new random unit vector within the hemisphere centred around the 
- * given vector.
+ * Returns a random vector within a unit (radius = 1.0) disk.
  */
-extern Vector vec_rndm_in_hemi(Vector surf_norm);
+extern Vector vec_rndm_in_unit_disk(Rng_Ctx* rng);
 
 /*
- * Returns a random vector within a unit (radius = 1.0) disk.
+ * Maps a point (sample) of the unit square (x and y in the range 0-1) to a point
+ * within a unit (radius = 1.0) disk, evenly covering the disk.
+ */
+extern Vector vec_map_to_unit_disk(Vector sample);
+
+/*
+ * Maps a point (sample) of the unit square (x and y in the range 0-1) to a 
+ * cosine weighted unit vector in the hemisphere around the unit vector 
+ * (surf_norm).
+ */
+extern Vector vec_map_to_cos_hemi(Vector sample, Vector surf_norm);
+
+/*
+ * Maps (count) points of the unit square to the unit disk, see 
+ * vec_map_to_unit_disk.
+ */
+extern void vec_map_to_unit_disk_batch(const Vector* samples, Vector* out, 
+									   size_t count);
+
+/*
+ * Maps (count) points of the unit square to cosine weighted unit vectors around 
+ * the matching normals, see vec_map_to_cos_hemi.
  */
-extern Vector vec_rndm_in_unit_disk(void);
+extern void vec_map_to_cos_hemi_batch(const Vector* samples, const Vector* surf_norms, 
+									  Vector* out, size_t count);
 
 /*
  * Reflects the given vector in a plane with normal (surf_norm)
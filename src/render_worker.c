@@ -0,0 +1,228 @@
+#include "render_worker.h"
+
+/*
+ * PRIVATE:
+ */
+
+/*
+ * Renders the next stage of the preview while there is one (see 
+ * cam_render_preview), halving the grid after each, then the next progressive 
+ * pass, or the next band of rows in one go if band_rows is not 0, into the 
+ * framebuffer. Returns true once the image is complete. A stage or band cut 
+ * short by a cancellation may be counted as done, but that does not matter, as 
+ * the worker is always restarted from scratch.
+ */
+static bool _render_step(Render_Worker* worker)
+{
+	Framebuffer* fb = worker->fb;
+	size_t block = __atomic_load_n(&worker->stage_block, __ATOMIC_RELAXED);
+	if ((block > 1) && (worker->band_rows == 0)) // bands trace sample 0 themselves
+	{
+		size_t traced = render_pool_render_preview(worker->pool, worker->cam, 
+												   worker->scene, fb, block, 0, 0, 
+												   fb->width, fb->height);
+		__atomic_fetch_add(&worker->samples_done, traced, __ATOMIC_RELAXED);
+		__atomic_store_n(&worker->stage_block, block / 2, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	if (worker->band_rows == 0)
+	{
+		size_t traced = render_pool_render_pass(worker->pool, worker->cam, worker->scene,
+												fb, worker->samples_per_pass, 0, 0,
+												fb->width, fb->height);
+		__atomic_fetch_add(&worker->samples_done, traced, __ATOMIC_RELAXED);
+		return (traced == 0) && !render_pool_cancelled(worker->pool);
+	}
+
+	size_t end_row = worker->next_row + worker->band_rows;
+	if (end_row > fb->height)
+		end_row = fb->height;
+	render_pool_render(worker->pool, worker->cam, worker->scene, fb, 0,
+					   worker->next_row, fb->width, end_row);
+	__atomic_fetch_add(&worker->samples_done,
+					   (end_row - worker->next_row) * fb->width * worker->cam->samples_per_pixel,
+					   __ATOMIC_RELAXED);
+	worker->next_row = end_row;
+	return end_row == fb->height;
+}
+
+/*
+ * Thread entry point of the worker. Renders one step at a time (see
+ * _render_step) for as long as it is neither stopped nor done, and otherwise
+ * reports that it is idle and waits to be restarted, until the worker is freed.
+ * The lock is not held while rendering, so the window thread can ask the worker
+ * to stop at any time.
+ */
+static void* _run_worker(void* arg)
+{
+	Render_Worker* worker = arg;
+	trace_thread_name("render worker");
+	pthread_mutex_lock(&worker->lock);
+	while (true)
+	{
+		while (!worker->quit && (worker->stop || worker->done))
+		{
+			worker->running = false;
+			pthread_cond_broadcast(&worker->idle_cond);
+			pthread_cond_wait(&worker->start_cond, &worker->lock);
+		}
+		if (worker->quit)
+			break;
+		worker->running = true;
+		pthread_mutex_unlock(&worker->lock);
+
+		uint64_t start = trace_begin();
+		bool done = _render_step(worker);
+		trace_end("_render_step", start);
+
+		pthread_mutex_lock(&worker->lock);
+		worker->done = done;
+	}
+	worker->running = false;
+	pthread_cond_broadcast(&worker->idle_cond);
+	pthread_mutex_unlock(&worker->lock);
+	return NULL;
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Creates a render worker and starts its thread, which waits until the first
+ * call to render_worker_restart. By default the image is rendered
+ * progressively, one sample per pixel per pass, with no preview.
+ *
+ * This method allocates heap memory for the worker. If the allocation fails or
+ * the thread cannot be started, the application exits with code 1.
+ */
+Render_Worker* render_worker_new(Render_Pool* pool, Camera* cam, Hittable_List* scene,
+								 Framebuffer* fb)
+{
+	Render_Worker* worker;
+	if ((worker = malloc(sizeof(Render_Worker))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in render worker\n");
+		exit(1);
+	}
+
+	worker->pool = pool;
+	worker->cam = cam;
+	worker->scene = scene;
+	worker->fb = fb;
+	worker->samples_per_pass = 1;
+	worker->band_rows = 0;
+	worker->preview_block = 1;
+	worker->stage_block = 1;
+	worker->next_row = 0;
+	worker->samples_done = 0;
+	worker->stop = true;
+	worker->running = false;
+	worker->done = false;
+	worker->quit = false;
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_cond_init(&worker->start_cond, NULL);
+	pthread_cond_init(&worker->idle_cond, NULL);
+
+	if (pthread_create(&worker->thread, NULL, _run_worker, worker) != 0)
+	{
+		fprintf(stderr, "failed to start render worker thread\n");
+		exit(1);
+	}
+	return worker;
+}
+
+/*
+ * Clears the framebuffer, the progress of the worker, the render stats (see
+ * stats_reset) and the path depth histogram of the camera, if it has one, lifts the cancellation of the pool, and wakes the worker to
+ * render the image from the start, with the preview first if preview_block is
+ * more than 1. Only call this while the worker is stopped, as the framebuffer
+ * is cleared on the calling thread.
+ */
+void render_worker_restart(Render_Worker* worker)
+{
+	pthread_mutex_lock(&worker->lock);
+	framebuffer_clear(worker->fb);
+	stats_reset();
+	if (worker->cam->depth_hist != NULL)
+		memset(worker->cam->depth_hist, 0, sizeof(uint64_t) * CAM_DEPTH_BINS);
+	worker->next_row = 0;
+	__atomic_store_n(&worker->stage_block, worker->preview_block, __ATOMIC_RELAXED);
+	__atomic_store_n(&worker->samples_done, 0, __ATOMIC_RELAXED);
+	worker->done = false;
+	worker->stop = false;
+	render_pool_cancel(worker->pool, false);
+	pthread_cond_signal(&worker->start_cond);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/*
+ * Cancels the pool, so that the pass or band being rendered skips its remaining
+ * tiles, and waits for the worker to go idle. As the pool checks for the
+ * cancellation before every tile, this takes about as long as rendering one
+ * tile. The worker renders nothing more until it is restarted.
+ */
+void render_worker_stop(Render_Worker* worker)
+{
+	pthread_mutex_lock(&worker->lock);
+	worker->stop = true;
+	render_pool_cancel(worker->pool, true);
+	while (worker->running)
+		pthread_cond_wait(&worker->idle_cond, &worker->lock);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/*
+ * Returns true once the worker has rendered every sample of every pixel (or
+ * every pixel has converged with adaptive sampling). The worker is idle from
+ * then on, so the pool is free to use.
+ */
+bool render_worker_done(Render_Worker* worker)
+{
+	pthread_mutex_lock(&worker->lock);
+	bool done = worker->done && !worker->running;
+	pthread_mutex_unlock(&worker->lock);
+	return done;
+}
+
+/*
+ * Returns the grid of the preview stage being rendered (8 means one sample every 
+ * 8 pixels across and down), or 1 once the preview is done or there is none. 
+ * Can be read while the worker is rendering.
+ */
+size_t render_worker_stage(Render_Worker* worker)
+{
+	return __atomic_load_n(&worker->stage_block, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the amount of samples traced since the last restart, which can be read
+ * while the worker is rendering.
+ */
+size_t render_worker_samples(Render_Worker* worker)
+{
+	return __atomic_load_n(&worker->samples_done, __ATOMIC_RELAXED);
+}
+
+/*
+ * Stops the render, waits for the worker's thread to exit, and frees the worker.
+ */
+void render_worker_free(Render_Worker* worker)
+{
+	if (worker == NULL)
+		return;
+
+	pthread_mutex_lock(&worker->lock);
+	worker->quit = true;
+	render_pool_cancel(worker->pool, true);
+	pthread_cond_signal(&worker->start_cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_join(worker->thread, NULL);
+	render_pool_cancel(worker->pool, false);
+	pthread_mutex_destroy(&worker->lock);
+	pthread_cond_destroy(&worker->start_cond);
+	pthread_cond_destroy(&worker->idle_cond);
+	free(worker);
+}
@@ -0,0 +1,83 @@
+#ifndef RENDER_WORKER_H
+#define RENDER_WORKER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "camera.h"
+#include "scene.h"
+#include "framebuffer.h"
+#include "render_pool.h"
+
+/*
+ * Struct for a thread that renders into a framebuffer in the background on a
+ * render pool, so the thread that owns the window only has to handle events and
+ * show the framebuffer. The camera, scene, framebuffer and settings may only be
+ * changed while the worker is stopped.
+ */
+typedef struct Render_Worker {
+	pthread_t 		thread;
+	Render_Pool* 	pool;
+	Camera* 		cam;
+	Hittable_List* 	scene;
+	Framebuffer* 	fb;
+	size_t 			samples_per_pass; // samples added to each pixel by a progressive pass
+	size_t 			band_rows;		  // rows rendered at once with every sample, 0 for progressive
+	size_t 			preview_block;	  // first preview grid (power of 2, progressive only), 1 for none
+	size_t 			stage_block;	  // grid of the preview stage being rendered, 1 after (atomic)
+	size_t 			next_row;		  // first row of the next band
+	size_t 			samples_done;	  // samples traced since the last restart (atomic)
+
+	pthread_mutex_t lock;			  // guards everything below
+	pthread_cond_t  start_cond;		  // signalled when the worker is restarted or freed
+	pthread_cond_t  idle_cond;		  // signalled when the worker stops rendering
+	bool 			stop;			  // render nothing until restarted
+	bool 			running;		  // a pass or band is being rendered
+	bool 			done;			  // every pixel has all of its samples
+	bool 			quit;
+} Render_Worker;
+
+/*
+ * Starts a worker that renders the scene seen by the camera into the framebuffer
+ * on the threads of the pool. It waits for render_worker_restart before it
+ * renders anything.
+ */
+extern Render_Worker* render_worker_new(Render_Pool* pool, Camera* cam,
+										Hittable_List* scene, Framebuffer* fb);
+
+/*
+ * Clears the framebuffer and starts rendering it from scratch in the background.
+ * The worker must be stopped (or not started yet).
+ */
+extern void render_worker_restart(Render_Worker* worker);
+
+/*
+ * Cancels the render and returns once the worker has stopped.
+ */
+extern void render_worker_stop(Render_Worker* worker);
+
+/*
+ * Returns true once every pixel of the framebuffer has all of its samples.
+ */
+extern bool render_worker_done(Render_Worker* worker);
+
+/*
+ * Returns the grid (in pixels) of the preview stage being rendered, or 1 once 
+ * the preview is done.
+ */
+extern size_t render_worker_stage(Render_Worker* worker);
+
+/*
+ * Returns the amount of samples traced since the last restart.
+ */
+extern size_t render_worker_samples(Render_Worker* worker);
+
+/*
+ * Stops the worker's thread and frees it. The pool, camera, scene and
+ * framebuffer are left to the caller.
+ */
+extern void render_worker_free(Render_Worker* worker);
+
+#endif
@@ -1,6 +1,11 @@
+#ifndef HEADLESS // headless builds do not link SDL
 #include "renderer.h"
 
-#define BYTES_PER_PIXEL 4
+#ifdef DEBUG
+#define _WINDOW_SCALE 4 // debug images are small, so the window is scaled up
+#else
+#define _WINDOW_SCALE 1
+#endif
 
 static SDL_Window *window;
 static SDL_Surface *surface;
@@ -27,28 +32,32 @@ void close_render_window(void)
 }
 
 /*
- * Sets the colour of a pixel at the coordinates (x, y). The colour passed in 
- * is a vector where the components represent red, green, and blue. This vector 
- * should be normalized (each component in the range 0-1) however the method does
- * not break with unnormalized values. 
- *
- * Gamma correction is performed on the colour passed in before the pixel is 
- * written to the screen.
+ * Returns the pixel buffer of the SDL window surface, which holds 4 bytes per 
+ * pixel in the order alpha, red, green, blue from the most significant byte, 
+ * and stores the amount of bytes per row in (pitch). Colours are written to it 
+ * by tonemap_rect (or render_pool_tonemap) and shown with update_render_window.
  */
-void set_pixel(size_t x, size_t  y, Vector colour)
+uint32_t* render_window_pixels(size_t* pitch)
 {
-	colour.x = (colour.x < 0.0) ? 0.0 : sqrt(colour.x);
-	colour.y = (colour.y < 0.0) ? 0.0 : sqrt(colour.y);
-	colour.z = (colour.z < 0.0) ? 0.0 : sqrt(colour.z);
+	*pitch = (size_t) surface->pitch;
+	return (uint32_t*) surface->pixels;
+}
 
-	uint32_t r = round(colour.x * 255.0);
-	uint32_t g = round(colour.y * 255.0);
-	uint32_t b = round(colour.z * 255.0);
+/*
+ * Fetches the window surface again after the window was resized, as SDL 
+ * replaces it, and stores the size of the image that fits the window in 
+ * (screen_width, screen_height). In debug mode, that is a quarter of the size 
+ * of the window (see init_renderer). If the surface cannot be fetched, the 
+ * application exits with code 1.
+ */
+void resize_render_window(size_t* screen_width, size_t* screen_height)
+{
+	surface = SDL_GetWindowSurface(window);
+	if (surface == NULL) exit(1);
 
-	uint8_t* pixel = (uint8_t*) surface->pixels 
-				   + y * surface->pitch 
-				   + x * BYTES_PER_PIXEL;
-	*(uint32_t*) pixel = (r << 16) | (g << 8) | (b);
+	*screen_width = (surface->w >= _WINDOW_SCALE) ? surface->w / _WINDOW_SCALE : 1;
+	*screen_height = (surface->h >= _WINDOW_SCALE) ? surface->h / _WINDOW_SCALE : 1;
+	SDL_FillSurfaceRect(surface, NULL, 0xFF00FF);
 }
 
 /*
@@ -60,7 +69,8 @@ void set_pixel(size_t x, size_t  y, Vector colour)
  * up debugging. In release mode, the window is at the same resolution as the 
  * rendered image.
  *
- * On initialization, the window is filled with a magenta colour.
+ * The window can be resized, see resize_render_window. On initialization, the 
+ * window is filled with a magenta colour.
  */
 void init_renderer(size_t screen_width, size_t screen_height)
 {
@@ -69,11 +79,12 @@ void init_renderer(size_t screen_width, size_t screen_height)
 		fprintf(stderr, "\nFailed to initialize sdl3 window %s\n", SDL_GetError());
 		exit(1);
 	}
-	window = SDL_CreateWindow("Ray Tracing", screen_width, screen_height, 0);
+	window = SDL_CreateWindow("Ray Tracing", screen_width, screen_height, 
+							  SDL_WINDOW_RESIZABLE);
 	if (window == NULL) exit(1);
 
 #ifdef DEBUG
-	SDL_SetWindowSize(window, screen_width * 4.0, screen_height * 4.0);
+	SDL_SetWindowSize(window, screen_width * _WINDOW_SCALE, screen_height * _WINDOW_SCALE);
 #endif
 
 	surface = SDL_GetWindowSurface(window);
@@ -81,3 +92,4 @@ void init_renderer(size_t screen_width, size_t screen_height)
 
 	SDL_FillSurfaceRect(surface , NULL, 0xFF00FF);
 }
+#endif
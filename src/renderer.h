@@ -10,15 +10,22 @@
 #include "math_utils.h"
 
 /*
- * Assigns the given colour to the pixel at the given coordinates.
+ * Returns the pixels of the render window (ARGB8888) and stores the amount of 
+ * bytes per row in (pitch).
  */
-extern void set_pixel(size_t x, size_t y, Vector colour);
+extern uint32_t* render_window_pixels(size_t* pitch);
 
 /*
  * Refreshes the render window to see any changes.
  */
 extern void update_render_window(void);
 
+/*
+ * Picks up the new size of the render window after it was resized, storing the 
+ * size of the image that fits it in (screen_width, screen_height).
+ */
+extern void resize_render_window(size_t* screen_width, size_t* screen_height);
+
 /*
  * Initializes the render window with given dimensions.
  */
@@ -0,0 +1,185 @@
+#include "sampler.h"
+
+/*
+ * PRIVATE:
+ */
+
+#define _U32_TO_01 (1.0 / 4294967296.0) // maps a 32 bit integer to 0-1
+
+/*
+ * Returns a well mixed 32 bit hash of (x) (lowbias32).
+ */
+static uint32_t _hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+/*
+ * Returns (x) with the order of its bits reversed.
+ */
+static uint32_t _reverse_bits(uint32_t x)
+{
+	x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+	x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+	x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+/*
+ * Owen scrambles (x) with the given seed: every bit is flipped depending on a
+ * hash of the bits above it, which shuffles points between strata at every
+ * level while keeping them stratified. The Laine-Karras hash only carries bits
+ * upwards, so it is applied to the reversed value.
+ */
+static uint32_t _owen_scramble(uint32_t x, uint32_t seed)
+{
+	x = _reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6C50B47C;
+	x ^= x * 0xB82F1E52;
+	x ^= x * 0xC7AFE638;
+	x ^= x * 0x8D22F6E6;
+	return _reverse_bits(x);
+}
+
+/*
+ * Returns the second dimension of the sobol point (index). The first dimension
+ * is the index with its bits reversed. The direction numbers of the second
+ * dimension start at the top bit and each is the previous one xor itself
+ * shifted down by one.
+ */
+static uint32_t _sobol_dim_1(uint32_t index)
+{
+	uint32_t out = 0;
+	for (uint32_t dir = 0x80000000; index != 0; index >>= 1, dir ^= dir >> 1)
+		if (index & 1)
+			out ^= dir;
+	return out;
+}
+
+/*
+ * Returns the interleaved gradient noise value at (x, y), a cheap screen space
+ * noise whose neighbouring values are as different as possible.
+ */
+static double _ign(double x, double y)
+{
+	double val = 52.9829189 * fmod(0.06711056 * x + 0.00583715 * y, 1.0);
+	return val - floor(val);
+}
+
+/*
+ * Returns the per pixel shift of axis (axis) of the current dimension of the
+ * blue noise sampler. The noise is offset for every dimension and axis so they
+ * do not all shift by the same amount.
+ */
+static double _blue_noise_shift(Sampler* sampler, uint32_t axis)
+{
+	double offset = 5.588238 * (double) (2 * sampler->dim + axis);
+	return _ign((double) sampler->x + offset, (double) sampler->y + offset);
+}
+
+/*
+ * Draws the next dimension of a sobol based sampler, storing the scrambled
+ * first and second dimensions of its point in (u) and (v). Every dimension
+ * shuffles the order of the points with its own owen scramble of the index, so
+ * dimensions are not correlated even though only the first two dimensions of
+ * the sequence are used.
+ */
+static void _sobol_next(Sampler* sampler, uint32_t* u, uint32_t* v)
+{
+	uint32_t dim_seed = _hash(sampler->seed ^ _hash(sampler->dim));
+	uint32_t index = _owen_scramble(sampler->index, dim_seed);
+	*u = _owen_scramble(_reverse_bits(index), _hash(dim_seed + 1));
+	*v = _owen_scramble(_sobol_dim_1(index), _hash(dim_seed + 2));
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Starts sample (sample) of the pixel (x, y). The random sampler seeds its
+ * stream from the seed, pixel and sample (see rng_ctx_seed_sample). The sobol
+ * sampler scrambles the sequence differently for every pixel, whereas the blue
+ * noise sampler uses one scrambling for the whole image and shifts it per pixel
+ * instead, so that the error of neighbouring pixels differs as much as
+ * possible and looks like fine grain rather than blotches.
+ */
+void sampler_start(Sampler* sampler, Sampler_Type type, uint64_t seed, uint32_t x,
+				   uint32_t y, uint32_t sample)
+{
+	sampler->type = type;
+	sampler->x = x;
+	sampler->y = y;
+	sampler->index = sample;
+	sampler->dim = 0;
+	uint32_t image_seed = _hash((uint32_t) seed ^ _hash((uint32_t) (seed >> 32)));
+
+	switch (type) {
+	case SAMPLER_SOBOL:
+		sampler->seed = _hash(image_seed ^ _hash(x ^ _hash(y)));
+		break;
+	case SAMPLER_BLUE_NOISE:
+		sampler->seed = image_seed;
+		break;
+	default:
+		rng_ctx_seed_sample(&sampler->rng, seed, x, y, sample);
+		break;
+	}
+}
+
+/*
+ * Returns the next dimension of the sample in the range 0-1.
+ */
+double sampler_1d(Sampler* sampler)
+{
+	if (sampler->type == SAMPLER_RANDOM)
+		return rng_ctx_01(&sampler->rng);
+
+	uint32_t u, v;
+	_sobol_next(sampler, &u, &v);
+	double out = (double) u * _U32_TO_01;
+	if (sampler->type == SAMPLER_BLUE_NOISE)
+	{
+		out += _blue_noise_shift(sampler, 0);
+		out -= (out >= 1.0) ? 1.0 : 0.0;
+	}
+	sampler->dim++;
+	return out;
+}
+
+/*
+ * Returns the next two dimensions of the sample as the x and y of a vector, in
+ * the range 0-1. Both come from the same 2d point, so the samples of a pixel are
+ * stratified in the square and not just along each axis.
+ */
+Vector sampler_2d(Sampler* sampler)
+{
+	Vector out = {0.0, 0.0, 0.0};
+	if (sampler->type == SAMPLER_RANDOM)
+	{
+		out.x = rng_ctx_01(&sampler->rng);
+		out.y = rng_ctx_01(&sampler->rng);
+		return out;
+	}
+
+	uint32_t u, v;
+	_sobol_next(sampler, &u, &v);
+	out.x = (double) u * _U32_TO_01;
+	out.y = (double) v * _U32_TO_01;
+	if (sampler->type == SAMPLER_BLUE_NOISE)
+	{
+		out.x += _blue_noise_shift(sampler, 0);
+		out.y += _blue_noise_shift(sampler, 1);
+		out.x -= (out.x >= 1.0) ? 1.0 : 0.0;
+		out.y -= (out.y >= 1.0) ? 1.0 : 0.0;
+	}
+	sampler->dim++;
+	return out;
+}
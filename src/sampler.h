@@ -0,0 +1,51 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "math_utils.h"
+#include "random.h"
+
+/*
+ * Kinds of sample sequence a sampler can draw from.
+ */
+typedef enum Sampler_Type {
+	SAMPLER_RANDOM,		// independent numbers from a per sample rng stream
+	SAMPLER_SOBOL,		// owen scrambled sobol points, scrambled per pixel
+	SAMPLER_BLUE_NOISE	// one scrambled sobol sequence, shifted per pixel by blue noise
+} Sampler_Type;
+
+/*
+ * State of the samples of one path. Every draw takes the next dimension of the
+ * sample (index) of the pixel (x, y), so the nth draw of a path always lines up
+ * with the nth draw of the other samples of the pixel.
+ */
+typedef struct Sampler {
+	Sampler_Type type;
+	Rng_Ctx 	 rng;	// stream of the random sampler
+	uint32_t 	 x, y;	// pixel being sampled
+	uint32_t 	 index;	// sample of the pixel
+	uint32_t 	 seed;	// scrambling of the sequence
+	uint32_t 	 dim;	// next dimension to draw
+} Sampler;
+
+/*
+ * Starts the given sample (sample) of the pixel (x, y) of an image rendered with
+ * the given seed.
+ */
+extern void sampler_start(Sampler* sampler, Sampler_Type type, uint64_t seed,
+						  uint32_t x, uint32_t y, uint32_t sample);
+
+/*
+ * Returns the next dimension of the sample, between 0 and 1.
+ */
+extern double sampler_1d(Sampler* sampler);
+
+/*
+ * Returns the next two dimensions of the sample as the x and y of a vector, each
+ * between 0 and 1.
+ */
+extern Vector sampler_2d(Sampler* sampler);
+
+#endif
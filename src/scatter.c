@@ -2,14 +2,14 @@
 
 /*
  * Returns the direction of a ray that has scattered diffusely (lambertian 
- * diffuse) in a completely rough surface with the normal (surf_norm). In this 
- * simple implementation, the direction of the scattered ray is completely random.
+ * diffuse) in a completely rough surface with the unit normal (surf_norm). The 
+ * direction is drawn from the cosine weighted hemisphere around the normal (see 
+ * vec_map_to_cos_hemi) with the next 2 dimensions of the sampler, and is 
+ * already a unit vector.
  */
-Vector scatter_diffuse(Vector surf_norm)
+Vector scatter_diffuse(Sampler* sampler, Vector surf_norm)
 {
-	Vector out = vec_add(surf_norm, vec_rndm_unit());
-	if (vec_near_zero(out)) return surf_norm;
-	return out;
+	return vec_map_to_cos_hemi(sampler_2d(sampler), surf_norm);
 }
 
 /*
@@ -30,18 +30,22 @@ Vector scatter_metallic(Vector incoming, Vector surf_norm)
  * constant of the material (constant).
  *
  * For a realistic effect, glancing rays are reflected whereas direct hits are 
- * refracted, these two are blended between by using a random number to weight 
- * each case more heavily towards one or the other. This method uses an approximation 
- * of the reflectance of the material based on its constant, this approximation is 
- * quite accurate and widely accepted as "good enough".
+ * refracted, these two are blended between by using a random number (the next 
+ * dimension of the sampler, drawn for every hit so that later dimensions line up) 
+ * to weight each case more heavily towards one or the other. 
+ * This method uses an approximation of the reflectance of the material based on 
+ * its constant, this approximation is quite accurate and widely accepted as 
+ * "good enough".
  */
-Vector scatter_glass(Vector incoming, Vector surf_norm, bool front_face, double constant)
+Vector scatter_glass(Sampler* sampler, Vector incoming, Vector surf_norm, bool front_face, 
+					 double constant)
 {
 	if (front_face) constant = 1.0 / constant;
 	double cos_theta = vec_dot(vec_mul(vec_unit(incoming), -1.0), surf_norm);
 	if (cos_theta > 1.0) cos_theta = 1.0;
 	double sin_theta = sqrt(1.0 - (cos_theta * cos_theta));
 
+	double choice = sampler_1d(sampler);
 	double reflectance;
 	{
 		double tmp = (1.0 - constant) / (1.0 + constant);
@@ -49,7 +53,7 @@ Vector scatter_glass(Vector incoming, Vector surf_norm, bool front_face, double
 		reflectance = tmp + (1.0 - tmp) * pow(1.0 - cos_theta, 5.0);
 	}
 
-	return ((constant * sin_theta > 1.0) || (reflectance > rng_01()))
+	return ((constant * sin_theta > 1.0) || (reflectance > choice))
 	? vec_reflect(vec_unit(incoming), surf_norm)
 	: vec_refract(vec_unit(incoming), surf_norm, constant);
 }
@@ -3,12 +3,13 @@
 
 #include "math_utils.h"
 #include "render_utils.h"
+#include "sampler.h"
 
 /*
  * Returns the direction of a ray after a lambertian diffuse in a surface with 
  * the given normal.
  */
-extern Vector scatter_diffuse(Vector surf_norm);
+extern Vector scatter_diffuse(Sampler* sampler, Vector surf_norm);
 
 /*
  * Returns the direction of a ray after a perfect reflection in a surface with 
@@ -20,7 +21,7 @@ extern Vector scatter_metallic(Vector incoming, Vector surf_norm);
  * Returns the direction of a ray after a reflection / refraction with a 
  * transparent material with a given normal and refractive index.
  */
-extern Vector scatter_glass(Vector incoming, Vector surf_norm, 
+extern Vector scatter_glass(Sampler* sampler, Vector incoming, Vector surf_norm, 
 							bool front_face, double constant);
 
 #endif
@@ -1,62 +1,126 @@
 #include "scene.h"
 
 /*
- * Initializes a scene that can hold up to 1000 hittable objects. The method 
- * accepts a pointer to the preallocated scene struct and allocates memory for 
- * each of the 1000 hittables that the scene can have. If any of these allocations 
- * fail, then the application exits with code 1.
+ * PRIVATE:
+ */
+
+/*
+ * Frees the scene's BVH if it has one. This is done whenever a hittable is added 
+ * as the hierarchy would no longer cover every hittable in the scene.
+ */
+static void _invalidate_bvh(Hittable_List* scene)
+{
+	bvh_free(scene->bvh);
+	scene->bvh = NULL;
+}
+
+/*
+ * Makes sure that the scene's hittable array can hold at least (capacity) 
+ * hittables, doubling its size until it can. If the reallocation fails, the 
+ * application exits with code 1.
+ */
+static void _reserve(Hittable_List* scene, size_t capacity)
+{
+	if (capacity <= scene->capacity)
+		return;
+
+	size_t new_capacity = scene->capacity;
+	while (new_capacity < capacity)
+		new_capacity *= 2;
+
+	Hittable** hittables;
+	if ((hittables = realloc(scene->hittables, sizeof(Hittable*) * new_capacity)) == NULL)
+	{
+		fprintf(stderr, "realloc failed in scene\n");
+		exit(1);
+	}
+	scene->hittables = hittables;
+	scene->capacity = new_capacity;
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Initializes an empty scene. The method accepts a pointer to the preallocated 
+ * scene struct and allocates an array with room for 1000 hittable pointers, which 
+ * grows as more hittables are added. The scene is set to use the SAH BVH builder. 
+ * If the allocation fails, then the application exits with code 1.
  */
 void scene_init(Hittable_List* scene)
 {
 	scene->length = 0;
-	for (size_t i = 0; i < 1000; i++)
+	scene->capacity = 1000;
+	scene->builder = BVH_BUILD_SAH;
+	scene->bvh = NULL;
+	if ((scene->hittables = malloc(sizeof(Hittable*) * scene->capacity)) == NULL)
 	{
-		if ((scene->hittables[i] = malloc(sizeof(Hittable*))) == NULL)
-		{
-			fprintf(stderr, "malloc failed in scene");
-			exit(1);
-		}
-	}	
+		fprintf(stderr, "malloc failed in scene");
+		exit(1);
+	}
 }
 
 /*
  * Adds an Obj_Object to the scene (created by importing a 3d model in the obj 
  * format). This object is similar to a scene, it has an array of internal hittables 
  * which are all triangles. This method loops over every triangle within the object 
- * and adds it to the scene. If the hittable object limit for the scene is reached 
- * (1000) then the application exits with code 1. See scene_add for extra info.
+ * and adds it to the scene. See scene_add for extra info.
  */
 void scene_add_obj(Hittable_List* scene, Obj_Object* object)
 {
+	_invalidate_bvh(scene);
+	_reserve(scene, scene->length + object->length);
 	for (size_t i = 0; i < object->length; i++)
-	{
-		size_t next_idx = scene->length++;
-		if (next_idx >= sizeof(scene->hittables) / sizeof(scene->hittables[0]))
-		{
-			fprintf(stderr, "Attempting to write outside of array bounds in scene add obj\n");
-			exit(1);
-		}
-		scene->hittables[next_idx] = object->tris[i];
-	}
+		scene->hittables[scene->length++] = object->tris[i];
 }
 
 /**
- * Adds a single hittable object to the scene. If the hittable object limit for 
- * the scene is reached (1000) then the application exits with code 1. Hittables 
- * in the scene's array must be well packed for the intersection method to work 
- * well. This can be ensured as there is currently no way to dynamically remove 
- * a hittable from the scene, this limitation is minimal as this hittable could 
- * simply not be added in the first place.
+ * Adds a single hittable object to the scene, growing the scene's array if it is 
+ * full. Hittables in the scene's array must be well packed for the intersection 
+ * method to work well. This can be ensured as there is currently no way to 
+ * dynamically remove a hittable from the scene, this limitation is minimal as 
+ * this hittable could simply not be added in the first place.
+ *
+ * Adding a hittable discards the scene's BVH, so scene_build_bvh must be called 
+ * again afterwards.
  */
 void scene_add(Hittable_List* scene, Hittable* object)
 {
-	size_t next_idx = scene->length++;
-	if (next_idx >= sizeof(scene->hittables) / sizeof(scene->hittables[0]))
+	_invalidate_bvh(scene);
+	_reserve(scene, scene->length + 1);
+	scene->hittables[scene->length++] = object;
+}
+
+/*
+ * Builds a bounding volume hierarchy over every hittable currently in the scene 
+ * with the scene's chosen builder (see bvh_build and lbvh_build) and stores it 
+ * in the scene so that scene_hit_idx can use it. The wide layout is selected by 
+ * default as it is the fastest to traverse, see bvh_set_layout to switch back 
+ * to the binary one. Any previously built BVH is discarded. This method 
+ * allocates a temporary array of bounding boxes, if this allocation fails the 
+ * application exits with code 1.
+ */
+void scene_build_bvh(Hittable_List* scene)
+{
+	uint64_t start = trace_begin();
+	_invalidate_bvh(scene);
+
+	AABB* boxes;
+	if ((boxes = malloc(sizeof(AABB) * (scene->length + 1))) == NULL)
 	{
-		fprintf(stderr, "Attempting to write outside of array bounds: scene.hittables\n");
+		fprintf(stderr, "malloc failed in scene\n");
 		exit(1);
 	}
-	scene->hittables[next_idx] = object;
+	for (size_t i = 0; i < scene->length; i++)
+		boxes[i] = scene->hittables[i]->aabb;
+
+	scene->bvh = (scene->builder == BVH_BUILD_LBVH)
+			   ? lbvh_build(boxes, scene->length)
+			   : bvh_build(boxes, scene->length);
+	bvh_set_layout(scene->bvh, BVH_WIDE);
+	free(boxes);
+	trace_end("scene_build_bvh", start);
 }
 
 /*
@@ -66,31 +130,37 @@ void scene_add(Hittable_List* scene, Hittable* object)
  * The closest intersection within the interval is always returned. If no objects 
  * from the scene intersect with the given ray, then the method returns SIZE_MAX 
  * (the maximum value of size_t) as a sentinel value.
+ *
+ * If the scene has a BVH (see scene_build_bvh) then it is used to find the 
+ * closest hit, otherwise every hittable in the scene is tested in turn.
  */
 size_t scene_hit_idx(Hittable_List* scene, Ray r, Interval itvl, Hit_Record* hit_rec)
 {
+	STATS_ADD(rays, 1);
+	if (scene->bvh != NULL)
+	{
+		size_t hit_idx = bvh_hit_idx(scene->bvh, scene->hittables, r, itvl, hit_rec);
+		STATS_ADD(hits, hit_idx != SIZE_MAX);
+		return hit_idx;
+	}
+
 	size_t hit_idx = SIZE_MAX;
 	for (size_t i = 0; i < scene->length; i++)
 	{
 		if (scene->hittables[i] == NULL)
 			break;
 
-		Hit_Record* temp_rec;
-		if ((temp_rec = malloc(sizeof(Hit_Record))) == NULL)
-		{
-			fprintf(stderr, "malloc failed in scene\n");
-			exit(1);
-		}
-		if (hittable_hit(scene->hittables[i], r, itvl, temp_rec))
+		Hit_Record temp_rec;
+		if (hittable_hit(scene->hittables[i], r, itvl, &temp_rec))
 		{
-			if (interval_surrounds(itvl, temp_rec->t))
+			if (interval_surrounds(itvl, temp_rec.t))
 			{
 				hit_idx = i;
-				itvl.max = temp_rec->t;
-				memcpy(hit_rec, temp_rec, sizeof(*temp_rec));
+				itvl.max = temp_rec.t;
+				*hit_rec = temp_rec;
 			}
 		}
-		free(temp_rec);
 	}
+	STATS_ADD(hits, hit_idx != SIZE_MAX);
 	return hit_idx;
 }
@@ -7,18 +7,34 @@
 
 #include "math_utils.h"
 #include "hittable.h"
+#include "bvh.h"
+#include "lbvh.h"
+#include "trace.h"
 
 /*
- * Struct representing a renderable scene that rays can be cast through. A list 
- * of hittables.
+ * Specifies the algorithm used to build a scene's BVH. SAH builds the fastest 
+ * tree to trace, LBVH builds a slightly slower tree in a fraction of the time.
+ */
+typedef enum E_BVH_Builder {
+	BVH_BUILD_SAH,
+	BVH_BUILD_LBVH
+} E_BVH_Builder;
+
+/*
+ * Struct representing a renderable scene that rays can be cast through. A 
+ * growable list of hittables, and an optional acceleration structure built 
+ * over them.
  */
 typedef struct Hittable_List {
-	Hittable* hittables[1000];
-	size_t length;
+	Hittable**    hittables;
+	size_t 		  length;
+	size_t 		  capacity;
+	E_BVH_Builder builder;
+	BVH* 		  bvh;
 } Hittable_List;
 
 /*
- * Initializes a given scene by allocation heap memory for each hittable pointer.
+ * Initializes a given scene by allocating heap memory for its hittable pointers.
  */
 extern void scene_init(Hittable_List* scene);
 
@@ -32,6 +48,12 @@ extern void scene_add_obj(Hittable_List* scene, Obj_Object* object);
  */
 extern void scene_add(Hittable_List* scene, Hittable* object);
 
+/*
+ * Builds the acceleration structure for the scene. This should be called once 
+ * all hittables have been added and before rendering.
+ */
+extern void scene_build_bvh(Hittable_List* scene);
+
 /*
  * Casts the given ray through the given scene and returns the index of the 
  * hittable object that it collided with in the scene within the given interval.
@@ -36,8 +36,10 @@ Hittable_List* build_model_scene(Camera* cam)
 	Hittable* sphere_c = hittable_new_sphere(-4.0, 3.5, -2.0, 4.0, metal_blue);
 	Hittable* sphere_d = hittable_new_sphere(2.5, 0.0, 1.5, 0.5, glass_white);
 	Hittable* sphere_e = hittable_new_sphere(2.5, 0.0, 1.5, 0.4, air_white);
-	Obj_Object* obj = parse_obj_file("res/porsche.obj", 1.8, -0.5, 0.3, 
-									 diff_red);
+	Obj_Object* mesh = parse_obj_file("res/porsche.obj", 0.0, 0.0, 0.0, diff_red);
+	Vector car_pos = {1.8, -0.5, 0.3};
+	Vector car_rot = {0.0, 0.0, 0.0};
+	Hittable* car = hittable_new_instance(mesh, car_pos, car_rot, 1.0, diff_red);
 
 	Hittable_List* scene;
 	if ((scene = malloc(sizeof(Hittable_List))) == NULL)
@@ -52,7 +54,8 @@ Hittable_List* build_model_scene(Camera* cam)
 	scene_add(scene, sphere_c);
 	scene_add(scene, sphere_d);
 	scene_add(scene, sphere_e);
-	scene_add_obj(scene, obj);
+	scene_add(scene, car);
+	scene_build_bvh(scene);
 
 	return scene;
 }
@@ -92,6 +95,103 @@ Hittable_List* build_demo_scene(Camera* cam)
 	scene_add(scene, sphere_b);
 	scene_add(scene, sphere_c);
 	scene_add(scene, sphere_d);
+	scene_build_bvh(scene);
+
+	return scene;
+}
+
+/*
+ * Returns a pointer to the hittable list (scene) that the camera should render.
+ * The camera is accepted into the method so that its position, focus distance,
+ * and other paramters can be adjusted for each one.
+ */
+Hittable_List* build_instanced_scene(Camera* cam)
+{
+	Vector cam_pos = {0.0, 4.0, 9.0};
+	Vector cam_facing = {0.0, -0.45, -1.0};
+
+	cam->transform->position = cam_pos;
+	cam->transform->facing = cam_facing;
+	cam->fov_radians = PI / 3.0;
+	cam->defocus_angle = 0.0;
+	cam->focus_distance = 9.0;
+
+	Vector col_gray = {0.7, 0.7, 0.7};
+	Material metal_gray = {METALLIC, col_gray, 0.0};
+
+	Hittable_List* scene;
+	if ((scene = malloc(sizeof(Hittable_List))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in scene builder\n");
+		exit(1);
+	} 
+	scene_init(scene);
+
+	scene_add(scene, hittable_new_sphere(0.0, -1000.5, 0.0, 1000.0, metal_gray));
+
+	// one parse of the model shared by a 10 x 5 grid of cars
+	Obj_Object* mesh = parse_obj_file("res/porsche.obj", 0.0, 0.0, 0.0, metal_gray);
+	for (size_t i = 0; i < 50; i++)
+	{
+		size_t col = i % 10;
+		size_t row = i / 10;
+		Vector albedo = {0.2 + 0.08 * col, 0.2 + 0.15 * row, 1.0 - 0.08 * col};
+		Material paint = {(i % 3 == 0) ? METALLIC : DIFFUSE, albedo, 0.0};
+		Vector pos = {-11.25 + 2.5 * col, -0.5, -2.5 * row};
+		Vector rot = {0.0, 0.35 * (double) i, 0.0};
+		scene_add(scene, hittable_new_instance(mesh, pos, rot, 1.0, paint));
+	}
+	scene_build_bvh(scene);
+
+	return scene;
+}
+
+/*
+ * Returns a pointer to the hittable list (scene) that the camera should render.
+ * The camera is accepted into the method so that its position, focus distance,
+ * and other paramters can be adjusted for each one.
+ */
+Hittable_List* build_spheres_scene(Camera* cam, size_t count)
+{
+	Vector cam_pos = {0.0, 6.0, 20.0};
+	Vector cam_facing = {0.0, -0.35, -1.0};
+
+	cam->transform->position = cam_pos;
+	cam->transform->facing = cam_facing;
+	cam->fov_radians = PI / 3.0;
+	cam->defocus_angle = 0.0;
+	cam->focus_distance = 20.0;
+
+	Vector col_gray = {0.7, 0.7, 0.7};
+	Material metal_gray = {METALLIC, col_gray, 0.0};
+
+	Hittable_List* scene;
+	if ((scene = malloc(sizeof(Hittable_List))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in scene builder\n");
+		exit(1);
+	} 
+	scene_init(scene);
+
+	scene_add(scene, hittable_new_sphere(0.0, -1000.0, 0.0, 1000.0, metal_gray));
+
+	// a jittered square grid, from a fixed seed so every run builds the same scene
+	Rng_Ctx rng;
+	rng_ctx_seed(&rng, 1);
+	size_t side = (size_t) ceil(sqrt((double) count));
+	double spacing = 0.5;
+	for (size_t i = 0; i < count; i++)
+	{
+		double radius = 0.05 + 0.15 * rng_ctx_01(&rng);
+		double x = ((double) (i % side) - 0.5 * (double) side + rng_ctx_01(&rng)) * spacing;
+		double z = (-(double) (i / side) + rng_ctx_01(&rng)) * spacing;
+		Vector albedo = vec_rndm(&rng, 0.1, 1.0);
+		double pick = rng_ctx_01(&rng);
+		Material mat = {(pick < 0.7) ? DIFFUSE : (pick < 0.9) ? METALLIC : GLASS, 
+						albedo, 1.5};
+		scene_add(scene, hittable_new_sphere(x, radius, z, radius, mat));
+	}
+	scene_build_bvh(scene);
 
 	return scene;
 }
@@ -19,4 +19,18 @@ extern Hittable_List* build_demo_scene(Camera* cam);
  */
 extern Hittable_List* build_model_scene(Camera* cam);
 
+/*
+ * Returns a pointer to a scene with many instances of one imported model.
+ * This scene consists of a grid of 50 differently coloured and rotated copies 
+ * of the same car, all sharing one parsed mesh, on top of a reflective ground.
+ */
+extern Hittable_List* build_instanced_scene(Camera* cam);
+
+/*
+ * Returns a pointer to a scene with (count) generated spheres.
+ * This scene consists of a field of small spheres of random sizes and materials 
+ * on a reflective ground, placed from a fixed seed so it is the same every run.
+ */
+extern Hittable_List* build_spheres_scene(Camera* cam, size_t count);
+
 #endif
@@ -0,0 +1,142 @@
+#include "stats.h"
+
+/*
+ * PRIVATE:
+ */
+
+// names of the counters in the order of the fields of Render_Stats
+static const char* _NAMES[STATS_COUNTER_COUNT] = {
+	"samples", "rays", "hits", "box_tests", "sphere_tests", "tri_tests",
+	"instance_tests", "bounces", "escaped", "roulette", "max_depth"
+};
+
+static Render_Stats _total; // flushed counters of every thread (atomic)
+
+/*
+ * Returns (num) / (den), or 0 if (den) is 0.
+ */
+static double _ratio(uint64_t num, uint64_t den)
+{
+	return (den > 0) ? (double) num / (double) den : 0.0;
+}
+
+/*
+ * PUBLIC:
+ */
+
+#ifdef STATS_ENABLED
+_Thread_local Render_Stats stats_thread;
+#endif
+
+/*
+ * Returns true if the counters are compiled in (debug builds, or builds with
+ * -DRENDER_STATS). Otherwise STATS_ADD does nothing and every total stays 0.
+ */
+bool stats_enabled(void)
+{
+#ifdef STATS_ENABLED
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Adds the calling thread's counters to the totals and zeroes them. The render
+ * functions of the camera call this once per section, like the depth histogram,
+ * so that the counters of a thread live in its own cache lines while it renders
+ * and the shared totals are only touched a few times per tile.
+ */
+void stats_flush(void)
+{
+#ifdef STATS_ENABLED
+	uint64_t* local = (uint64_t*) &stats_thread;
+	uint64_t* total = (uint64_t*) &_total;
+	for (size_t i = 0; i < STATS_COUNTER_COUNT; i++)
+	{
+		if (local[i] > 0)
+			__atomic_fetch_add(&total[i], local[i], __ATOMIC_RELAXED);
+		local[i] = 0;
+	}
+#endif
+}
+
+/*
+ * Zeroes the totals and the calling thread's counters. Other threads must not
+ * be rendering.
+ */
+void stats_reset(void)
+{
+#ifdef STATS_ENABLED
+	memset(&stats_thread, 0, sizeof(Render_Stats));
+#endif
+	uint64_t* total = (uint64_t*) &_total;
+	for (size_t i = 0; i < STATS_COUNTER_COUNT; i++)
+		__atomic_store_n(&total[i], 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Stores the totals in (stats). Counters that a thread has not flushed yet are
+ * not included, so read them once the render is done.
+ */
+void stats_total(Render_Stats* stats)
+{
+	uint64_t* total = (uint64_t*) &_total;
+	uint64_t* out = (uint64_t*) stats;
+	for (size_t i = 0; i < STATS_COUNTER_COUNT; i++)
+		out[i] = __atomic_load_n(&total[i], __ATOMIC_RELAXED);
+}
+
+/*
+ * Prints every counter to (file), followed by the tests per ray, which is where
+ * the time of a render goes, and the share of paths ended in each way.
+ */
+void stats_print(const Render_Stats* stats, FILE* file)
+{
+	const uint64_t* counters = (const uint64_t*) stats;
+	for (size_t i = 0; i < STATS_COUNTER_COUNT; i++)
+		fprintf(file, "%-15s %llu\n", _NAMES[i], (unsigned long long) counters[i]);
+
+	uint64_t paths = stats->escaped + stats->roulette + stats->max_depth;
+	fprintf(file, "per ray: %.2f box tests, %.2f sphere tests, %.2f tri tests, "
+			"%.3f instance tests, %.1f%% hit\n",
+			_ratio(stats->box_tests, stats->rays), _ratio(stats->sphere_tests, stats->rays),
+			_ratio(stats->tri_tests, stats->rays),
+			_ratio(stats->instance_tests, stats->rays),
+			100.0 * _ratio(stats->hits, stats->rays));
+	fprintf(file, "per path: %.2f bounces, %.1f%% escaped, %.1f%% roulette, "
+			"%.1f%% max depth\n", _ratio(stats->bounces, stats->samples),
+			100.0 * _ratio(stats->escaped, paths), 100.0 * _ratio(stats->roulette, paths),
+			100.0 * _ratio(stats->max_depth, paths));
+}
+
+/*
+ * Writes the counters to (path) as one JSON object with a field per counter.
+ * Returns false and prints a message if the file cannot be written.
+ */
+bool stats_write_json(const Render_Stats* stats, const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "failed to open %s for writing\n", path);
+		return false;
+	}
+
+	const uint64_t* counters = (const uint64_t*) stats;
+	bool ok = fprintf(file, "{\n") > 0;
+	for (size_t i = 0; ok && (i < STATS_COUNTER_COUNT); i++)
+	{
+		ok = fprintf(file, "  \"%s\": %llu%s\n", _NAMES[i],
+					 (unsigned long long) counters[i],
+					 (i + 1 < STATS_COUNTER_COUNT) ? "," : "") > 0;
+	}
+	ok = ok && (fprintf(file, "}\n") > 0);
+
+	if ((fclose(file) != 0) || !ok)
+	{
+		fprintf(stderr, "failed to write %s\n", path);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// counters are compiled in for debug builds, or with -DRENDER_STATS
+#if defined(DEBUG) || defined(RENDER_STATS)
+#define STATS_ENABLED
+#endif
+
+/*
+ * Struct for the counters of the hot path of the renderer. Every field is a
+ * uint64_t, so the struct can be walked as an array of STATS_COUNTER_COUNT.
+ */
+typedef struct Render_Stats {
+	uint64_t samples;		 // camera rays, one per sample
+	uint64_t rays;			 // rays cast into the scene (camera rays and bounces)
+	uint64_t hits;			 // rays that hit something
+	uint64_t box_tests;		 // bounding box tests, 4 per wide BVH node
+	uint64_t sphere_tests;
+	uint64_t tri_tests;		 // single triangles and triangles of a triangle store
+	uint64_t instance_tests; // instances whose mesh BVH was traversed
+	uint64_t bounces;		 // rays scattered off a surface
+	uint64_t escaped;		 // paths that ended in the background
+	uint64_t roulette;		 // paths ended by russian roulette
+	uint64_t max_depth;		 // paths cut off at max_ray_bounces
+} Render_Stats;
+
+#define STATS_COUNTER_COUNT (sizeof(Render_Stats) / sizeof(uint64_t))
+
+#ifdef STATS_ENABLED
+// the calling thread's counters since it last called stats_flush
+extern _Thread_local Render_Stats stats_thread;
+
+#define STATS_ADD(counter, n) (stats_thread.counter += (n))
+// box and primitive tests of the calling thread, the traversal cost of a pixel
+#define STATS_COST() (stats_thread.box_tests + stats_thread.sphere_tests \
+					  + stats_thread.tri_tests + stats_thread.instance_tests)
+#else
+#define STATS_ADD(counter, n) ((void) 0)
+#define STATS_COST() ((uint64_t) 0)
+#endif
+
+/*
+ * Returns true if the counters are compiled in.
+ */
+extern bool stats_enabled(void);
+
+/*
+ * Adds the calling thread's counters to the totals and zeroes them.
+ */
+extern void stats_flush(void);
+
+/*
+ * Zeroes the totals and the calling thread's counters.
+ */
+extern void stats_reset(void);
+
+/*
+ * Stores the totals of every flushed counter in (stats).
+ */
+extern void stats_total(Render_Stats* stats);
+
+/*
+ * Prints the counters and the averages per ray and per path to (file).
+ */
+extern void stats_print(const Render_Stats* stats, FILE* file);
+
+/*
+ * Writes the counters to (path) as JSON. Returns false if writing fails.
+ */
+extern bool stats_write_json(const Render_Stats* stats, const char* path);
+
+#endif
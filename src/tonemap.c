@@ -0,0 +1,297 @@
+#include "tonemap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TONEMAP_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * PRIVATE:
+ */
+
+#define _LANE_COUNT 8				 // pixels mapped per kernel call, one per AVX lane of floats
+#define _SRGB_MIN_BITS 0x39000000	 // bits of 2^-13, below which srgb rounds to 0
+#define _SRGB_MAX_BITS 0x3F7FFFFF	 // bits of the largest float below 1
+#define _SRGB_SHIFT 15				 // keeps the exponent and top 8 mantissa bits
+#define _SRGB_TABLE_SIZE (13 * 256)	 // 256 entries for each power of 2 from 2^-13 to 2^-1
+#define _ACES_EXPOSURE 0.6f			 // scales the input so that the fit matches ACES
+#define _ALPHA 0xFF000000
+
+static uint32_t _srgb_table[_SRGB_TABLE_SIZE];
+static pthread_once_t _srgb_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Fills the srgb table. Entry i holds the srgb byte of the middle of the range
+ * of floats whose bits, less _SRGB_MIN_BITS, have i as their top bits. Each
+ * range spans 1/256 of a power of 2, across which the srgb curve moves by less
+ * than half a step of a byte, so the result is at most 1 from exact rounding.
+ */
+static void _fill_srgb_table(void)
+{
+	for (uint32_t i = 0; i < _SRGB_TABLE_SIZE; i++)
+	{
+		uint32_t bits = _SRGB_MIN_BITS + (i << _SRGB_SHIFT) + (1 << (_SRGB_SHIFT - 1));
+		float lin;
+		memcpy(&lin, &bits, sizeof(float));
+		double srgb = (lin <= 0.0031308) ? 12.92 * lin
+										 : 1.055 * pow(lin, 1.0 / 2.4) - 0.055;
+		_srgb_table[i] = (uint32_t) round(srgb * 255.0);
+	}
+}
+
+/*
+ * Returns the srgb byte of the linear value (lin), from the table. Values are
+ * clamped to 2^-13 - 1 first, which also maps NaN to 0.
+ */
+static uint32_t _srgb_byte(float lin)
+{
+	uint32_t bits;
+	memcpy(&bits, &lin, sizeof(uint32_t));
+	if (!(lin > 0.0f) || (bits < _SRGB_MIN_BITS))
+		bits = _SRGB_MIN_BITS;
+	if (bits > _SRGB_MAX_BITS)
+		bits = _SRGB_MAX_BITS;
+	return _srgb_table[(bits - _SRGB_MIN_BITS) >> _SRGB_SHIFT];
+}
+
+/*
+ * Returns the byte of the linear value (lin) with a gamma of 2 (square root),
+ * rounded to the nearest byte like the AVX kernel.
+ */
+static uint32_t _gamma_byte(float lin)
+{
+	float val = (lin > 0.0f) ? sqrtf(lin) : 0.0f;
+	val = (val < 1.0f) ? val : 1.0f;
+	return (uint32_t) lrintf(val * 255.0f);
+}
+
+/*
+ * Returns the ACES filmic curve of (lin) (Narkowicz's fit), which is in the
+ * range 0-1 for any positive input. The multiplications and additions are kept
+ * separate, without fused multiply adds, so the AVX kernel rounds the same way.
+ */
+static float _aces(float lin)
+{
+	lin *= _ACES_EXPOSURE;
+	return (lin * (2.51f * lin + 0.03f)) / (lin * (2.43f * lin + 0.59f) + 0.14f);
+}
+
+/*
+ * Returns the byte of one channel of a pixel whose samples add up to (sum),
+ * with (inv_count) the inverse of the amount of samples.
+ */
+static uint32_t _channel_byte(float sum, float inv_count, Tonemap_Op op)
+{
+	float lin = sum * inv_count;
+	switch (op) {
+	case TONEMAP_SRGB:
+		return _srgb_byte(lin);
+	case TONEMAP_ACES:
+		return _srgb_byte(_aces(lin > 0.0f ? lin : 0.0f));
+	default:
+		return _gamma_byte(lin);
+	}
+}
+
+/*
+ * Maps the pixels (x, y) to (end_x, y) of the framebuffer one at a time into
+ * (dst). Used for the pixels left over at the end of a row, and on hosts
+ * without AVX2.
+ */
+static void _map_scalar(const Framebuffer* fb, Tonemap_Op op, uint32_t* dst,
+						size_t x, size_t y, size_t end_x)
+{
+	for (; x < end_x; x++)
+	{
+		size_t idx = y * fb->width + x;
+		uint32_t n = fb->samples[idx];
+		float inv_count = 1.0f / (float) ((n > 0) ? n : 1);
+		const float* sum = fb->accum + 3 * idx;
+		dst[x] = _ALPHA
+			   | (_channel_byte(sum[0], inv_count, op) << 16)
+			   | (_channel_byte(sum[1], inv_count, op) << 8)
+			   | _channel_byte(sum[2], inv_count, op);
+	}
+}
+
+#ifdef TONEMAP_X86
+/*
+ * AVX version of _srgb_byte for 8 values: clamps the bits and looks up the
+ * table with a gather.
+ */
+__attribute__((target("avx2")))
+static inline __m256i _srgb_bytes_avx2(__m256 lin)
+{
+	__m256i bits = _mm256_castps_si256(_mm256_max_ps(lin, _mm256_setzero_ps()));
+	bits = _mm256_max_epi32(bits, _mm256_set1_epi32(_SRGB_MIN_BITS));
+	bits = _mm256_min_epi32(bits, _mm256_set1_epi32(_SRGB_MAX_BITS));
+	__m256i idx = _mm256_srli_epi32(_mm256_sub_epi32(bits, _mm256_set1_epi32(_SRGB_MIN_BITS)),
+									_SRGB_SHIFT);
+	return _mm256_i32gather_epi32((const int*) _srgb_table, idx, 4);
+}
+
+/*
+ * AVX version of _channel_byte for 8 pixels.
+ */
+__attribute__((target("avx2")))
+static inline __m256i _channel_bytes_avx2(__m256 sum, __m256 inv_count, Tonemap_Op op)
+{
+	__m256 lin = _mm256_mul_ps(sum, inv_count);
+	if (op == TONEMAP_SRGB)
+		return _srgb_bytes_avx2(lin);
+
+	if (op == TONEMAP_ACES)
+	{
+		lin = _mm256_mul_ps(_mm256_max_ps(lin, _mm256_setzero_ps()),
+							_mm256_set1_ps(_ACES_EXPOSURE));
+		__m256 num = _mm256_mul_ps(lin, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.51f), lin),
+													  _mm256_set1_ps(0.03f)));
+		__m256 den = _mm256_add_ps(_mm256_mul_ps(lin, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.43f), lin),
+																	_mm256_set1_ps(0.59f))),
+								   _mm256_set1_ps(0.14f));
+		return _srgb_bytes_avx2(_mm256_div_ps(num, den));
+	}
+
+	// max returns its second operand for NaN, so NaN maps to 0 like the scalar code
+	__m256 val = _mm256_sqrt_ps(_mm256_max_ps(lin, _mm256_setzero_ps()));
+	val = _mm256_min_ps(val, _mm256_set1_ps(1.0f));
+	return _mm256_cvtps_epi32(_mm256_mul_ps(val, _mm256_set1_ps(255.0f)));
+}
+
+/*
+ * Maps the pixels (x, y) to (end_x, y) of the framebuffer into (dst), 8 at a
+ * time, and the rest with _map_scalar. The red, green and blue sums of 8 pixels
+ * are gathered out of the interleaved framebuffer, divided by the sample
+ * counts, mapped, and packed into ARGB8888 with shifts. Only called when the
+ * host supports AVX2. FMA is left off so that the results are bit identical to
+ * _map_scalar, and the upper halves of the registers are cleared before
+ * returning to SSE code.
+ */
+__attribute__((target("avx2")))
+static void _map_avx2(const Framebuffer* fb, Tonemap_Op op, uint32_t* dst, size_t x,
+					  size_t y, size_t end_x)
+{
+	const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	const __m256i one = _mm256_set1_epi32(1);
+	for (; x + _LANE_COUNT <= end_x; x += _LANE_COUNT)
+	{
+		size_t idx = y * fb->width + x;
+		__m256i n = _mm256_loadu_si256((const __m256i*) (fb->samples + idx));
+		__m256 inv_count = _mm256_div_ps(_mm256_set1_ps(1.0f),
+										 _mm256_cvtepi32_ps(_mm256_max_epu32(n, one)));
+
+		const float* sum = fb->accum + 3 * idx;
+		__m256i r = _channel_bytes_avx2(_mm256_i32gather_ps(sum, offsets, 4), inv_count, op);
+		__m256i g = _channel_bytes_avx2(_mm256_i32gather_ps(sum + 1, offsets, 4), inv_count, op);
+		__m256i b = _channel_bytes_avx2(_mm256_i32gather_ps(sum + 2, offsets, 4), inv_count, op);
+
+		__m256i argb = _mm256_or_si256(_mm256_set1_epi32((int) _ALPHA), b);
+		argb = _mm256_or_si256(argb, _mm256_slli_epi32(r, 16));
+		argb = _mm256_or_si256(argb, _mm256_slli_epi32(g, 8));
+		_mm256_storeu_si256((__m256i*) (dst + x), argb);
+	}
+	_mm256_zeroupper();
+	_map_scalar(fb, op, dst, x, y, end_x);
+}
+#endif
+
+/*
+ * Returns true if the host supports AVX2. The result is cached after the first
+ * call.
+ */
+static bool _has_avx2(void)
+{
+#ifdef TONEMAP_X86
+	static int supported = -1;
+	if (supported < 0)
+		supported = __builtin_cpu_supports("avx2");
+
+	return supported;
+#else
+	return false;
+#endif
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Maps a portion of the framebuffer to the display, row by row. This is the only
+ * place the linear image is turned into bytes, so it only has to run when the
+ * window is refreshed or an image is written, never while samples are traced.
+ * Rows are mapped 8 pixels at a time with AVX2 where the host supports it,
+ * which gives the same bytes as the scalar code.
+ *
+ * The srgb curve (also used after ACES) comes from a table of 3328 entries
+ * indexed by the top bits of the float (see _fill_srgb_table), which is filled
+ * the first time it is needed.
+ */
+void tonemap_rect(const Framebuffer* fb, Tonemap_Op op, uint32_t* pixels, size_t pitch,
+				  size_t start_x, size_t start_y, size_t end_x, size_t end_y)
+{
+	if (op != TONEMAP_GAMMA)
+		pthread_once(&_srgb_once, &_fill_srgb_table);
+
+	for (size_t y = start_y; y < end_y; y++)
+	{
+		uint32_t* dst = (uint32_t*) ((uint8_t*) pixels + y * pitch);
+#ifdef TONEMAP_X86
+		if (_has_avx2())
+		{
+			_map_avx2(fb, op, dst, start_x, y, end_x);
+			continue;
+		}
+#endif
+		_map_scalar(fb, op, dst, start_x, y, end_x);
+	}
+}
+
+/*
+ * Fills every pixel of (pixels) (ARGB8888, with (pitch) bytes between rows) 
+ * whose pixel in the framebuffer has no samples yet with the colour of the 
+ * top left pixel of the smallest block around it, of 2, 4, up to (max_block) 
+ * pixels, that has samples. Run after tonemap_rect while a preview is rendered 
+ * (see cam_render_preview), this shows each preview sample as a block. Pixels 
+ * with no sampled block are left as they are.
+ */
+void tonemap_fill_holes(const Framebuffer* fb, uint32_t* pixels, size_t pitch, 
+						size_t max_block)
+{
+	for (size_t y = 0; y < fb->height; y++)
+	{
+		uint32_t* dst = (uint32_t*) ((uint8_t*) pixels + y * pitch);
+		for (size_t x = 0; x < fb->width; x++)
+		{
+			if (fb->samples[y * fb->width + x] > 0)
+				continue;
+			for (size_t block = 2; block <= max_block; block *= 2)
+			{
+				size_t src_x = x - x % block;
+				size_t src_y = y - y % block;
+				if (fb->samples[src_y * fb->width + src_x] > 0)
+				{
+					dst[x] = ((uint32_t*) ((uint8_t*) pixels + src_y * pitch))[src_x];
+					break;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Stores the curve called (name) in (op), returning false if the name is not
+ * gamma, srgb or aces.
+ */
+bool tonemap_parse(const char* name, Tonemap_Op* op)
+{
+	if (strcmp(name, "gamma") == 0)
+		*op = TONEMAP_GAMMA;
+	else if (strcmp(name, "srgb") == 0)
+		*op = TONEMAP_SRGB;
+	else if (strcmp(name, "aces") == 0)
+		*op = TONEMAP_ACES;
+	else
+		return false;
+	return true;
+}
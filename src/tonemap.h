@@ -0,0 +1,46 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "math_utils.h"
+#include "framebuffer.h"
+
+/*
+ * Curves that map the linear colour of a pixel to the 0-255 range of a display.
+ */
+typedef enum Tonemap_Op {
+	TONEMAP_GAMMA, // square root, a cheap approximation of srgb (the original look)
+	TONEMAP_SRGB,  // the exact srgb transfer curve
+	TONEMAP_ACES   // ACES filmic curve, which rolls off highlights, then srgb
+} Tonemap_Op;
+
+/*
+ * Writes the mean of every pixel of a portion of the framebuffer (between start /
+ * end, x / y) to (pixels) as ARGB8888, mapped to the display with (op) and
+ * clamped. (pitch) is the amount of bytes between the starts of two rows of
+ * (pixels), which has the same coordinates as the framebuffer. With a pitch of 0,
+ * every row is written to the start of (pixels).
+ */
+extern void tonemap_rect(const Framebuffer* fb, Tonemap_Op op, uint32_t* pixels,
+						 size_t pitch, size_t start_x, size_t start_y, size_t end_x,
+						 size_t end_y);
+
+/*
+ * Fills the pixels that have no samples yet with the colour of the nearest 
+ * sampled pixel of a preview grid of up to (max_block) pixels.
+ */
+extern void tonemap_fill_holes(const Framebuffer* fb, uint32_t* pixels, size_t pitch, 
+							   size_t max_block);
+
+/*
+ * Stores the curve called (name) (gamma, srgb or aces) in (op). Returns false if
+ * there is no curve with that name.
+ */
+extern bool tonemap_parse(const char* name, Tonemap_Op* op);
+
+#endif
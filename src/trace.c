@@ -0,0 +1,210 @@
+#include "trace.h"
+
+/*
+ * PRIVATE:
+ */
+
+#define _NO_TILE SIZE_MAX // x of an event that has no tile coordinates
+
+/*
+ * An event on one thread, from start to end in nanoseconds of CLOCK_MONOTONIC.
+ */
+typedef struct _Trace_Event {
+	const char* name;
+	uint64_t 	start, end;
+	size_t 		x, y; // tile coordinates, x is _NO_TILE if there are none
+} _Trace_Event;
+
+/*
+ * The events of one thread. Each thread appends to its own buffer without a
+ * lock, and the buffers are kept in a list so that trace_write can find them,
+ * even those of threads that have exited.
+ */
+typedef struct _Trace_Buffer {
+	_Trace_Event* 		  events;
+	size_t 				  count, capacity;
+	uint32_t 			  tid; 	 // small id of the thread, in order of its first event
+	char 				  thread_name[32];
+	struct _Trace_Buffer* next;
+} _Trace_Buffer;
+
+static bool _trace_on = false; 	  // events are recorded (atomic)
+static uint64_t _origin = 0; 	  // time of trace_start, the 0 of the trace
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER; // guards the list
+static _Trace_Buffer* _buffers = NULL;
+static uint32_t _next_tid = 1;
+
+static _Thread_local _Trace_Buffer* _buffer = NULL;
+static _Thread_local char _thread_name[32] = "";
+
+/*
+ * Returns the time of CLOCK_MONOTONIC in nanoseconds.
+ */
+static uint64_t _now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/*
+ * Returns the calling thread's buffer, creating it and adding it to the list on
+ * the thread's first event.
+ *
+ * If the allocation fails, the application exits with code 1.
+ */
+static _Trace_Buffer* _thread_buffer(void)
+{
+	if (_buffer != NULL)
+		return _buffer;
+
+	if ((_buffer = malloc(sizeof(_Trace_Buffer))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in trace\n");
+		exit(1);
+	}
+	_buffer->events = NULL;
+	_buffer->count = 0;
+	_buffer->capacity = 0;
+	memcpy(_buffer->thread_name, _thread_name, sizeof(_thread_name));
+
+	pthread_mutex_lock(&_lock);
+	_buffer->tid = _next_tid++;
+	_buffer->next = _buffers;
+	_buffers = _buffer;
+	pthread_mutex_unlock(&_lock);
+	return _buffer;
+}
+
+/*
+ * Appends an event to the calling thread's buffer, doubling it when full.
+ *
+ * If the allocation fails, the application exits with code 1.
+ */
+static void _record(const char* name, uint64_t start, size_t x, size_t y)
+{
+	uint64_t end = _now();
+	_Trace_Buffer* buffer = _thread_buffer();
+	if (buffer->count == buffer->capacity)
+	{
+		size_t capacity = (buffer->capacity == 0) ? 1024 : 2 * buffer->capacity;
+		_Trace_Event* events = realloc(buffer->events, sizeof(_Trace_Event) * capacity);
+		if (events == NULL)
+		{
+			fprintf(stderr, "malloc failed in trace\n");
+			exit(1);
+		}
+		buffer->events = events;
+		buffer->capacity = capacity;
+	}
+	_Trace_Event event = {name, start, end, x, y};
+	buffer->events[buffer->count++] = event;
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Starts recording. Times in the trace are counted from this call. Events only
+ * cost a check of a flag (see trace_begin) until tracing is started.
+ */
+void trace_start(void)
+{
+	_origin = _now();
+	__atomic_store_n(&_trace_on, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the time an event starts, or 0 if tracing has not been started, in
+ * which case the matching trace_end does nothing. Events are meant to be coarse
+ * (a tile, a frame, a parse), so this is never called per ray.
+ */
+uint64_t trace_begin(void)
+{
+	if (!__atomic_load_n(&_trace_on, __ATOMIC_ACQUIRE))
+		return 0;
+	return _now();
+}
+
+/*
+ * Records the event (name) from (start), a value of trace_begin, until now on
+ * the calling thread. The name is stored as a pointer, so it must be a string
+ * literal or otherwise outlive the trace.
+ */
+void trace_end(const char* name, uint64_t start)
+{
+	if (start != 0)
+		_record(name, start, _NO_TILE, 0);
+}
+
+/*
+ * Records the event (name) like trace_end, along with the top left corner (x, y)
+ * of the tile it worked on, so that slow tiles can be found in the image.
+ */
+void trace_end_tile(const char* name, uint64_t start, size_t x, size_t y)
+{
+	if (start != 0)
+		_record(name, start, x, y);
+}
+
+/*
+ * Names the calling thread in the trace (at most 31 characters are kept). Call
+ * it before the thread records its first event, it is only read then.
+ */
+void trace_thread_name(const char* name)
+{
+	snprintf(_thread_name, sizeof(_thread_name), "%s", name);
+	if (_buffer != NULL)
+		memcpy(_buffer->thread_name, _thread_name, sizeof(_thread_name));
+}
+
+/*
+ * Writes every recorded event to (path) in the Chrome trace event format: one
+ * complete ("X") event per recorded event, with times in microseconds since
+ * trace_start, and a thread_name metadata ("M") event for each named thread.
+ * Only call this once no other thread is recording. Returns false and prints a
+ * message if the file cannot be written.
+ */
+bool trace_write(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "failed to open %s for writing\n", path);
+		return false;
+	}
+
+	pthread_mutex_lock(&_lock);
+	bool ok = fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+					  "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+					  "\"args\": {\"name\": \"ray-trace\"}}") > 0;
+	for (_Trace_Buffer* buffer = _buffers; ok && (buffer != NULL); buffer = buffer->next)
+	{
+		if (buffer->thread_name[0] != '\0')
+			ok = fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+						 "\"tid\": %u, \"args\": {\"name\": \"%s\"}}", buffer->tid,
+						 buffer->thread_name) > 0;
+		for (size_t i = 0; ok && (i < buffer->count); i++)
+		{
+			_Trace_Event* event = &buffer->events[i];
+			ok = fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+						 "\"tid\": %u, \"ts\": %.3f, \"dur\": %.3f", event->name,
+						 buffer->tid, (double) (event->start - _origin) * 1.0E-3,
+						 (double) (event->end - event->start) * 1.0E-3) > 0;
+			if (ok && (event->x != _NO_TILE))
+				ok = fprintf(file, ", \"args\": {\"x\": %zu, \"y\": %zu}", event->x,
+							 event->y) > 0;
+			ok = ok && (fprintf(file, "}") > 0);
+		}
+	}
+	pthread_mutex_unlock(&_lock);
+	ok = ok && (fprintf(file, "\n]}\n") > 0);
+
+	if ((fclose(file) != 0) || !ok)
+	{
+		fprintf(stderr, "failed to write %s\n", path);
+		return false;
+	}
+	return true;
+}
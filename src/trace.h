@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Starts recording events on every thread. Until then, trace_begin returns 0
+ * and trace_end does nothing.
+ */
+extern void trace_start(void);
+
+/*
+ * Returns the start time of an event to pass to trace_end, or 0 if tracing has
+ * not been started.
+ */
+extern uint64_t trace_begin(void);
+
+/*
+ * Records an event called (name) (a string that outlives the trace) on the
+ * calling thread, from (start) until now. Does nothing if (start) is 0.
+ */
+extern void trace_end(const char* name, uint64_t start);
+
+/*
+ * Same as trace_end, with the coordinates (x, y) of a tile as arguments.
+ */
+extern void trace_end_tile(const char* name, uint64_t start, size_t x, size_t y);
+
+/*
+ * Names the calling thread in the trace.
+ */
+extern void trace_thread_name(const char* name);
+
+/*
+ * Writes every event recorded so far to (path) as Chrome trace JSON, which
+ * chrome://tracing and Perfetto can open. Returns false if writing fails.
+ */
+extern bool trace_write(const char* path);
+
+#endif
@@ -0,0 +1,365 @@
+#include "tri_store.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRI_STORE_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * PRIVATE:
+ */
+
+#define _LANE_COUNT 4 // triangles tested per kernel call, one per AVX lane of doubles
+
+/*
+ * Calculates the barycentric coordinates (u, v) of the point where the ray (r)
+ * crosses the plane of triangle (idx), in exactly the same way as _hit_scalar.
+ */
+static void _barycentric(Tri_Store* store, size_t idx, Ray r, double* u, double* v)
+{
+	Vector e1 = {store->e1_x[idx], store->e1_y[idx], store->e1_z[idx]};
+	Vector e2 = {store->e2_x[idx], store->e2_y[idx], store->e2_z[idx]};
+	Vector n = {store->n_x[idx], store->n_y[idx], store->n_z[idx]};
+	Vector v0 = {store->v0_x[idx], store->v0_y[idx], store->v0_z[idx]};
+
+	Vector ao = vec_sub(r.origin, v0);
+	Vector dao = vec_cross(ao, r.direction);
+	double inv_det = 1.0 / -vec_dot(r.direction, n);
+
+	*u = vec_dot(e2, dao) * inv_det;
+	*v = -vec_dot(e1, dao) * inv_det;
+}
+
+/*
+ * Tests the ray (r) against triangles [first - first + count) of the store, with
+ * count <= _LANE_COUNT. Returns the index (relative to first) of the closest 
+ * triangle hit strictly inside (itvl) and stores its distance in (t), or returns
+ * -1 if none are hit. Ties go to the lowest index.
+ *
+ * The arithmetic is the same as _hit_tri, operation for operation, with the 
+ * edges and the face normal read from the store instead of being recalculated, 
+ * so the distances match _hit_tri bit for bit. Triangles facing away from the 
+ * ray (determinant < 0) are culled.
+ */
+static int _hit_scalar(Tri_Store* store, size_t first, size_t count, Ray r, 
+					   Interval itvl, double* t)
+{
+	Vector d = r.direction;
+	Vector o = r.origin;
+	int lane = -1;
+
+	for (size_t j = 0; j < count; j++)
+	{
+		size_t i = first + j;
+
+		double det = -(d.x * store->n_x[i] + d.y * store->n_y[i] + d.z * store->n_z[i]);
+		if (det < 0.0)
+			continue;
+		double inv_det = 1.0 / det;
+
+		double ax = o.x - store->v0_x[i];
+		double ay = o.y - store->v0_y[i];
+		double az = o.z - store->v0_z[i];
+
+		double dst = (ax * store->n_x[i] + ay * store->n_y[i] + az * store->n_z[i]) * inv_det;
+		if (dst < 0.0)
+			continue;
+
+		// dao = ao x d
+		double qx = ay * d.z - az * d.y;
+		double qy = az * d.x - ax * d.z;
+		double qz = ax * d.y - ay * d.x;
+
+		double u = (store->e2_x[i] * qx + store->e2_y[i] * qy + store->e2_z[i] * qz) * inv_det;
+		double v = -(store->e1_x[i] * qx + store->e1_y[i] * qy + store->e1_z[i] * qz) * inv_det;
+		if ((u < 0.0) || (v < 0.0) || (1.0 - u - v < 0.0))
+			continue;
+
+		if (interval_surrounds(itvl, dst))
+		{
+			itvl.max = dst;
+			*t = dst;
+			lane = (int) j;
+		}
+	}
+
+	return lane;
+}
+
+#ifdef TRI_STORE_X86
+/*
+ * AVX version of _hit_scalar that runs the same steps on all 4 lanes at once, 
+ * masking off the lanes that miss instead of branching. Lanes past (count) read 
+ * the following triangles (or the zeroed padding at the end of each array) and 
+ * are masked off too. Only called when the host supports AVX2, and the upper 
+ * halves of the registers are cleared before returning to SSE code.
+ *
+ * FMA is deliberately not enabled here: fused multiply-adds round differently 
+ * from _hit_tri, and negation flips the sign bit rather than subtracting from 
+ * zero so that a determinant of +0 gives the same infinity as the scalar code.
+ */
+__attribute__((target("avx2")))
+static int _hit_avx2(Tri_Store* store, size_t first, size_t count, Ray r, 
+					 Interval itvl, double* t)
+{
+	__m256d dx = _mm256_set1_pd(r.direction.x);
+	__m256d dy = _mm256_set1_pd(r.direction.y);
+	__m256d dz = _mm256_set1_pd(r.direction.z);
+	__m256d zero = _mm256_setzero_pd();
+	__m256d one = _mm256_set1_pd(1.0);
+	__m256d sign = _mm256_set1_pd(-0.0);
+
+	__m256d nx = _mm256_loadu_pd(store->n_x + first);
+	__m256d ny = _mm256_loadu_pd(store->n_y + first);
+	__m256d nz = _mm256_loadu_pd(store->n_z + first);
+
+	__m256d det = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, nx), _mm256_mul_pd(dy, ny)), 
+								_mm256_mul_pd(dz, nz));
+	det = _mm256_xor_pd(det, sign);
+	__m256d miss = _mm256_cmp_pd(det, zero, _CMP_LT_OQ);
+	__m256d inv_det = _mm256_div_pd(one, det);
+
+	__m256d ax = _mm256_sub_pd(_mm256_set1_pd(r.origin.x), _mm256_loadu_pd(store->v0_x + first));
+	__m256d ay = _mm256_sub_pd(_mm256_set1_pd(r.origin.y), _mm256_loadu_pd(store->v0_y + first));
+	__m256d az = _mm256_sub_pd(_mm256_set1_pd(r.origin.z), _mm256_loadu_pd(store->v0_z + first));
+
+	__m256d dst = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, nx), _mm256_mul_pd(ay, ny)), 
+								_mm256_mul_pd(az, nz));
+	dst = _mm256_mul_pd(dst, inv_det);
+	miss = _mm256_or_pd(miss, _mm256_cmp_pd(dst, zero, _CMP_LT_OQ));
+
+	// dao = ao x d
+	__m256d qx = _mm256_sub_pd(_mm256_mul_pd(ay, dz), _mm256_mul_pd(az, dy));
+	__m256d qy = _mm256_sub_pd(_mm256_mul_pd(az, dx), _mm256_mul_pd(ax, dz));
+	__m256d qz = _mm256_sub_pd(_mm256_mul_pd(ax, dy), _mm256_mul_pd(ay, dx));
+
+	__m256d e2x = _mm256_loadu_pd(store->e2_x + first);
+	__m256d e2y = _mm256_loadu_pd(store->e2_y + first);
+	__m256d e2z = _mm256_loadu_pd(store->e2_z + first);
+	__m256d u = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e2x, qx), _mm256_mul_pd(e2y, qy)), 
+							  _mm256_mul_pd(e2z, qz));
+	u = _mm256_mul_pd(u, inv_det);
+	miss = _mm256_or_pd(miss, _mm256_cmp_pd(u, zero, _CMP_LT_OQ));
+
+	__m256d e1x = _mm256_loadu_pd(store->e1_x + first);
+	__m256d e1y = _mm256_loadu_pd(store->e1_y + first);
+	__m256d e1z = _mm256_loadu_pd(store->e1_z + first);
+	__m256d v = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e1x, qx), _mm256_mul_pd(e1y, qy)), 
+							  _mm256_mul_pd(e1z, qz));
+	v = _mm256_mul_pd(_mm256_xor_pd(v, sign), inv_det);
+	miss = _mm256_or_pd(miss, _mm256_cmp_pd(v, zero, _CMP_LT_OQ));
+	miss = _mm256_or_pd(miss, _mm256_cmp_pd(_mm256_sub_pd(_mm256_sub_pd(one, u), v), zero, 
+											_CMP_LT_OQ));
+
+	__m256d valid = _mm256_andnot_pd(miss, _mm256_cmp_pd(dst, _mm256_set1_pd(itvl.min), 
+														 _CMP_GT_OQ));
+	valid = _mm256_and_pd(valid, _mm256_cmp_pd(dst, _mm256_set1_pd(itvl.max), _CMP_LT_OQ));
+	valid = _mm256_and_pd(valid, _mm256_cmp_pd(_mm256_set_pd(3.0, 2.0, 1.0, 0.0), 
+											   _mm256_set1_pd((double) count), _CMP_LT_OQ));
+
+	int mask = _mm256_movemask_pd(valid);
+	if (mask == 0)
+	{
+		_mm256_zeroupper(); // see _slab_test_avx2
+		return -1;
+	}
+
+	// horizontal minimum of the lanes that hit, misses become infinity
+	dst = _mm256_blendv_pd(_mm256_set1_pd(INFINITY), dst, valid);
+	__m256d min = _mm256_min_pd(dst, _mm256_permute2f128_pd(dst, dst, 1));
+	min = _mm256_min_pd(min, _mm256_permute_pd(min, 0x5));
+
+	int closest = _mm256_movemask_pd(_mm256_cmp_pd(dst, min, _CMP_EQ_OQ)) & mask;
+	*t = _mm256_cvtsd_f64(min);
+	_mm256_zeroupper();
+	return __builtin_ctz(closest);
+}
+#endif
+
+/*
+ * Returns true if the host supports AVX2. The result is cached after the first
+ * call.
+ */
+static bool _has_avx2(void)
+{
+#ifdef TRI_STORE_X86
+	static int supported = -1;
+	if (supported < 0)
+		supported = __builtin_cpu_supports("avx2");
+
+	return supported;
+#else
+	return false;
+#endif
+}
+
+/*
+ * PUBLIC:
+ */
+
+/*
+ * Builds a triangle store from the triangle hittables of the object (obj). If
+ * (order) is given, triangle i of the store is triangle order[i] of the object,
+ * which lets the triangles be laid out in the leaf order of a BVH so that each
+ * leaf covers a contiguous range of the store. The edges and the face normal are
+ * calculated once here instead of on every intersection test.
+ *
+ * All of the component arrays share one 64 byte aligned allocation, padded so 
+ * that a full group of lanes can be loaded from any triangle. This method
+ * allocates heap memory for the store, its arrays and its normals. If any of
+ * these allocations fail, the application exits with code 1.
+ */
+Tri_Store* tri_store_build(Obj_Object* obj, size_t* order)
+{
+	Tri_Store* store;
+	if ((store = malloc(sizeof(Tri_Store))) == NULL)
+	{
+		fprintf(stderr, "malloc failed in tri store\n");
+		exit(1);
+	}
+
+	size_t n = obj->length;
+	size_t stride = (n + 7) & ~((size_t) 7); // keep each array 64 byte aligned
+	double* data;
+	if (((data = aligned_alloc(64, sizeof(double) * 12 * (stride + 8))) == NULL)
+		|| ((store->norm_idx = malloc(sizeof(uint32_t) * (n + 1))) == NULL)
+		|| ((store->normals = malloc(sizeof(Vector) * 3 * (n + 1))) == NULL))
+	{
+		fprintf(stderr, "malloc failed in tri store\n");
+		exit(1);
+	}
+
+	memset(data, 0, sizeof(double) * 12 * (stride + 8)); // padding lanes must be finite
+
+	double** arrays[12] = {&store->v0_x, &store->v0_y, &store->v0_z,
+						   &store->e1_x, &store->e1_y, &store->e1_z,
+						   &store->e2_x, &store->e2_y, &store->e2_z,
+						   &store->n_x,  &store->n_y,  &store->n_z};
+	for (size_t i = 0; i < 12; i++)
+		*arrays[i] = data + i * (stride + 8);
+
+	store->length = n;
+	store->mat = obj->mat;
+	for (size_t i = 0; i < n; i++)
+	{
+		size_t src = (order == NULL) ? i : order[i];
+		Vector* tri = obj->tris[src]->vectors;
+		Vector e1 = vec_sub(tri[1], tri[0]);
+		Vector e2 = vec_sub(tri[2], tri[0]);
+		Vector n = vec_cross(e1, e2);
+
+		store->v0_x[i] = tri[0].x;
+		store->v0_y[i] = tri[0].y;
+		store->v0_z[i] = tri[0].z;
+		store->e1_x[i] = e1.x;
+		store->e1_y[i] = e1.y;
+		store->e1_z[i] = e1.z;
+		store->e2_x[i] = e2.x;
+		store->e2_y[i] = e2.y;
+		store->e2_z[i] = e2.z;
+		store->n_x[i] = n.x;
+		store->n_y[i] = n.y;
+		store->n_z[i] = n.z;
+
+		store->norm_idx[i] = (uint32_t) (3 * src);
+		store->normals[3 * src] = tri[3];
+		store->normals[3 * src + 1] = tri[4];
+		store->normals[3 * src + 2] = tri[5];
+	}
+
+	return store;
+}
+
+/*
+ * Frees the given triangle store and all of its arrays.
+ */
+void tri_store_free(Tri_Store* store)
+{
+	if (store == NULL)
+		return;
+
+	free(store->v0_x);
+	free(store->norm_idx);
+	free(store->normals);
+	free(store);
+}
+
+/*
+ * Tests the ray (r) against up to 4 triangles starting at (first), see 
+ * _hit_scalar. Returns the index (relative to first) of the closest hit 
+ * strictly inside (itvl) and stores its distance in (t), or returns -1.
+ *
+ * The AVX2 kernel is used when the host supports it, otherwise the scalar loop.
+ */
+int tri_store_hit4(Tri_Store* store, size_t first, size_t count, Ray r, 
+				   Interval itvl, double* t)
+{
+#ifdef TRI_STORE_X86
+	if (_has_avx2())
+		return _hit_avx2(store, first, count, r, itvl, t);
+#endif
+
+	return _hit_scalar(store, first, count, r, itvl, t);
+}
+
+/*
+ * Tests the ray (r) against triangles [first - first + count) of the store and 
+ * keeps the closest hit within (itvl). When a closer hit is found, itvl->max is 
+ * set to its distance and its index is stored in (hit_idx), so after a 
+ * traversal itvl->max is the distance of the winner. The triangles are tested 
+ * in groups of 4 with tri_store_hit4.
+ *
+ * Only the distance is kept here, the barycentric coordinates and the 
+ * interpolated normal are only calculated for the winning triangle (see 
+ * tri_store_hit_record).
+ */
+void tri_store_hit(Tri_Store* store, size_t first, size_t count, Ray r, 
+				   Interval* itvl, size_t* hit_idx)
+{
+	STATS_ADD(tri_tests, count);
+	for (size_t i = first; i < first + count; i += _LANE_COUNT)
+	{
+		size_t lanes = first + count - i;
+		if (lanes > _LANE_COUNT)
+			lanes = _LANE_COUNT;
+
+		double t;
+		int lane = tri_store_hit4(store, i, lanes, r, *itvl, &t);
+		if (lane >= 0)
+		{
+			itvl->max = t;
+			*hit_idx = i + lane;
+		}
+	}
+}
+
+/*
+ * Fills in (hit_rec) for the ray (r) hitting triangle (idx) of the store at the
+ * distance (t). The vertex normals are blended by the barycentric coordinates
+ * of the hit and the result is oriented in the same way as _hit_tri.
+ */
+void tri_store_hit_record(Tri_Store* store, size_t idx, Ray r, double t, Hit_Record* hit_rec)
+{
+	double u, v;
+	_barycentric(store, idx, r, &u, &v);
+	double w = 1.0 - u - v;
+
+	Vector* n = &store->normals[store->norm_idx[idx]];
+	Vector normal = vec_unit(vec_add_3(vec_mul(n[0], w),
+									   vec_mul(n[1], u),
+									   vec_mul(n[2], v)));
+
+	hit_rec->t = t;
+	hit_rec->p = ray_at(r, t);
+	if (vec_dot(r.direction, normal) < 0.0)
+	{
+		hit_rec->norm = vec_mul(normal, -1.0);
+		hit_rec->front = false;
+	}
+	else
+	{
+		hit_rec->norm = normal;
+		hit_rec->front = true;
+	}
+	hit_rec->atten = store->mat.albedo;
+}
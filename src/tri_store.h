@@ -0,0 +1,62 @@
+#ifndef TRI_STORE_H
+#define TRI_STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "math_utils.h"
+#include "render_utils.h"
+#include "hittable.h"
+
+/*
+ * Struct of arrays holding every triangle of a mesh, ready for intersection 
+ * tests. Each triangle is stored as its first vertex (v0), the two edges 
+ * leaving it (e1 = v1 - v0, e2 = v2 - v0) and its face normal (n = e1 x e2), 
+ * with each component in its own contiguous array. The vertex normals of 
+ * triangle i are found at normals[norm_idx[i]] to normals[norm_idx[i] + 2].
+ */
+typedef struct Tri_Store {
+	double*   v0_x, *v0_y, *v0_z; // first vertex
+	double*   e1_x, *e1_y, *e1_z; // first edge
+	double*   e2_x, *e2_y, *e2_z; // second edge
+	double*   n_x,  *n_y,  *n_z;  // unnormalised face normal
+	uint32_t* norm_idx;			  // index of each triangle's first vertex normal
+	Vector*   normals;			  // 3 vertex normals per triangle
+	Material  mat;				  // material of the whole mesh
+	size_t 	  length;			  // amount of triangles
+} Tri_Store;
+
+/*
+ * Builds a triangle store from the triangles of the given object, in the order 
+ * given by (order) (or the object's own order if NULL).
+ */
+extern Tri_Store* tri_store_build(Obj_Object* obj, size_t* order);
+
+/*
+ * Frees a triangle store.
+ */
+extern void tri_store_free(Tri_Store* store);
+
+/*
+ * Tests the ray against up to 4 triangles starting at (first) in one call and 
+ * returns the index (relative to first) of the closest one hit inside the 
+ * interval, storing its distance in t, or -1 if none are hit.
+ */
+extern int tri_store_hit4(Tri_Store* store, size_t first, size_t count, Ray r, 
+						  Interval itvl, double* t);
+
+/*
+ * Tests the ray against (count) triangles starting at (first) and, if one is 
+ * closer than itvl->max, shrinks the interval to it and stores its index.
+ */
+extern void tri_store_hit(Tri_Store* store, size_t first, size_t count, Ray r, 
+						  Interval* itvl, size_t* hit_idx);
+
+/*
+ * Fills in the hit record for the ray hitting triangle (idx) at distance (t).
+ */
+extern void tri_store_hit_record(Tri_Store* store, size_t idx, Ray r, double t, 
+								 Hit_Record* hit_rec);
+
+#endif